@@ -78,6 +78,12 @@
 
 #define TEST_
 
+// LIB2048_ builds the engine as a library (see lib2048.h): no main(), and
+// the console draws into memory, never on a terminal
+#if defined(LIB2048_) && !defined(RECORDING_CONSOLE_)
+#define RECORDING_CONSOLE_
+#endif
+
 // strsafe.h needs MINGW_HAS_SECURE_API, it can be missing in _mingw.h
 #define MINGW_HAS_SECURE_API 1
 
@@ -138,12 +144,6 @@ static_assert(UNKNOWN_COMPILER, "this compiler may not be fully supported");
 #pragma comment(lib, "user32")
 #endif
 
-#if defined(__GNUC__) || defined(__clang__)
-#define __try (void)0;
-#define __except(x) (void)0;
-#define __finally (void)0;
-#endif  // __GNUC__ || __clang__
-
 #if defined(_MSC_VER) && (_MSC_VER < 1900)
 // TODO: meaning of return value differs for snprintf & _snprintf
 #define snprintf _snprintf
@@ -157,6 +157,21 @@ static_assert(UNKNOWN_COMPILER, "this compiler may not be fully supported");
 #define VERIFYF($func) VerifierX(__LINE__,__FILE__,#$func) =
 #endif
 
+// the code address an allocation function returns to
+#if defined(_MSC_VER) && !defined(__clang__)
+#define RETURN_ADDRESS() _ReturnAddress()
+#else
+#define RETURN_ADDRESS() __builtin_return_address(0)
+#endif
+
+// inlined into callers, the replaced operator delete has GCC take its free()
+// of memory from the replaced operator new for a mismatch
+#if defined(__GNUC__) && !defined(__clang__)
+#define NOINLINE __attribute__((noinline))
+#else
+#define NOINLINE
+#endif
+
 // Macro taken from Goocle C++ style
 #define DISALLOW_COPY_AND_ASSIGN(TypeName) \
     TypeName(const TypeName&); \
@@ -189,7 +204,61 @@ INFO("with -Wall, add compiler option" \
 #include <rtcapi.h>
 #endif
 
+#if defined(_WIN32)
 #include <windows.h>
+#endif
+
+// C++ headers are included before the debug-CRT 'new' macro below
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(LIB2048_)
+#include "lib2048.h"
+#endif
+#if !defined(_WIN32)
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#endif
+#endif
+
+// after the C++ headers, libstdc++ defines __try for its own use
+#if defined(__GNUC__) || defined(__clang__)
+#undef __try
+#define __try (void)0;
+#define __except(x) (void)0;
+#define __finally (void)0;
+#endif  // __GNUC__ || __clang__
 
 #if defined(MSC_DEBUG_)
 #define _CRTDBG_MAP_ALLOC
@@ -201,6 +270,7 @@ INFO("with -Wall, add compiler option" \
 // static char THIS_FILE[] = __FILE__;
 #endif  // MSC_DEBUG_
 
+#if defined(_WIN32)
 #include <tchar.h>
 #include <stdio.h>
 #include <io.h>
@@ -215,6 +285,9 @@ INFO("with -Wall, add compiler option" \
 #else
 #include <strsafe.h>
 #endif
+#else
+#include <stdio.h>
+#endif  // _WIN32
 
 
 #if defined(MSC_ONLY_) && !defined(NO_WALL_FILTER)
@@ -222,6 +295,144 @@ INFO("with -Wall, add compiler option" \
 #pragma warning(pop)
 #endif
 
+// posix compatibility {{{
+// Just enough of the Win32 vocabulary for the shared code to build on POSIX
+// systems; the console itself has its own backend (see ansi terminal backend).
+#if !defined(_WIN32)
+typedef int BOOL;
+typedef unsigned short WORD;
+typedef unsigned long DWORD;
+typedef short SHORT;
+typedef unsigned int UINT;
+typedef long LONG;
+typedef void* HANDLE;
+typedef unsigned long COLORREF;
+typedef char TCHAR;
+typedef const char* LPCTSTR;
+typedef int errno_t;
+
+#define TRUE 1
+#define FALSE 0
+#define WINAPI
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+#define TEXT(x) x
+#define _TEXT(x) x
+
+typedef struct {
+    SHORT X;
+    SHORT Y;
+} COORD;
+
+typedef struct {
+    SHORT Left;
+    SHORT Top;
+    SHORT Right;
+    SHORT Bottom;
+} SMALL_RECT;
+
+typedef struct {
+    BOOL bKeyDown;
+    WORD wRepeatCount;
+    WORD wVirtualKeyCode;
+    WORD wVirtualScanCode;
+    union {
+        wchar_t UnicodeChar;
+        char AsciiChar;
+    } uChar;
+    DWORD dwControlKeyState;
+} KEY_EVENT_RECORD;
+
+typedef struct {
+    COORD dwMousePosition;
+    DWORD dwButtonState;
+    DWORD dwControlKeyState;
+    DWORD dwEventFlags;
+} MOUSE_EVENT_RECORD;
+
+typedef struct {
+    WORD EventType;
+    union {
+        KEY_EVENT_RECORD KeyEvent;
+        MOUSE_EVENT_RECORD MouseEvent;
+    } Event;
+} INPUT_RECORD;
+
+enum {
+    KEY_EVENT = 0x01,
+    MOUSE_EVENT = 0x02,
+    WINDOW_BUFFER_SIZE_EVENT = 0x04,
+    MENU_EVENT = 0x08,
+    FOCUS_EVENT = 0x10,
+};
+
+enum {
+    VK_RETURN = 0x0d,
+    VK_ESCAPE = 0x1b,
+    VK_LEFT = 0x25,
+    VK_UP = 0x26,
+    VK_RIGHT = 0x27,
+    VK_DOWN = 0x28,
+    VK_F5 = 0x74,
+};
+
+enum {
+    LEFT_ALT_PRESSED = 0x02,
+    LEFT_CTRL_PRESSED = 0x08,
+    SHIFT_PRESSED = 0x10,
+    FROM_LEFT_1ST_BUTTON_PRESSED = 0x01,
+    MOUSE_WHEELED = 0x04,
+};
+
+enum {
+    CTRL_C_EVENT = 0,
+    CTRL_BREAK_EVENT = 1,
+    CTRL_CLOSE_EVENT = 2,
+    CTRL_LOGOFF_EVENT = 5,
+    CTRL_SHUTDOWN_EVENT = 6,
+};
+
+inline void OutputDebugStringA(const char* str)
+{
+    (void)str;  // no debugger channel, debug output is dropped
+}
+
+inline DWORD GetLastError()
+{
+    return (DWORD)errno;
+}
+
+inline void Sleep(DWORD ms)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ms / 1000);
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&ts, NULL);
+}
+
+template<size_t N>
+errno_t strncat_s(char (&dst)[N], const char* src, size_t count)
+{
+    size_t used = strlen(dst);
+    size_t size = strnlen(src, count);
+
+    if (used + size >= N) {
+        dst[0] = '\0';
+        return ERANGE;
+    } else { }
+
+    memcpy(dst + used, src, size);
+    dst[used + size] = '\0';
+    return 0;
+}
+
+template<size_t N>
+errno_t strcat_s(char (&dst)[N], const char* src)
+{
+    return strncat_s(dst, src, strlen(src));
+}
+#endif  // !_WIN32
+// end of posix compatibility }}}
+
 //
 // N is the board size, default is 4; 3 or 5 also possible.
 // if other than 3, 4, or 5 then modify Grid::PatchGrid()
@@ -319,6 +530,7 @@ void dprint(const char* fmt, Args... args)
 }
 #endif
 
+#if defined(_WIN32)
 // Format a readable error message and display it in a message box
 void ErrorInfo(LPCTSTR lpszFunction)
 {
@@ -358,6 +570,15 @@ void ErrorInfo(LPCTSTR lpszFunction)
         // TODO
     }
 }
+#else
+// Format a readable error message and print it, there is no message box
+void ErrorInfo(LPCTSTR lpszFunction)
+{
+    int error = errno;
+    fprintf(stderr, "%s failed with error %d: %s\n",
+            lpszFunction, error, strerror(error));
+}
+#endif  // _WIN32
 // end of log routines }}}
 
 // code defect detectors {{{
@@ -501,6 +722,7 @@ RunTimeChecker rtc; NOTE("RunTimeChecker in use")
 // end of code defect detectors }}}
 
 // error handling routines {{{
+#if defined(_WIN32)
 void invalid_parameter_handler(const wchar_t* expression,
                                const wchar_t* function,
                                const wchar_t* file,
@@ -538,6 +760,7 @@ LONG WINAPI UnhandledExceptionFilterFunc(struct _EXCEPTION_POINTERS* pinfo)
 
     return EXCEPTION_CONTINUE_SEARCH;
 }
+#endif  // _WIN32
 
 class VerifierX
 {
@@ -598,6 +821,12 @@ class GRNG
         seed_ = (uint8_t)(seed & 0xff);
     }
 
+    // the seed the next number comes from
+    unsigned int State() const
+    {
+        return seed_;
+    }
+
     unsigned int operator()(unsigned int range_max)
     {
         unsigned int r = ((*this)());
@@ -666,18 +895,40 @@ struct Clock {
 
     int64_t Ticks_ms()
     {
-        // NOTE: below can be alternatives
-        // QueryUnbiasedInterruptTime
-        // QueryPerformanceCounter
-#ifdef __GNUC__
-#define GetTickCount64 GetTickCount
-#endif
-#ifdef _WIN64
-        return (int64_t)GetTickCount64();
+        return Ticks_ns() / 1000000;
+    }
+
+    // for measuring short intervals, like drawing a frame
+    int64_t Ticks_us()
+    {
+        return Ticks_ns() / 1000;
+    }
+
+    // monotonic, does not wrap, resolution of the performance counter
+    int64_t Ticks_ns()
+    {
+#if !defined(_WIN32)
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
 #else
-        return GetTickCount();
-#endif
+        static const int64_t freq = Frequency();
+        LARGE_INTEGER count;
+        QueryPerformanceCounter(&count);
+        return (count.QuadPart / freq) * 1000000000 +
+               (count.QuadPart % freq) * 1000000000 / freq;
+#endif  // !_WIN32
+    }
+
+  private:
+#if defined(_WIN32)
+    static int64_t Frequency()
+    {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        return (int64_t)freq.QuadPart;
     }
+#endif  // _WIN32
 };
 
 struct Duration {
@@ -691,21 +942,23 @@ struct Duration {
 class Timer
 {
   public:
-    Timer() : stopped_(true), wait_(0), start_(0), finish_(0) { }
+    Timer() : stopped_(true), wait_(0), start_(0), finish_(0), dur_ms_(-1), dur_() { }
     ~Timer() { }
 
-    void Start()
+    // played_ns: time played before, e.g. by a saved game
+    void Start(int64_t played_ns = 0)
     {
         stopped_ = false;
         wait_ = 0;
-        start_ = Clock().Ticks_ms();
+        start_ = Clock().Ticks_ns() - played_ns;
+        dur_ms_ = -1;
     }
 
     void Stop()
     {
         if (!stopped_) {
             stopped_ = true;
-            finish_ = Clock().Ticks_ms();
+            finish_ = Clock().Ticks_ns();
         } else { }
     }
 
@@ -713,7 +966,7 @@ class Timer
     {
         if (stopped_) {
             stopped_ = false;
-            int64_t now = Clock().Ticks_ms();
+            int64_t now = Clock().Ticks_ns();
             wait_ += now - finish_;
         } else { }
     }
@@ -723,31 +976,55 @@ class Timer
         Stop();
     }
 
-    operator const Duration()
+    // time played, not counting pauses
+    int64_t Elapsed_ns()
     {
-        Duration dur = { 0, 0, 0, 0, 0 };
-
         if (stopped_) {
         } else {
-            finish_ = Clock().Ticks_ms();
+            finish_ = Clock().Ticks_ns();
         }
 
         int64_t tmp = finish_ - start_ - wait_;
+        return (tmp > 0) ? tmp : 0;
+    }
+
+    operator const Duration()
+    {
+        int64_t ms = Elapsed_ns() / 1000000;
+        int64_t delta = ms - dur_ms_;
+
+        if ((dur_ms_ >= 0) && (delta >= 0) && (delta < 1000)) {
+            // updates are far less than a second apart, so only carry
+            dur_.ms = (int16_t)(dur_.ms + delta);
+
+            if (dur_.ms >= 1000) {
+                dur_.ms = (int16_t)(dur_.ms - 1000);
 
-        if (tmp > 0) {
+                if (++dur_.sec == 60) {
+                    dur_.sec = 0;
+
+                    if (++dur_.min == 60) {
+                        dur_.min = 0;
+
+                        if (++dur_.hour == 24) {
+                            dur_.hour = 0;
+                            dur_.day = (dur_.day + 1) & 0x7f;
+                        } else { }
+                    } else { }
+                } else { }
+            } else { }
+        } else {
             // NOTE: casting not needed below, but to suppress warning
-            lldiv_t qr = lldiv(tmp, 1000);
-            dur.ms = (int16_t)qr.rem;
-            qr = lldiv(qr.quot, 60);
-            dur.sec = (int8_t)qr.rem;
-            qr = lldiv(qr.quot, 60);
-            dur.min = (int8_t)qr.rem;
-            qr = lldiv(qr.quot, 24);
-            dur.hour = (int8_t)qr.rem;
-            dur.day = qr.quot & 0x7f;  // TODO: perhaps few days enough
-        } else { }
+            dur_.ms = (int16_t)(ms % 1000);
+            uint32_t sec = (uint32_t)(ms / 1000);  // wraps after 136 years
+            dur_.sec = (int8_t)(sec % 60);
+            dur_.min = (int8_t)(sec / 60 % 60);
+            dur_.hour = (int8_t)(sec / 3600 % 24);
+            dur_.day = (sec / 86400) & 0x7f;  // TODO: perhaps few days enough
+        }
 
-        return dur;
+        dur_ms_ = ms;
+        return dur_;
     }
 
   private:
@@ -758,3110 +1035,13942 @@ class Timer
     int64_t wait_;
     int64_t start_;
     int64_t finish_;
+    int64_t dur_ms_;  // elapsed ms of dur_, -1 if none
+    Duration dur_;
 };
 // end of date/time helpers }}}
 
-// windows console api wrapper {{{
-class Console
+// see memory mapped file
+bool WriteFileAtomic(const char* path, const void* data, size_t size);
+
+// counter registry {{{
+//
+// Named counters of the work done, to see where time goes in a game or a
+// headless run without a profiler.  Each thread adds to a shard of its own,
+// cache line aligned so threads do not share a line, with plain relaxed
+// loads and stores.  Threads beyond MAX_SHARDS share one more shard with
+// atomic adds.  Shards are returned when their thread exits and reused by
+// the next one, keeping their counts.
+//
+// Dump() sums the shards into a JSON file, replaced as a whole so a reader
+// never finds it half written; StartDump() also rewrites it every interval
+// until StopDump().  Counters named *_ns are times added by
+// CounterTimer.
+//
+enum CounterId {
+    CTR_MOVES,
+    CTR_NOOP_MOVES,
+    CTR_MERGES,
+    CTR_SPAWNS,
+    CTR_UNDOS,
+    CTR_CONSOLE_CALLS,
+    CTR_CONSOLE_BYTES,
+    CTR_FRAMES,
+    CTR_AI_NODES,
+    CTR_MOVE_NS,
+    CTR_DRAW_NS,
+    CTR_SEARCH_NS,
+    CTR_KINDS
+};
+
+class CounterRegistry
 {
   public:
-    enum { LAST_VALUE = 0xffff };
-  public:
-    Console() : top_(0), height_(-1), interrupted_(0),
-        text_attrib_(0), oldcp_(0), oldMode_(0), cursor_size(0),
-        input_(INVALID_HANDLE_VALUE), output_(INVALID_HANDLE_VALUE),
-        oldout_(INVALID_HANDLE_VALUE), conout_(INVALID_HANDLE_VALUE)
+    enum { MAX_SHARDS = 64, CACHE_LINE = 64 };
+
+    CounterRegistry()
+        : start_ns_(Clock().Ticks_ns()), shards_(), leased_(), high_(0),
+          exiting_(), path_(NULL), interval_ms_(0), stop_(false), mutex_(),
+          wake_(), thread_()
     {
-        memset(ct_, 0, sizeof(ct_));
+        exiting_.owner = this;
+        exiting_.index = MAX_SHARDS;
+        exiting_.shard = &shards_[MAX_SHARDS];
     }
-    ~Console()
+    ~CounterRegistry()
     {
-        FlushConsoleInputBuffer(input_);
-
-        if (conout_ != INVALID_HANDLE_VALUE) {
-            CloseHandle(conout_);
-        } else { }
+        StopDump();
     }
 
-    BOOL CtrlHandler(DWORD ctrl)
+    void Add(int id, uint64_t n = 1)
     {
-        BOOL retval = TRUE;
-        interrupted_ = 1;
-
-        switch (ctrl) {
-        case CTRL_C_EVENT:
-            // printf("Ctrl-C event\n\n");
-            Beep(750, 300);
-            retval = TRUE;
-            break;
-        case CTRL_BREAK_EVENT:
-            Beep(900, 200);
-            // printf("Ctrl-Break event\n\n");
-            retval = FALSE;
-            break;
-        case CTRL_CLOSE_EVENT:
-            // CTRL-CLOSE: confirm that the user wants to exit.
-            Beep(600, 200);
-            // printf("Ctrl-Close event\n\n");
-            retval = TRUE;
-            ++interrupted_;
-            break;
-        case CTRL_LOGOFF_EVENT:
-            Beep(1000, 200);
-            // printf("Ctrl-Logoff event\n\n");
-            retval = FALSE;
-            ++interrupted_;
-            break;
-        case CTRL_SHUTDOWN_EVENT:
-            Beep(750, 500);
-            // printf("Ctrl-Shutdown event\n\n");
-            retval = FALSE;
-            ++interrupted_;
-            break;
-        default:
-            retval = FALSE;
-            break;
-        }
-
-        HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+        Lease& lease = Local();
+        std::atomic<uint64_t>& value = lease.shard->value[id];
 
-        if ((in == INVALID_HANDLE_VALUE) || (in == NULL)) {
-            dprint("CtrlHandler(%lu): error(%lu)", ctrl, GetLastError());
-            FreeConsole();  // TODO: is FreeConsole() a bad idea?
+        if (lease.index < MAX_SHARDS) {
+            value.store(value.load(std::memory_order_relaxed) + n,
+                        std::memory_order_relaxed);
         } else {
-            CloseHandle(in);  // NOTE: forces time out in ReadConsoleInput()
+            value.fetch_add(n, std::memory_order_relaxed);
         }
+    }
 
-        // TODO: inter-locked-functions may be good interrupted_, since
-        // ctrl-handler runs in another thread
-        while (interrupted_) {
-            Sleep(50);
+    uint64_t Total(int id)
+    {
+        uint64_t total = 0;
+
+        for (unsigned int i = 0; i <= MAX_SHARDS; ++i) {
+            total += shards_[i].value[id].load(std::memory_order_relaxed);
         }
 
-        return retval;
+        return total;
     }
 
-    void AllowCtrlHandler()
+    const char* Name(int id)
     {
-        interrupted_ = 0;
-    }
+        static const char* const name[CTR_KINDS] = {
+            "moves", "noop_moves", "merges", "spawns", "undos",
+            "console_calls", "console_bytes", "frames", "ai_nodes",
+            "move_ns", "draw_ns", "search_ns"
+        };
 
-    int CanReset()
-    {
-        return interrupted_ < 2;
+        return name[id];
     }
 
-    void Acquire()
+    bool Dump(const char* path)
     {
-        if (_isatty(_fileno(stdout))) {
-        } else {
-            conout_ = CreateFile(L"CONOUT$",
-                                 GENERIC_READ | GENERIC_WRITE,
-                                 0, 0, OPEN_EXISTING, 0, 0);
-            SetStdHandle(STD_OUTPUT_HANDLE, conout_);
+        char text[2048];
+        int n = snprintf(text, sizeof(text),
+                         "{\n  \"elapsed_ms\": %lld,\n  \"shards\": %u,\n"
+                         "  \"counters\": {\n",
+                         (long long)((Clock().Ticks_ns() - start_ns_) / 1000000),
+                         high_.load());
+
+        for (int id = 0; id < CTR_KINDS; ++id) {
+            n += snprintf(text + n, sizeof(text) - (size_t)n,
+                          "    \"%s\": %llu%s\n", Name(id),
+                          (unsigned long long)Total(id),
+                          (id + 1 < CTR_KINDS) ? "," : "");
         }
 
-        VERIFYF(GetStdHandle) input_ = GetStdHandle(STD_INPUT_HANDLE);
-        VERIFYF(GetStdHandle) output_ = GetStdHandle(STD_OUTPUT_HANDLE);
-        oldcp_ = GetConsoleOutputCP();
-        SetConsoleOutputCP(65001);
-        SaveState();
-        GetConsoleMode(input_, &oldMode_);
-        DWORD dwNewMode = oldMode_ | ENABLE_MOUSE_INPUT;
-        dwNewMode &= ~(DWORD)ENABLE_QUICK_EDIT_MODE;
-        SetConsoleMode(input_, dwNewMode | ENABLE_EXTENDED_FLAGS);
-        SaveCursor();
-        HideCursor();
+        n += snprintf(text + n, sizeof(text) - (size_t)n, "%s", "  }\n}\n");
+        return WriteFileAtomic(path, text, (size_t)n);
     }
 
-    void Release()
+    // dumps to path at StopDump(), and every interval_ms if not 0
+    void StartDump(const char* path, int interval_ms)
     {
-        SetConsoleMode(input_, oldMode_ | ENABLE_EXTENDED_FLAGS);
-        ResetColor();
-        SetConsoleOutputCP(oldcp_);
-        ShowCursor();
+        path_ = path;
+        interval_ms_ = interval_ms;
+        stop_ = false;
+
+        if (path_ && (interval_ms_ > 0)) {
+            thread_ = std::thread(&CounterRegistry::Run, this);
+        } else { }
     }
 
-    void SaveBuffer()
+    // returns false if the last dump failed
+    bool StopDump()
     {
-        oldout_ = GetStdHandle(STD_OUTPUT_HANDLE);
-        output_ = CreateConsoleScreenBuffer(
-            GENERIC_READ |            // read/write access
-            GENERIC_WRITE,
-            FILE_SHARE_READ |
-            FILE_SHARE_WRITE,         // shared
-            NULL,                     // default security attributes
-            CONSOLE_TEXTMODE_BUFFER,  // must be TEXTMODE
-            NULL);                    // reserved; must be NULL
+        if (thread_.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                stop_ = true;
+            }
+            wake_.notify_one();
+            thread_.join();
+        } else { }
 
-        if (output_ == INVALID_HANDLE_VALUE) {
-            printf("CreateConsoleScreenBuffer failed - (%lu)\n", GetLastError());
-            return;
-        }
+        const char* path = path_;
+        path_ = NULL;
+        return path ? Dump(path) : true;
+    }
 
-        if (!SetStdHandle(STD_OUTPUT_HANDLE, output_)) {
-            printf("SetStdHandle failed - (%lu)\n", GetLastError());
-            return;
-        }
+  private:
+    struct alignas(CACHE_LINE) Shard {
+        std::atomic<uint64_t> value[CTR_KINDS];
+    };
 
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        GetConsoleScreenBufferInfo(output_, &csbi);
-        csbi.dwSize.Y++;
-        // dprint("SaveBuffer: csbi.dwSize.Y=%d", csbi.dwSize.Y);
-        SetConsoleScreenBufferSize(output_, csbi.dwSize);
+    // the shard of a thread, given back when the thread exits
+    struct Lease {
+        Lease() : owner(NULL), shard(NULL), index(0) { }
+        ~Lease()
+        {
+            if (owner && (this != &owner->exiting_)) {
+                Exited() = true;  // of the thread, which is exiting
+            } else { }
 
-        if (!SetConsoleActiveScreenBuffer(output_)) {
-            printf("SetConsoleActiveScreenBuffer failed - (%lu)\n", GetLastError());
-            return;
+            if (owner && (index < MAX_SHARDS)) {
+                owner->leased_[index].store(false, std::memory_order_release);
+            } else { }
         }
 
-        HideCursor();
+        CounterRegistry* owner;
+        Shard* shard;
+        unsigned int index;
+
+      private:
+        DISALLOW_COPY_AND_ASSIGN(Lease);
+    };
+
+    // set once the lease of the thread is destroyed; a bool has no
+    // destructor, so it can still be read while the thread exits
+    static bool& Exited()
+    {
+        static thread_local bool exited = false;
+        return exited;
     }
 
-    void RestoreBuffer()
+    Lease& Local()
     {
-        if (!SetConsoleActiveScreenBuffer(oldout_)) {
-            printf("SetConsoleActiveScreenBuffer failed - (%lu)\n", GetLastError());
-            return;
-        }
+        static thread_local Lease lease;
 
-        CloseHandle(output_);
-        output_ = oldout_;
-        SetStdHandle(STD_OUTPUT_HANDLE, output_);
-        oldout_ = NULL;
-    }
+        if (Exited()) {
+            return exiting_;  // counts added while the thread exits
+        } else if (lease.shard) {
+            return lease;
+        } else { }
 
-    void ShowCursor()
-    {
-        CONSOLE_CURSOR_INFO info;
-        info.dwSize = cursor_size;
-        info.bVisible = TRUE;
-        SetConsoleCursorInfo(output_, &info);
+        unsigned int i = 0;
+
+        for (; i < MAX_SHARDS; ++i) {
+            bool free = false;
+
+            if (leased_[i].compare_exchange_strong(free, true,
+                                                   std::memory_order_acquire)) {
+                break;
+            } else { }
+        }
+
+        unsigned int used = (i < MAX_SHARDS) ? i + 1 : (unsigned int)MAX_SHARDS;
+        unsigned int high = high_.load();
+
+        while ((high < used) && !high_.compare_exchange_weak(high, used)) {
+        }
+
+        lease.owner = this;
+        lease.index = i;
+        lease.shard = &shards_[i];
+        return lease;
     }
 
-    void HideCursor()
+    void Run()
     {
-        CONSOLE_CURSOR_INFO info;
-        info.dwSize = 1;
-        info.bVisible = FALSE;
-        SetConsoleCursorInfo(output_, &info);
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        while (!wake_.wait_for(lock, std::chrono::milliseconds(interval_ms_),
+                               [this] { return stop_; })) {
+            Dump(path_);
+        }
     }
 
-    void SaveCursor()
+  private:
+    DISALLOW_COPY_AND_ASSIGN(CounterRegistry);
+
+  private:
+    int64_t start_ns_;
+    Shard shards_[MAX_SHARDS + 1];  // the last one is shared
+    std::atomic<bool> leased_[MAX_SHARDS];
+    std::atomic<unsigned int> high_;  // shards used so far
+    Lease exiting_;  // on the shared shard
+    const char* path_;
+    int interval_ms_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::thread thread_;
+};
+
+CounterRegistry counters;
+
+// adds the time of its scope to a *_ns counter
+class CounterTimer
+{
+  public:
+    explicit CounterTimer(int id) : id_(id), start_(Clock().Ticks_ns()) { }
+    ~CounterTimer()
     {
-        CONSOLE_CURSOR_INFO cci;
-        GetConsoleCursorInfo(output_, &cci);
-        cursor_size = cci.dwSize;
+        counters.Add(id_, (uint64_t)(Clock().Ticks_ns() - start_));
     }
 
-    int ReadInput(INPUT_RECORD& inrec)
-    {
-        switch (WaitForSingleObject(input_, 100)) {
-        case WAIT_OBJECT_0: {
-            DWORD nEvents;
+  private:
+    DISALLOW_COPY_AND_ASSIGN(CounterTimer);
 
-            if (ReadConsoleInput(input_, &inrec, 1, &nEvents)) {
-                if (nEvents > 0) {
-                    return 1;
-                } else { }
-            }
-        } break;
-        case WAIT_TIMEOUT:
-            inrec.EventType = 0x0;
-            return 1;
-        case WAIT_ABANDONED:
-        case WAIT_FAILED:
-        default:  // TODO: to check recoverable or not and to act on it
-            // dprint("wait for input failed with error code %lu",
-            //        (DWORD)GetLastError());
-            break;
-        }
+  private:
+    int id_;
+    int64_t start_;
+};
+// end of counter registry }}}
 
-        inrec.EventType = 0x0;
+// trace ring {{{
+//
+// Timestamped binary events, an event id and up to three integers, recorded
+// without formatting or locks, so tracing barely changes the timing it is
+// looking at (unlike DPRINT, which formats and writes synchronously).  Each
+// thread writes to a ring of its own, leased on its first event and given
+// back when the thread exits; the oldest events of a full ring are
+// overwritten.  Nothing is recorded until Start().
+//
+// Save() merges the rings into a file when the program ends, and
+// DecodeTrace() prints such a file as text or as Chrome trace JSON (for
+// chrome://tracing or Perfetto).  The file is in the byte order of the
+// machine that wrote it.
+//
+enum TraceId {
+    TR_KEY,
+    TR_MOUSE,
+    TR_IDLE,
+    TR_MOVE,
+    TR_SPAWN,
+    TR_UNDO,
+    TR_PUBLISH,
+    TR_DRAW,
+    TR_CON_READ,
+    TR_CON_WRITE,
+    TR_CON_CELLS,
+    TR_CON_RESIZE,
+    TR_KINDS
+};
 
-        if (interrupted_) {
-            return 0;
-        } else { }
+struct TraceEvent {
+    int64_t ns;
+    uint16_t id;
+    uint8_t phase;   // 'i' instant, 'B' begin or 'E' end
+    uint8_t thread;  // in the order threads started tracing
+    int32_t arg[3];
+};
 
-        return -1;
-    }
+static_assert((sizeof(TraceEvent) == 24), "TraceEvent: error in size");
 
-    void MoveTo(unsigned int x, unsigned int y)
-    {
-        COORD coord = {(SHORT)x, (SHORT)y};
-        coord.Y += top_;
+struct TraceKind {
+    const char* name;
+    const char* arg[3];  // NULL if not used
+};
 
-        if (coord.Y >= height_) {
-            coord.Y = height_;
-        }
+inline const TraceKind& GetTraceKind(unsigned int id)
+{
+    static const TraceKind kind[TR_KINDS + 1] = {
+        { "key", { "code", "down", "input" } },
+        { "mouse", { "x", "y", "input" } },
+        { "idle", { "timer", NULL, NULL } },
+        { "move", { "type", "moved", "score" } },
+        { "spawn", { "row", "col", "value" } },
+        { "undo", { NULL, NULL, NULL } },
+        { "publish", { "moves", "queued", NULL } },
+        { "draw", { "moves", "all", NULL } },
+        { "con_read", { "bytes", NULL, NULL } },
+        { "con_write", { "bytes", "written", NULL } },
+        { "con_cells", { "x", "y", "cells" } },
+        { "con_resize", { "width", "height", NULL } },
+        { "?", { "a", "b", "c" } }
+    };
 
-        SetConsoleCursorPosition(output_, coord);
-    }
+    return kind[(id < TR_KINDS) ? id : (unsigned int)TR_KINDS];
+}
 
-    void SetColor(unsigned int color)
+class TraceRecorder
+{
+  public:
+    enum { MAX_RINGS = 16, RING_SIZE = 1 << 14 };
+
+    TraceRecorder()
+        : on_(false), threads_(0), dropped_(0), start_ns_(0), rings_(), mutex_() { }
+    ~TraceRecorder()
     {
-        SetConsoleTextAttribute(output_, (WORD)color);
+        for (unsigned int i = 0; i < MAX_RINGS; ++i) {
+            delete[] rings_[i].events;
+        }
     }
 
-    void SaveState()
+    void Start()
     {
-        // saves color, cursor position and buffer height
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        GetConsoleScreenBufferInfo(output_, &csbi);
-        text_attrib_ = csbi.wAttributes;
-        top_ = csbi.dwCursorPosition.Y;
-        height_ = csbi.dwSize.Y;
+        start_ns_ = Clock().Ticks_ns();
+        on_ = true;
     }
 
-    short ResetCursorPosition(short top)
+    bool On()
     {
-        // only y value is handled
-        if (top >= 0) {
-            return (top_ = (SHORT)top);
-        } else {
-            CONSOLE_SCREEN_BUFFER_INFO csbi;
-            GetConsoleScreenBufferInfo(output_, &csbi);
-            return (top_ = csbi.srWindow.Top);
-        }
+        return on_.load(std::memory_order_relaxed);
     }
 
-    void Resize(int rows)
+    void Record(int id, int32_t a = 0, int32_t b = 0, int32_t c = 0, uint8_t phase = 'i')
     {
-        // only y value is handled
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        GetConsoleScreenBufferInfo(output_, &csbi);
+        if (On()) {
+        } else {
+            return;
+        }
 
-        short height = csbi.dwSize.Y;
-        short top = csbi.srWindow.Top;
-        short bottom = csbi.srWindow.Bottom;
+        Lease& lease = Local();
 
-        if ((rows >= csbi.dwMaximumWindowSize.Y) || (rows <= 1)) {
-            // TODO: assert, what if dwMaximumWindowSize is less?
-            // DPRINT("((rows >= csbi.dwMaximumWindowSize.Y) || (rows <= 1))");
+        if (lease.ring) {
+        } else {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
             return;
         }
 
-        if ((bottom - top) >= rows) {
-            // console can diplay full grid
-            // DPRINT("((bottom - top) >= rows)");
-        } else {
-            if (height >= (top + rows)) {
-                // good
-            } else {
-                top = height - (SHORT)rows;
-            }
+        Ring& ring = *lease.ring;
+        uint32_t head = ring.head.load(std::memory_order_relaxed);
+        TraceEvent& e = ring.events[head & (RING_SIZE - 1)];
+        e.ns = Clock().Ticks_ns();
+        e.id = (uint16_t)id;
+        e.phase = phase;
+        e.thread = lease.thread;
+        e.arg[0] = a;
+        e.arg[1] = b;
+        e.arg[2] = c;
+        ring.head.store(head + 1, std::memory_order_release);
+    }
 
-            SMALL_RECT srctWindow;
-            srctWindow.Top = top;  // move top saved y-top-position
-            srctWindow.Bottom = top + (SHORT)rows;
-            srctWindow.Left = 0;
-            srctWindow.Right = csbi.srWindow.Right - csbi.srWindow.Left;
+    // writes the events of all rings in time order, call when the threads
+    // recording them are done
+    bool Save(const char* path)
+    {
+        std::vector<TraceEvent> events;
 
-            SetConsoleWindowInfo(output_, TRUE, &srctWindow);
-            // DPRINT("%d %d / %d", top_, srctWindow.Top, srctWindow.Bottom);
+        for (unsigned int i = 0; i < MAX_RINGS; ++i) {
+            Ring& ring = rings_[i];
+            uint32_t head = ring.head.load(std::memory_order_acquire);
+            uint32_t n = std::min(head, (uint32_t)RING_SIZE);
+
+            for (uint32_t k = head - n; k != head; ++k) {
+                events.push_back(ring.events[k & (RING_SIZE - 1)]);
+            }
         }
-    }
 
-    void Clear()
-    {
-        // only y value is handled
-        CONSOLE_SCREEN_BUFFER_INFO csbi;
-        GetConsoleScreenBufferInfo(output_, &csbi);
+        std::stable_sort(events.begin(), events.end(),
+                         [](const TraceEvent& x, const TraceEvent& y) {
+                             return x.ns < y.ns;
+                         });
 
-        short top = csbi.srWindow.Top;
-        short bottom = csbi.srWindow.Bottom;
+        FILE* out = fopen(path, "wb");
 
-        for (int i = 0; i < (bottom - top); i++) {
-            printf("\n");
+        if (out) {
+        } else {
+            return false;
         }
-    }
 
-    void ResetColor()
-    {
-        SetConsoleTextAttribute(output_, text_attrib_);
+        TraceHeader header = { { '2', '0', '4', '8', 'T', 'R', 'C', '1' },
+                               (uint32_t)events.size(), dropped_.load(), start_ns_ };
+        bool ok = (fwrite(&header, sizeof(header), 1, out) == 1) &&
+                  (events.empty() ||
+                   (fwrite(&events[0], sizeof(TraceEvent), events.size(), out) ==
+                    events.size()));
+        return (fclose(out) == 0) && ok;
     }
 
-    void FlushInput()
-    {
-        FlushConsoleInputBuffer(input_);
-    }
+    struct TraceHeader {
+        char magic[8];
+        uint32_t count;
+        uint32_t dropped;  // events of threads beyond MAX_RINGS
+        int64_t start_ns;
+    };
 
-    void SavePalette()
-    {
-        GetPalette(ct_);
-    }
+  private:
+    struct Ring {
+        std::atomic<uint32_t> head;  // events recorded
+        std::atomic<bool> leased;
+        TraceEvent* events;
+    };
 
-    void GetOldPalette(COLORREF ct[16])
-    {
-        memcpy(ct, ct_, sizeof(COLORREF) * 16);
-    }
+    struct Lease {
+        Lease() : owner(NULL), ring(NULL), thread(0), tried(false) { }
+        ~Lease()
+        {
+            if (owner && ring) {
+                ring->leased.store(false, std::memory_order_release);
+                ring = NULL;
+            } else { }
+        }
 
-    void GetPalette(COLORREF ct[16])
-    {
-#if defined(__MINGW32__) && !defined(__MINGW64_VERSION_MAJOR)
-        // GetConsoleScreenBufferInfoEx() not yet supported by MinGW
-        (void)ct;
-#else
-        CONSOLE_SCREEN_BUFFER_INFOEX sbi;
-        ZeroMemory(&sbi, sizeof(sbi));
-        sbi.cbSize = sizeof(sbi);
+        TraceRecorder* owner;
+        Ring* ring;
+        uint8_t thread;
+        bool tried;
 
-        if (GetConsoleScreenBufferInfoEx(output_, &sbi)) {
-            memcpy(ct, sbi.ColorTable, sizeof(COLORREF) * 16);
-        } else { }
-#endif
-    }
+      private:
+        DISALLOW_COPY_AND_ASSIGN(Lease);
+    };
 
-    void SetPalette(COLORREF ct[16])
+    Lease& Local()
     {
-#if defined(__MINGW32__) && !defined(__MINGW64_VERSION_MAJOR)
-        // SetConsoleScreenBufferInfoEx() not yet supported by MinGW
-        (void)ct;
-#else
-        CONSOLE_SCREEN_BUFFER_INFOEX sbi;
-        ZeroMemory(&sbi, sizeof(sbi));
-        sbi.cbSize = sizeof(sbi);
+        static thread_local Lease lease;
 
-        RECT r;
-        HWND hwnd = GetConsoleWindow();
-        GetWindowRect(hwnd, &r);
+        if (lease.tried) {
+            return lease;
+        } else { }
 
-        if (GetConsoleScreenBufferInfoEx(output_, &sbi)) {
-            memcpy(sbi.ColorTable, ct, sizeof(COLORREF) * 16);
+        lease.tried = true;
+        lease.owner = this;
+        lease.thread = (uint8_t)threads_.fetch_add(1);
+        std::lock_guard<std::mutex> guard(mutex_);
 
-            sbi.srWindow.Right++;
-            sbi.srWindow.Bottom++;
+        for (unsigned int i = 0; i < MAX_RINGS; ++i) {
+            if (rings_[i].leased.load()) {
+            } else {
+                if (rings_[i].events) {
+                } else {
+                    rings_[i].events = new TraceEvent[RING_SIZE];
+                }
 
-            SetConsoleScreenBufferInfoEx(output_, &sbi);
+                rings_[i].leased.store(true);
+                lease.ring = &rings_[i];
+                break;
+            }
+        }
 
-            // TODO: remove MoveWindow()/UpdateWindow() and test
-            MoveWindow(hwnd, r.left, r.top, r.right - r.left, r.bottom - r.top, TRUE);
-            UpdateWindow(hwnd);
-        } else { }
-#endif
+        return lease;
     }
 
-    void ResetPalette()
+  private:
+    DISALLOW_COPY_AND_ASSIGN(TraceRecorder);
+
+  private:
+    std::atomic<bool> on_;
+    std::atomic<unsigned int> threads_;
+    std::atomic<uint32_t> dropped_;
+    int64_t start_ns_;
+    Ring rings_[MAX_RINGS];
+    std::mutex mutex_;
+};
+
+TraceRecorder tracer;
+
+// records a begin event, and the end event when it goes out of scope
+class TraceScope
+{
+  public:
+    TraceScope(int id, int32_t a = 0, int32_t b = 0) : id_(id)
     {
-        SetPalette(ct_);
+        tracer.Record(id_, a, b, 0, 'B');
     }
-
-    void SetTitle(const TCHAR* title)
+    ~TraceScope()
     {
-        if (title) {
-            SetConsoleTitle(title);
-        } else { }
+        tracer.Record(id_, 0, 0, 0, 'E');
     }
 
-    int Write(unsigned int color, unsigned int x, unsigned int y, const char* str)
-    {
-        if (x == LAST_VALUE && y == LAST_VALUE) {
-            // continue from current position
-        } else {
-            MoveTo(x, y);
-        }
+  private:
+    DISALLOW_COPY_AND_ASSIGN(TraceScope);
 
-        if (color == LAST_VALUE) {
-            // no change in color
-        } else {
-            SetColor(color);
-        }
+  private:
+    int id_;
+};
 
-        return Write(str);
+// prints a file written by TraceRecorder::Save() as text or Chrome JSON
+inline bool DecodeTrace(const char* path, bool chrome, FILE* out)
+{
+    FILE* in = fopen(path, "rb");
+
+    if (in) {
+    } else {
+        return false;
     }
 
-    int Write(unsigned int x, unsigned int y, const char* str)
-    {
-        if (x == LAST_VALUE && y == LAST_VALUE) {
-            // continue from current position
+    TraceRecorder::TraceHeader header;
+    bool ok = (fread(&header, sizeof(header), 1, in) == 1) &&
+              (memcmp(header.magic, "2048TRC1", 8) == 0);
+
+    if (ok && chrome) {
+        fprintf(out, "%s", "{\"traceEvents\":[\n");
+    } else if (ok) {
+        fprintf(out, "%12s %3s  %s\n", "us", "thr", "event");
+    } else { }
+
+    TraceEvent e;
+    uint32_t n = 0;
+
+    for (; ok && (n < header.count) && (fread(&e, sizeof(e), 1, in) == 1); ++n) {
+        const TraceKind& kind = GetTraceKind(e.id);
+        double us = (double)(e.ns - header.start_ns) / 1000.0;
+
+        if (chrome) {
+            fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,"
+                    "\"tid\":%u%s", n ? ",\n" : "", kind.name, e.phase, us,
+                    e.thread, (e.phase == 'i') ? ",\"s\":\"t\"" : "");
+
+            for (int i = 0; (i < 3) && kind.arg[i] && (e.phase != 'E'); ++i) {
+                fprintf(out, "%s\"%s\":%d", i ? "," : ",\"args\":{", kind.arg[i], e.arg[i]);
+            }
+
+            fprintf(out, "%s", (kind.arg[0] && (e.phase != 'E')) ? "}}" : "}");
         } else {
-            MoveTo(x, y);
+            fprintf(out, "%12.3f %3u  %s%s", us, e.thread,
+                    (e.phase == 'B') ? "begin " : (e.phase == 'E') ? "end " : "",
+                    kind.name);
+
+            for (int i = 0; (i < 3) && kind.arg[i] && (e.phase != 'E'); ++i) {
+                fprintf(out, " %s=%d", kind.arg[i], e.arg[i]);
+            }
+
+            fprintf(out, "%s", "\n");
         }
+    }
 
-        return Write(str);
+    if (ok && chrome) {
+        fprintf(out, "%s", "\n]}\n");
+    } else if (ok && header.dropped) {
+        fprintf(out, "%u events of threads beyond %u were dropped\n",
+                header.dropped, (unsigned int)TraceRecorder::MAX_RINGS);
+    } else { }
+
+    fclose(in);
+    return ok && (n == header.count);
+}
+// end of trace ring }}}
+
+// allocation tracking {{{
+//
+// The global operator new and delete are replaced to count allocations,
+// their bytes and their call sites per phase: a thread sets its phase with
+// AllocPhase for the span of a move, a spawn, a frame or a search, so the
+// drawing and search threads are told apart from the game.  Nothing is
+// counted until Start().  Memory taken with malloc() directly, as by the C
+// library, is not seen.
+//
+// Allocations made while the globals are constructed, before the tracker
+// itself may be, only read its zero-initialized on_ flag.  The debug CRT of
+// MSC_DEBUG_ builds maps 'new' for its own leak reports, and a LIB2048_
+// library must leave the operators of its host alone, so the operators are
+// not replaced there.
+//
+#if !defined(MSC_DEBUG_) && !defined(LIB2048_)
+#define ALLOC_TRACKING_
+#endif
+
+enum AllocPhaseId {
+    ALLOC_OTHER,
+    ALLOC_MOVE,
+    ALLOC_SPAWN,
+    ALLOC_FRAME,
+    ALLOC_SEARCH,
+    ALLOC_PHASES
+};
+
+static thread_local int alloc_phase;
+
+class AllocTracker
+{
+  public:
+    enum { SITES = 64 };  // per phase, more sites are counted as one
+
+    AllocTracker() : on_(false), phases_() { }
+    ~AllocTracker() { }
+
+    void Start()
+    {
+        on_ = true;
     }
 
-    int Write(unsigned int color, const char* str)
+    void Stop()
     {
-        if (color == LAST_VALUE) {
-            // no change in color
-        } else {
-            SetColor(color);
-        }
+        on_ = false;
+    }
 
-        return Write(str);
+    void Reset()
+    {
+        for (int i = 0; i < ALLOC_PHASES; ++i) {
+            Phase& phase = phases_[i];
+            phase.count = 0;
+            phase.bytes = 0;
+            phase.frees = 0;
+            phase.more = 0;
+
+            for (int k = 0; k < SITES; ++k) {
+                phase.site[k] = 0;
+                phase.site_count[k] = 0;
+            }
+        }
     }
 
-    int Write(const char* str)
+    void Allocated(size_t size, const void* return_address)
     {
-        if (str && *str) {
+        if (on_.load(std::memory_order_relaxed)) {
         } else {
-            return 0;  // TODO: assert
+            return;
         }
 
-        DWORD n;
-        int count = (int)strlen(str);
+        Phase& phase = phases_[alloc_phase];
+        phase.count.fetch_add(1, std::memory_order_relaxed);
+        phase.bytes.fetch_add(size, std::memory_order_relaxed);
 
-        WriteConsoleA(output_, str, (unsigned int)count, &n, NULL);
+        // sites are offsets into the code, the same in every run
+        uintptr_t site = (uintptr_t)return_address - (uintptr_t)&PhaseName;
+        site = site ? site : 1;
+        unsigned int h = (unsigned int)((site * 0x9e3779b97f4a7c15ull) >> 58);
 
-        return count;
+        for (unsigned int i = 0; i < SITES; ++i) {
+            unsigned int k = (h + i) & (SITES - 1);
+            uintptr_t key = phase.site[k].load(std::memory_order_relaxed);
+
+            if ((key == 0) &&
+                phase.site[k].compare_exchange_strong(key, site)) {
+                key = site;
+            } else { }
+
+            if (key == site) {
+                phase.site_count[k].fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else { }
+        }
+
+        phase.more.fetch_add(1, std::memory_order_relaxed);
     }
 
-#if 0
-    template<typename ...Args>
-    int Write(const char* fmt, Args... args)
+    void Freed()
     {
-        int count;
-        char buf[128];
+        if (on_.load(std::memory_order_relaxed)) {
+            phases_[alloc_phase].frees.fetch_add(1, std::memory_order_relaxed);
+        } else { }
+    }
 
-        count = snprintf(buf, sizeof(buf) - 1, fmt, args...);
-        buf[sizeof(buf) - 1] = '\0';
+    uint64_t Count(int phase)
+    {
+        return phases_[phase].count.load();
+    }
 
-        if (count < 0) {
-            buf[sizeof(buf) - 2] = '?';
-            OutputDebugStringA(buf);
-            count = sizeof(buf) - 2;
-        } else { }
+    void Print(FILE* out)
+    {
+        fprintf(out, "%-8s %10s %12s %10s\n", "phase", "allocs", "bytes", "frees");
 
-        DWORD n;
+        for (int i = 0; i < ALLOC_PHASES; ++i) {
+            Phase& phase = phases_[i];
+            fprintf(out, "%-8s %10llu %12llu %10llu\n", PhaseName(i),
+                    (unsigned long long)phase.count.load(),
+                    (unsigned long long)phase.bytes.load(),
+                    (unsigned long long)phase.frees.load());
 
-        WriteConsoleA(output_, buf, (unsigned int)count, &n, NULL);
+            // the busiest sites first
+            uint64_t count[SITES];
+            unsigned int order[SITES];
 
-        return count;
+            for (unsigned int k = 0; k < SITES; ++k) {
+                count[k] = phase.site[k].load() ? phase.site_count[k].load() : 0;
+                order[k] = k;
+            }
+
+            std::sort(order, order + SITES, [&count](unsigned int x, unsigned int y) {
+                return count[x] > count[y];
+            });
+
+            for (unsigned int k = 0; (k < SITES) && count[order[k]]; ++k) {
+                fprintf(out, "    site %08x %10llu\n", SiteHash(phase.site[order[k]].load()),
+                        (unsigned long long)count[order[k]]);
+            }
+
+            if (phase.more.load()) {
+                fprintf(out, "    other sites   %10llu\n",
+                        (unsigned long long)phase.more.load());
+            } else { }
+        }
     }
-#endif
 
-    void CopyRegion(SMALL_RECT& dst, SMALL_RECT& src)
+    static const char* PhaseName(int phase)
     {
-        COORD buf_size;
-        COORD buf_coord;
-
-        src.Top += top_;
-        src.Bottom += top_;
-        dst.Top += top_;
-        dst.Bottom += top_;
+        static const char* const name[ALLOC_PHASES] = {
+            "other", "move", "spawn", "frame", "search"
+        };
 
-        buf_size.X = (short)(src.Right - src.Left + 1);
-        buf_size.Y = (short)(src.Bottom - src.Top + 1);
+        return name[phase];
+    }
 
-#ifndef USE_VLA_
-        CHAR_INFO* buf = NULL;
+  private:
+    static unsigned int SiteHash(uintptr_t site)
+    {
+        uint32_t h = 2166136261u;  // FNV-1a
 
-        try {
-            // assert ((size_t)(buf_size.X * buf_size.Y)) > 0
-            buf = new CHAR_INFO[(size_t)(buf_size.X * buf_size.Y)];
-        } catch (...) {
-            dprint("%s", "new CHAR_INFO[] failed");
-            return;
+        for (unsigned int i = 0; i < sizeof(site); ++i) {
+            h = (h ^ (uint32_t)((site >> (8 * i)) & 0xffu)) * 16777619u;
         }
-#else
-        CHAR_INFO buf[buf_size.X * buf_size.Y];
-#endif
 
-        // The top left destination cell of the CHAR_INFO buf
-        buf_coord.X = 0;
-        buf_coord.Y = 0;
-
-        // Copy the block from the screen buffer to the buf
-        ReadConsoleOutput(output_,    // screen buffer to read from
-                          buf,        // buffer to copy into
-                          buf_size,   // col-row size of buf
-                          buf_coord,  // top left dest. cell in buf
-                          &src);      // screen buffer source rectangle
-
-        // Copy from the buf to the screen buffer.
-        WriteConsoleOutput(output_,    // screen buffer to write to
-                           buf,        // buffer to copy from
-                           buf_size,   // col-row size of buf
-                           buf_coord,  // top left src cell in buf
-                           &dst);      // dest. screen buffer rectangle
-
-#ifndef USE_VLA_
-        delete[] buf;
-#endif
-#undef USE_VLA_
+        return h;
     }
 
+    struct Phase {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> frees;
+        std::atomic<uint64_t> more;
+        std::atomic<uintptr_t> site[SITES];
+        std::atomic<uint64_t> site_count[SITES];
+    };
+
   private:
-    DISALLOW_COPY_AND_ASSIGN(Console);
+    DISALLOW_COPY_AND_ASSIGN(AllocTracker);
 
   private:
-    SHORT top_;
-    SHORT height_;
-    short interrupted_;
-    WORD text_attrib_;
-    UINT oldcp_;
-    DWORD oldMode_;
-    DWORD cursor_size;
-    HANDLE input_;
-    HANDLE output_;
-    HANDLE oldout_;
-    HANDLE conout_;
-    COLORREF ct_[16];
+    std::atomic<bool> on_;
+    Phase phases_[ALLOC_PHASES];
 };
-// end of windows console api wrapper }}}
 
-Console con;
+AllocTracker alloc_tracker;
 
-BOOL CtrlHandler(DWORD ctrl)
+// sets the allocation phase of the thread for its scope
+class AllocPhase
 {
-    return con.CtrlHandler(ctrl);
+  public:
+    explicit AllocPhase(int phase) : old_(alloc_phase)
+    {
+        alloc_phase = phase;
+    }
+    ~AllocPhase()
+    {
+        alloc_phase = old_;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(AllocPhase);
+
+  private:
+    int old_;
+};
+
+#if defined(ALLOC_TRACKING_)
+void* operator new(size_t size)
+{
+    void* p = malloc(size ? size : 1);
+
+    if (p) {
+    } else {
+        throw std::bad_alloc();
+    }
+
+    alloc_tracker.Allocated(size, RETURN_ADDRESS());
+    return p;
 }
 
-// math or numerical routines {{{
-template<typename T> T Max(T a, T b)
+void* operator new[](size_t size)
 {
-    return a > b ? a : b;
+    void* p = malloc(size ? size : 1);
+
+    if (p) {
+    } else {
+        throw std::bad_alloc();
+    }
+
+    alloc_tracker.Allocated(size, RETURN_ADDRESS());
+    return p;
 }
 
-template<typename T> T Min(T a, T b)
+void* operator new(size_t size, const std::nothrow_t&) throw()
 {
-    return a < b ? a : b;
+    void* p = malloc(size ? size : 1);
+
+    if (p) {
+        alloc_tracker.Allocated(size, RETURN_ADDRESS());
+    } else { }
+
+    return p;
 }
 
-class Stripe
+void* operator new[](size_t size, const std::nothrow_t&) throw()
 {
-  public:
-    Stripe(int type, int pos, uint8_t (&aa)[N][N])
-        : begin_(0), step_(0), end_(0),
-          type_(type), stripe_(pos), x_(1), a_(aa)
-    {
-        if ((stripe_ >= 0) && (stripe_ < N)) {
-            switch (type_) {
-            case ROW_L2R_STRIPE:
-                begin_ = 0;
-                step_ = 1;
-                end_ = N;
-                break;
-            case COL_U2D_STRIPE:
-                begin_ = 0;
-                step_ = 1;
-                end_ = N;
-                break;
-            case ROW_R2L_STRIPE:
-                begin_ = N - 1;
-                step_ = -1;
-                end_ = -1;
-                break;
-            case COL_D2U_STRIPE:
-                begin_ = N - 1;
-                step_ = -1;
-                end_ = -1;
-                break;
-            default:
-                begin_ = 0;
-                step_ = 0;
-                end_ = 0;
-                stripe_ = -1;
-                break;
-            }
+    void* p = malloc(size ? size : 1);
+
+    if (p) {
+        alloc_tracker.Allocated(size, RETURN_ADDRESS());
+    } else { }
+
+    return p;
+}
+
+NOINLINE void operator delete(void* p) throw()
+{
+    if (p) {
+        alloc_tracker.Freed();
+        free(p);
+    } else { }
+}
+
+NOINLINE void operator delete[](void* p) throw()
+{
+    if (p) {
+        alloc_tracker.Freed();
+        free(p);
+    } else { }
+}
+
+void operator delete(void* p, const std::nothrow_t&) throw()
+{
+    operator delete(p);
+}
+
+#if defined(__cpp_sized_deallocation)
+void operator delete(void* p, size_t) throw()
+{
+    operator delete(p);
+}
+
+void operator delete[](void* p, size_t) throw()
+{
+    operator delete[](p);
+}
+#endif
+
+void operator delete[](void* p, const std::nothrow_t&) throw()
+{
+    operator delete[](p);
+}
+#endif  // ALLOC_TRACKING_
+// end of allocation tracking }}}
+
+// console cell {{{
+// A character cell as drawn by Console::WriteCells(): the UTF-8 text for
+// terminals and the UTF-16 character for the console API, with its color.
+struct ConsoleCell {
+    WORD color;
+    wchar_t wide;
+    uint8_t size;
+    char text[4];
+};
+
+// sets the cell from the UTF-8 sequence at text, returns its length
+inline unsigned int SetConsoleCell(ConsoleCell& cell, const char* text, WORD color)
+{
+    unsigned char c = (unsigned char)text[0];
+    unsigned int size = (c < 0xc0u) ? 1 : (c < 0xe0u) ? 2 : (c < 0xf0u) ? 3 : 4;
+    unsigned int code = (size == 1) ? c : (c & (0x7fu >> size));
+
+    for (unsigned int i = 1; i < size; ++i) {
+        if ((text[i] & 0xc0) == 0x80) {
+            code = (code << 6) | (text[i] & 0x3fu);
         } else {
-            begin_ = 0;
-            step_ = 0;
-            end_ = 0;
-            stripe_ = -1;
+            size = i;  // truncated sequence
+            break;
         }
     }
-    ~Stripe() { }
 
-#if 0
-    // code below can be used for debugging the class
-    void DbgPrintM()
-    {
-        for (int r = 0; r < N; ++r) {
-            for (int c = 0; c < N; ++c) {
-                if (a_[r][c]) {
-                    printf("%u", a_[r][c]);
-                } else {
-                    printf("%s", ".");
-                }
-            }
+    cell.color = color;
+    cell.wide = (wchar_t)((code < 0x10000u) ? code : 0xfffdu);
+    cell.size = (uint8_t)size;
+    memset(cell.text, 0, sizeof(cell.text));
+    memcpy(cell.text, text, size);
+    return size;
+}
+// end of console cell }}}
 
-            printf("%s", "\n");
-        }
+// windows console api wrapper {{{
+#if defined(_WIN32)
+class Console
+{
+  public:
+    enum { LAST_VALUE = 0xffff };
+  public:
+    Console() : top_(0), height_(-1), interrupted_(0),
+        text_attrib_(0), oldcp_(0), oldMode_(0), cursor_size(0),
+        input_(INVALID_HANDLE_VALUE), output_(INVALID_HANDLE_VALUE),
+        oldout_(INVALID_HANDLE_VALUE), conout_(INVALID_HANDLE_VALUE)
+    {
+        memset(ct_, 0, sizeof(ct_));
     }
-
-    void DbgPrintI()
+    ~Console()
     {
-        switch (type_) {
-        case ROW_L2R_STRIPE:
-            printf("L(%d): ", stripe_);
-            break;
-        case COL_U2D_STRIPE:
-            printf("U(%d): ", stripe_);
-            break;
-        case ROW_R2L_STRIPE:
-            printf("R(%d): ", stripe_);
-            break;
-        case COL_D2U_STRIPE:
-            printf("D(%d): ", stripe_);
-            break;
-        default:
-            printf("!!!(%d): ", stripe_);
-            break;
-        }
+        FlushConsoleInputBuffer(input_);
 
-        DPRINT("b(%d) s(%d) e(%d)\n", begin_, step_, end_);
+        if (conout_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(conout_);
+        } else { }
     }
 
-    void DbgPrintS()
+    BOOL CtrlHandler(DWORD ctrl)
     {
-        Stripe& A = *this;
-        /*
-        switch (type_) {
-        case ROW_L2R_STRIPE:
-            printf("L(%d) ", stripe_);
+        BOOL retval = TRUE;
+        interrupted_ = 1;
+
+        switch (ctrl) {
+        case CTRL_C_EVENT:
+            // printf("Ctrl-C event\n\n");
+            Beep(750, 300);
+            retval = TRUE;
             break;
-        case COL_U2D_STRIPE:
-            printf("U(%d) ", stripe_);
+        case CTRL_BREAK_EVENT:
+            Beep(900, 200);
+            // printf("Ctrl-Break event\n\n");
+            retval = FALSE;
             break;
-        case ROW_R2L_STRIPE:
-            printf("R(%d) ", stripe_);
+        case CTRL_CLOSE_EVENT:
+            // CTRL-CLOSE: confirm that the user wants to exit.
+            Beep(600, 200);
+            // printf("Ctrl-Close event\n\n");
+            retval = TRUE;
+            ++interrupted_;
             break;
-        case COL_D2U_STRIPE:
-            printf("D(%d) ", stripe_);
+        case CTRL_LOGOFF_EVENT:
+            Beep(1000, 200);
+            // printf("Ctrl-Logoff event\n\n");
+            retval = FALSE;
+            ++interrupted_;
+            break;
+        case CTRL_SHUTDOWN_EVENT:
+            Beep(750, 500);
+            // printf("Ctrl-Shutdown event\n\n");
+            retval = FALSE;
+            ++interrupted_;
             break;
         default:
-            printf("!!!(%d) ", stripe_);
-            printf("%s", "invalid\n");
-            return;
+            retval = FALSE;
+            break;
         }
 
-        for (int i = begin_; i != end_; i += step_) {
-            if (A[i]) {
-                printf("%u", A[i]);
-            } else {
-                printf("%s", ".");
-            }
-        }  // */
+        HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
 
-        char s[N + 2] = { 0 };
+        if ((in == INVALID_HANDLE_VALUE) || (in == NULL)) {
+            dprint("CtrlHandler(%lu): error(%lu)", ctrl, GetLastError());
+            FreeConsole();  // TODO: is FreeConsole() a bad idea?
+        } else {
+            CloseHandle(in);  // NOTE: forces time out in ReadConsoleInput()
+        }
 
-        for (int i = 0; i < N; ++i) {
-            s[i] = (char)(A[i] + '0');
+        // TODO: inter-locked-functions may be good interrupted_, since
+        // ctrl-handler runs in another thread
+        while (interrupted_) {
+            Sleep(50);
         }
 
-        DPRINT("%s", s);
+        return retval;
     }
-#endif
 
-    bool within(int index, int limit)
+    void AllowCtrlHandler()
     {
-        switch (type_) {
-        case ROW_L2R_STRIPE: return (index < limit);
-        case COL_U2D_STRIPE: return (index < limit);
-        case ROW_R2L_STRIPE: return (limit < index);
-        case COL_D2U_STRIPE: return (limit < index);
-        default: break;
-        }
+        interrupted_ = 0;
+    }
 
-        printf("within(%d %d)\n", index, limit);
-        return false;
+    int CanReset()
+    {
+        return interrupted_ < 2;
     }
 
-    template<typename T>
-    unsigned int Nudge(T& scorer)
+    int Interrupted()
     {
-#define A (*this) /* Stripe& A = *this; */
-        int b = -1;
-        unsigned int m = 0;
-        int ec = end_ - step_;
+        return interrupted_;
+    }
 
-        for (int c = begin_; within(c, ec); c += step_) {
-            if (A[c] == 0) {
-                b = c;
-            } else if (within(c, ec) && A[c + step_] == 0) {
-                b = c + step_;
-            }
+    void Acquire()
+    {
+        if (_isatty(_fileno(stdout))) {
+        } else {
+            conout_ = CreateFile(L"CONOUT$",
+                                 GENERIC_READ | GENERIC_WRITE,
+                                 0, 0, OPEN_EXISTING, 0, 0);
+            SetStdHandle(STD_OUTPUT_HANDLE, conout_);
+        }
 
-            if (b > -1) {
-                for (int i = b, j = i + step_; within(j, end_); j += step_) {
-                    if (A[j] == 0) {
-                        ec -= step_;
-                        continue;
-                    } else {
-                        A[i] = A[j];
-                        A[j] = 0;
-                        ++m;  // m += A[i] ? 1 : 0;
-                        i += step_;
-                    }
-                }
+        VERIFYF(GetStdHandle) input_ = GetStdHandle(STD_INPUT_HANDLE);
+        VERIFYF(GetStdHandle) output_ = GetStdHandle(STD_OUTPUT_HANDLE);
+        oldcp_ = GetConsoleOutputCP();
+        SetConsoleOutputCP(65001);
+        SaveState();
+        GetConsoleMode(input_, &oldMode_);
+        DWORD dwNewMode = oldMode_ | ENABLE_MOUSE_INPUT;
+        dwNewMode &= ~(DWORD)ENABLE_QUICK_EDIT_MODE;
+        SetConsoleMode(input_, dwNewMode | ENABLE_EXTENDED_FLAGS);
+        SaveCursor();
+        HideCursor();
+    }
 
-                ec -= step_;
-                b = -1;
-            } else { }
+    void Release()
+    {
+        SetConsoleMode(input_, oldMode_ | ENABLE_EXTENDED_FLAGS);
+        ResetColor();
+        SetConsoleOutputCP(oldcp_);
+        ShowCursor();
+    }
 
-            if (A[c] == A[c + step_]) {
-                if (A[c]) {
-                    A[c]++;
-                    scorer(1 << A[c]);
-                    A[c] |= 0x80u;
-                    A[c + step_] = 0;  //
-                    m += (A[c] == (X800 | 0x80u)) ? 2048u : 1u;
-                } else { /* A[c] = 0; */ }  // A[c + step_] = 0;
+    void SaveBuffer()
+    {
+        oldout_ = GetStdHandle(STD_OUTPUT_HANDLE);
+        output_ = CreateConsoleScreenBuffer(
+            GENERIC_READ |            // read/write access
+            GENERIC_WRITE,
+            FILE_SHARE_READ |
+            FILE_SHARE_WRITE,         // shared
+            NULL,                     // default security attributes
+            CONSOLE_TEXTMODE_BUFFER,  // must be TEXTMODE
+            NULL);                    // reserved; must be NULL
 
-                int i;
+        if (output_ == INVALID_HANDLE_VALUE) {
+            printf("CreateConsoleScreenBuffer failed - (%lu)\n", GetLastError());
+            return;
+        }
 
-                for (i = c + step_; within(i, ec); i += step_) {
-                    A[i] = A[i + step_];
-                }
+        if (!SetStdHandle(STD_OUTPUT_HANDLE, output_)) {
+            printf("SetStdHandle failed - (%lu)\n", GetLastError());
+            return;
+        }
 
-                A[i] = 0;
-                ec -= step_;
-            } else { }
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        GetConsoleScreenBufferInfo(output_, &csbi);
+        csbi.dwSize.Y++;
+        // dprint("SaveBuffer: csbi.dwSize.Y=%d", csbi.dwSize.Y);
+        SetConsoleScreenBufferSize(output_, csbi.dwSize);
+
+        if (!SetConsoleActiveScreenBuffer(output_)) {
+            printf("SetConsoleActiveScreenBuffer failed - (%lu)\n", GetLastError());
+            return;
         }
-#undef A
-        return m;
+
+        HideCursor();
     }
 
-    uint8_t& operator[](int i)
+    void RestoreBuffer()
     {
-        if ((i >= 0) && (i < N)) {
-            switch (type_) {
-            case ROW_L2R_STRIPE: return a_[stripe_][i];
-            case COL_U2D_STRIPE: return a_[i][stripe_];
-            case ROW_R2L_STRIPE: return a_[stripe_][i];
-            case COL_D2U_STRIPE: return a_[i][stripe_];
-            default: DPRINT("Stripe: incorrect type '%d'\n", type_);
-                     break;  // TODO: to assert
-            }
-        } else { }
+        if (!SetConsoleActiveScreenBuffer(oldout_)) {
+            printf("SetConsoleActiveScreenBuffer failed - (%lu)\n", GetLastError());
+            return;
+        }
 
-        // DPRINT("A[%d] ?\n", i);
+        CloseHandle(output_);
+        output_ = oldout_;
+        SetStdHandle(STD_OUTPUT_HANDLE, output_);
+        oldout_ = NULL;
+    }
 
-        return x_;  // TODO: to assert
+    void ShowCursor()
+    {
+        CONSOLE_CURSOR_INFO info;
+        info.dwSize = cursor_size;
+        info.bVisible = TRUE;
+        SetConsoleCursorInfo(output_, &info);
     }
 
-  private:
-    DISALLOW_COPY_AND_ASSIGN(Stripe);
+    void HideCursor()
+    {
+        CONSOLE_CURSOR_INFO info;
+        info.dwSize = 1;
+        info.bVisible = FALSE;
+        SetConsoleCursorInfo(output_, &info);
+    }
 
-  private:
-    int begin_;
-    int step_;
-    int end_;
-    int type_;
-    int stripe_;
-    uint8_t x_;
-    uint8_t (&a_)[N][N];
-};
-
-class Matrix
-{
-    //     column 0 1 2 3
-    //          +----------> X
-    //    row 0 | 0 1 2 3
-    //    row 1 | 4 5 6 7
-    //    row 2 | 8 9 A B
-    //    row 3 | C D E F
-    //          v
-    //          Y
-    //
-  public:
-    explicit Matrix(uint8_t (&aa)[N][N])
-        : aa_(aa)
+    void SaveCursor()
     {
+        CONSOLE_CURSOR_INFO cci;
+        GetConsoleCursorInfo(output_, &cci);
+        cursor_size = cci.dwSize;
     }
 
-    ~Matrix() { }
-
-    void Reset(int n)
+    int ReadInput(INPUT_RECORD& inrec)
     {
-        switch (n) {
-        // case 0:
-        //    for (int r = 0; r < N; ++r) {
-        //        for (int c = 0; c < N; ++c) {
-        //            aa_[r][c] = 0;
-        //        }
-        //    } break;
-        case 1:
-            for (int i = 0; i < N * N; ++i) {
-                aa_[i >> 2][i & 0x3] = (uint8_t)(i);
-            }
+        switch (WaitForSingleObject(input_, 100)) {
+        case WAIT_OBJECT_0: {
+            DWORD nEvents;
 
-            aa_[0][0] = 1;
+            if (ReadConsoleInput(input_, &inrec, 1, &nEvents)) {
+                if (nEvents > 0) {
+                    return 1;
+                } else { }
+            }
+        } break;
+        case WAIT_TIMEOUT:
+            inrec.EventType = 0x0;
+            return 1;
+        case WAIT_ABANDONED:
+        case WAIT_FAILED:
+        default:  // TODO: to check recoverable or not and to act on it
+            // dprint("wait for input failed with error code %lu",
+            //        (DWORD)GetLastError());
             break;
-        default:
-            for (int r = 0; r < N; ++r) {
-                for (int c = 0; c < N; ++c) {
-                    aa_[r][c] = 0;
-                }
-            } break;
         }
+
+        inrec.EventType = 0x0;
+
+        if (interrupted_) {
+            return 0;
+        } else { }
+
+        return -1;
     }
 
-    uint8_t operator()(unsigned int r, unsigned int c)
+    void MoveTo(unsigned int x, unsigned int y)
     {
-        if ((r < N) && (c < N)) {
-            return aa_[r][c];
-        } else {
-            dprint("A[%u][%u] ?\n", r, c);
+        COORD coord = {(SHORT)x, (SHORT)y};
+        coord.Y += top_;
+
+        if (coord.Y >= height_) {
+            coord.Y = height_;
         }
 
-        return 0;
+        SetConsoleCursorPosition(output_, coord);
+        counters.Add(CTR_CONSOLE_CALLS);
     }
 
-    void SetAt(unsigned int r, unsigned int c, uint8_t value)
+    void SetColor(unsigned int color)
     {
-        if ((r < N) && (c < N)) {
-            aa_[r][c] = value;
+        SetConsoleTextAttribute(output_, (WORD)color);
+        counters.Add(CTR_CONSOLE_CALLS);
+    }
+
+    void SaveState()
+    {
+        // saves color, cursor position and buffer height
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        GetConsoleScreenBufferInfo(output_, &csbi);
+        text_attrib_ = csbi.wAttributes;
+        top_ = csbi.dwCursorPosition.Y;
+        height_ = csbi.dwSize.Y;
+    }
+
+    short ResetCursorPosition(short top)
+    {
+        // only y value is handled
+        if (top >= 0) {
+            return (top_ = (SHORT)top);
         } else {
-            printf("A[%u][%u] ?\n", r, c);
+            CONSOLE_SCREEN_BUFFER_INFO csbi;
+            GetConsoleScreenBufferInfo(output_, &csbi);
+            return (top_ = csbi.srWindow.Top);
         }
     }
 
-    void DbgPrint()
+    void Resize(int rows)
     {
-        fprintf(stderr, "%s", " ");
+        // only y value is handled
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        GetConsoleScreenBufferInfo(output_, &csbi);
 
-        for (int r = 0; r < N; ++r) {
-            for (int c = 0; c < N; ++c) {
-                fprintf(stderr, "%2X", aa_[r][c]);
-            }
+        short height = csbi.dwSize.Y;
+        short top = csbi.srWindow.Top;
+        short bottom = csbi.srWindow.Bottom;
 
-            fprintf(stderr, "%s", " ");
+        if ((rows >= csbi.dwMaximumWindowSize.Y) || (rows <= 1)) {
+            // TODO: assert, what if dwMaximumWindowSize is less?
+            // DPRINT("((rows >= csbi.dwMaximumWindowSize.Y) || (rows <= 1))");
+            return;
         }
 
-        fprintf(stderr, "%s", "\n");
-        fflush(stderr);
-    }
-
-    void Transpose()
-    {
-        for (int r = 0; r <= N - 2; ++r) {
-            for (int c = r + 1; c <= N - 1; ++c) {
-                Swap(aa_[r][c], aa_[c][r]);
+        if ((bottom - top) >= rows) {
+            // console can diplay full grid
+            // DPRINT("((bottom - top) >= rows)");
+        } else {
+            if (height >= (top + rows)) {
+                // good
+            } else {
+                top = height - (SHORT)rows;
             }
+
+            SMALL_RECT srctWindow;
+            srctWindow.Top = top;  // move top saved y-top-position
+            srctWindow.Bottom = top + (SHORT)rows;
+            srctWindow.Left = 0;
+            srctWindow.Right = csbi.srWindow.Right - csbi.srWindow.Left;
+
+            SetConsoleWindowInfo(output_, TRUE, &srctWindow);
+            // DPRINT("%d %d / %d", top_, srctWindow.Top, srctWindow.Bottom);
         }
     }
 
-    void SwapV()
+    void Clear()
     {
-        for (int r = 0; r < N / 2; ++r) {
-            for (int c = 0; c < N; ++c) {
-                Swap(aa_[r][c], aa_[N - 1 - r][c]);
-            }
+        // only y value is handled
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        GetConsoleScreenBufferInfo(output_, &csbi);
+
+        short top = csbi.srWindow.Top;
+        short bottom = csbi.srWindow.Bottom;
+
+        for (int i = 0; i < (bottom - top); i++) {
+            printf("\n");
         }
     }
 
-    void SwapH()
+    void ResetColor()
     {
-        for (int r = 0; r < N; ++r) {
-            for (int c = 0; c < N / 2; ++c) {
-                Swap(aa_[r][c], aa_[r][N - 1 - c]);
-            }
-        }
+        SetConsoleTextAttribute(output_, text_attrib_);
     }
 
-    void RotateCW()
+    void FlushInput()
     {
-        Transpose();
-        SwapH();
+        FlushConsoleInputBuffer(input_);
     }
 
-    void RotateCCW()
+    void SavePalette()
     {
-        Transpose();
-        SwapV();
+        GetPalette(ct_);
     }
 
-  private:
-    void Swap(uint8_t& a, uint8_t& b)
+    void GetOldPalette(COLORREF ct[16])
     {
-        uint8_t t = a;
-        a = b;
-        b = t;
+        memcpy(ct, ct_, sizeof(COLORREF) * 16);
     }
 
-  private:
-    DISALLOW_COPY_AND_ASSIGN(Matrix);
-
-  private:
-    uint8_t (&aa_)[N][N];
-};
-// end of math or numerical routines }}}
-
-class Grid
-{
-  public:
-    // grid/message offsets of x and y
-    enum {
-        GRID_X = 5,
-        GRID_Y = 2,
-        MESG_X = GRID_X + 9 * N + 5,
-        MESG_Y = 14
-    };
-  public:
-    Grid()
-#if defined(_MSC_VER) && (_MSC_VER < 1800)
-        // not supported ?
+    void GetPalette(COLORREF ct[16])
+    {
+#if defined(__MINGW32__) && !defined(__MINGW64_VERSION_MAJOR)
+        // GetConsoleScreenBufferInfoEx() not yet supported by MinGW
+        (void)ct;
 #else
-        : text_{ }
+        CONSOLE_SCREEN_BUFFER_INFOEX sbi;
+        ZeroMemory(&sbi, sizeof(sbi));
+        sbi.cbSize = sizeof(sbi);
+
+        if (GetConsoleScreenBufferInfoEx(output_, &sbi)) {
+            memcpy(ct, sbi.ColorTable, sizeof(COLORREF) * 16);
+        } else { }
 #endif
+    }
+
+    void SetPalette(COLORREF ct[16])
     {
-#if defined(_MSC_VER) && (_MSC_VER < 1800)
-        memset(&text_, 0, sizeof(text_));
-#endif
-        SetGridMode(1);
+#if defined(__MINGW32__) && !defined(__MINGW64_VERSION_MAJOR)
+        // SetConsoleScreenBufferInfoEx() not yet supported by MinGW
+        (void)ct;
+#else
+        CONSOLE_SCREEN_BUFFER_INFOEX sbi;
+        ZeroMemory(&sbi, sizeof(sbi));
+        sbi.cbSize = sizeof(sbi);
 
-        for (int i = 0; i < (int)(sizeof(ct) / sizeof(ct[0])); ++i) {
-            ct[i] = 0x0u;
-        }
-    }
+        RECT r;
+        HWND hwnd = GetConsoleWindow();
+        GetWindowRect(hwnd, &r);
 
-    ~Grid() { }
+        if (GetConsoleScreenBufferInfoEx(output_, &sbi)) {
+            memcpy(sbi.ColorTable, ct, sizeof(COLORREF) * 16);
 
-    void DrawGrid()
-    {
-        //
-        //  Board layout
-        //  ------------
-        //
-        //  (GRID_X,GRID_Y) = (5,2)
-        //    \           1         2         3
-        //     \0123456789012345678901234567890123456
-        //    0 +--------+--------+--------+--------+
-        //    1 |.      .|.      .|.      .|.      .|
-        //    2 |.   2  .|.  64  .|. 128  .|. 1024 .|
-        //    3 |.      .|.      .|.      .|.      .|
-        //    4 +--------+--------+--------+--------+
-        //    5 |        |        |        |        |
-        //    6 |        |        |        |        |
-        //    7 |        |        |        |        |             1         2
-        //    8 +--------+--------+--------+--------+   0123456789012345678901
-        //    9 |        |        |        |        |
-        //   10 |        |        |        |        |  (MESG_X,MESG_Y) = (46,14)
-        //    1 |        |        |        |        |    /
-        //    2 +--------+--------+--------+--------+   +--------------------+
-        //    3 |        |        |        |        |   |      You WON!      |
-        //    4 |        |        |        |        |   +--------------------+
-        //    5 |        |        |        |        |
-        //    6 +--------+--------+--------+--------+   > Keep Going: Yes / No
-        //
-        //  Board drawing characters
-        //  ------------------------
-        //     ┏━━━┯━━━┓   ╔═══╗  ┏━━━┓  ┌───┐
-        //     ┃   │   ┃   ║   ║  ┃   ┃  │   │   ___▌___▐___
-        //     ┠───┼───┨   ╚═══╝  ┗━━━┛  └───┘
-        //     ┃   │   ┃
-        //     ┗━━━┷━━━┛
-        //
+            sbi.srWindow.Right++;
+            sbi.srWindow.Bottom++;
 
-        con.MoveTo(0, 0);
+            SetConsoleScreenBufferInfoEx(output_, &sbi);
 
-        con.Write(0x08u, GRID_X, GRID_Y, text_.grid_top_line);
+            // TODO: remove MoveWindow()/UpdateWindow() and test
+            MoveWindow(hwnd, r.left, r.top, r.right - r.left, r.bottom - r.top, TRUE);
+            UpdateWindow(hwnd);
+        } else { }
+#endif
+    }
 
-        unsigned int y;
+    void ResetPalette()
+    {
+        SetPalette(ct_);
+    }
 
-        for (y = 1; y < 4 * N; ++y) {
-            con.MoveTo(GRID_X, GRID_Y + y);
+    void SetTitle(const TCHAR* title)
+    {
+        if (title) {
+            SetConsoleTitle(title);
+        } else { }
+    }
 
-            switch (y) {
-            case 4: case 8: case 12: case 16:
-                con.Write(text_.grid_sep_line);
-                break;
-            default:
-                con.Write(text_.grid_mid_line);
-            }
+    int Write(unsigned int color, unsigned int x, unsigned int y, const char* str)
+    {
+        if (x == LAST_VALUE && y == LAST_VALUE) {
+            // continue from current position
+        } else {
+            MoveTo(x, y);
         }
 
-        con.MoveTo(GRID_X, GRID_Y + y);
-        con.Write(text_.grid_bot_line);
-
-        PatchGrid(N);
+        if (color == LAST_VALUE) {
+            // no change in color
+        } else {
+            SetColor(color);
+        }
 
-        con.Write(MESG_X, 4, "Score      Time");
+        return Write(str);
     }
 
-    void PatchGrid(int grid_size)
+    int Write(unsigned int x, unsigned int y, const char* str)
     {
-        // PatchGrid is used just to experiment copying regions of console
-        switch (grid_size) {
-        case 3: {
-            SMALL_RECT src = { 41, 2, 50, 14 };
-            SMALL_RECT dst = { 32, 2, 41, 14 };
-            con.CopyRegion(dst, src);
-        } break;
-        case 5: {
-            SMALL_RECT src = { 32, 2, 41, 22 };
-            SMALL_RECT dst = { 41, 2, 50, 22 };
-            con.CopyRegion(dst, src);
-        } break;
-        default:
-            break;
+        if (x == LAST_VALUE && y == LAST_VALUE) {
+            // continue from current position
+        } else {
+            MoveTo(x, y);
         }
+
+        return Write(str);
     }
 
-    void SetGridMode(int mode)
+    int Write(unsigned int color, const char* str)
     {
-        switch (mode) {
-        case 0:
-            text_.grid_top_line = "+--------+--------+--------+--------+";
-            text_.grid_sep_line = "+--------+--------+--------+--------+";
-            text_.grid_mid_line = "|        |        |        |        |";
-            text_.grid_bot_line = "+--------+--------+--------+--------+";
-            text_.cell_left_pad = " ";
-            text_.cell_right_pad = " ";
-            text_.won_top_line = " +====================+ ";
-            text_.won_mid_line = " |                    | ";
-            text_.won_bot_line = " +====================+ ";
-            text_.lost_top_line = " +--------------------+ ";
-            text_.lost_mid_line = " |                    | ";
-            text_.lost_bot_line = " +--------------------+ ";
-            text_.prompt_char = ">";
-            text_.underline = " ---- ";
-            text_.filler_line = "      ";
-            break;
-        default:
-            text_.grid_top_line = "┏━━━━━━━━┯━━━━━━━━┯━━━━━━━━┯━━━━━━━━┓";
-            text_.grid_sep_line = "┠────────┼────────┼────────┼────────┨";
-            text_.grid_mid_line = "┃        │        │        │        ┃";
-            text_.grid_bot_line = "┗━━━━━━━━┷━━━━━━━━┷━━━━━━━━┷━━━━━━━━┛";
-            text_.cell_left_pad = "▌";
-            text_.cell_right_pad = "▐";
-            text_.won_top_line = " ╔════════════════════╗ ";
-            text_.won_mid_line = " ║                    ║ ";
-            text_.won_bot_line = " ╚════════════════════╝ ";
-            text_.lost_top_line = " ┏━━━━━━━━━━━━━━━━━━━━┓ ";
-            text_.lost_mid_line = " ┃                    ┃ ";
-            text_.lost_bot_line = " ┗━━━━━━━━━━━━━━━━━━━━┛ ";
-            text_.prompt_char = "►";
-            text_.underline = " ──── ";
-            text_.filler_line = "      ";
-            break;
+        if (color == LAST_VALUE) {
+            // no change in color
+        } else {
+            SetColor(color);
         }
+
+        return Write(str);
     }
 
-    void ShowMessage(bool won)
+    int Write(const char* str)
     {
-        con.SetColor((won ? 0xcfu : 0x70u));
-        con.MoveTo(MESG_X, MESG_Y + 0);
-        con.Write(won ? text_.won_top_line : text_.lost_top_line);
-        con.MoveTo(MESG_X, MESG_Y + 1);
-        con.Write(won ? text_.won_mid_line : text_.lost_mid_line);
-        con.MoveTo(MESG_X, MESG_Y + 2);
-        con.Write(won ? text_.won_bot_line : text_.lost_bot_line);
+        if (str && *str) {
+        } else {
+            return 0;  // TODO: assert
+        }
 
-        con.MoveTo(MESG_X + 7, MESG_Y + 1);
-        con.Write(won ? " You WON! " : "Game Over!");
+        DWORD n;
+        int count = (int)strlen(str);
 
-        con.MoveTo(MESG_X, MESG_Y + 4);
-        con.SetColor(0xfu);
-        con.Write(text_.prompt_char);
-        con.SetColor(0x7u);
-        con.Write(won ? " Keep Going? " : " Play Again? ");
-        con.SetColor(0x8fu);
-        con.Write(" Y");
-        con.SetColor(0x80u);
-        con.Write("es ");
-        con.SetColor(0x8u);
-        con.Write(" / ");
-        con.SetColor(0x7u);
-        con.Write("N");
-        con.SetColor(0x8u);
-        con.Write("o");
+        WriteConsoleA(output_, str, (unsigned int)count, &n, NULL);
+        counters.Add(CTR_CONSOLE_CALLS);
+        tracer.Record(TR_CON_WRITE, count, (int32_t)n);
+        counters.Add(CTR_CONSOLE_BYTES, (uint64_t)count);
+
+        return count;
     }
 
-    void ClearMessage()
+#if 0
+    template<typename ...Args>
+    int Write(const char* fmt, Args... args)
     {
-        con.SetColor(07);
-        con.MoveTo(MESG_X, MESG_Y + 0);
-        //        " +--------------------+ ");
-        con.Write("                        ");
-        con.MoveTo(MESG_X, MESG_Y + 1);
-        con.Write("                        ");
-        con.MoveTo(MESG_X, MESG_Y + 2);
-        con.Write("                        ");
+        int count;
+        char buf[128];
 
-        con.MoveTo(MESG_X, MESG_Y + 4);
-        //        ". Keep Going? .Yes. / No");
-        con.Write("                        ");
+        count = snprintf(buf, sizeof(buf) - 1, fmt, args...);
+        buf[sizeof(buf) - 1] = '\0';
+
+        if (count < 0) {
+            buf[sizeof(buf) - 2] = '?';
+            OutputDebugStringA(buf);
+            count = sizeof(buf) - 2;
+        } else { }
+
+        DWORD n;
+
+        WriteConsoleA(output_, buf, (unsigned int)count, &n, NULL);
+
+        return count;
     }
+#endif
 
-    void ShowCell(unsigned int n, unsigned int r, unsigned int c, bool highlight = true)
+    // copies through a fixed buffer a few rows at a time, the bottom rows
+    // first when copying down, so that overlapping regions copy right
+    void CopyRegion(SMALL_RECT& dst, SMALL_RECT& src)
     {
-        if ((r < N) && (c < N)) {
-        } else {
-            return;
-        }
+        enum { MAX_CELLS = 256 };
+        CHAR_INFO buf[MAX_CELLS];
 
-        unsigned int i;
+        src.Top += top_;
+        src.Bottom += top_;
+        dst.Top += top_;
+        dst.Bottom += top_;
 
-        if (highlight) {
-            i = 0x70;
-        } else {
-            i = GetColor(n & 0x7fu);
+        SHORT width = (SHORT)(src.Right - src.Left + 1);
+        SHORT height = (SHORT)(src.Bottom - src.Top + 1);
+        SHORT rows = ((width > 0) && (width <= MAX_CELLS)) ? (SHORT)(MAX_CELLS / width) : 0;
+        bool down = (dst.Top > src.Top);
+
+        for (SHORT done = 0; rows && (done < height); ) {
+            SHORT h = std::min(rows, (SHORT)(height - done));
+            SHORT r = down ? (SHORT)(height - done - h) : done;
+            SMALL_RECT from = { src.Left, (SHORT)(src.Top + r), src.Right,
+                                (SHORT)(src.Top + r + h - 1) };
+            SMALL_RECT to = { dst.Left, (SHORT)(dst.Top + r), dst.Right,
+                              (SHORT)(dst.Top + r + h - 1) };
+            COORD buf_size = { width, h };
+            COORD buf_coord = { 0, 0 };
+
+            ReadConsoleOutput(output_, buf, buf_size, buf_coord, &from);
+            WriteConsoleOutput(output_, buf, buf_size, buf_coord, &to);
+            counters.Add(CTR_CONSOLE_CALLS, 2);
+            done = (SHORT)(done + h);
         }
-
-        unsigned int x = 6 + 9 * c;
-        unsigned int y = 3 + 4 * r;
-        con.MoveTo(x, y);
-        PrintLine(i, text_.filler_line);
-        con.MoveTo(x, y + 1);
-        PrintNumber(n, i);
-        con.MoveTo(x, y + 2);
-        PrintLine(i, text_.filler_line);
     }
 
-    void ShowMatrix(Matrix& matrix)
+    // draws a block of cells with one call, cursor and color are unchanged
+    void WriteCells(unsigned int x, unsigned int y, const ConsoleCell* cells,
+                    unsigned int width, unsigned int height)
     {
-        for (unsigned int r = 0; r < N; ++r) {
-            unsigned int y = 3 + 4 * r;
-
-            for (unsigned int c = 0; c < N; ++c) {
-                unsigned int x = 6 + 9 * c;
+        enum { MAX_CELLS = 256 };
+        CHAR_INFO buf[MAX_CELLS];
+        unsigned int rows = (width && (width <= MAX_CELLS)) ? MAX_CELLS / width : 0;
 
-                unsigned int n = matrix(r, c);
-                unsigned int i = GetColor(n & 0x7fu);
+        for (unsigned int r = 0; rows && (r < height); r += rows) {
+            unsigned int h = std::min(rows, height - r);
 
-                con.MoveTo(x, y);
-                PrintLine(i, text_.filler_line);
-                con.MoveTo(x, (y + 1));
-                PrintNumber(n, i);
-                con.MoveTo(x, (y + 2));
-                PrintLine(i, (n & 0x80u) ? text_.underline : text_.filler_line);
+            for (unsigned int i = 0; i < width * h; ++i) {
+                buf[i].Char.UnicodeChar = cells[r * width + i].wide;
+                buf[i].Attributes = cells[r * width + i].color;
             }
+
+            COORD buf_size = { (SHORT)width, (SHORT)h };
+            COORD buf_coord = { 0, 0 };
+            SMALL_RECT rect;
+            rect.Left = (SHORT)x;
+            rect.Top = (SHORT)(y + r + top_);
+            rect.Right = (SHORT)(x + width - 1);
+            rect.Bottom = (SHORT)(y + r + h - 1 + top_);
+            WriteConsoleOutput(output_, buf, buf_size, buf_coord, &rect);
+            counters.Add(CTR_CONSOLE_CALLS);
+            tracer.Record(TR_CON_CELLS, (int32_t)x, (int32_t)(y + r), (int32_t)(width * h));
+            counters.Add(CTR_CONSOLE_BYTES, width * h * sizeof(CHAR_INFO));
         }
     }
 
-    void PrintNumber(unsigned int n, unsigned int i)
+    void SetRenderThread(bool on)
     {
-        switch (n & 0x7fu) {
-        case 0:  PrintLine(i, "   0  "); break;
-        case 1:  PrintLine(i, "   2  "); break;
-        case 2:  PrintLine(i, "   4  "); break;
-        case 3:  PrintLine(i, "   8  "); break;
-        case 4:  PrintLine(i, "  16  "); break;
-        case 5:  PrintLine(i, "  32  "); break;
-        case 6:  PrintLine(i, "  64  "); break;
-        case 7:  PrintLine(i, "  128 "); break;
-        case 8:  PrintLine(i, "  256 "); break;
-        case 9:  PrintLine(i, "  512 "); break;
-        case 10: PrintLine(i, " 1024 "); break;
-        case 11: PrintLine(i, " 2048 "); break;
-        case 12: PrintLine(i, " 4096 "); break;
-        case 13: PrintLine(i, " 8192 "); break;
-        case 14: PrintLine(i, "  16K "); break;
-        case 15: PrintLine(i, "  32K "); break;
-        case 16: PrintLine(i, "  64K "); break;
-        case 17: PrintLine(i, " 128K "); break;
-        case 18: PrintLine(i, " 256K "); break;
-        case 19: PrintLine(i, " 512K "); break;
-        case 20: PrintLine(i, "  1M  "); break;
-        case 21: PrintLine(i, "  2M  "); break;
-        case 22: PrintLine(i, "  4M  "); break;
-        case 23: PrintLine(i, "  8M  "); break;
-        case 24: PrintLine(i, "  16M "); break;
-        case 25: PrintLine(i, "  32M "); break;
-        case 26: PrintLine(i, "  64M "); break;
-        case 27: PrintLine(i, " 128M "); break;
-        case 28: PrintLine(i, " 256M "); break;
-        case 29: PrintLine(i, " 512M "); break;
-        default: PrintLine(i, "  ??  "); break;
-        }
+        (void)on;  // input and output have handles of their own
     }
 
-#if 0
-    // old code with macros
-    void PrintNumber(unsigned int n, unsigned int i)
+    void BeginFrame()
     {
-        unsigned int v = (n & 0x7fu);
-        v = (v ? (1u << v) : v);
-#define CASE1(n) case n
-#define CASE3(n) case n: case n + 1: case n + 2
-#define CASE4(n) case n: case n + 1: case n + 2: case n + 3
-#define k ((v/1024))
-#define m ((v/1024/1024))
-
-        switch (n & 0x7fu) {
-        CASE1( 0): PRINTLINE(i,"   %u  ", 0u); break;  // 0       > |   0  |
-        CASE3( 1): PRINTLINE(i,"   %u  ", v); break;  // 2-8      > |   #  |
-        CASE3( 4): PRINTLINE(i,"  %u  ", v); break;  // 16-64     > |  ##  |
-        CASE3( 7): PRINTLINE(i,"  %u ", v); break;  // 128-512    > |  ### |
-        CASE4(10): PRINTLINE(i," %u ", v); break;  // 1024-8192   > | #### |
-        CASE3(14): PRINTLINE(i,"  %uK ", k); break;  // 16K-64K   > |  ### |
-        CASE3(17): PRINTLINE(i," %uK ", k); break;  // 128K-512K  > | #### |
-        CASE4(20): PRINTLINE(i,"  %uM  ", m); break;  // 1M-8M    > |  ##  |
-        CASE3(24): PRINTLINE(i,"  %uM ", m); break;  // 16M-64M   > |  ### |
-        CASE3(27): PRINTLINE(i," %uM ", m); break;  // 128M-512M  > | #### |
-        default: PRINTLINE(i,"%s", "  ??  "); break;  // overflow > |  ??  |
-        }
-#undef CASE1
-#undef CASE3
-#undef CASE4
-#undef k
-#undef m
+        // nothing is deferred to the drawing thread
     }
-#endif
 
-    void PrintLine(unsigned int color, const char* value)
+    void Flush()
     {
-        con.SetColor(color & 0xf0u);
-        con.Write(text_.cell_left_pad);
-        con.SetColor(color);
-        con.Write(value);
-        con.SetColor(color & 0xf0u);
-        con.Write(text_.cell_right_pad);
+        // console API calls are not buffered
+        counters.Add(CTR_FRAMES);
     }
 
-    unsigned int GetColor(unsigned int value)
+    void PrintStats(FILE* out)
     {
-        unsigned int n = value;
+        // console API calls go out one by one, there are no frames to count
+        (void)out;
+    }
 
-        uint8_t const cid[] = {
-            // 0     2     4     8    16    32    64   128   256   512
-            0x08, 0x9f, 0x6f, 0x5f, 0x4f, 0x4f, 0x3f, 0x3f, 0x2f, 0x2f,
-            0x17, 0xcf, 0xdf, 0xb0, 0xe6, 0xe2, 0xf0, 0xfc, 0xfc, 0xfc,
-            0xac  // 2k    4k    8k
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Console);
+
+  private:
+    SHORT top_;
+    SHORT height_;
+    short interrupted_;
+    WORD text_attrib_;
+    UINT oldcp_;
+    DWORD oldMode_;
+    DWORD cursor_size;
+    HANDLE input_;
+    HANDLE output_;
+    HANDLE oldout_;
+    HANDLE conout_;
+    COLORREF ct_[16];
+};
+#endif  // _WIN32
+// end of windows console api wrapper }}}
+
+// ansi terminal backend {{{
+//
+// Console for POSIX terminals, driven by termios and VT100/xterm escape
+// sequences.  Output is collected in one buffer that goes out with a single
+// write() per frame; a frame ends when the game waits for input.  Bytes per
+// frame are what this backend optimizes:
+//  - a shadow copy of the screen is kept and text already shown is skipped,
+//  - MoveTo() and SetColor() only take effect when text follows, and then as
+//    the shortest of the absolute, relative or re-sent-text cursor moves,
+//  - SGR sequences are prepared once per attribute, and only the foreground
+//    or background part is sent if the other one is unchanged.
+//
+#if !defined(_WIN32)
+class Console
+{
+  public:
+    enum { LAST_VALUE = 0xffff };
+    enum { OUT_SIZE = 16384, IN_SIZE = 64, WAIT_MS = 100, ESC_WAIT_MS = 25 };
+
+  public:
+    Console() : top_(0), height_(-1), width_(0), interrupted_(0), resized_(0),
+        raw_(false), titled_(false), in_fd_(STDIN_FILENO),
+        out_fd_(STDOUT_FILENO), tty_fd_(-1), x_(-1), y_(-1), pen_x_(-1),
+        pen_y_(-1), color_(UNKNOWN_COLOR), pen_color_(DEFAULT_COLOR),
+        overridden_(0), used_(0), in_size_(0), frames_(0), bytes_(0),
+        frame_bytes_(0), max_frame_(0), render_thread_(false), cleared_(0),
+        has_pending_(false), screen_(), pending_(), tio_()
+    {
+        // the classic console color table, as COLORREF (0x00bbggrr)
+        static const COLORREF vga[16] = {
+            0x000000, 0x800000, 0x008000, 0x808000,
+            0x000080, 0x800080, 0x008080, 0xc0c0c0,
+            0x808080, 0xff0000, 0x00ff00, 0xffff00,
+            0x0000ff, 0xff00ff, 0x00ffff, 0xffffff,
         };
 
-        if (n < (sizeof(cid) / sizeof(cid[0]))) {
-            return cid[n];
-        } else {
-            return cid[(sizeof(cid) / sizeof(cid[0])) - 1];
-        }
+        memcpy(ct_, vga, sizeof(ct_));
+        memcpy(palette_, vga, sizeof(palette_));
+        memset(in_, 0, sizeof(in_));
+        BuildSgr();
     }
-
-    void SetColorScheme(int s)
+    ~Console()
     {
-        COLORREF cto[16];
-        con.GetOldPalette(cto);
+        Flush();
 
-        switch (s) {
-        case 1:
-            ct[0]  = 0x00182028;
-            ct[1]  = 0x00133af1;  // #f13a13
-            ct[2]  = 0x000068ff;  // #ff6800
-            ct[3]  = 0x005c7aff;  // #ff7a5c
-            ct[4]  = 0x00008eff;  // #ff8e00
-            ct[5]  = 0x0000b3ff;  // #ffb300
-            ct[6]  = 0x0000c8f4;  // #f4c800
-            ct[7]  = cto[7];
-            ct[8]  = cto[8];
-            ct[9]  = 0x0062a2ce;  // #cea262
-            ct[10] = 0x0000aa93;  // #93aa00
-            ct[11] = 0x00347d00;  // #007d34
-            ct[12] = 0x001000ff;  // #ff0010
-            ct[13] = 0x008a5300;  // #00538a
-            ct[14] = 0x007a3753;  // #53377a
-            ct[15]  = cto[15];
-            break;
-        case 2:
-            ct[0]  = 0x00251810;
-            ct[1]  = 0x00f990c4 - 0x444444;  // #c490f9
-            ct[2]  = 0x00f99090 - 0x444444;  // #9090f9
-            ct[3]  = 0x00f9c490 - 0x444444;  // #90c4f9
-            ct[4]  = 0x00f9f990 - 0x444444;  // #90f9f9
-            ct[5]  = 0x00c4f990 - 0x444444;  // #90f9c4
-            ct[6]  = 0x0090f990 - 0x444444;  // #90f990
-            ct[7]  = cto[7];
-            ct[8]  = cto[8];
-            ct[9]  = 0x0090f9c4 - 0x444444;  // #c4f990
-            ct[10] = 0x0090f9f9 - 0x444444;  // #f9f990
-            ct[11] = 0x0090c4f9 - 0x444444;  // #f9c490
-            ct[12] = 0x009090f9 - 0x444444;  // #f99090
-            ct[13] = 0x00f990f9 - 0x444444;  // #f990f9
-            ct[14] = 0x00c490f9 - 0x444444;  // #f990c4
-            ct[15]  = cto[15];
-            break;
-#if 0
-        case 3:
-            ct[0]  = 0x000000u + 0x201010u;  //      0
-            ct[1]  = 0x800000u + 0x002828u;  // 800000
-            ct[2]  = 0x008000u + 0x280028u;  //   8000
-            ct[3]  = 0x808000u + 0x000028u;  // 808000
-            ct[4]  = 0x000080u + 0x282800u;  //     80
-            ct[5]  = 0x800080u + 0x002800u;  // 800080
-            ct[6]  = 0x008080u + 0x280000u;  //   8080
-            ct[7]  = 0xc0c0c0u - 0x000000u;  // c0c0c0
-            ct[8]  = 0x808080u - 0x282828u;  // 808080
-            ct[9]  = 0xff0000u - 0x330000u + 0x002222u;  // ff0000
-            ct[10] = 0x00ff00u - 0x003300u + 0x220022u;  //   ff00
-            ct[11] = 0xffff00u - 0x333300u + 0x000022u;  // ffff00
-            ct[12] = 0x0000ffu - 0x000022u + 0x222200u;  //     ff
-            ct[13] = 0xff00ffu - 0x330022u + 0x002200u;  // ff00ff
-            ct[14] = 0x00ffffu - 0x003322u + 0x220000u;  //   ffff
-            ct[15] = 0xffffffu - 0x111111u;
-            break;
-#endif
-        case 3:
-            ct[0]  = 0x222827u;
-            ct[1]  = 0x9e5401u;
-            ct[2]  = 0x04aa74u;
-            ct[3]  = 0xa6831au;
-            ct[4]  = 0x3403a7u;
-            ct[5]  = 0x9c5689u;
-            ct[6]  = 0x49b6b6u;
-            ct[7]  = 0xcacacau;
-            ct[8]  = 0x7c7c7cu;
-            ct[9]  = 0xf58303u;
-            ct[10] = 0x06d08du;
-            ct[11] = 0xe5c258u;
-            ct[12] = 0x4b04f3u;
-            ct[13] = 0xb87da8u;
-            ct[14] = 0x81ccccu;
-            ct[15] = 0xffffffu;
-            break;
+        if (tty_fd_ >= 0) {
+            close(tty_fd_);
+        } else { }
+    }
+
+    BOOL CtrlHandler(DWORD ctrl)
+    {
+        // called from a signal handler: only the flag is set here, poll() in
+        // ReadInput() returns with EINTR and reports the interruption
+        switch (ctrl) {
+        case CTRL_C_EVENT:
+        case CTRL_BREAK_EVENT:
+            interrupted_ = 1;
+            return TRUE;
+        case CTRL_CLOSE_EVENT:
+        case CTRL_LOGOFF_EVENT:
+        case CTRL_SHUTDOWN_EVENT:
+            interrupted_ = 2;  // the terminal may be gone, nothing to reset
+            return TRUE;
         default:
-            return;
+            return FALSE;
         }
+    }
 
-        con.SetPalette(ct);
+    void Resized()
+    {
+        resized_ = 1;
     }
 
-    void ShowScore(const int score)
+    void AllowCtrlHandler()
     {
-        char buf[32] = { };
-        int unused = snprintf(buf, sizeof(buf) - 1, "%-8d ", score);
-        (void)unused;  // TODO: assert?
+        interrupted_ = 0;
+    }
 
-        con.Write(0xfu, MESG_X, 5, buf);
+    int CanReset()
+    {
+        return interrupted_ < 2;
     }
 
-    void ShowTime(Duration dur, bool show_ms = false)
+    int Interrupted()
     {
-        int unused;
-        char buf[32] = { };
-        con.SetColor((show_ms ? 0x7u : 0x8u));
-        con.MoveTo(MESG_X + 10, 5);
+        return interrupted_;
+    }
 
-        if (dur.day > 0) {
-            unused = snprintf(buf, sizeof(buf) - 1, " %d day%s %02d",
-                              dur.day, (dur.day > 1 ? "s" : ""), dur.hour);
-            (void)unused;  // TODO: assert?
-            con.Write(buf);
+    void Acquire()
+    {
+        if (isatty(STDOUT_FILENO)) {
+            out_fd_ = STDOUT_FILENO;
         } else {
-            if (dur.hour > 0) {
-                unused = snprintf(buf, sizeof(buf) - 1, " %02d", dur.hour);
-                (void)unused;  // TODO: assert?
-                con.Write(buf);
-            } else {
-                con.Write(" ..");
-            }
+            // as CONOUT$ does, draw on the terminal while stdout is redirected
+            tty_fd_ = (tty_fd_ >= 0) ? tty_fd_ : open("/dev/tty", O_WRONLY);
+            out_fd_ = (tty_fd_ >= 0) ? tty_fd_ : STDOUT_FILENO;
         }
 
-        unused = snprintf(buf, sizeof(buf) - 1, ":%02d:%02d", dur.min, dur.sec);
-        (void)unused;  // TODO: assert?
-        con.Write(buf);
+        if (tcgetattr(in_fd_, &tio_) == 0) {
+            struct termios tio = tio_;
+            tio.c_iflag &= ~(tcflag_t)(IXON | ICRNL | INLCR | IGNCR);
+            tio.c_lflag &= ~(tcflag_t)(ICANON | ECHO | IEXTEN);
+            tio.c_cc[VMIN] = 1;
+            tio.c_cc[VTIME] = 0;
+            tio.c_cc[VSUSP] = _POSIX_VDISABLE;  // ^Z would leave the tty raw
+            raw_ = (tcsetattr(in_fd_, TCSAFLUSH, &tio) == 0);
+        } else { }
 
-        if (show_ms) {
-            unused = snprintf(buf, sizeof(buf) - 1, ".%03d ", dur.ms);
-            (void)unused;  // TODO: assert?
-            con.Write(buf);
-        } else {
-            con.Write("     ");
-        }
+        Put("\x1b[?1000h\x1b[?1006h");  // mouse buttons, SGR coordinates
+        SaveState();
+        SaveCursor();
+        HideCursor();
     }
 
-    int GetMinHeight()
+    void Release()
     {
-        enum {
-            BOARD_HEIGHT = GRID_Y + N * 4 + 1
-        };
-        return BOARD_HEIGHT;
-    }
+        Put("\x1b[?1006l\x1b[?1000l");
+        ResetColor();
+        SyncCursor();
+        ShowCursor();
 
-  private:
-    struct TextData {
-        const char* grid_top_line;
-        const char* grid_sep_line;
-        const char* grid_mid_line;
-        const char* grid_bot_line;
-        const char* cell_left_pad;
-        const char* cell_right_pad;
-        const char* won_top_line;
-        const char* won_mid_line;
-        const char* won_bot_line;
-        const char* lost_top_line;
-        const char* lost_mid_line;
-        const char* lost_bot_line;
-        // const char* won_message;
-        // const char* lost_message;
-        // const char* won_question;
-        // const char* lost_question;
-        const char* prompt_char;
-        const char* filler_line;
-        const char* underline;
-    };
+        if (titled_) {
+            Put("\x1b[23;0t");  // pops the title pushed by SetTitle()
+            titled_ = false;
+        } else { }
 
-  private:
-    DISALLOW_COPY_AND_ASSIGN(Grid);
+        Flush();
 
-  private:
-    TextData text_;
-    COLORREF ct[16];
-};
+        if (raw_) {
+            tcsetattr(in_fd_, TCSAFLUSH, &tio_);
+            raw_ = false;
+        } else { }
+    }
 
-union Board4x4 {
-    uint8_t ac[N][N];
-    uint64_t al[N64];  // since N = 4
-};
+    void SaveBuffer()
+    {
+        Put("\x1b[?1049h\x1b[H\x1b[2J");  // alternate screen, cleared
+        Invalidate();
+        HideCursor();
+    }
 
-static_assert((sizeof(Board4x4) >= N * N), "Board4x4: error in size");
+    void RestoreBuffer()
+    {
+        Put("\x1b[?1049l");
+        Invalidate();
+    }
 
-enum {
-    GAME_ERROR = -1,
-    GAME_NOOP = 0,
-    GAME_ABORT,
-    GAME_STOP,
-    GAME_LOST,
-    GAME_WON,
-    GAME_PERSIST,
-    GAME_RESTART,
-    GAME_TIMER,
-    GAME_UNDO,
+    void ShowCursor()
+    {
+        Put("\x1b[?25h");
+    }
 
-    MOVE_LEFT = 0x10,
-    MOVE_UP,
-    MOVE_RIGHT,
-    MOVE_DOWN,
-    MOVE_MOUSE_WHEEL_FW = 0x20,
-    MOVE_MOUSE_WHEEL_BW,
-    MOVE_MOUSE_WHEEL_FW_SHIFT,
-    MOVE_MOUSE_WHEEL_BW_SHIFT,
+    void HideCursor()
+    {
+        Put("\x1b[?25l");
+    }
 
-    BOARD_REFRESH = 0x40,
-    BOARD_TRANSPOSE,
-    BOARD_ROTATE_CW,
-    BOARD_ROTATE_CCW,
-    BOARD_SWAP_VERTICAL,
-    BOARD_SWAP_HORIZONTAL,
-};
+    void SaveCursor()
+    {
+        // the cursor shape is not changed, so nothing to save
+    }
 
-class Mapper
-{
-  public:
-    Mapper(int y_top = 0) : r(-1), c(-1), top(y_top) { }
-    ~Mapper() { }
-
-    int FindCell(int x, int y)
+    int ReadInput(INPUT_RECORD& inrec)
     {
-        enum {
-            W = 9,
-            H = 4,
-            NO_X1 = Grid::MESG_X + 22,
-            NO_X2 = Grid::MESG_X + 23,
-            YES_X1 = Grid::MESG_X + 14,
-            YES_X2 = Grid::MESG_X + 18,
-        };
-
-        if (y == Grid::MESG_Y + 4 + top) {
-            if ((x >= YES_X1) && (x <= YES_X2)) {
-                // DPRINT("mouse yes");
-                return GAME_PERSIST;
-            } else if ((x >= NO_X1) && (x <= NO_X2)) {
-                // DPRINT("mouse no");
-                return GAME_STOP;
-            } else {
-                return 0;
-            }
-        } else { }
+        memset(&inrec, 0, sizeof(inrec));
 
-        x -= Grid::GRID_X;
-        y -= Grid::GRID_Y + top;
+        if (render_thread_) {
+        } else {
+            Flush();  // the frame is complete when the game waits for input
+        }
 
-        if ((x <= 0) || (y <= 0) || (x >= N * W) || (y >= N * H)) {
-            r = c = -1;
-            return 0;
-        } else { }
+        for (;;) {
+            if (interrupted_) {
+                return 0;
+            } else if (has_pending_) {
+                has_pending_ = false;
+                inrec.EventType = KEY_EVENT;
+                inrec.Event.KeyEvent = pending_;
+                return 1;
+            } else if (resized_ && !render_thread_) {
+                resized_ = 0;
+                QuerySize();
+                inrec.EventType = WINDOW_BUFFER_SIZE_EVENT;
+                return 1;
+            } else if (in_size_) {
+                if (Decode(inrec)) {
+                    return 1;
+                } else {
+                    continue;
+                }
+            } else { }
 
-        switch (x % W) {
-        case 0:
-        case 1:
-        case W - 1:
-            return 0;
-        default:
-            c = x / W;
-        }
+            struct pollfd pfd = { in_fd_, POLLIN, 0 };
+            int ret = poll(&pfd, 1, WAIT_MS);
 
-        switch (y % H) {
-        case 0:
-            return 0;
-        default:
-            r = y / H;
+            if (ret == 0) {
+                return 1;  // time out, EventType is 0
+            } else if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                } else {
+                    return -1;
+                }
+            } else if (Fill() <= 0) {
+                return 0;  // end of input, no more keys will come
+            } else { }
         }
+    }
 
-        // DPRINT("mouse cell: %3d %3d", c, r);
+    void MoveTo(unsigned int x, unsigned int y)
+    {
+        pen_x_ = (int)x;
+        pen_y_ = (int)y + top_;
 
-        return (0x10000 + r * 0x100 + c);
+        if (pen_y_ >= height_) {
+            pen_y_ = height_ - 1;
+        } else { }
     }
 
-  private:
-    DISALLOW_COPY_AND_ASSIGN(Mapper);
+    void SetColor(unsigned int color)
+    {
+        pen_color_ = color & 0xffu;
+    }
 
-  private:
-    int r;
-    int c;
-    int top;
-    // previous position (xc,xr) is needed for tracing mouse path
-    // int xr;
-    // int xc;
-};
+    void SaveState()
+    {
+        // there is no scroll-back buffer to place the board in, the board
+        // starts at the top of the screen
+        QuerySize();
+        top_ = 0;
+    }
 
-class TimeKeeper
-{
-  public:
-    explicit TimeKeeper(Grid& g) : show_ms_(false), hash_(-1), timer_(), grid_(g) { }
-    ~TimeKeeper() { }
+    short ResetCursorPosition(short top)
+    {
+        // only y value is handled
+        if (top >= 0) {
+            return (top_ = top);
+        } else {
+            return (top_ = 0);  // Clear() has scrolled the screen empty
+        }
+    }
 
-    void operator()()
+    void Resize(int rows)
     {
-        Update();
+        // a terminal window is sized by its user, not by the program
+        (void)rows;
     }
 
-    void Update()
+    void Clear()
     {
-        const Duration dur = timer_;
+        // scrolls the screen content into the terminal's scroll-back
+        SyncColor();
 
-        if (show_ms_) {
-            if (dur.ms + 1000 == hash_) {
-                return;
-            } else {
-                hash_ = dur.ms + 1000;
-            }
-        } else  {
-            if (dur.sec == hash_) {
-                return;
-            } else {
-                hash_ = dur.sec;
-            }
+        for (int i = 0; i < height_; i++) {
+            Put("\n");
         }
 
-        grid_.ShowTime(timer_, show_ms_);
+        Invalidate();
     }
 
-    void Update(bool show_ms)
+    void ResetColor()
     {
-        show_ms_ = show_ms;
-        Update();
+        pen_color_ = DEFAULT_COLOR;
+        SyncColor();
     }
 
-    void Start()
+    void FlushInput()
     {
-        show_ms_ = false;
-        hash_ = -1;
-        timer_.Start();
+        tcflush(in_fd_, TCIFLUSH);
+        in_size_ = 0;
     }
 
-    void Stop()
+    void SavePalette()
     {
-        show_ms_ = true;
-        timer_.Stop();
+        GetPalette(ct_);
     }
 
-    void Continue()
+    void GetOldPalette(COLORREF ct[16])
     {
-        show_ms_ = false;
-        hash_ = -1;
-        timer_.Continue();
-        Update();
+        memcpy(ct, ct_, sizeof(COLORREF) * 16);
     }
 
-    void Pause()
+    void GetPalette(COLORREF ct[16])
     {
-        show_ms_ = true;
-        timer_.Pause();
-        Update(true);
+        // a terminal answers palette queries asynchronously, if at all;
+        // reports the palette as last set, initially the console default
+        memcpy(ct, palette_, sizeof(COLORREF) * 16);
     }
 
-  private:
-    DISALLOW_COPY_AND_ASSIGN(TimeKeeper);
+    void SetPalette(COLORREF ct[16])
+    {
+        // OSC 4 redefines a terminal color, as the console color table does.
+        // Colors matching the saved palette stay the terminal's own.
+        char buf[32];
 
-  private:
-    bool show_ms_;
-    int hash_;
-    Timer timer_;
-    Grid& grid_;
-};
+        for (unsigned int i = 0; i < 16; ++i) {
+            unsigned int bit = 1u << i;
+            int ansi = AnsiColor(i) + (int)(i & 8u);
+            int size = 0;
+
+            if (ct[i] == ct_[i]) {
+                if (overridden_ & bit) {
+                    size = snprintf(buf, sizeof(buf), "\x1b]104;%d\x07", ansi);
+                    overridden_ &= ~bit;
+                } else { }
+            } else if (((overridden_ & bit) == 0) || (ct[i] != palette_[i])) {
+                size = snprintf(buf, sizeof(buf), "\x1b]4;%d;rgb:%02x/%02x/%02x\x07",
+                                ansi, (unsigned int)(ct[i] & 0xff),
+                                (unsigned int)((ct[i] >> 8) & 0xff),
+                                (unsigned int)((ct[i] >> 16) & 0xff));
+                overridden_ |= bit;
+            } else { }
 
-class Puzzle2048
-{
-  public:
-    Puzzle2048()
-        : old_score_(0), score_(), grid_(), time_keeper_(grid_),
-#if defined(_MSC_VER) && (_MSC_VER < 1800)
-          // not supported ?
-#else
-          undo_{ }, board_{ },
-#endif
-          matrix(board_.ac)
+            if (size > 0) {
+                Put(buf, (unsigned int)size);
+            } else { }
+
+            palette_[i] = ct[i];
+        }
+    }
+
+    void ResetPalette()
     {
-#if defined(_MSC_VER) && (_MSC_VER < 1800)
-        memset(&undo_, 0, sizeof(undo_));
-        memset(&board_, 0, sizeof(undo_));
-#endif
-        matrix.Reset(0);
+        SetPalette(ct_);
     }
-    ~Puzzle2048() { }
 
-    int Play(int s, int d)
+    void SetTitle(const TCHAR* title)
     {
-        unsigned int m = 1;
-        int k = GAME_NOOP;
-        int state = 0;
-        unsigned int rand_row = 0;
-        unsigned int rand_col = 0;
-        bool highlight = false;
+        if (title) {
+            if (titled_) {
+            } else {
+                Put("\x1b[22;0t");  // saves the title on xterm's title stack
+                titled_ = true;
+            }
 
-        short y_top = InitConsole(s, d);
-        InputReader ir(y_top);
-        Start2048();
+            Put("\x1b]0;");
+            Put(title);
+            Put("\x07");
+        } else { }
+    }
 
-        for (; k == GAME_NOOP; k = ir.GetInput()) {
-            // no-op
+    int Write(unsigned int color, unsigned int x, unsigned int y, const char* str)
+    {
+        if (x == LAST_VALUE && y == LAST_VALUE) {
+            // continue from current position
+        } else {
+            MoveTo(x, y);
         }
 
-        time_keeper_.Start();
+        if (color == LAST_VALUE) {
+            // no change in color
+        } else {
+            SetColor(color);
+        }
 
-        for (; k != GAME_ABORT; k = ir.GetInput(time_keeper_)) {
-            switch (k) {
-            case GAME_ERROR:  // TODO: report error and exit or try recover?
-            case GAME_NOOP:
-                continue;
-            case GAME_ABORT:
-                time_keeper_.Update(true);
-                break;
-            case GAME_UNDO:
-                highlight = false;
-                Undo();
+        return Write(str);
+    }
 
-                if (state) {
-                    grid_.ClearMessage();
-                    state = 0;
-                } else { }
+    int Write(unsigned int x, unsigned int y, const char* str)
+    {
+        if (x == LAST_VALUE && y == LAST_VALUE) {
+            // continue from current position
+        } else {
+            MoveTo(x, y);
+        }
 
-                time_keeper_.Continue();
-                grid_.ShowScore(score_);
-                grid_.ShowMatrix(matrix);
-                continue;
-            default:
-                if (k >= 0x10000) {  // cheating ...
-                    int r = (k / 0x100) & 0xff;
-                    int c = k & 0xff;
-                    uint8_t cur = 0;
+        return Write(str);
+    }
 
-                    if ((r - 1) >= 0) {
-                        cur = Max<uint8_t>(cur, matrix(r - 1, c));
-                    } else { }
+    int Write(unsigned int color, const char* str)
+    {
+        if (color == LAST_VALUE) {
+            // no change in color
+        } else {
+            SetColor(color);
+        }
 
-                    if ((r + 1) < N) {
-                        cur = Max<uint8_t>(cur, matrix(r + 1, c));
-                    } else { }
+        return Write(str);
+    }
 
-                    if ((c - 1) >= 0) {
-                        cur = Max<uint8_t>(cur, matrix(r, c - 1));
-                    } else { }
+    int Write(const char* str)
+    {
+        if (str && *str) {
+        } else {
+            return 0;  // TODO: assert
+        }
 
-                    if ((c + 1) < N) {
-                        cur = Max<uint8_t>(cur, matrix(r, c + 1));
-                    } else { }
-
-                    if (cur && cur > matrix(r, c)) {
-                        matrix.SetAt(r, c, cur);
-                    } else { }
+        const char* s = str;
 
-                    grid_.ShowMatrix(matrix);
-                } else { }
-                break;
-            }
+        while (*s) {
+            unsigned int size = GlyphSize(s);
+            PutGlyph(s, size);
+            s += size;
+        }
 
-            if (state) {
-                if (k == GAME_STOP) {
-                    time_keeper_.Pause();
-                    break;
-                } else {
-                    if (((state & 0x20) && ((state & 0x0f) > 0)) ||
-                        ((state & 0x10) && ((state & 0x0f) > 1))) {
-                        k = GAME_PERSIST;
-                    } else { }
-                }
+        return (int)(s - str);
+    }
 
-                switch (k) {
-                case GAME_PERSIST:
-                    grid_.ClearMessage();
+    void CopyRegion(SMALL_RECT& dst, SMALL_RECT& src)
+    {
+        // a terminal cannot be read back, the cells come from the shadow
+        src.Top += top_;
+        src.Bottom += top_;
+        dst.Top += top_;
+        dst.Bottom += top_;
 
-                    if ((state & 0xf0) == 0x10) {
-                        Start2048();
-                    } else {
-                        time_keeper_.Continue();
-                        AddNew(rand_row, rand_col);
-                    }
+        int x0 = pen_x_;
+        int y0 = pen_y_;
+        unsigned int color = pen_color_;
+        int w = std::min(src.Right - src.Left, dst.Right - dst.Left) + 1;
+        int h = std::min(src.Bottom - src.Top, dst.Bottom - dst.Top) + 1;
+        std::vector<Cell> row((size_t)std::max(w, 0));
 
-                    state = 0;
-                    break;
-                case GAME_STOP:
-                    break;  // see above
-                case MOVE_LEFT:
-                case MOVE_RIGHT:
-                case MOVE_UP:
-                case MOVE_DOWN:
-                    ++state;
-                    continue;
-                default:
-                    continue;
-                }
-            } else {
-                if (m) {
-                    Save();
-                } else { }
+        for (int i = 0; i < h; ++i) {
+            for (int j = 0; j < w; ++j) {
+                row[(size_t)j] = At(src.Left + j, src.Top + i);
+            }
 
-                m = 0;
-                time_keeper_.Update(false);
+            for (int j = 0; j < w; ++j) {
+                const Cell& cell = row[(size_t)j];
 
-                switch (k) {
-                case GAME_RESTART:
-                    Start2048();
-                    grid_.ShowMatrix(matrix);
-                    continue;
-                case BOARD_REFRESH:
-                    grid_.DrawGrid();
-                    grid_.ShowMatrix(matrix);
-                    grid_.ShowScore(score_);
-                    time_keeper_.Update();
-                    continue;
-                case BOARD_TRANSPOSE:
-                    matrix.Transpose();
-                    grid_.ShowMatrix(matrix);
-                    continue;
-                case BOARD_ROTATE_CW:
-                    matrix.RotateCW();
-                    grid_.ShowMatrix(matrix);
-                    continue;
-                case BOARD_ROTATE_CCW:
-                    matrix.RotateCCW();
-                    grid_.ShowMatrix(matrix);
-                    continue;
-                case BOARD_SWAP_VERTICAL:
-                    matrix.SwapV();
-                    grid_.ShowMatrix(matrix);
-                    continue;
-                case BOARD_SWAP_HORIZONTAL:
-                    matrix.SwapH();
-                    grid_.ShowMatrix(matrix);
-                    continue;
-#ifdef TEST_
-                case GAME_WON:
-                    state = 0x20;
-                    time_keeper_.Pause();
-                    grid_.ShowMessage(true);  // won
-                    continue;
-                case GAME_LOST:
-                    state = 0x10;
-                    time_keeper_.Pause();
-                    grid_.ShowMessage(false);  // lost
-                    continue;
-#endif
-                default:
-                    break;
-                }
+                if (cell.size) {
+                    pen_x_ = dst.Left + j;
+                    pen_y_ = dst.Top + i;
+                    pen_color_ = cell.color;
+                    PutGlyph(cell.text, cell.size);
+                } else { }
+            }
+        }
 
-                switch (k) {
-                case MOVE_LEFT:
-                case MOVE_MOUSE_WHEEL_FW:
-                    m = Nudge(ROW_L2R_STRIPE);
-                    break;
-                case MOVE_RIGHT:
-                case MOVE_MOUSE_WHEEL_FW_SHIFT:
-                    m = Nudge(ROW_R2L_STRIPE);
-                    break;
-                case MOVE_UP:
-                case MOVE_MOUSE_WHEEL_BW_SHIFT:
-                    m = Nudge(COL_U2D_STRIPE);
-                    break;
-                case MOVE_DOWN:
-                case MOVE_MOUSE_WHEEL_BW:
-                    m = Nudge(COL_D2U_STRIPE);
-                    break;
-                default:
-                    break;
-                }
+        pen_x_ = x0;
+        pen_y_ = y0;
+        pen_color_ = color;
+    }
 
-                if (m >= 2048) {
-                    state = 0x20;
-                    time_keeper_.Pause();
-                    grid_.ShowScore(score_);
-                    grid_.ShowMessage(true);  // won
-                    grid_.ShowMatrix(matrix);
-                    ResetHighlight();
-                    continue;
-                } else { }
+    // draws a block of cells, cursor and color are unchanged
+    void WriteCells(unsigned int x, unsigned int y, const ConsoleCell* cells,
+                    unsigned int width, unsigned int height)
+    {
+        int x0 = pen_x_;
+        int y0 = pen_y_;
+        unsigned int color = pen_color_;
 
-                if (m > 0) {
-                    grid_.ShowScore(score_);
-                    grid_.ShowMatrix(matrix);
-                    m = AddNew(rand_row, rand_col);
-                    highlight = (m > 0);
-                } else {
-                    if (highlight) {
-                        grid_.ShowCell(matrix(rand_row, rand_col), rand_row, rand_col, false);  // reset
-                        highlight = false;
-                    } else { }
-                }
+        for (unsigned int r = 0; r < height; ++r) {
+            MoveTo(x, y + r);
 
-                if (IsSolvable()) {
-                } else {
-                    m = 0;
-                    state = 0x10;
-                    time_keeper_.Pause();
-                    grid_.ShowMessage(false);  // lost
-                }
+            for (unsigned int c = 0; c < width; ++c) {
+                const ConsoleCell& cell = cells[r * width + c];
+                pen_color_ = cell.color & 0xffu;
+                PutGlyph(cell.text, cell.size);
             }
         }
 
-        ResetConsole(s);
+        pen_x_ = x0;
+        pen_y_ = y0;
+        pen_color_ = color;
+    }
 
-        return 1;
+    // While another thread draws, ReadInput() neither ends frames nor
+    // touches the screen: a resize or a redraw key is left for BeginFrame(),
+    // which that thread calls before it draws.
+    void SetRenderThread(bool on)
+    {
+        render_thread_ = on;
     }
 
-    int SchemeTest(int s, int d)
+    void BeginFrame()
     {
-        int unused;
-        COLORREF ct[16];
-        InitConsole(s, d);
-        con.GetPalette(ct);
+        if (resized_) {
+            resized_ = 0;
+            QuerySize();
+        } else { }
 
-        con.Write("\n Press ESC key to exit\n\n");
+        if (cleared_) {
+            cleared_ = 0;
+            Put("\x1b[2J");
+            Invalidate();
+        } else { }
+    }
 
-        char buf[16] = { };
+    void Flush()
+    {
+        Drain();
 
-        for (unsigned int i = 0; i < 16; ++i) {
-            con.Write(" ");
+        if (frame_bytes_) {
+            ++frames_;
+            counters.Add(CTR_FRAMES);
+            max_frame_ = std::max(max_frame_, frame_bytes_);
+            frame_bytes_ = 0;
+        } else { }
+    }
 
-            for (unsigned int j = 0; j < 16; ++j) {
-                unsigned int color = ((i * 16) + j) & 0xffu;
-                unused = snprintf(buf, sizeof(buf) - 1, " %2x ", color);
-                (void)unused;  // TODO: assert?
-                con.Write(color, buf);
-            }
+    void PrintStats(FILE* out)
+    {
+        if (frames_) {
+            fprintf(out, "console: %llu frames, %llu bytes, %llu bytes/frame,"
+                    " max %llu\n", (unsigned long long)frames_,
+                    (unsigned long long)bytes_,
+                    (unsigned long long)(bytes_ / frames_),
+                    (unsigned long long)max_frame_);
+        } else { }
+    }
 
-            unused = snprintf(buf, sizeof(buf) - 1, " - %06lx\n", ct[i]);
-            (void)unused;  // TODO: assert?
-            con.Write(0x07u, buf);
-        }
+  private:
+    enum { DEFAULT_COLOR = 0x10000, UNKNOWN_COLOR = 0x20000 };
 
-        int k;
-        InputReader ir;
+    struct Cell {
+        unsigned int color;
+        uint8_t size;  // 0: unknown content
+        char text[4];
+    };
 
-        while ((k = ir.GetInput()) != GAME_ABORT) {
-            Sleep(0);
-        }
+    struct Sgr {
+        uint8_t size;
+        char text[15];
+    };
 
-        con.Write("\n");
-        ResetConsole(s);
-        return 0;
+    static int AnsiColor(unsigned int c)
+    {
+        // console colors are BGR bit fields, ANSI colors are RGB
+        return (int)(((c & 1u) << 2) | (c & 2u) | ((c & 4u) >> 2));
     }
 
-    int GridTest(int g, int s, int d)
+    static unsigned int GlyphSize(const char* s)
     {
-        InitConsole(s, d);
+        unsigned char c = (unsigned char)*s;
+        unsigned int size = (c < 0xc0u) ? 1 : (c < 0xe0u) ? 2 : (c < 0xf0u) ? 3 : 4;
 
-        switch (g) {
-        case 1:
-            Preset(-1);
-            board_.ac[0][0] = 0;
-            board_.ac[0][1] = 1;
-            break;
-        case 2:
-            Preset(N * N - N - 1);
-            break;
-        case 3:
-            Preset(N * N + 1);
-            break;
-        default:
-            matrix.Reset(0);
-            break;
+        for (unsigned int i = 1; i < size; ++i) {
+            if (s[i] == '\0') {
+                return i;
+            } else { }
         }
 
-        grid_.DrawGrid();
-        grid_.ShowMatrix(matrix);
+        return size;
+    }
 
-        if (g == 1) {
-            grid_.ShowCell(matrix(0, 1), 0, 1);
-        } else { }
+    static int Csi(char (&buf)[16], int n, char final)
+    {
+        if (n == 1) {
+            return snprintf(buf, sizeof(buf), "\x1b[%c", final);
+        } else {
+            return snprintf(buf, sizeof(buf), "\x1b[%d%c", n, final);
+        }
+    }
 
-        con.MoveTo(48, 10);
-        con.SetColor(0x70u);
-        con.Write(" Press ESC to exit ");
+    void BuildSgr()
+    {
+        for (unsigned int i = 0; i < 16; ++i) {
+            int fg = ((i & 8u) ? 90 : 30) + AnsiColor(i);
+            int bg = ((i & 8u) ? 100 : 40) + AnsiColor(i);
+            fore_[i].size = (uint8_t)snprintf(fore_[i].text, sizeof(fore_[i].text),
+                                              "\x1b[%dm", fg);
+            back_[i].size = (uint8_t)snprintf(back_[i].text, sizeof(back_[i].text),
+                                              "\x1b[%dm", bg);
+        }
 
-        int k;
-        InputReader ir;
+        for (unsigned int a = 0; a < 256; ++a) {
+            int fg = ((a & 8u) ? 90 : 30) + AnsiColor(a & 7u);
+            int bg = ((a & 0x80u) ? 100 : 40) + AnsiColor((a >> 4) & 7u);
+            full_[a].size = (uint8_t)snprintf(full_[a].text, sizeof(full_[a].text),
+                                              "\x1b[%d;%dm", fg, bg);
+        }
+    }
 
-        while ((k = ir.GetInput()) != GAME_ABORT) {
-            if (k == 'W') {
-                grid_.ShowMessage(true);  // won
-                continue;
-            } else if (k == 'E') {
-                grid_.ShowMessage(false);  // lost
-                continue;
-            } else {
-                grid_.ClearMessage();
-            }
+    void QuerySize()
+    {
+        struct winsize ws;
+        memset(&ws, 0, sizeof(ws));
 
-            Sleep(0);
+        if ((ioctl(out_fd_, TIOCGWINSZ, &ws) == 0) && ws.ws_row && ws.ws_col) {
+            height_ = (short)ws.ws_row;
+            width_ = (short)ws.ws_col;
+        } else {
+            height_ = 25;
+            width_ = 80;
         }
 
-        ResetConsole(s);
-        return 0;
+        tracer.Record(TR_CON_RESIZE, width_, height_);
+        screen_.resize((size_t)(height_ * width_));
+        Invalidate();
     }
 
-  private:
-    class Scorer
+    void Invalidate()
     {
-      public:
-        Scorer() : value_(0) { }
-        ~Scorer() { }
+        Cell unknown = { UNKNOWN_COLOR, 0, { 0 } };
+        std::fill(screen_.begin(), screen_.end(), unknown);
+        x_ = -1;
+        y_ = -1;
+    }
 
-        void operator()(int a)
-        {
-            value_ += a;
+    Cell& At(int x, int y)
+    {
+        static Cell none;
+
+        if ((x >= 0) && (y >= 0) && (x < width_) && (y < height_)) {
+            return screen_[(size_t)(y * width_ + x)];
+        } else {
+            none.size = 0;
+            return none;
         }
+    }
 
-        // int operator=(int n)
-        // {
-        //     value_ = n;
-        //     return value_;
-        // }
+    unsigned int Fill()
+    {
+        ssize_t n;
 
-        operator int() const
-        {
-            return value_;
-        }
+        do {
+            n = read(in_fd_, in_ + in_size_, sizeof(in_) - in_size_);
+        } while ((n < 0) && (errno == EINTR) && !interrupted_);
 
-        void Reset(int n)
-        {
-            value_ = n;
+        if (n > 0) {
+            in_size_ += (unsigned int)n;
+            tracer.Record(TR_CON_READ, (int32_t)n);
+            return (unsigned int)n;
+        } else {
+            return 0;
+        }
+    }
+
+    bool Refill(int ms)
+    {
+        // waits for the rest of an escape sequence
+        struct pollfd pfd = { in_fd_, POLLIN, 0 };
+
+        if ((in_size_ < sizeof(in_)) && (poll(&pfd, 1, ms) > 0)) {
+            return Fill() > 0;
+        } else {
+            return false;
+        }
+    }
+
+    void Consume(unsigned int n)
+    {
+        n = std::min(n, in_size_);
+        memmove(in_, in_ + n, in_size_ - n);
+        in_size_ -= n;
+    }
+
+    static void SetKey(INPUT_RECORD& inrec, WORD key, DWORD state)
+    {
+        inrec.EventType = KEY_EVENT;
+        inrec.Event.KeyEvent.bKeyDown = TRUE;
+        inrec.Event.KeyEvent.wRepeatCount = 1;
+        inrec.Event.KeyEvent.wVirtualKeyCode = key;
+        inrec.Event.KeyEvent.dwControlKeyState = state;
+    }
+
+    static DWORD Modifiers(int m)
+    {
+        // xterm: 1 + (shift: 1, alt: 2, ctrl: 4)
+        DWORD state = 0;
+        m = (m > 0) ? m - 1 : 0;
+        state |= (m & 1) ? (DWORD)SHIFT_PRESSED : 0;
+        state |= (m & 2) ? (DWORD)LEFT_ALT_PRESSED : 0;
+        state |= (m & 4) ? (DWORD)LEFT_CTRL_PRESSED : 0;
+        return state;
+    }
+
+    void SetMouse(INPUT_RECORD& inrec, int b, int x, int y, bool press)
+    {
+        MOUSE_EVENT_RECORD& mer = inrec.Event.MouseEvent;
+        inrec.EventType = MOUSE_EVENT;
+        mer.dwMousePosition.X = (SHORT)(x - 1);
+        mer.dwMousePosition.Y = (SHORT)(y - 1);
+        mer.dwControlKeyState = ((b & 4) ? (DWORD)SHIFT_PRESSED : 0) |
+                                ((b & 8) ? (DWORD)LEFT_ALT_PRESSED : 0) |
+                                ((b & 16) ? (DWORD)LEFT_CTRL_PRESSED : 0);
+
+        if (b & 64) {
+            // the wheel delta is the high word of the button state
+            mer.dwEventFlags = MOUSE_WHEELED;
+            mer.dwButtonState = (b & 1) ? 0xff880000ul : 0x00780000ul;
+        } else if (press && ((b & 35) == 0)) {
+            mer.dwButtonState = FROM_LEFT_1ST_BUTTON_PRESSED;
+        } else {
+            mer.dwButtonState = 0;  // release, motion or other buttons
+        }
+    }
+
+    // decodes the key or mouse event at the start of in_, consumes its bytes
+    bool Decode(INPUT_RECORD& inrec)
+    {
+        unsigned int c = in_[0];
+
+        if (c == 0x1b) {
+            if (in_size_ == 1) {
+                Refill(ESC_WAIT_MS);
+            } else { }
+
+            if (in_size_ == 1) {
+                Consume(1);
+                SetKey(inrec, VK_ESCAPE, 0);
+                return Keystroke(inrec);
+            } else if ((in_[1] == '[') || (in_[1] == 'O')) {
+                return DecodeSequence(inrec);
+            } else {
+                // ESC and a key is how a terminal reports Alt+key
+                Consume(1);
+
+                if (Decode(inrec) && (inrec.EventType == KEY_EVENT)) {
+                    inrec.Event.KeyEvent.dwControlKeyState |= LEFT_ALT_PRESSED;
+                    pending_.dwControlKeyState |= LEFT_ALT_PRESSED;
+                    return true;
+                } else {
+                    return false;
+                }
+            }
+        } else { }
+
+        Consume(1);
+
+        if ((c == '\r') || (c == '\n')) {
+            SetKey(inrec, VK_RETURN, 0);
+        } else if (c == 0x0c) {
+            SetKey(inrec, VK_F5, 0);  // ^L, the usual redraw key
+        } else if ((c >= 'a') && (c <= 'z')) {
+            SetKey(inrec, (WORD)(c - 'a' + 'A'), 0);
+        } else if ((c >= 'A') && (c <= 'Z')) {
+            SetKey(inrec, (WORD)c, SHIFT_PRESSED);
+        } else if (((c >= '0') && (c <= '9')) || (c == ' ')) {
+            SetKey(inrec, (WORD)c, 0);
+        } else {
+            return false;  // other controls, punctuation, UTF-8 bytes
+        }
+
+        return Keystroke(inrec);
+    }
+
+    bool DecodeSequence(INPUT_RECORD& inrec)
+    {
+        // CSI/SS3: ESC [ <params> <final> or ESC O <final>
+        unsigned int i = 2;
+
+        for (int tries = 0; ; ++tries) {
+            for (i = 2; i < in_size_; ++i) {
+                if ((in_[i] >= 0x40) && (in_[i] <= 0x7e)) {
+                    break;
+                } else { }
+            }
+
+            if ((i < in_size_) || (tries > 0) || !Refill(ESC_WAIT_MS)) {
+                break;
+            } else { }
+        }
+
+        if (i >= in_size_) {
+            Consume(in_size_);  // truncated or unknown, dropped
+            return false;
+        } else { }
+
+        bool sgr_mouse = (in_[2] == '<');
+        int p[3] = { 0, 0, 0 };
+        int np = 0;
+
+        for (unsigned int j = sgr_mouse ? 3 : 2; j < i; ++j) {
+            if ((in_[j] >= '0') && (in_[j] <= '9')) {
+                p[np] = p[np] * 10 + (in_[j] - '0');
+            } else if ((in_[j] == ';') && (np < 2)) {
+                ++np;
+            } else { }
+        }
+
+        unsigned char final = in_[i];
+        Consume(i + 1);
+
+        if (sgr_mouse) {
+            SetMouse(inrec, p[0], p[1], p[2], final == 'M');
+            return true;
+        } else if ((final == 'M') && (i == 2)) {
+            // legacy mouse report, three bytes offset by 32
+            if ((in_size_ < 3) && !Refill(ESC_WAIT_MS)) {
+                Consume(in_size_);
+                return false;
+            } else { }
+
+            int b = in_[0] - 32;
+            int x = in_[1] - 32;
+            int y = in_[2] - 32;
+            Consume(3);
+            SetMouse(inrec, b, x, y, (b & 3) != 3);
+            return true;
+        } else { }
+
+        switch (final) {
+        case 'A': SetKey(inrec, VK_UP, Modifiers(p[1])); break;
+        case 'B': SetKey(inrec, VK_DOWN, Modifiers(p[1])); break;
+        case 'C': SetKey(inrec, VK_RIGHT, Modifiers(p[1])); break;
+        case 'D': SetKey(inrec, VK_LEFT, Modifiers(p[1])); break;
+        case '~':
+            if (p[0] == 15) {
+                SetKey(inrec, VK_F5, Modifiers(p[1]));
+            } else {
+                return false;
+            }
+            break;
+        default:
+            return false;
+        }
+
+        return Keystroke(inrec);
+    }
+
+    // A terminal reports a keystroke once: it is returned as a key press now
+    // and as a key release on the next call, as the console would report it.
+    bool Keystroke(INPUT_RECORD& inrec)
+    {
+        KEY_EVENT_RECORD& ker = inrec.Event.KeyEvent;
+
+        if (ker.wVirtualKeyCode != VK_F5) {
+        } else if (render_thread_) {
+            cleared_ = 1;
+        } else {
+            // a redraw is asked for, the shadow can no longer be trusted
+            Put("\x1b[2J");
+            Invalidate();
+        }
+
+        pending_ = ker;
+        pending_.bKeyDown = FALSE;
+        has_pending_ = true;
+        return true;
+    }
+
+    void Put(const char* str)
+    {
+        Put(str, (unsigned int)strlen(str));
+    }
+
+    void Put(const char* str, unsigned int size)
+    {
+        if (used_ + size > sizeof(out_)) {
+            Drain();
+        } else { }
+
+        if (size > sizeof(out_)) {
+            return;  // TODO: assert
+        } else { }
+
+        memcpy(out_ + used_, str, size);
+        used_ += size;
+    }
+
+    void Drain()
+    {
+        const char* p = out_;
+        unsigned int size = used_;
+
+        while (size) {
+            ssize_t n = write(out_fd_, p, size);
+            counters.Add(CTR_CONSOLE_CALLS);
+            tracer.Record(TR_CON_WRITE, (int32_t)size, (int32_t)n);
+
+            if (n > 0) {
+                p += n;
+                size -= (unsigned int)n;
+                bytes_ += (uint64_t)n;
+                counters.Add(CTR_CONSOLE_BYTES, (uint64_t)n);
+                frame_bytes_ += (uint64_t)n;
+            } else if ((n < 0) && (errno == EINTR)) {
+                continue;
+            } else {
+                break;  // output is gone, frame is dropped
+            }
+        }
+
+        used_ = 0;
+    }
+
+    void SyncCursor()
+    {
+        if ((pen_x_ < 0) || (pen_y_ < 0) ||
+            ((pen_x_ == x_) && (pen_y_ == y_))) {
+            return;
+        } else { }
+
+        char buf[16];
+        char alt[16];
+        int size;
+
+        if (pen_x_ == 0) {
+            size = snprintf(buf, sizeof(buf), "\x1b[%dH", pen_y_ + 1);
+        } else {
+            size = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", pen_y_ + 1, pen_x_ + 1);
+        }
+
+        if ((x_ >= 0) && (y_ >= 0)) {
+            // relative moves need a known cursor position
+            int dx = pen_x_ - x_;
+            int dy = pen_y_ - y_;
+            int n = 0;
+
+            if ((dy == 0) && (pen_x_ == 0)) {
+                n = snprintf(alt, sizeof(alt), "%s", "\r");
+            } else if ((dy == 0) && (dx > 0)) {
+                if (ResendCells(size)) {
+                    return;
+                } else { }
+
+                n = Csi(alt, dx, 'C');
+            } else if (dy == 0) {
+                n = Csi(alt, -dx, 'D');
+            } else if ((dy == 1) && (pen_x_ == 0)) {
+                n = snprintf(alt, sizeof(alt), "%s", "\r\n");
+            } else if (dx == 0) {
+                n = (dy > 0) ? Csi(alt, dy, 'B') : Csi(alt, -dy, 'A');
+            } else { }
+
+            if ((n > 0) && (n < size)) {
+                memcpy(buf, alt, (size_t)n);
+                size = n;
+            } else { }
+
+            if (dy == 0) {
+                n = Csi(alt, pen_x_ + 1, 'G');
+
+                if (n < size) {
+                    memcpy(buf, alt, (size_t)n);
+                    size = n;
+                } else { }
+            } else { }
+        } else { }
+
+        Put(buf, (unsigned int)size);
+        x_ = pen_x_;
+        y_ = pen_y_;
+    }
+
+    // moves right by re-sending the cells in between, if that is shorter
+    bool ResendCells(int limit)
+    {
+        int n = 0;
+
+        for (int x = x_; x < pen_x_; ++x) {
+            const Cell& cell = At(x, y_);
+            n += cell.size;
+
+            if ((cell.size == 0) || (cell.color != color_) || (n >= limit)) {
+                return false;
+            } else { }
+        }
+
+        for (int x = x_; x < pen_x_; ++x) {
+            const Cell& cell = At(x, y_);
+            Put(cell.text, cell.size);
+        }
+
+        x_ = pen_x_;
+        return true;
+    }
+
+    void SyncColor()
+    {
+        unsigned int c = pen_color_;
+
+        if (c == color_) {
+            return;
+        } else if (c == DEFAULT_COLOR) {
+            Put("\x1b[0m");
+        } else if ((color_ & 0xffffff00u) || (((c ^ color_) & 0x0fu) && ((c ^ color_) & 0xf0u))) {
+            Put(full_[c].text, full_[c].size);
+        } else if ((c ^ color_) & 0x0fu) {
+            Put(fore_[c & 0x0fu].text, fore_[c & 0x0fu].size);
+        } else {
+            Put(back_[c >> 4].text, back_[c >> 4].size);
+        }
+
+        color_ = c;
+    }
+
+    void PutGlyph(const char* text, unsigned int size)
+    {
+        if (text[0] == '\n') {
+            SyncCursor();
+            SyncColor();
+            Put("\r\n");
+
+            if ((y_ >= 0) && (y_ + 1 < height_)) {
+                x_ = 0;
+                ++y_;
+            } else {
+                Invalidate();  // the screen scrolled
+            }
+
+            pen_x_ = x_;
+            pen_y_ = y_;
+            return;
+        } else if ((pen_x_ < 0) || (pen_y_ < 0)) {
+            SyncColor();  // position unknown, nothing to track
+            Put(text, size);
+            return;
+        } else if ((pen_x_ >= width_) || (pen_y_ >= height_)) {
+            ++pen_x_;  // clipped
+            return;
+        } else { }
+
+        Cell& cell = At(pen_x_, pen_y_);
+
+        if ((cell.size == size) && (cell.color == pen_color_) &&
+            (memcmp(cell.text, text, size) == 0)) {
+            ++pen_x_;  // already on screen
+            return;
+        } else { }
+
+        SyncCursor();
+        SyncColor();
+        Put(text, size);
+
+        cell.color = pen_color_;
+        cell.size = (uint8_t)size;
+        memcpy(cell.text, text, size);
+
+        ++pen_x_;
+        x_ = (pen_x_ < width_) ? pen_x_ : -1;  // wrap pending at the margin
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Console);
+
+  private:
+    short top_;
+    short height_;
+    short width_;
+    volatile sig_atomic_t interrupted_;
+    std::atomic<int> resized_;  // set by a signal handler, lock free
+    bool raw_;
+    bool titled_;
+    int in_fd_;
+    int out_fd_;
+    int tty_fd_;
+    int x_;  // terminal cursor, -1 if not known
+    int y_;
+    int pen_x_;  // where the next text goes
+    int pen_y_;
+    unsigned int color_;  // terminal color
+    unsigned int pen_color_;  // color of the next text
+    unsigned int overridden_;  // palette entries changed by SetPalette()
+    unsigned int used_;
+    unsigned int in_size_;
+    uint64_t frames_;
+    uint64_t bytes_;
+    uint64_t frame_bytes_;
+    uint64_t max_frame_;
+    bool render_thread_;
+    std::atomic<int> cleared_;  // F5 read, the screen is cleared at BeginFrame()
+    bool has_pending_;
+    std::vector<Cell> screen_;
+    KEY_EVENT_RECORD pending_;
+    struct termios tio_;
+    COLORREF ct_[16];
+    COLORREF palette_[16];
+    Sgr full_[256];
+    Sgr fore_[16];
+    Sgr back_[16];
+    unsigned char in_[IN_SIZE];
+    char out_[OUT_SIZE];
+};
+#endif  // !_WIN32
+// end of ansi terminal backend }}}
+
+// recording console {{{
+//
+// A Console that draws into an in-memory cell grid instead of a terminal and
+// counts the calls and bytes of the drawing primitives.  It replaces the
+// platform console in builds with -DRECORDING_CONSOLE_, so rendering can be
+// measured and checked without a terminal: GetStats() returns the counts
+// since ResetStats(), FrameHash() hashes the characters and colors on screen.
+// Input comes from a script filled by PushKey()/PushInput(); once the script
+// is used up, ReadInput() reports an interruption as a closed console would.
+//
+struct RenderStats {
+    uint64_t move_to;
+    uint64_t set_color;
+    uint64_t write;
+    uint64_t copy_region;
+    uint64_t write_cells;
+    uint64_t bytes;  // text bytes passed to Write() and WriteCells()
+};
+
+class RecordingConsole
+{
+  public:
+    enum { LAST_VALUE = 0xffff };
+    enum { WIDTH = 100, HEIGHT = 40, DEFAULT_COLOR = 0x07 };
+
+  public:
+    RecordingConsole() : top_(0), x_(0), y_(0), color_(DEFAULT_COLOR),
+        interrupted_(0), next_(0), script_()
+    {
+        memset(&stats_, 0, sizeof(stats_));
+        memset(ct_, 0, sizeof(ct_));
+        memset(palette_, 0, sizeof(palette_));
+        Clear();
+    }
+    ~RecordingConsole() { }
+
+    BOOL CtrlHandler(DWORD ctrl)
+    {
+        (void)ctrl;
+        interrupted_ = 1;
+        return TRUE;
+    }
+
+    void Resized()
+    {
+        // the cell grid has a fixed size
+    }
+
+    void AllowCtrlHandler()
+    {
+        interrupted_ = 0;
+    }
+
+    int CanReset()
+    {
+        return interrupted_ < 2;
+    }
+
+    int Interrupted()
+    {
+        return interrupted_;
+    }
+
+    void Acquire() { }
+    void Release() { }
+
+    void SaveBuffer()
+    {
+        Clear();
+    }
+
+    void RestoreBuffer()
+    {
+        Clear();
+    }
+
+    void ShowCursor() { }
+    void HideCursor() { }
+    void SaveCursor() { }
+
+    void PushInput(const INPUT_RECORD& inrec)
+    {
+        script_.push_back(inrec);
+    }
+
+    // a key press followed by its release, as a console reports a keystroke
+    void PushKey(WORD key, DWORD state = 0)
+    {
+        INPUT_RECORD inrec;
+        memset(&inrec, 0, sizeof(inrec));
+        inrec.EventType = KEY_EVENT;
+        inrec.Event.KeyEvent.bKeyDown = TRUE;
+        inrec.Event.KeyEvent.wRepeatCount = 1;
+        inrec.Event.KeyEvent.wVirtualKeyCode = key;
+        inrec.Event.KeyEvent.dwControlKeyState = state;
+        PushInput(inrec);
+        inrec.Event.KeyEvent.bKeyDown = FALSE;
+        PushInput(inrec);
+    }
+
+    int ReadInput(INPUT_RECORD& inrec)
+    {
+        if (interrupted_ || (next_ >= script_.size())) {
+            inrec.EventType = 0x0;
+            return 0;
+        } else {
+            inrec = script_[next_++];
+            return 1;
+        }
+    }
+
+    void MoveTo(unsigned int x, unsigned int y)
+    {
+        ++stats_.move_to;
+        x_ = (int)x;
+        y_ = (int)y + top_;
+
+        if (y_ >= HEIGHT) {
+            y_ = HEIGHT - 1;
+        } else { }
+    }
+
+    void SetColor(unsigned int color)
+    {
+        ++stats_.set_color;
+        color_ = (WORD)color;
+    }
+
+    void SaveState()
+    {
+        top_ = 0;
+    }
+
+    short ResetCursorPosition(short top)
+    {
+        // only y value is handled
+        return (top_ = (top >= 0) ? top : 0);
+    }
+
+    void Resize(int rows)
+    {
+        (void)rows;
+    }
+
+    void Clear()
+    {
+        Cell blank = { DEFAULT_COLOR, 1, { ' ' } };
+        std::fill(&screen_[0][0], &screen_[0][0] + WIDTH * HEIGHT, blank);
+        x_ = 0;
+        y_ = 0;
+    }
+
+    void ResetColor()
+    {
+        color_ = DEFAULT_COLOR;
+    }
+
+    void FlushInput()
+    {
+        // the script is the input, it is kept
+    }
+
+    void SavePalette()
+    {
+        GetPalette(ct_);
+    }
+
+    void GetOldPalette(COLORREF ct[16])
+    {
+        memcpy(ct, ct_, sizeof(COLORREF) * 16);
+    }
+
+    void GetPalette(COLORREF ct[16])
+    {
+        memcpy(ct, palette_, sizeof(COLORREF) * 16);
+    }
+
+    void SetPalette(COLORREF ct[16])
+    {
+        memcpy(palette_, ct, sizeof(COLORREF) * 16);
+    }
+
+    void ResetPalette()
+    {
+        SetPalette(ct_);
+    }
+
+    void SetTitle(const TCHAR* title)
+    {
+        (void)title;
+    }
+
+    int Write(unsigned int color, unsigned int x, unsigned int y, const char* str)
+    {
+        if (x == LAST_VALUE && y == LAST_VALUE) {
+            // continue from current position
+        } else {
+            MoveTo(x, y);
+        }
+
+        if (color == LAST_VALUE) {
+            // no change in color
+        } else {
+            SetColor(color);
+        }
+
+        return Write(str);
+    }
+
+    int Write(unsigned int x, unsigned int y, const char* str)
+    {
+        if (x == LAST_VALUE && y == LAST_VALUE) {
+            // continue from current position
+        } else {
+            MoveTo(x, y);
+        }
+
+        return Write(str);
+    }
+
+    int Write(unsigned int color, const char* str)
+    {
+        if (color == LAST_VALUE) {
+            // no change in color
+        } else {
+            SetColor(color);
+        }
+
+        return Write(str);
+    }
+
+    int Write(const char* str)
+    {
+        if (str && *str) {
+        } else {
+            return 0;  // TODO: assert
+        }
+
+        ++stats_.write;
+        const char* s = str;
+
+        while (*s) {
+            // one cell per UTF-8 sequence
+            unsigned int size = 1;
+
+            while ((size < 4) && ((s[size] & 0xc0) == 0x80)) {
+                ++size;
+            }
+
+            Put(s, size);
+            s += size;
+        }
+
+        stats_.bytes += (uint64_t)(s - str);
+        return (int)(s - str);
+    }
+
+    void CopyRegion(SMALL_RECT& dst, SMALL_RECT& src)
+    {
+        ++stats_.copy_region;
+        src.Top += top_;
+        src.Bottom += top_;
+        dst.Top += top_;
+        dst.Bottom += top_;
+
+        // through a copy of the whole screen, the regions may overlap
+        std::vector<Cell> copy(&screen_[0][0], &screen_[0][0] + WIDTH * HEIGHT);
+
+        for (int y = src.Top; y <= src.Bottom; ++y) {
+            for (int x = src.Left; x <= src.Right; ++x) {
+                int tx = dst.Left + (x - src.Left);
+                int ty = dst.Top + (y - src.Top);
+
+                if (Inside(x, y) && Inside(tx, ty) &&
+                    (tx <= dst.Right) && (ty <= dst.Bottom)) {
+                    screen_[ty][tx] = copy[(size_t)(y * WIDTH + x)];
+                } else { }
+            }
+        }
+    }
+
+    void WriteCells(unsigned int x, unsigned int y, const ConsoleCell* cells,
+                    unsigned int width, unsigned int height)
+    {
+        ++stats_.write_cells;
+
+        for (unsigned int r = 0; r < height; ++r) {
+            for (unsigned int c = 0; c < width; ++c) {
+                const ConsoleCell& cell = cells[r * width + c];
+                int tx = (int)(x + c);
+                int ty = (int)(y + r) + top_;
+
+                if (Inside(tx, ty)) {
+                    Cell& dst = screen_[ty][tx];
+                    dst.color = cell.color;
+                    dst.size = cell.size;
+                    memcpy(dst.text, cell.text, cell.size);
+                } else { }
+
+                stats_.bytes += cell.size;
+            }
+        }
+    }
+
+    void SetRenderThread(bool on)
+    {
+        (void)on;  // scripted input does not draw
+    }
+
+    void BeginFrame() { }
+
+    void Flush() { }
+
+    void PrintStats(FILE* out)
+    {
+        fprintf(out, "console: %llu moves, %llu colors, %llu writes, %llu copies,"
+                " %llu blits, %llu bytes, hash %016llx\n",
+                (unsigned long long)stats_.move_to,
+                (unsigned long long)stats_.set_color,
+                (unsigned long long)stats_.write,
+                (unsigned long long)stats_.copy_region,
+                (unsigned long long)stats_.write_cells,
+                (unsigned long long)stats_.bytes,
+                (unsigned long long)FrameHash());
+    }
+
+    const RenderStats& GetStats() const
+    {
+        return stats_;
+    }
+
+    void ResetStats()
+    {
+        memset(&stats_, 0, sizeof(stats_));
+    }
+
+    // FNV-1a over characters and colors of all cells
+    uint64_t FrameHash() const
+    {
+        uint64_t h = 0xcbf29ce484222325ull;
+
+        for (int y = 0; y < HEIGHT; ++y) {
+            for (int x = 0; x < WIDTH; ++x) {
+                const Cell& cell = screen_[y][x];
+
+                for (unsigned int i = 0; i < cell.size; ++i) {
+                    h = (h ^ (uint8_t)cell.text[i]) * 0x100000001b3ull;
+                }
+
+                h = (h ^ (cell.color & 0xffu)) * 0x100000001b3ull;
+                h = (h ^ (cell.color >> 8)) * 0x100000001b3ull;
+            }
+        }
+
+        return h;
+    }
+
+    // the text of a row, trailing blanks removed
+    const char* GetRow(int y, char* buf, size_t size) const
+    {
+        size_t n = 0;
+        size_t end = 0;
+
+        for (int x = 0; (x < WIDTH) && Inside(x, y); ++x) {
+            const Cell& cell = screen_[y][x];
+
+            if (n + cell.size >= size) {
+                break;
+            } else { }
+
+            memcpy(buf + n, cell.text, cell.size);
+            n += cell.size;
+            end = (cell.text[0] == ' ') ? end : n;
+        }
+
+        if (size) {
+            buf[end] = '\0';
+        } else { }
+
+        return buf;
+    }
+
+  private:
+    struct Cell {
+        WORD color;
+        uint8_t size;
+        char text[4];
+    };
+
+    static bool Inside(int x, int y)
+    {
+        return (x >= 0) && (y >= 0) && (x < WIDTH) && (y < HEIGHT);
+    }
+
+    void Put(const char* text, unsigned int size)
+    {
+        if (text[0] == '\n') {
+            x_ = 0;
+
+            if (y_ + 1 < HEIGHT) {
+                ++y_;
+            } else {
+                // scrolls up by a row
+                memmove(&screen_[0][0], &screen_[1][0],
+                        sizeof(Cell) * WIDTH * (HEIGHT - 1));
+                Cell blank = { DEFAULT_COLOR, 1, { ' ' } };
+                std::fill(&screen_[HEIGHT - 1][0], &screen_[HEIGHT - 1][0] + WIDTH, blank);
+            }
+
+            return;
+        } else { }
+
+        if (Inside(x_, y_)) {
+            Cell& cell = screen_[y_][x_];
+            cell.color = color_;
+            cell.size = (uint8_t)size;
+            memcpy(cell.text, text, size);
+        } else { }
+
+        ++x_;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(RecordingConsole);
+
+  private:
+    short top_;
+    int x_;
+    int y_;
+    WORD color_;
+    int interrupted_;
+    size_t next_;
+    std::vector<INPUT_RECORD> script_;
+    RenderStats stats_;
+    COLORREF ct_[16];
+    COLORREF palette_[16];
+    Cell screen_[HEIGHT][WIDTH];
+};
+// end of recording console }}}
+
+#if defined(RECORDING_CONSOLE_)
+RecordingConsole con;
+#else
+Console con;
+#endif
+
+BOOL CtrlHandler(DWORD ctrl)
+{
+    return con.CtrlHandler(ctrl);
+}
+
+#if !defined(_WIN32)
+void SignalHandler(int sig)
+{
+    switch (sig) {
+    case SIGINT: CtrlHandler(CTRL_C_EVENT); break;
+    case SIGTERM: CtrlHandler(CTRL_BREAK_EVENT); break;
+    case SIGHUP: CtrlHandler(CTRL_CLOSE_EVENT); break;
+    case SIGWINCH: con.Resized(); break;
+    default: break;
+    }
+}
+#endif  // !_WIN32
+
+// math or numerical routines {{{
+template<typename T> T Max(T a, T b)
+{
+    return a > b ? a : b;
+}
+
+template<typename T> T Min(T a, T b)
+{
+    return a < b ? a : b;
+}
+
+class Stripe
+{
+  public:
+    Stripe(int type, int pos, uint8_t (&aa)[N][N])
+        : begin_(0), step_(0), end_(0),
+          type_(type), stripe_(pos), x_(1), a_(aa)
+    {
+        if ((stripe_ >= 0) && (stripe_ < N)) {
+            switch (type_) {
+            case ROW_L2R_STRIPE:
+                begin_ = 0;
+                step_ = 1;
+                end_ = N;
+                break;
+            case COL_U2D_STRIPE:
+                begin_ = 0;
+                step_ = 1;
+                end_ = N;
+                break;
+            case ROW_R2L_STRIPE:
+                begin_ = N - 1;
+                step_ = -1;
+                end_ = -1;
+                break;
+            case COL_D2U_STRIPE:
+                begin_ = N - 1;
+                step_ = -1;
+                end_ = -1;
+                break;
+            default:
+                begin_ = 0;
+                step_ = 0;
+                end_ = 0;
+                stripe_ = -1;
+                break;
+            }
+        } else {
+            begin_ = 0;
+            step_ = 0;
+            end_ = 0;
+            stripe_ = -1;
+        }
+    }
+    ~Stripe() { }
+
+#if 0
+    // code below can be used for debugging the class
+    void DbgPrintM()
+    {
+        for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < N; ++c) {
+                if (a_[r][c]) {
+                    printf("%u", a_[r][c]);
+                } else {
+                    printf("%s", ".");
+                }
+            }
+
+            printf("%s", "\n");
+        }
+    }
+
+    void DbgPrintI()
+    {
+        switch (type_) {
+        case ROW_L2R_STRIPE:
+            printf("L(%d): ", stripe_);
+            break;
+        case COL_U2D_STRIPE:
+            printf("U(%d): ", stripe_);
+            break;
+        case ROW_R2L_STRIPE:
+            printf("R(%d): ", stripe_);
+            break;
+        case COL_D2U_STRIPE:
+            printf("D(%d): ", stripe_);
+            break;
+        default:
+            printf("!!!(%d): ", stripe_);
+            break;
+        }
+
+        DPRINT("b(%d) s(%d) e(%d)\n", begin_, step_, end_);
+    }
+
+    void DbgPrintS()
+    {
+        Stripe& A = *this;
+        /*
+        switch (type_) {
+        case ROW_L2R_STRIPE:
+            printf("L(%d) ", stripe_);
+            break;
+        case COL_U2D_STRIPE:
+            printf("U(%d) ", stripe_);
+            break;
+        case ROW_R2L_STRIPE:
+            printf("R(%d) ", stripe_);
+            break;
+        case COL_D2U_STRIPE:
+            printf("D(%d) ", stripe_);
+            break;
+        default:
+            printf("!!!(%d) ", stripe_);
+            printf("%s", "invalid\n");
+            return;
+        }
+
+        for (int i = begin_; i != end_; i += step_) {
+            if (A[i]) {
+                printf("%u", A[i]);
+            } else {
+                printf("%s", ".");
+            }
+        }  // */
+
+        char s[N + 2] = { 0 };
+
+        for (int i = 0; i < N; ++i) {
+            s[i] = (char)(A[i] + '0');
+        }
+
+        DPRINT("%s", s);
+    }
+#endif
+
+    bool within(int index, int limit)
+    {
+        switch (type_) {
+        case ROW_L2R_STRIPE: return (index < limit);
+        case COL_U2D_STRIPE: return (index < limit);
+        case ROW_R2L_STRIPE: return (limit < index);
+        case COL_D2U_STRIPE: return (limit < index);
+        default: break;
+        }
+
+        printf("within(%d %d)\n", index, limit);
+        return false;
+    }
+
+    template<typename T>
+    unsigned int Nudge(T& scorer)
+    {
+#define A (*this) /* Stripe& A = *this; */
+        int b = -1;
+        unsigned int m = 0;
+        int ec = end_ - step_;
+
+        for (int c = begin_; within(c, ec); c += step_) {
+            if (A[c] == 0) {
+                b = c;
+            } else if (within(c, ec) && A[c + step_] == 0) {
+                b = c + step_;
+            }
+
+            if (b > -1) {
+                for (int i = b, j = i + step_; within(j, end_); j += step_) {
+                    if (A[j] == 0) {
+                        ec -= step_;
+                        continue;
+                    } else {
+                        A[i] = A[j];
+                        A[j] = 0;
+                        ++m;  // m += A[i] ? 1 : 0;
+                        i += step_;
+                    }
+                }
+
+                ec -= step_;
+                b = -1;
+            } else { }
+
+            if (A[c] == A[c + step_]) {
+                if (A[c]) {
+                    A[c]++;
+                    scorer(1 << A[c]);
+                    A[c] |= 0x80u;
+                    A[c + step_] = 0;  //
+                    m += (A[c] == (X800 | 0x80u)) ? 2048u : 1u;
+                } else { /* A[c] = 0; */ }  // A[c + step_] = 0;
+
+                int i;
+
+                for (i = c + step_; within(i, ec); i += step_) {
+                    A[i] = A[i + step_];
+                }
+
+                A[i] = 0;
+                ec -= step_;
+            } else { }
+        }
+#undef A
+        return m;
+    }
+
+    uint8_t& operator[](int i)
+    {
+        if ((i >= 0) && (i < N)) {
+            switch (type_) {
+            case ROW_L2R_STRIPE: return a_[stripe_][i];
+            case COL_U2D_STRIPE: return a_[i][stripe_];
+            case ROW_R2L_STRIPE: return a_[stripe_][i];
+            case COL_D2U_STRIPE: return a_[i][stripe_];
+            default: DPRINT("Stripe: incorrect type '%d'\n", type_);
+                     break;  // TODO: to assert
+            }
+        } else { }
+
+        // DPRINT("A[%d] ?\n", i);
+
+        return x_;  // TODO: to assert
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Stripe);
+
+  private:
+    int begin_;
+    int step_;
+    int end_;
+    int type_;
+    int stripe_;
+    uint8_t x_;
+    uint8_t (&a_)[N][N];
+};
+
+class Matrix
+{
+    //     column 0 1 2 3
+    //          +----------> X
+    //    row 0 | 0 1 2 3
+    //    row 1 | 4 5 6 7
+    //    row 2 | 8 9 A B
+    //    row 3 | C D E F
+    //          v
+    //          Y
+    //
+  public:
+    explicit Matrix(uint8_t (&aa)[N][N])
+        : aa_(aa)
+    {
+    }
+
+    ~Matrix() { }
+
+    void Reset(int n)
+    {
+        switch (n) {
+        // case 0:
+        //    for (int r = 0; r < N; ++r) {
+        //        for (int c = 0; c < N; ++c) {
+        //            aa_[r][c] = 0;
+        //        }
+        //    } break;
+        case 1:
+            for (int i = 0; i < N * N; ++i) {
+                aa_[i >> 2][i & 0x3] = (uint8_t)(i);
+            }
+
+            aa_[0][0] = 1;
+            break;
+        default:
+            for (int r = 0; r < N; ++r) {
+                for (int c = 0; c < N; ++c) {
+                    aa_[r][c] = 0;
+                }
+            } break;
+        }
+    }
+
+    uint8_t operator()(unsigned int r, unsigned int c)
+    {
+        if ((r < N) && (c < N)) {
+            return aa_[r][c];
+        } else {
+            dprint("A[%u][%u] ?\n", r, c);
+        }
+
+        return 0;
+    }
+
+    void SetAt(unsigned int r, unsigned int c, uint8_t value)
+    {
+        if ((r < N) && (c < N)) {
+            aa_[r][c] = value;
+        } else {
+            printf("A[%u][%u] ?\n", r, c);
+        }
+    }
+
+    void DbgPrint()
+    {
+        fprintf(stderr, "%s", " ");
+
+        for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < N; ++c) {
+                fprintf(stderr, "%2X", aa_[r][c]);
+            }
+
+            fprintf(stderr, "%s", " ");
+        }
+
+        fprintf(stderr, "%s", "\n");
+        fflush(stderr);
+    }
+
+    void Transpose()
+    {
+        for (int r = 0; r <= N - 2; ++r) {
+            for (int c = r + 1; c <= N - 1; ++c) {
+                Swap(aa_[r][c], aa_[c][r]);
+            }
+        }
+    }
+
+    void SwapV()
+    {
+        for (int r = 0; r < N / 2; ++r) {
+            for (int c = 0; c < N; ++c) {
+                Swap(aa_[r][c], aa_[N - 1 - r][c]);
+            }
+        }
+    }
+
+    void SwapH()
+    {
+        for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < N / 2; ++c) {
+                Swap(aa_[r][c], aa_[r][N - 1 - c]);
+            }
+        }
+    }
+
+    void RotateCW()
+    {
+        Transpose();
+        SwapH();
+    }
+
+    void RotateCCW()
+    {
+        Transpose();
+        SwapV();
+    }
+
+  private:
+    void Swap(uint8_t& a, uint8_t& b)
+    {
+        uint8_t t = a;
+        a = b;
+        b = t;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Matrix);
+
+  private:
+    uint8_t (&aa_)[N][N];
+};
+// end of math or numerical routines }}}
+
+class Grid
+{
+  public:
+    // grid/message offsets of x and y
+    enum {
+        GRID_X = 5,
+        GRID_Y = 2,
+        MESG_X = GRID_X + 9 * N + 5,
+        MESG_Y = 14
+    };
+  public:
+    Grid()
+#if defined(_MSC_VER) && (_MSC_VER < 1800)
+        // not supported ?
+        : time_color_(0), rank_shown_(false)
+#else
+        : text_{ }, time_color_(0), rank_shown_(false)
+#endif
+    {
+#if defined(_MSC_VER) && (_MSC_VER < 1800)
+        memset(&text_, 0, sizeof(text_));
+#endif
+        memset(time_text_, 0, sizeof(time_text_));
+        SetGridMode(1);
+
+        for (int i = 0; i < (int)(sizeof(ct) / sizeof(ct[0])); ++i) {
+            ct[i] = 0x0u;
+        }
+    }
+
+    ~Grid() { }
+
+    void DrawGrid()
+    {
+        //
+        //  Board layout
+        //  ------------
+        //
+        //  (GRID_X,GRID_Y) = (5,2)
+        //    \           1         2         3
+        //     \0123456789012345678901234567890123456
+        //    0 +--------+--------+--------+--------+
+        //    1 |.      .|.      .|.      .|.      .|
+        //    2 |.   2  .|.  64  .|. 128  .|. 1024 .|
+        //    3 |.      .|.      .|.      .|.      .|
+        //    4 +--------+--------+--------+--------+
+        //    5 |        |        |        |        |
+        //    6 |        |        |        |        |
+        //    7 |        |        |        |        |             1         2
+        //    8 +--------+--------+--------+--------+   0123456789012345678901
+        //    9 |        |        |        |        |
+        //   10 |        |        |        |        |  (MESG_X,MESG_Y) = (46,14)
+        //    1 |        |        |        |        |    /
+        //    2 +--------+--------+--------+--------+   +--------------------+
+        //    3 |        |        |        |        |   |      You WON!      |
+        //    4 |        |        |        |        |   +--------------------+
+        //    5 |        |        |        |        |
+        //    6 +--------+--------+--------+--------+   > Keep Going: Yes / No
+        //
+        //  Board drawing characters
+        //  ------------------------
+        //     ┏━━━┯━━━┓   ╔═══╗  ┏━━━┓  ┌───┐
+        //     ┃   │   ┃   ║   ║  ┃   ┃  │   │   ___▌___▐___
+        //     ┠───┼───┨   ╚═══╝  ┗━━━┛  └───┘
+        //     ┃   │   ┃
+        //     ┗━━━┷━━━┛
+        //
+
+        con.MoveTo(0, 0);
+
+        con.Write(0x08u, GRID_X, GRID_Y, text_.grid_top_line);
+
+        unsigned int y;
+
+        for (y = 1; y < 4 * N; ++y) {
+            con.MoveTo(GRID_X, GRID_Y + y);
+
+            switch (y) {
+            case 4: case 8: case 12: case 16:
+                con.Write(text_.grid_sep_line);
+                break;
+            default:
+                con.Write(text_.grid_mid_line);
+            }
+        }
+
+        con.MoveTo(GRID_X, GRID_Y + y);
+        con.Write(text_.grid_bot_line);
+
+        PatchGrid(N);
+
+        con.Write(MESG_X, 4, "Score      Time");
+        time_text_[0] = '\0';
+    }
+
+    void PatchGrid(int grid_size)
+    {
+        // PatchGrid is used just to experiment copying regions of console
+        switch (grid_size) {
+        case 3: {
+            SMALL_RECT src = { 41, 2, 50, 14 };
+            SMALL_RECT dst = { 32, 2, 41, 14 };
+            con.CopyRegion(dst, src);
+        } break;
+        case 5: {
+            SMALL_RECT src = { 32, 2, 41, 22 };
+            SMALL_RECT dst = { 41, 2, 50, 22 };
+            con.CopyRegion(dst, src);
+        } break;
+        default:
+            break;
+        }
+    }
+
+    void SetGridMode(int mode)
+    {
+        switch (mode) {
+        case 0:
+            text_.grid_top_line = "+--------+--------+--------+--------+";
+            text_.grid_sep_line = "+--------+--------+--------+--------+";
+            text_.grid_mid_line = "|        |        |        |        |";
+            text_.grid_bot_line = "+--------+--------+--------+--------+";
+            text_.cell_left_pad = " ";
+            text_.cell_right_pad = " ";
+            text_.won_top_line = " +====================+ ";
+            text_.won_mid_line = " |                    | ";
+            text_.won_bot_line = " +====================+ ";
+            text_.lost_top_line = " +--------------------+ ";
+            text_.lost_mid_line = " |                    | ";
+            text_.lost_bot_line = " +--------------------+ ";
+            text_.prompt_char = ">";
+            text_.underline = " ---- ";
+            text_.filler_line = "      ";
+            break;
+        default:
+            text_.grid_top_line = "┏━━━━━━━━┯━━━━━━━━┯━━━━━━━━┯━━━━━━━━┓";
+            text_.grid_sep_line = "┠────────┼────────┼────────┼────────┨";
+            text_.grid_mid_line = "┃        │        │        │        ┃";
+            text_.grid_bot_line = "┗━━━━━━━━┷━━━━━━━━┷━━━━━━━━┷━━━━━━━━┛";
+            text_.cell_left_pad = "▌";
+            text_.cell_right_pad = "▐";
+            text_.won_top_line = " ╔════════════════════╗ ";
+            text_.won_mid_line = " ║                    ║ ";
+            text_.won_bot_line = " ╚════════════════════╝ ";
+            text_.lost_top_line = " ┏━━━━━━━━━━━━━━━━━━━━┓ ";
+            text_.lost_mid_line = " ┃                    ┃ ";
+            text_.lost_bot_line = " ┗━━━━━━━━━━━━━━━━━━━━┛ ";
+            text_.prompt_char = "►";
+            text_.underline = " ──── ";
+            text_.filler_line = "      ";
+            break;
+        }
+
+        BuildTiles();
+    }
+
+    // with the rank of the score among games, if there are games
+    void ShowMessage(bool won, unsigned int rank = 0, unsigned int games = 0)
+    {
+        con.SetColor((won ? 0xcfu : 0x70u));
+        con.MoveTo(MESG_X, MESG_Y + 0);
+        con.Write(won ? text_.won_top_line : text_.lost_top_line);
+        con.MoveTo(MESG_X, MESG_Y + 1);
+        con.Write(won ? text_.won_mid_line : text_.lost_mid_line);
+        con.MoveTo(MESG_X, MESG_Y + 2);
+        con.Write(won ? text_.won_bot_line : text_.lost_bot_line);
+
+        con.MoveTo(MESG_X + 7, MESG_Y + 1);
+        con.Write(won ? " You WON! " : "Game Over!");
+
+        if (games) {
+            char line[48];
+            double top = 100.0 * rank / games;
+
+            if (snprintf(line, sizeof(line), "#%u of %u, top %.1f%%", rank,
+                         games, top) > 22) {  // the width of the message
+                snprintf(line, sizeof(line), "#%u, top %.1f%%", rank, top);
+                line[22] = '\0';
+            } else { }
+
+            con.MoveTo(MESG_X + 1, MESG_Y + 3);
+            con.SetColor(0x7u);
+            con.Write("                      ");
+            con.MoveTo(MESG_X + 1 + (unsigned int)(22 - strlen(line)) / 2,
+                       MESG_Y + 3);
+            con.Write(line);
+            rank_shown_ = true;
+        } else { }
+
+        con.MoveTo(MESG_X, MESG_Y + 4);
+        con.SetColor(0xfu);
+        con.Write(text_.prompt_char);
+        con.SetColor(0x7u);
+        con.Write(won ? " Keep Going? " : " Play Again? ");
+        con.SetColor(0x8fu);
+        con.Write(" Y");
+        con.SetColor(0x80u);
+        con.Write("es ");
+        con.SetColor(0x8u);
+        con.Write(" / ");
+        con.SetColor(0x7u);
+        con.Write("N");
+        con.SetColor(0x8u);
+        con.Write("o");
+    }
+
+    void ClearMessage()
+    {
+        con.SetColor(07);
+        con.MoveTo(MESG_X, MESG_Y + 0);
+        //        " +--------------------+ ");
+        con.Write("                        ");
+        con.MoveTo(MESG_X, MESG_Y + 1);
+        con.Write("                        ");
+        con.MoveTo(MESG_X, MESG_Y + 2);
+        con.Write("                        ");
+
+        if (rank_shown_) {
+            con.MoveTo(MESG_X, MESG_Y + 3);
+            con.Write("                        ");
+            rank_shown_ = false;
+        } else { }
+
+        con.MoveTo(MESG_X, MESG_Y + 4);
+        //        ". Keep Going? .Yes. / No");
+        con.Write("                        ");
+    }
+
+    void ShowCell(unsigned int n, unsigned int r, unsigned int c, bool highlight = true)
+    {
+        if ((r < N) && (c < N)) {
+        } else {
+            return;
+        }
+
+        const TileImage& tile = Tile(n, highlight ? TILE_HIGHLIGHT : TILE_PLAIN);
+        con.WriteCells(6 + 9 * c, 3 + 4 * r, &tile.cells[0][0], TILE_W, TILE_H);
+    }
+
+    // cells with bit 4 * r + c set in highlight are shown highlighted
+    void ShowMatrix(Matrix& matrix, unsigned int highlight = 0)
+    {
+        for (unsigned int r = 0; r < N; ++r) {
+            for (unsigned int c = 0; c < N; ++c) {
+                unsigned int n = matrix(r, c);
+                const TileImage& tile = Tile(n, ((highlight >> (4 * r + c)) & 1u) ? TILE_HIGHLIGHT :
+                                                (n & 0x80u) ? TILE_UNDERLINE : TILE_PLAIN);
+                con.WriteCells(6 + 9 * c, 3 + 4 * r, &tile.cells[0][0], TILE_W, TILE_H);
+            }
+        }
+    }
+
+    const char* TileLabel(unsigned int n)
+    {
+        static const char* const label[TILE_KINDS] = {
+            "   0  ", "   2  ", "   4  ", "   8  ", "  16  ", "  32  ",
+            "  64  ", "  128 ", "  256 ", "  512 ", " 1024 ", " 2048 ",
+            " 4096 ", " 8192 ", "  16K ", "  32K ", "  64K ", " 128K ",
+            " 256K ", " 512K ", "  1M  ", "  2M  ", "  4M  ", "  8M  ",
+            "  16M ", "  32M ", "  64M ", " 128M ", " 256M ", " 512M ",
+            "  ??  "
+        };
+
+        return label[Min(n, (unsigned int)TILE_KINDS - 1)];
+    }
+
+#if 0
+    // old code with macros
+    void PrintNumber(unsigned int n, unsigned int i)
+    {
+        unsigned int v = (n & 0x7fu);
+        v = (v ? (1u << v) : v);
+#define CASE1(n) case n
+#define CASE3(n) case n: case n + 1: case n + 2
+#define CASE4(n) case n: case n + 1: case n + 2: case n + 3
+#define k ((v/1024))
+#define m ((v/1024/1024))
+
+        switch (n & 0x7fu) {
+        CASE1( 0): PRINTLINE(i,"   %u  ", 0u); break;  // 0       > |   0  |
+        CASE3( 1): PRINTLINE(i,"   %u  ", v); break;  // 2-8      > |   #  |
+        CASE3( 4): PRINTLINE(i,"  %u  ", v); break;  // 16-64     > |  ##  |
+        CASE3( 7): PRINTLINE(i,"  %u ", v); break;  // 128-512    > |  ### |
+        CASE4(10): PRINTLINE(i," %u ", v); break;  // 1024-8192   > | #### |
+        CASE3(14): PRINTLINE(i,"  %uK ", k); break;  // 16K-64K   > |  ### |
+        CASE3(17): PRINTLINE(i," %uK ", k); break;  // 128K-512K  > | #### |
+        CASE4(20): PRINTLINE(i,"  %uM  ", m); break;  // 1M-8M    > |  ##  |
+        CASE3(24): PRINTLINE(i,"  %uM ", m); break;  // 16M-64M   > |  ### |
+        CASE3(27): PRINTLINE(i," %uM ", m); break;  // 128M-512M  > | #### |
+        default: PRINTLINE(i,"%s", "  ??  "); break;  // overflow > |  ??  |
+        }
+#undef CASE1
+#undef CASE3
+#undef CASE4
+#undef k
+#undef m
+    }
+#endif
+
+    // Renders every tile once into cell images: the number line between two
+    // filler lines (underlined for merged tiles), padded left and right, and
+    // the empty board that slides are composed on.  The colors are palette
+    // indices, so only the grid mode needs a rebuild.
+    void BuildTiles()
+    {
+        for (unsigned int state = 0; state < TILE_STATES; ++state) {
+            for (unsigned int n = 0; n < TILE_KINDS; ++n) {
+                WORD color = (WORD)((state == TILE_HIGHLIGHT) ? 0x70u : GetColor(n));
+                const char* lines[TILE_H] = {
+                    text_.filler_line, TileLabel(n),
+                    (state == TILE_UNDERLINE) ? text_.underline : text_.filler_line
+                };
+
+                for (unsigned int y = 0; y < TILE_H; ++y) {
+                    ConsoleCell* cell = tiles_[state][n].cells[y];
+                    const char* value = lines[y];
+                    SetConsoleCell(cell[0], text_.cell_left_pad, (WORD)(color & 0xf0u));
+
+                    for (unsigned int x = 1; x < TILE_W - 1; ++x) {
+                        value += *value ? SetConsoleCell(cell[x], value, color) :
+                                 SetConsoleCell(cell[x], " ", color);
+                    }
+
+                    SetConsoleCell(cell[TILE_W - 1], text_.cell_right_pad,
+                                   (WORD)(color & 0xf0u));
+                }
+            }
+        }
+
+        for (unsigned int y = 0; y < BOARD_H; ++y) {
+            const char* line = ((y + 1) % 4) ? text_.grid_mid_line : text_.grid_sep_line;
+
+            for (unsigned int x = 0; x < BOARD_W; ++x) {
+                line += *line ? SetConsoleCell(background_[y][x], line, 0x08u) :
+                        SetConsoleCell(background_[y][x], " ", 0x08u);
+            }
+        }
+
+        for (unsigned int r = 0; r < N; ++r) {
+            for (unsigned int c = 0; c < N; ++c) {
+                for (unsigned int y = 0; y < TILE_H; ++y) {
+                    memcpy(&background_[4 * r + y][1 + 9 * c],
+                           tiles_[TILE_PLAIN][0].cells[y], sizeof(tiles_[0][0].cells[y]));
+                }
+            }
+        }
+    }
+
+    unsigned int GetColor(unsigned int value)
+    {
+        unsigned int n = value;
+
+        uint8_t const cid[] = {
+            // 0     2     4     8    16    32    64   128   256   512
+            0x08, 0x9f, 0x6f, 0x5f, 0x4f, 0x4f, 0x3f, 0x3f, 0x2f, 0x2f,
+            0x17, 0xcf, 0xdf, 0xb0, 0xe6, 0xe2, 0xf0, 0xfc, 0xfc, 0xfc,
+            0xac  // 2k    4k    8k
+        };
+
+        if (n < (sizeof(cid) / sizeof(cid[0]))) {
+            return cid[n];
+        } else {
+            return cid[(sizeof(cid) / sizeof(cid[0])) - 1];
+        }
+    }
+
+    void SetColorScheme(int s)
+    {
+        COLORREF cto[16];
+        con.GetOldPalette(cto);
+
+        switch (s) {
+        case 1:
+            ct[0]  = 0x00182028;
+            ct[1]  = 0x00133af1;  // #f13a13
+            ct[2]  = 0x000068ff;  // #ff6800
+            ct[3]  = 0x005c7aff;  // #ff7a5c
+            ct[4]  = 0x00008eff;  // #ff8e00
+            ct[5]  = 0x0000b3ff;  // #ffb300
+            ct[6]  = 0x0000c8f4;  // #f4c800
+            ct[7]  = cto[7];
+            ct[8]  = cto[8];
+            ct[9]  = 0x0062a2ce;  // #cea262
+            ct[10] = 0x0000aa93;  // #93aa00
+            ct[11] = 0x00347d00;  // #007d34
+            ct[12] = 0x001000ff;  // #ff0010
+            ct[13] = 0x008a5300;  // #00538a
+            ct[14] = 0x007a3753;  // #53377a
+            ct[15]  = cto[15];
+            break;
+        case 2:
+            ct[0]  = 0x00251810;
+            ct[1]  = 0x00f990c4 - 0x444444;  // #c490f9
+            ct[2]  = 0x00f99090 - 0x444444;  // #9090f9
+            ct[3]  = 0x00f9c490 - 0x444444;  // #90c4f9
+            ct[4]  = 0x00f9f990 - 0x444444;  // #90f9f9
+            ct[5]  = 0x00c4f990 - 0x444444;  // #90f9c4
+            ct[6]  = 0x0090f990 - 0x444444;  // #90f990
+            ct[7]  = cto[7];
+            ct[8]  = cto[8];
+            ct[9]  = 0x0090f9c4 - 0x444444;  // #c4f990
+            ct[10] = 0x0090f9f9 - 0x444444;  // #f9f990
+            ct[11] = 0x0090c4f9 - 0x444444;  // #f9c490
+            ct[12] = 0x009090f9 - 0x444444;  // #f99090
+            ct[13] = 0x00f990f9 - 0x444444;  // #f990f9
+            ct[14] = 0x00c490f9 - 0x444444;  // #f990c4
+            ct[15]  = cto[15];
+            break;
+#if 0
+        case 3:
+            ct[0]  = 0x000000u + 0x201010u;  //      0
+            ct[1]  = 0x800000u + 0x002828u;  // 800000
+            ct[2]  = 0x008000u + 0x280028u;  //   8000
+            ct[3]  = 0x808000u + 0x000028u;  // 808000
+            ct[4]  = 0x000080u + 0x282800u;  //     80
+            ct[5]  = 0x800080u + 0x002800u;  // 800080
+            ct[6]  = 0x008080u + 0x280000u;  //   8080
+            ct[7]  = 0xc0c0c0u - 0x000000u;  // c0c0c0
+            ct[8]  = 0x808080u - 0x282828u;  // 808080
+            ct[9]  = 0xff0000u - 0x330000u + 0x002222u;  // ff0000
+            ct[10] = 0x00ff00u - 0x003300u + 0x220022u;  //   ff00
+            ct[11] = 0xffff00u - 0x333300u + 0x000022u;  // ffff00
+            ct[12] = 0x0000ffu - 0x000022u + 0x222200u;  //     ff
+            ct[13] = 0xff00ffu - 0x330022u + 0x002200u;  // ff00ff
+            ct[14] = 0x00ffffu - 0x003322u + 0x220000u;  //   ffff
+            ct[15] = 0xffffffu - 0x111111u;
+            break;
+#endif
+        case 3:
+            ct[0]  = 0x222827u;
+            ct[1]  = 0x9e5401u;
+            ct[2]  = 0x04aa74u;
+            ct[3]  = 0xa6831au;
+            ct[4]  = 0x3403a7u;
+            ct[5]  = 0x9c5689u;
+            ct[6]  = 0x49b6b6u;
+            ct[7]  = 0xcacacau;
+            ct[8]  = 0x7c7c7cu;
+            ct[9]  = 0xf58303u;
+            ct[10] = 0x06d08du;
+            ct[11] = 0xe5c258u;
+            ct[12] = 0x4b04f3u;
+            ct[13] = 0xb87da8u;
+            ct[14] = 0x81ccccu;
+            ct[15] = 0xffffffu;
+            break;
+        default:
+            return;
+        }
+
+        con.SetPalette(ct);
+    }
+
+    void ShowScore(const int score)
+    {
+        char buf[32] = { };
+        int unused = snprintf(buf, sizeof(buf) - 1, "%-8d ", score);
+        (void)unused;  // TODO: assert?
+
+        con.Write(0xfu, MESG_X, 5, buf);
+    }
+
+    // writes only the characters that differ from the time shown before
+    void ShowTime(Duration dur, bool show_ms = false)
+    {
+        char buf[TIME_TEXT] = { };
+        char* p = buf;
+
+        if (dur.day > 0) {
+            *p++ = ' ';
+            p = PutDigits(p, dur.day, 1);
+            p = PutText(p, (dur.day > 1 ? " days " : " day "));
+            p = PutDigits(p, dur.hour, 2);
+        } else {
+            if (dur.hour > 0) {
+                *p++ = ' ';
+                p = PutDigits(p, dur.hour, 2);
+            } else {
+                p = PutText(p, " ..");
+            }
+        }
+
+        *p++ = ':';
+        p = PutDigits(p, dur.min, 2);
+        *p++ = ':';
+        p = PutDigits(p, dur.sec, 2);
+
+        if (show_ms) {
+            *p++ = '.';
+            p = PutDigits(p, dur.ms, 3);
+            *p++ = ' ';
+        } else {
+            p = PutText(p, "     ");
+        }
+
+        // blanks what is left of a longer time
+        for (size_t n = strlen(time_text_); (size_t)(p - buf) < n; ) {
+            *p++ = ' ';
+        }
+
+        const WORD color = (show_ms ? 0x7u : 0x8u);
+        size_t first = 0;
+        size_t last = (size_t)(p - buf);
+
+        if ((color == time_color_) && (last == strlen(time_text_))) {
+            while ((first < last) && (buf[first] == time_text_[first])) {
+                ++first;
+            }
+
+            while ((last > first) && (buf[last - 1] == time_text_[last - 1])) {
+                --last;
+            }
+        } else { }
+
+        memcpy(time_text_, buf, sizeof(time_text_));
+        time_color_ = color;
+
+        if (first < last) {
+            buf[last] = '\0';
+            con.Write(color, MESG_X + 10 + (int)first, 5, buf + first);
+        } else { }
+    }
+
+    void ShowHint(int type)
+    {
+        const char* hint;
+
+        switch (type) {
+        case ROW_L2R_STRIPE: hint = "Hint: Left  "; break;
+        case ROW_R2L_STRIPE: hint = "Hint: Right "; break;
+        case COL_U2D_STRIPE: hint = "Hint: Up    "; break;
+        case COL_D2U_STRIPE: hint = "Hint: Down  "; break;
+        default:             hint = "            "; break;
+        }
+
+        con.Write(0x7u, MESG_X, 7, hint);
+    }
+
+    int GetMinHeight()
+    {
+        enum {
+            BOARD_HEIGHT = GRID_Y + N * 4 + 1
+        };
+        return BOARD_HEIGHT;
+    }
+
+  private:
+    struct TextData {
+        const char* grid_top_line;
+        const char* grid_sep_line;
+        const char* grid_mid_line;
+        const char* grid_bot_line;
+        const char* cell_left_pad;
+        const char* cell_right_pad;
+        const char* won_top_line;
+        const char* won_mid_line;
+        const char* won_bot_line;
+        const char* lost_top_line;
+        const char* lost_mid_line;
+        const char* lost_bot_line;
+        // const char* won_message;
+        // const char* lost_message;
+        // const char* won_question;
+        // const char* lost_question;
+        const char* prompt_char;
+        const char* filler_line;
+        const char* underline;
+    };
+
+  public:
+    enum { TILE_W = 8, TILE_H = 3, TILE_KINDS = 31 };  // 0 to 2^29, and ??
+    enum { TILE_PLAIN, TILE_UNDERLINE, TILE_HIGHLIGHT, TILE_STATES };
+
+    // the inside of the board: the rows between the top and the bottom line
+    enum { BOARD_W = 9 * N + 1, BOARD_H = 4 * N - 1 };
+
+    struct TileImage {
+        ConsoleCell cells[TILE_H][TILE_W];
+    };
+
+    const TileImage& Tile(unsigned int n, int state)
+    {
+        return tiles_[state][Min(n & 0x7fu, (unsigned int)TILE_KINDS - 1)];
+    }
+
+    // the board with empty cells, to compose frames on
+    const ConsoleCell* Background()
+    {
+        return &background_[0][0];
+    }
+
+    // draws a frame composed of BOARD_W x BOARD_H cells
+    void ShowBoard(const ConsoleCell* cells)
+    {
+        con.WriteCells(GRID_X, GRID_Y + 1, cells, BOARD_W, BOARD_H);
+    }
+
+  private:
+    // " 127 days 23:59:59.999 " at most
+    enum { TIME_TEXT = 32 };
+
+    // writes v with at least width digits
+    static char* PutDigits(char* p, unsigned int v, unsigned int width)
+    {
+        char digits[10];
+        unsigned int n = 0;
+
+        do {
+            digits[n++] = (char)('0' + v % 10);
+            v /= 10;
+        } while ((v > 0) || (n < width));
+
+        while (n > 0) {
+            *p++ = digits[--n];
+        }
+
+        return p;
+    }
+
+    static char* PutText(char* p, const char* text)
+    {
+        while (*text) {
+            *p++ = *text++;
+        }
+
+        return p;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Grid);
+
+  private:
+    TextData text_;
+    COLORREF ct[16];
+    char time_text_[TIME_TEXT];  // the time as last written, "" after DrawGrid
+    WORD time_color_;
+    bool rank_shown_;  // the line under the message is written
+    TileImage tiles_[TILE_STATES][TILE_KINDS];
+    ConsoleCell background_[BOARD_H][BOARD_W];
+};
+
+union Board4x4 {
+    uint8_t ac[N][N];
+    uint64_t al[N64];  // since N = 4
+};
+
+static_assert((sizeof(Board4x4) >= N * N), "Board4x4: error in size");
+
+// packed board engine {{{
+//
+// A board packed into 64 bits, one nibble per cell: cell (r, c) is nibble
+// (r * N + c), so each row is a 16-bit value with column 0 in the lowest
+// nibble.  Highlight bits are dropped and exponents above 15 saturate.
+//
+static_assert((N == 4), "packed board engine assumes a 4x4 board");
+
+typedef uint64_t PackedBoard;
+
+// splitmix64 finalizer of board mixed with seed, every key bit affects
+// the low bits of the result
+inline uint64_t HashBoard(PackedBoard board, uint64_t seed = 0)
+{
+    uint64_t h = board + seed * 0x9e3779b97f4a7c15ull;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+PackedBoard PackBoard(const Board4x4& board)
+{
+    PackedBoard packed = 0;
+
+    for (int r = 0; r < N; ++r) {
+        for (int c = 0; c < N; ++c) {
+            unsigned int v = board.ac[r][c] & 0x7fu;
+            packed |= (PackedBoard)(v < 0xfu ? v : 0xfu) << (4 * (r * N + c));
+        }
+    }
+
+    return packed;
+}
+
+void UnpackBoard(PackedBoard packed, Board4x4& board)
+{
+    for (int r = 0; r < N; ++r) {
+        for (int c = 0; c < N; ++c) {
+            board.ac[r][c] = (uint8_t)((packed >> (4 * (r * N + c))) & 0xfu);
+        }
+    }
+}
+
+inline unsigned int GetTile(PackedBoard board, int cell)
+{
+    return (unsigned int)(board >> (4 * cell)) & 0xfu;
+}
+
+// board from N * N hex digit exponents in row order, "0000000000000011"
+// has two 2s at the bottom right
+bool ParseBoard(const char* text, PackedBoard& board)
+{
+    board = 0;
+
+    for (int i = 0; i < N * N; ++i) {
+        char ch = text[i];
+        unsigned int v = (ch >= '0' && ch <= '9') ? (unsigned int)(ch - '0') :
+                         (ch >= 'a' && ch <= 'f') ? (unsigned int)(ch - 'a' + 10) :
+                         (ch >= 'A' && ch <= 'F') ? (unsigned int)(ch - 'A' + 10) :
+                         0x10u;
+
+        if (v > 0xfu) {
+            return false;
+        } else { }
+
+        board |= (PackedBoard)v << (4 * i);
+    }
+
+    return text[N * N] == '\0';
+}
+
+inline PackedBoard TransposeBoard(PackedBoard x)
+{
+    PackedBoard a1 = x & 0xf0f00f0ff0f00f0full;
+    PackedBoard a2 = x & 0x0000f0f00000f0f0ull;
+    PackedBoard a3 = x & 0x0f0f00000f0f0000ull;
+    PackedBoard a = a1 | (a2 << 12) | (a3 >> 12);
+    PackedBoard b1 = a & 0xff00ff0000ff00ffull;
+    PackedBoard b2 = a & 0x00ff00ff00000000ull;
+    PackedBoard b3 = a & 0x00000000ff00ff00ull;
+    return b1 | (b2 >> 24) | (b3 << 24);
+}
+
+inline PackedBoard FlipBoardH(PackedBoard x)
+{
+    return ((x & 0x000f000f000f000full) << 12) |
+           ((x & 0x00f000f000f000f0ull) << 4) |
+           ((x & 0x0f000f000f000f00ull) >> 4) |
+           ((x & 0xf000f000f000f000ull) >> 12);
+}
+
+inline PackedBoard FlipBoardV(PackedBoard x)
+{
+    return ((x & 0x000000000000ffffull) << 48) |
+           ((x & 0x00000000ffff0000ull) << 16) |
+           ((x & 0x0000ffff00000000ull) >> 16) |
+           ((x & 0xffff000000000000ull) >> 48);
+}
+
+// Board seen through symmetry sym: bit 2 transposes, then bit 1 flips
+// vertically and bit 0 flips horizontally
+inline PackedBoard TransformBoard(PackedBoard x, int sym)
+{
+    x = (sym & 4) ? TransposeBoard(x) : x;
+    x = (sym & 2) ? FlipBoardV(x) : x;
+    return (sym & 1) ? FlipBoardH(x) : x;
+}
+
+// smallest of the 8 rotations/reflections of board, sym tells which one
+PackedBoard CanonicalBoard(PackedBoard x, int& sym)
+{
+    PackedBoard m = x;
+    sym = 0;
+
+    for (int i = 1; i < 8; ++i) {
+        PackedBoard y = TransformBoard(x, i);
+
+        if (y < m) {
+            m = y;
+            sym = i;
+        } else { }
+    }
+
+    return m;
+}
+
+PackedBoard CanonicalBoard(PackedBoard x)
+{
+    int unused;
+    return CanonicalBoard(x, unused);
+}
+
+// stripe type of a move seen through symmetry sym, or back from it
+int TransformMove(int type, int sym, bool inverse = false)
+{
+    for (int i = 0; i < 3; ++i) {
+        // forward: transpose, flip V, flip H; inverse in reverse order
+        int bit = inverse ? (1 << i) : (4 >> i);
+
+        if ((sym & bit) == 0) {
+            continue;
+        } else { }
+
+        switch (bit) {
+        case 1:
+            type = (type == ROW_L2R_STRIPE) ? ROW_R2L_STRIPE :
+                   (type == ROW_R2L_STRIPE) ? ROW_L2R_STRIPE : type;
+            break;
+        case 2:
+            type = (type == COL_U2D_STRIPE) ? COL_D2U_STRIPE :
+                   (type == COL_D2U_STRIPE) ? COL_U2D_STRIPE : type;
+            break;
+        default:
+            switch (type) {
+            case ROW_L2R_STRIPE: type = COL_U2D_STRIPE; break;
+            case COL_U2D_STRIPE: type = ROW_L2R_STRIPE; break;
+            case ROW_R2L_STRIPE: type = COL_D2U_STRIPE; break;
+            case COL_D2U_STRIPE: type = ROW_R2L_STRIPE; break;
+            default: break;
+            }
+            break;
+        }
+    }
+
+    return type;
+}
+
+// Ranges, out of 256, of a new tile being 2, 4, 8 or 16 for the smallest
+// and largest exponents found by Puzzle2048::CountZeros()
+void GetSpawnRanges(int min, int max, int (&range)[4])
+{
+    // max  1 2 3  4      5  6   7    8   9   10    11
+    //             |             |        |    |     |
+    //      2 4 8 16     32 64 128  256 512 1024  2048
+
+    int r2, r4, r8;  // ranges for 2, 4 and 8 respectively
+
+#define SET($r2, $r4, $r8, $x) \
+        r2 = $r2; \
+        r4 = $r4; \
+        r8 = $r8; \
+        static_assert(($r2+$r4+$r8+$x) == 256, \
+                      "GetSpawnRanges: total of ranges should be 256") \
+
+#define SET2($r2, $r4, $r8, $r22, $r24, $r28) \
+        if (min != 1) { \
+            r2 = $r2; \
+            r4 = $r4; \
+            r8 = $r8; \
+        } else { \
+            r2 = $r22; \
+            r4 = $r24; \
+            r8 = $r28; \
+        } \
+        static_assert(($r2+$r4+$r8) == 256, \
+                      "GetSpawnRanges: total of ranges should be 256"); \
+        static_assert(($r22+$r24+$r28) == 256, \
+                      "GetSpawnRanges: total of ranges should be 256") \
+
+    switch (max) {
+    case 0: case 1: case 2: case 3: case 4:
+        SET(160, 96, 0, 0);
+        break;
+    case 5: case 6: case 7:
+        SET(64, 160, 32, 0);
+        break;
+    case 8: case 9:
+        SET2(0, 208, 48, 120, 120, 16);
+        break;
+    case 10:
+        SET(0, 160, 96, 0);
+        break;
+    default:
+        SET(0, 96, 152, 8);
+        break;
+    }
+#undef SET
+#undef SET2
+
+    range[0] = r2;
+    range[1] = r4;
+    range[2] = r8;
+    range[3] = 256 - r2 - r4 - r8;
+}
+
+struct SpawnModel {
+    int count;          // number of cells a new tile can appear in
+    int cell[N * N];    // nibble index of each candidate cell
+    int range[4];       // ranges of 2, 4, 8 and 16; total is 256
+};
+
+// Mirrors Puzzle2048::AddNew() with its quirks: while more than 2N cells are
+// empty only the first (zeros - N) of them, counted from the bottom right,
+// can get the new tile; min/max are found like CountZeros() does.  Smaller
+// boards of side n use nibbles (r * n + c), see SmallBoard.
+void GetSpawnModel(PackedBoard board, SpawnModel& sm, int n = N)
+{
+    int min = 16;
+    int max = 0;
+    int nz = 0;
+
+    for (int i = 0; i < n * n; ++i) {
+        int v = (int)GetTile(board, i);
+
+        if (v == 0) {
+            ++nz;
+        } else if (v < min) {
+            min = v;
+        } else if (v > max) {
+            max = v;
+        } else { }
+    }
+
+    if (nz > n + n) {
+        nz -= n;
+    } else { }
+
+    sm.count = 0;
+
+    for (int i = n * n; i-- && (sm.count < nz); (void)0) {
+        if (GetTile(board, i) == 0) {
+            sm.cell[sm.count++] = i;
+        } else { }
+    }
+
+    GetSpawnRanges(min, max, sm.range);
+}
+
+// calls f(spawned, probability) for every board the game may spawn on board
+template<typename T>
+void ForEachSpawn(PackedBoard board, T f, int n = N)
+{
+    SpawnModel sm;
+    GetSpawnModel(board, sm, n);
+
+    for (int i = 0; i < sm.count; ++i) {
+        for (int t = 0; t < 4; ++t) {
+            if (sm.range[t]) {
+                f(board | ((PackedBoard)(t + 1) << (4 * sm.cell[i])),
+                  (float)sm.range[t] / (256.0f * (float)sm.count));
+            } else { }
+        }
+    }
+}
+
+//
+// Row lookup tables for moving packed boards.  The tables are generated by
+// Stripe::Nudge() itself, so a move of a packed board gives exactly what
+// the game gives (merged-tile markers aside).  Columns are moved as rows of
+// the transposed board.
+//
+class MoveKernel
+{
+  public:
+    enum { ROWS = 1 << (4 * N) };
+
+    static const MoveKernel& Instance()
+    {
+        static const MoveKernel kernel;  // built on first use
+        return kernel;
+    }
+
+    // moves the board towards stripe type (ROW_L2R_STRIPE etc.), and adds
+    // merged values to score
+    PackedBoard Move(PackedBoard board, int type, int& score) const
+    {
+        switch (type) {
+        case ROW_L2R_STRIPE:
+            return MoveRows(board, left_, left_score_, score);
+        case ROW_R2L_STRIPE:
+            return MoveRows(board, right_, right_score_, score);
+        case COL_U2D_STRIPE:
+            return TransposeBoard(MoveRows(TransposeBoard(board),
+                                           left_, left_score_, score));
+        case COL_D2U_STRIPE:
+            return TransposeBoard(MoveRows(TransposeBoard(board),
+                                           right_, right_score_, score));
+        default:
+            break;
+        }
+
+        return board;
+    }
+
+    // bit (type - 1) is set when a move of stripe type changes the board
+    unsigned int LegalMoves(PackedBoard board) const
+    {
+        unsigned int mask = 0;
+
+        for (int type = ROW_L2R_STRIPE; type <= COL_D2U_STRIPE; ++type) {
+            int unused = 0;
+
+            if (Move(board, type, unused) != board) {
+                mask |= 1u << (type - 1);
+            } else { }
+        }
+
+        return mask;
+    }
+
+    float Evaluate(PackedBoard board) const
+    {
+        PackedBoard t = TransposeBoard(board);
+        float h = 0.0f;
+
+        for (int i = 0; i < N; ++i) {
+            h += heuristic_[(board >> (16 * i)) & 0xffffu];
+            h += heuristic_[(t >> (16 * i)) & 0xffffu];
+        }
+
+        return h;
+    }
+
+  private:
+    struct RowScorer {
+        int value;
+
+        void operator()(int a)
+        {
+            value += a;
+        }
+    };
+
+    MoveKernel()
+    {
+        for (unsigned int row = 0; row < ROWS; ++row) {
+            left_[row] = NudgeRow(row, ROW_L2R_STRIPE, left_score_[row]);
+            right_[row] = NudgeRow(row, ROW_R2L_STRIPE, right_score_[row]);
+            heuristic_[row] = RowHeuristic(row);
+        }
+    }
+
+    static uint16_t NudgeRow(unsigned int row, int type, int& score)
+    {
+        uint8_t aa[N][N] = { };
+
+        for (int c = 0; c < N; ++c) {
+            aa[0][c] = (uint8_t)((row >> (4 * c)) & 0xfu);
+        }
+
+        RowScorer scorer = { 0 };
+        Stripe stripe(type, 0, aa);
+        stripe.Nudge(scorer);
+        score = scorer.value;
+
+        unsigned int result = 0;
+
+        for (int c = 0; c < N; ++c) {
+            unsigned int v = aa[0][c] & 0x7fu;
+            result |= (v < 0xfu ? v : 0xfu) << (4 * c);
+        }
+
+        return (uint16_t)result;
+    }
+
+    // the usual expectimax weights: empty cells, merges, monotonicity and
+    // a penalty on large tiles away from the edges
+    static float RowHeuristic(unsigned int row)
+    {
+        const double LOST_PENALTY = 200000.0;
+        const double MONOTONICITY_POWER = 4.0;
+        const double MONOTONICITY_WEIGHT = 47.0;
+        const double SUM_POWER = 3.5;
+        const double SUM_WEIGHT = 11.0;
+        const double MERGES_WEIGHT = 700.0;
+        const double EMPTY_WEIGHT = 270.0;
+
+        int v[N];
+        double sum = 0.0;
+        int empty = 0;
+        int merges = 0;
+        int prev = 0;
+        int counter = 0;
+
+        for (int c = 0; c < N; ++c) {
+            v[c] = (int)((row >> (4 * c)) & 0xfu);
+            sum += pow((double)v[c], SUM_POWER);
+
+            if (v[c] == 0) {
+                ++empty;
+            } else {
+                if (prev == v[c]) {
+                    ++counter;
+                } else if (counter > 0) {
+                    merges += 1 + counter;
+                    counter = 0;
+                } else { }
+
+                prev = v[c];
+            }
+        }
+
+        if (counter > 0) {
+            merges += 1 + counter;
+        } else { }
+
+        double mono_left = 0.0;
+        double mono_right = 0.0;
+
+        for (int c = 1; c < N; ++c) {
+            double a = pow((double)v[c - 1], MONOTONICITY_POWER);
+            double b = pow((double)v[c], MONOTONICITY_POWER);
+
+            if (v[c - 1] > v[c]) {
+                mono_left += a - b;
+            } else {
+                mono_right += b - a;
+            }
+        }
+
+        return (float)(LOST_PENALTY + EMPTY_WEIGHT * empty +
+                       MERGES_WEIGHT * merges -
+                       MONOTONICITY_WEIGHT * Min(mono_left, mono_right) -
+                       SUM_WEIGHT * sum);
+    }
+
+    static PackedBoard MoveRows(PackedBoard board, const uint16_t* to,
+                                const int* gain, int& score)
+    {
+        PackedBoard moved = 0;
+
+        for (int i = 0; i < N; ++i) {
+            unsigned int row = (unsigned int)(board >> (16 * i)) & 0xffffu;
+            moved |= (PackedBoard)to[row] << (16 * i);
+            score += gain[row];
+        }
+
+        return moved;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(MoveKernel);
+
+  private:
+    uint16_t left_[ROWS];
+    uint16_t right_[ROWS];
+    int left_score_[ROWS];
+    int right_score_[ROWS];
+    float heuristic_[ROWS];
+};
+//
+// Open-addressed set of packed boards, grown to keep the load under 1/2.
+// The empty board is kept aside since 0 marks a free slot.
+//
+class BoardSet
+{
+  public:
+    BoardSet() : keys_(NULL), mask_(0), count_(0), zero_(false)
+    {
+        Resize(1024);
+    }
+    ~BoardSet()
+    {
+        delete[] keys_;
+    }
+
+    // true if board was not in the set yet
+    bool Insert(PackedBoard board)
+    {
+        if (board == 0) {
+            bool fresh = !zero_;
+            zero_ = true;
+            count_ += fresh ? 1 : 0;
+            return fresh;
+        } else if (2 * (count_ + 1) > mask_) {
+            Resize(2 * (mask_ + 1));
+        } else { }
+
+        size_t i = Find(board);
+
+        if (keys_[i] == board) {
+            return false;
+        } else { }
+
+        keys_[i] = board;
+        ++count_;
+        return true;
+    }
+
+    bool Contains(PackedBoard board) const
+    {
+        return (board == 0) ? zero_ : (keys_[Find(board)] == board);
+    }
+
+    size_t Size() const
+    {
+        return count_;
+    }
+
+    void Clear()
+    {
+        memset(keys_, 0, (mask_ + 1) * sizeof(keys_[0]));
+        count_ = 0;
+        zero_ = false;
+    }
+
+  private:
+    // slot holding board or the free slot where it goes
+    size_t Find(PackedBoard board) const
+    {
+        size_t i = (size_t)HashBoard(board) & mask_;
+
+        while (keys_[i] && (keys_[i] != board)) {
+            i = (i + 1) & mask_;
+        }
+
+        return i;
+    }
+
+    void Resize(size_t slots)
+    {
+        PackedBoard* old = keys_;
+        size_t old_slots = old ? mask_ + 1 : 0;
+
+        keys_ = new PackedBoard[slots]();
+        mask_ = slots - 1;
+
+        for (size_t i = 0; i < old_slots; ++i) {
+            if (old[i]) {
+                keys_[Find(old[i])] = old[i];
+            } else { }
+        }
+
+        delete[] old;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(BoardSet);
+
+  private:
+    PackedBoard* keys_;
+    size_t mask_;
+    size_t count_;
+    bool zero_;
+};
+// end of packed board engine }}}
+
+// lock-free transposition table {{{
+struct TTStats {
+    uint64_t probes;
+    uint64_t hits;
+    uint64_t collisions;  // probed bucket was full of other positions
+    uint64_t stores;
+    uint64_t replaced;    // a store evicted another position
+
+    void Add(const TTStats& s)
+    {
+        probes += s.probes;
+        hits += s.hits;
+        collisions += s.collisions;
+        stores += s.stores;
+        replaced += s.replaced;
+    }
+};
+
+//
+// Fixed-size, open-addressed table of evaluated positions shared by search
+// threads without locks.  An entry is 16 bytes: (key ^ data) and data, so
+// an entry torn by concurrent writers fails the XOR check and reads as a
+// miss.  Four entries make one 64-byte bucket; a store evicts an entry of
+// an older search first, then the shallowest one.
+//
+// Keys can be canonicalized over the 8 symmetries of the board.  Note that
+// the spawn rule of AddNew() is not symmetric, so canonical keys trade some
+// accuracy for more hits.
+//
+// Stats are counted into caller-owned TTStats, one per thread, so probes do
+// not share a counter cache line.
+//
+class TranspositionTable
+{
+  public:
+    enum { BUCKET = 4 };
+
+    explicit TranspositionTable(size_t megabytes, bool canonical = false)
+        : table_(NULL), mask_(0), bytes_(0), huge_(false),
+          canonical_(canonical), generation_(1), owned_(true)
+    {
+        size_t buckets = 1;
+
+        while ((buckets * 2 * sizeof(Bucket)) <= (megabytes << 20)) {
+            buckets *= 2;
+        }
+
+        bytes_ = buckets * sizeof(Bucket);
+        table_ = (Bucket*)Allocate(bytes_, huge_);
+        mask_ = table_ ? buckets - 1 : 0;
+    }
+
+    // a table over zeroed memory owned by the caller, e.g. a mapped file
+    TranspositionTable(void* memory, size_t bytes, bool canonical,
+                       uint8_t generation)
+        : table_(NULL), mask_(0), bytes_(0), huge_(false),
+          canonical_(canonical), generation_(generation), owned_(false)
+    {
+        size_t buckets = 1;
+
+        while ((buckets * 2 * sizeof(Bucket)) <= bytes) {
+            buckets *= 2;
+        }
+
+        if (memory && (bytes >= sizeof(Bucket))) {
+            table_ = (Bucket*)memory;
+            bytes_ = buckets * sizeof(Bucket);
+            mask_ = buckets - 1;
+        } else { }
+    }
+
+    ~TranspositionTable()
+    {
+        if (owned_) {
+            Free(table_, bytes_);
+        } else { }
+    }
+
+    // starts a new search; entries of previous searches are replaced first
+    void NewSearch()
+    {
+        generation_ = (uint8_t)(generation_ + 1);
+    }
+
+    bool Probe(PackedBoard board, int depth, float& value, TTStats& stats) const
+    {
+        ++stats.probes;
+
+        if (table_) {
+        } else {
+            return false;
+        }
+
+        uint64_t key = Key(board);
+        Bucket& bucket = table_[Index(key)];
+        int others = 0;
+
+        for (int i = 0; i < BUCKET; ++i) {
+            uint64_t data = bucket.entry[i].data.load(std::memory_order_relaxed);
+            uint64_t check = bucket.entry[i].check.load(std::memory_order_relaxed);
+
+            if ((data & VALID) == 0) {
+                continue;
+            } else if ((check ^ data) != key) {
+                ++others;
+                continue;
+            } else if (Depth(data) >= depth) {
+                value = Value(data);
+                ++stats.hits;
+                return true;
+            } else {
+                return false;
+            }
+        }
+
+        if (others == BUCKET) {
+            ++stats.collisions;
+        } else { }
+
+        return false;
+    }
+
+    void Store(PackedBoard board, int depth, float value, TTStats& stats)
+    {
+        if (table_) {
+        } else {
+            return;
+        }
+
+        uint64_t key = Key(board);
+        Bucket& bucket = table_[Index(key)];
+        int victim = 0;
+        int worst = 0x7fffffff;
+        bool evict = true;
+
+        for (int i = 0; i < BUCKET; ++i) {
+            uint64_t data = bucket.entry[i].data.load(std::memory_order_relaxed);
+            uint64_t check = bucket.entry[i].check.load(std::memory_order_relaxed);
+
+            if ((data & VALID) == 0) {
+                victim = i;
+                evict = false;
+                break;
+            } else if ((check ^ data) == key) {
+                if ((Depth(data) > depth) && (Generation(data) == generation_)) {
+                    return;  // keep the deeper result
+                } else { }
+
+                victim = i;
+                evict = false;
+                break;
+            } else {
+                // depth- and age-preferred: older searches go first
+                int worth = Depth(data) +
+                            ((Generation(data) == generation_) ? 0x100 : 0);
+
+                if (worth < worst) {
+                    worst = worth;
+                    victim = i;
+                } else { }
+            }
+        }
+
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        uint64_t data = VALID | ((uint64_t)generation_ << 40) |
+                        ((uint64_t)(depth & 0xff) << 32) | bits;
+
+        bucket.entry[victim].data.store(data, std::memory_order_relaxed);
+        bucket.entry[victim].check.store(key ^ data, std::memory_order_relaxed);
+
+        ++stats.stores;
+
+        if (evict) {
+            ++stats.replaced;
+        } else { }
+    }
+
+    size_t Capacity() const
+    {
+        return table_ ? (mask_ + 1) * BUCKET : 0;
+    }
+
+    void PrintStats(FILE* out, const TTStats& s, const char* name = "tt") const
+    {
+        fprintf(out, "%s: %u KiB%s, %u entries, probes %llu, hits %llu"
+                " (%.1f%%), collisions %llu, stores %llu, replaced %llu\n",
+                name, (unsigned int)(bytes_ >> 10),
+                (huge_ ? " (huge pages)" : (owned_ ? "" : " (mapped)")),
+                (unsigned int)Capacity(),
+                (unsigned long long)s.probes, (unsigned long long)s.hits,
+                (s.probes ? 100.0 * (double)s.hits / (double)s.probes : 0.0),
+                (unsigned long long)s.collisions,
+                (unsigned long long)s.stores, (unsigned long long)s.replaced);
+    }
+
+  private:
+    struct Entry {
+        std::atomic<uint64_t> check;  // key ^ data
+        std::atomic<uint64_t> data;   // valid | generation | depth | value
+    };
+
+    struct Bucket {
+        Entry entry[BUCKET];
+    };
+
+    static const uint64_t VALID = 1ull << 63;
+
+    uint64_t Key(PackedBoard board) const
+    {
+        return canonical_ ? CanonicalBoard(board) : board;
+    }
+
+    size_t Index(uint64_t key) const
+    {
+        return (size_t)HashBoard(key) & mask_;
+    }
+
+    static int Depth(uint64_t data)
+    {
+        return (int)((data >> 32) & 0xff);
+    }
+
+    static uint8_t Generation(uint64_t data)
+    {
+        return (uint8_t)(data >> 40);
+    }
+
+    static float Value(uint64_t data)
+    {
+        uint32_t bits = (uint32_t)data;
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // zeroed memory, on huge/large pages if the system allows it
+    static void* Allocate(size_t bytes, bool& huge)
+    {
+        void* p = NULL;
+#if defined(_WIN32)
+        // large pages need SeLockMemoryPrivilege, otherwise falls back
+        size_t large = GetLargePageMinimum();
+
+        if (large && ((bytes % large) == 0)) {
+            p = VirtualAlloc(NULL, bytes,
+                             MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                             PAGE_READWRITE);
+        } else { }
+
+        huge = (p != NULL);
+
+        if (p) {
+        } else {
+            p = VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+        }
+#else
+#if defined(MAP_HUGETLB)
+        p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        p = (p == MAP_FAILED) ? NULL : p;
+#endif
+        huge = (p != NULL);
+
+        if (p) {
+        } else {
+            p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            p = (p == MAP_FAILED) ? NULL : p;
+#if defined(MADV_HUGEPAGE)
+            if (p) {
+                madvise(p, bytes, MADV_HUGEPAGE);  // transparent huge pages
+            } else { }
+#endif
+        }
+#endif
+        return p;
+    }
+
+    static void Free(void* p, size_t bytes)
+    {
+        if (p) {
+#if defined(_WIN32)
+            (void)bytes;
+            VirtualFree(p, 0, MEM_RELEASE);
+#else
+            munmap(p, bytes);
+#endif
+        } else { }
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(TranspositionTable);
+
+  private:
+    Bucket* table_;
+    size_t mask_;
+    size_t bytes_;
+    bool huge_;
+    bool canonical_;
+    uint8_t generation_;
+    bool owned_;
+};
+
+static_assert((sizeof(std::atomic<uint64_t>) == 8), "TT: atomic size");
+// end of lock-free transposition table }}}
+
+// memory mapped file {{{
+class MappedFile
+{
+  public:
+    MappedFile()
+        : data_(NULL), size_(0),
+#if defined(_WIN32)
+          file_(INVALID_HANDLE_VALUE), map_(NULL)
+#else
+          fd_(-1)
+#endif
+    { }
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    // Opens or creates path and maps it shared, so other processes mapping
+    // the same file see the same memory.  A writable file smaller than size
+    // is grown (zero filled); size 0 maps the file as it is.
+    bool Open(const char* path, size_t size, bool writable = true)
+    {
+        Close();
+#if defined(_WIN32)
+        file_ = CreateFileA(path,
+                            GENERIC_READ | (writable ? GENERIC_WRITE : 0),
+                            FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+                            writable ? OPEN_ALWAYS : OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, NULL);
+
+        if (file_ == INVALID_HANDLE_VALUE) {
+            return false;
+        } else { }
+
+        LARGE_INTEGER length;
+
+        if (!GetFileSizeEx(file_, &length)) {
+            Close();
+            return false;
+        } else if ((size == 0) || ((uint64_t)length.QuadPart > size)) {
+            size = (size_t)length.QuadPart;
+        } else { }
+
+        if (size == 0) {
+            Close();
+            return false;
+        } else { }
+
+        // a mapping larger than the file extends the file
+        map_ = CreateFileMappingA(file_, NULL,
+                                  writable ? PAGE_READWRITE : PAGE_READONLY,
+                                  (DWORD)((uint64_t)size >> 32),
+                                  (DWORD)(size & 0xffffffffu), NULL);
+        data_ = map_ ? MapViewOfFile(map_,
+                                     writable ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ,
+                                     0, 0, size) : NULL;
+#else
+        fd_ = open(path, writable ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+
+        if (fd_ < 0) {
+            return false;
+        } else { }
+
+        struct stat st;
+
+        if (fstat(fd_, &st) != 0) {
+            Close();
+            return false;
+        } else if ((size == 0) || ((uint64_t)st.st_size > size)) {
+            size = (size_t)st.st_size;
+        } else if (ftruncate(fd_, (off_t)size) != 0) {
+            Close();
+            return false;
+        } else { }
+
+        if (size == 0) {
+            Close();
+            return false;
+        } else { }
+
+        data_ = mmap(NULL, size, PROT_READ | (writable ? PROT_WRITE : 0),
+                     MAP_SHARED, fd_, 0);
+        data_ = (data_ == MAP_FAILED) ? NULL : data_;
+#endif
+
+        if (data_) {
+            size_ = size;
+            return true;
+        } else { }
+
+        Close();
+        return false;
+    }
+
+    void Close()
+    {
+#if defined(_WIN32)
+        if (data_) {
+            UnmapViewOfFile(data_);
+        } else { }
+
+        if (map_) {
+            CloseHandle(map_);
+        } else { }
+
+        if (file_ != INVALID_HANDLE_VALUE) {
+            CloseHandle(file_);
+        } else { }
+
+        map_ = NULL;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_) {
+            munmap(data_, size_);
+        } else { }
+
+        if (fd_ >= 0) {
+            close(fd_);
+        } else { }
+
+        fd_ = -1;
+#endif
+        data_ = NULL;
+        size_ = 0;
+    }
+
+    // exclusive advisory lock of the whole file between processes
+    bool Lock()
+    {
+#if defined(_WIN32)
+        OVERLAPPED ov;
+        ZeroMemory(&ov, sizeof(ov));
+        return LockFileEx(file_, LOCKFILE_EXCLUSIVE_LOCK, 0,
+                          MAXDWORD, MAXDWORD, &ov) != FALSE;
+#else
+        return flock(fd_, LOCK_EX) == 0;
+#endif
+    }
+
+    void Unlock()
+    {
+#if defined(_WIN32)
+        OVERLAPPED ov;
+        ZeroMemory(&ov, sizeof(ov));
+        UnlockFileEx(file_, 0, MAXDWORD, MAXDWORD, &ov);
+#else
+        flock(fd_, LOCK_UN);
+#endif
+    }
+
+    // path names another file than the one mapped, e.g. after a rename
+    bool Moved(const char* path) const
+    {
+#if defined(_WIN32)
+        (void)path;
+        return false;  // a file open here cannot be replaced
+#else
+        struct stat mapped, named;
+        return (fstat(fd_, &mapped) != 0) || (stat(path, &named) != 0) ||
+               (mapped.st_dev != named.st_dev) || (mapped.st_ino != named.st_ino);
+#endif
+    }
+
+    // writes dirty pages back to the file
+    void Flush()
+    {
+        if (data_) {
+#if defined(_WIN32)
+            FlushViewOfFile(data_, size_);
+            FlushFileBuffers(file_);
+#else
+            msync(data_, size_, MS_SYNC);
+#endif
+        } else { }
+    }
+
+    void* Data()
+    {
+        return data_;
+    }
+
+    size_t Size() const
+    {
+        return size_;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(MappedFile);
+
+  private:
+    void* data_;
+    size_t size_;
+#if defined(_WIN32)
+    HANDLE file_;
+    HANDLE map_;
+#else
+    int fd_;
+#endif
+};
+// Writes size bytes to path through a temporary file that is renamed over
+// path, so readers find either the old or the new file, never a torn one.
+bool WriteFileAtomic(const char* path, const void* data, size_t size)
+{
+    char temp[1024];
+
+    if ((size_t)snprintf(temp, sizeof(temp) - 1, "%s.tmp", path) >=
+        sizeof(temp) - 1) {
+        return false;
+    } else { }
+
+    temp[sizeof(temp) - 1] = '\0';
+    const char* p = (const char*)data;
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(temp, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    } else { }
+
+    bool ok = true;
+
+    while (ok && size) {
+        DWORD chunk = (DWORD)Min(size, (size_t)(1u << 30));
+        DWORD written = 0;
+        ok = WriteFile(file, p, chunk, &written, NULL) && (written == chunk);
+        p += chunk;
+        size -= chunk;
+    }
+
+    ok = ok && FlushFileBuffers(file);
+    CloseHandle(file);
+    ok = ok && MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING |
+                                       MOVEFILE_WRITE_THROUGH);
+    if (!ok) {
+        DeleteFileA(temp);
+    } else { }
+#else
+    int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0) {
+        return false;
+    } else { }
+
+    bool ok = true;
+
+    while (ok && size) {
+        ssize_t written = write(fd, p, size);
+        ok = written > 0;
+        p += ok ? written : 0;
+        size -= ok ? (size_t)written : 0;
+    }
+
+    ok = (fsync(fd) == 0) && ok;
+    ok = (close(fd) == 0) && ok;
+    ok = ok && (rename(temp, path) == 0);
+
+    if (!ok) {
+        unlink(temp);
+    } else { }
+#endif
+    return ok;
+}
+
+// cuts the file at path to size bytes, e.g. to drop a record torn by a crash
+bool TruncateFile(const char* path, uint64_t size)
+{
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    LARGE_INTEGER at;
+    at.QuadPart = (LONGLONG)size;
+    bool ok = (file != INVALID_HANDLE_VALUE) &&
+              SetFilePointerEx(file, at, NULL, FILE_BEGIN) &&
+              SetEndOfFile(file);
+
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    } else { }
+
+    return ok;
+#else
+    return truncate(path, (off_t)size) == 0;
+#endif
+}
+// end of memory mapped file }}}
+
+// persistent evaluation cache {{{
+//
+// A transposition table kept in a memory-mapped file, so expectimax values
+// survive between runs and are shared by processes on the same host.  The
+// entries are the lock-free 16-byte entries of TranspositionTable: writers
+// in different processes (or one killed midway) can only produce entries
+// that fail the XOR check.  An entry keeps the depth it was searched to,
+// and a probe takes a value searched at least as deep.
+//
+// The header is validated on open, under an exclusive file lock.  A file
+// never initialized, or left half initialized by a crash ('ready' is
+// written last), is mapped by no one and is initialized in place.  A file
+// of another format, engine version or size may still be mapped by
+// processes of that version, so a new file is renamed over it instead:
+// they keep storing into the old one, which no later open sees.
+//
+class EvalCache
+{
+  public:
+    enum {
+        FORMAT = 1,        // file layout
+        ENGINE = 1,        // bump when heuristics or spawn rules change
+        HEADER_SIZE = 4096
+    };
+
+    EvalCache() : file_(), table_(NULL) { }
+    ~EvalCache()
+    {
+        Close();
+    }
+
+    bool Open(const char* path, size_t megabytes = 64, bool canonical = true)
+    {
+        enum { ATTEMPTS = 4 };
+        Header* h = NULL;
+        uint64_t bytes = 0;
+
+        if (Foreign(path)) {
+            fprintf(stderr, "'%s' is not an evaluation cache, left as it is\n",
+                    path);
+            return false;
+        } else { }
+
+        for (int attempt = 0; !h && (attempt < ATTEMPTS); ++attempt) {
+            Close();
+
+            if (file_.Open(path, 0) && (file_.Size() > HEADER_SIZE)) {
+                // an existing cache keeps its size
+            } else if (!file_.Open(path, HEADER_SIZE + (megabytes << 20))) {
+                return false;
+            } else { }
+
+            if (!file_.Lock()) {
+                file_.Close();
+                return false;
+            } else if (file_.Moved(path)) {
+                continue;  // replaced while waiting for the lock
+            } else { }
+
+            Header& header = *(Header*)file_.Data();
+            bytes = file_.Size() - HEADER_SIZE;
+
+            if (memcmp(header.magic, MAGIC, sizeof(header.magic)) != 0) {
+                // new or all zero, see Foreign(), unless changed since
+                for (size_t i = 0; i < HEADER_SIZE; ++i) {
+                    if (((const char*)file_.Data())[i] != 0) {
+                        Close();
+                        return false;
+                    } else { }
+                }
+
+                Init(file_, bytes, canonical, false);
+                h = &header;
+            } else if (header.ready != 1) {
+                Init(file_, bytes, canonical, true);  // a crash midway
+                h = &header;
+            } else if ((header.format != FORMAT) || (header.engine != ENGINE) ||
+                       (header.table_bytes != bytes)) {
+                if (Replace(path, bytes, canonical)) {
+                } else {
+                    Close();
+                    return false;
+                }
+            } else {
+                h = &header;
+            }
+        }
+
+        if (h) {
+        } else {
+            Close();
+            return false;
+        }
+
+        ++h->runs;
+        file_.Flush();
+        file_.Unlock();
+
+        table_ = new TranspositionTable((char*)file_.Data() + HEADER_SIZE,
+                                        (size_t)bytes, h->canonical != 0,
+                                        (uint8_t)h->runs);
+        return true;
+    }
+
+    void Close()
+    {
+        delete table_;
+        table_ = NULL;
+        file_.Flush();
+        file_.Close();
+    }
+
+    TranspositionTable* Table()
+    {
+        return table_;
+    }
+
+  private:
+    struct Header {
+        char magic[8];
+        uint32_t format;
+        uint32_t engine;
+        uint64_t table_bytes;
+        uint32_t canonical;
+        uint32_t ready;     // 1 once the table area is initialized
+        uint64_t runs;      // number of opens, used as generation
+    };
+
+    static const char MAGIC[8];
+
+    // a file that is neither empty, all zero nor a cache by its magic: one
+    // given by mistake, which must not be overwritten
+    static bool Foreign(const char* path)
+    {
+        FILE* f = fopen(path, "rb");
+        char buffer[4096];
+        size_t n = f ? fread(buffer, 1, sizeof(buffer), f) : 0;
+        bool foreign = false;
+
+        if ((n >= sizeof(MAGIC)) && (memcmp(buffer, MAGIC, sizeof(MAGIC)) == 0)) {
+            // a cache, maybe of another version
+        } else {
+            for (; !foreign && (n > 0); n = fread(buffer, 1, sizeof(buffer), f)) {
+                for (size_t i = 0; i < n; ++i) {
+                    foreign = foreign || (buffer[i] != 0);
+                }
+            }
+        }
+
+        if (f) {
+            fclose(f);
+        } else { }
+
+        return foreign;
+    }
+
+    // clears the table unless it is known to be zero, 'ready' last
+    static void Init(MappedFile& file, uint64_t bytes, bool canonical, bool clear)
+    {
+        Header& h = *(Header*)file.Data();
+        h.ready = 0;
+        file.Flush();
+
+        if (clear) {
+            memset((char*)file.Data() + HEADER_SIZE, 0, (size_t)bytes);
+        } else { }
+
+        memcpy(h.magic, MAGIC, sizeof(h.magic));
+        h.format = FORMAT;
+        h.engine = ENGINE;
+        h.table_bytes = bytes;
+        h.canonical = canonical ? 1 : 0;
+        h.runs = 0;
+        file.Flush();
+        h.ready = 1;
+        file.Flush();
+    }
+
+    // a new cache renamed over the one of file_, which is locked and is
+    // closed; its mappings keep the old file
+    bool Replace(const char* path, uint64_t bytes, bool canonical)
+    {
+        char temp[1024];
+        MappedFile fresh;
+
+        if ((size_t)snprintf(temp, sizeof(temp), "%s.tmp", path) < sizeof(temp)) {
+        } else {
+            return false;
+        }
+
+        remove(temp);  // a file grows but never shrinks when mapped
+
+        if (fresh.Open(temp, (size_t)(HEADER_SIZE + bytes))) {
+        } else {
+            return false;
+        }
+
+        Init(fresh, bytes, canonical, false);  // a new file reads as zeros
+        fresh.Close();
+#if defined(_WIN32)
+        Close();  // a mapped file cannot be replaced
+        bool ok = MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING |
+                                          MOVEFILE_WRITE_THROUGH) != FALSE;
+#else
+        bool ok = (rename(temp, path) == 0);  // still under the lock
+        Close();
+#endif
+
+        if (ok) {
+        } else {
+            remove(temp);
+        }
+
+        return ok;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(EvalCache);
+
+  private:
+    MappedFile file_;
+    TranspositionTable* table_;
+};
+
+const char EvalCache::MAGIC[8] = { 'X', '8', '0', '0', 'W', 'E', 'C', '\0' };
+// end of persistent evaluation cache }}}
+
+// expectimax search {{{
+//
+// Threads that search the root moves, started by the first search that
+// needs them and reused by the later ones, so a search neither creates
+// threads nor allocates.  Searches run by different threads take turns.
+//
+class SearchPool
+{
+  public:
+    enum { WORKERS = COL_D2U_STRIPE - 1 };  // the caller searches one move too
+
+    typedef void (*Task)(void* arg);
+
+    static SearchPool& Instance()
+    {
+        static SearchPool pool;
+        return pool;
+    }
+
+    // runs task(args[i]) for each i < n, returns when all are done
+    void Run(Task task, void* const* args, int n)
+    {
+        std::lock_guard<std::mutex> turn(turn_);
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        if (started_) {
+        } else {
+            for (int i = 0; i < WORKERS; ++i) {
+                worker_[i] = std::thread(&SearchPool::Loop, this);
+            }
+
+            started_ = true;
+        }
+
+        // workers late for the previous run must be done with it
+        idle_.wait(lock, [this] { return active_ == 0; });
+        task_ = task;
+        args_ = args;
+        count_ = n;
+        next_ = 0;
+        done_ = 0;
+        ++generation_;
+        lock.unlock();
+        wake_.notify_all();
+
+        Work(task, args, n);
+
+        lock.lock();
+        idle_.wait(lock, [this, n] { return done_.load() == n; });
+    }
+
+  private:
+    SearchPool()
+        : task_(NULL), args_(NULL), count_(0), next_(0), done_(0),
+          generation_(0), active_(0), started_(false), stop_(false),
+          turn_(), mutex_(), wake_(), idle_() { }
+    ~SearchPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+
+        for (int i = 0; started_ && (i < WORKERS); ++i) {
+            worker_[i].join();
+        }
+    }
+
+    void Loop()
+    {
+        unsigned int seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        for (;;) {
+            wake_.wait(lock, [this, &seen] { return stop_ || (generation_ != seen); });
+
+            if (stop_) {
+                break;
+            } else { }
+
+            seen = generation_;
+            Task task = task_;
+            void* const* args = args_;
+            int count = count_;
+            ++active_;
+            lock.unlock();
+
+            Work(task, args, count);
+
+            lock.lock();
+            --active_;
+            idle_.notify_all();
+        }
+    }
+
+    void Work(Task task, void* const* args, int count)
+    {
+        for (int i = next_++; i < count; i = next_++) {
+            task(args[i]);
+
+            if (++done_ == count) {
+                std::lock_guard<std::mutex> guard(mutex_);
+                idle_.notify_all();
+            } else { }
+        }
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(SearchPool);
+
+  private:
+    Task task_;
+    void* const* args_;
+    int count_;
+    std::atomic<int> next_;
+    std::atomic<int> done_;
+    unsigned int generation_;
+    int active_;
+    bool started_;
+    bool stop_;
+    std::mutex turn_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::thread worker_[WORKERS];
+};
+
+//
+// Max nodes choose a move, chance nodes average over the spawns allowed by
+// GetSpawnModel().  Chance nodes are cached in the transposition table.
+// The root moves are searched by the SearchPool threads sharing the table.
+//
+// With SetCache(), chance nodes of at least CACHE_DEPTH are also looked up
+// in and written to a persistent EvalCache table after a table miss.
+//
+class ExpectiMax
+{
+  public:
+    enum { DEFAULT_DEPTH = 3, CACHE_DEPTH = 2 };
+
+    ExpectiMax(TranspositionTable& tt, int depth, int threads = 0)
+        : depth_(depth < 1 ? 1 : depth),
+          threads_(threads > 0 ? threads
+                   : (int)std::thread::hardware_concurrency()),
+          stats_(), tt_(tt), cache_(NULL), kernel_(MoveKernel::Instance()) { }
+    ~ExpectiMax() { }
+
+    void SetCache(TranspositionTable* cache)
+    {
+        cache_ = cache;
+    }
+
+    // returns the best stripe type or UUS if there is no move
+    int BestMove(PackedBoard board, float* value = NULL)
+    {
+        CounterTimer timer(CTR_SEARCH_NS);
+        AllocPhase phase(ALLOC_SEARCH);
+        float result[COL_D2U_STRIPE + 1] = { };
+        Counters stats[COL_D2U_STRIPE + 1] = { };
+        PackedBoard moved[COL_D2U_STRIPE + 1] = { };
+        Root root[COL_D2U_STRIPE];
+        void* args[COL_D2U_STRIPE];
+        int roots = 0;
+
+        tt_.NewSearch();
+
+        for (int type = ROW_L2R_STRIPE; type <= COL_D2U_STRIPE; ++type) {
+            int unused = 0;
+            moved[type] = kernel_.Move(board, type, unused);
+
+            if (moved[type] == board) {
+            } else {
+                Root r = { this, moved[type], &result[type], &stats[type] };
+                root[roots] = r;
+                args[roots] = &root[roots];
+                ++roots;
+            }
+        }
+
+        if ((threads_ > 1) && (roots > 1)) {
+            SearchPool::Instance().Run(&ExpectiMax::SearchTask, args, roots);
+        } else {
+            for (int i = 0; i < roots; ++i) {
+                SearchTask(args[i]);
+            }
+        }
+
+        int best = UUS;
+
+        for (int type = ROW_L2R_STRIPE; type <= COL_D2U_STRIPE; ++type) {
+            stats_.tt.Add(stats[type].tt);
+            stats_.cache.Add(stats[type].cache);
+
+            if (moved[type] == board) {
+            } else if ((best == UUS) || (result[type] > result[best])) {
+                best = type;
+            } else { }
+        }
+
+        if (value) {
+            *value = (best == UUS) ? 0.0f : result[best];
+        } else { }
+
+        return best;
+    }
+
+    const TTStats& Stats() const
+    {
+        return stats_.tt;
+    }
+
+    const TTStats& CacheStats() const
+    {
+        return stats_.cache;
+    }
+
+  private:
+    struct Counters {
+        TTStats tt;
+        TTStats cache;
+    };
+
+    struct Root {
+        ExpectiMax* search;
+        PackedBoard moved;
+        float* value;
+        Counters* stats;
+    };
+
+    static void SearchTask(void* arg)
+    {
+        AllocPhase phase(ALLOC_SEARCH);
+        Root& root = *(Root*)arg;
+        *root.value = root.search->SearchSpawn(root.moved, root.search->depth_ - 1,
+                                               1.0f, *root.stats);
+    }
+
+    float SearchMove(PackedBoard board, int depth, float prob, Counters& stats)
+    {
+        float best = 0.0f;  // no move, game lost
+
+        for (int type = ROW_L2R_STRIPE; type <= COL_D2U_STRIPE; ++type) {
+            int unused = 0;
+            PackedBoard moved = kernel_.Move(board, type, unused);
+
+            if (moved != board) {
+                best = Max(best, SearchSpawn(moved, depth, prob, stats));
+            } else { }
+        }
+
+        return best;
+    }
+
+    float SearchSpawn(PackedBoard board, int depth, float prob, Counters& stats)
+    {
+        const float PROB_CUTOFF = 0.0001f;
+        counters.Add(CTR_AI_NODES);
+
+        if ((depth <= 0) || (prob < PROB_CUTOFF)) {
+            return kernel_.Evaluate(board);
+        } else { }
+
+        float value;
+        bool cached = cache_ && (depth >= CACHE_DEPTH);
+
+        if (tt_.Probe(board, depth, value, stats.tt)) {
+            return value;
+        } else if (cached && cache_->Probe(board, depth, value, stats.cache)) {
+            tt_.Store(board, depth, value, stats.tt);
+            return value;
+        } else { }
+
+        SpawnModel sm;
+        GetSpawnModel(board, sm);
+
+        if (sm.count == 0) {
+            return kernel_.Evaluate(board);
+        } else { }
+
+        value = 0.0f;
+
+        for (int i = 0; i < sm.count; ++i) {
+            for (int t = 0; t < 4; ++t) {
+                if (sm.range[t]) {
+                    float p = (float)sm.range[t] / (256.0f * (float)sm.count);
+                    PackedBoard spawned = board |
+                        ((PackedBoard)(t + 1) << (4 * sm.cell[i]));
+                    value += p * SearchMove(spawned, depth - 1, prob * p, stats);
+                } else { }
+            }
+        }
+
+        tt_.Store(board, depth, value, stats.tt);
+
+        if (cached) {
+            cache_->Store(board, depth, value, stats.cache);
+        } else { }
+
+        return value;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(ExpectiMax);
+
+  private:
+    int depth_;
+    int threads_;
+    Counters stats_;
+    TranspositionTable& tt_;
+    TranspositionTable* cache_;
+    const MoveKernel& kernel_;
+};
+// end of expectimax search }}}
+
+// opening book {{{
+//
+// Best moves of the positions near the start of a game, precomputed by a
+// deep search (see BookBuilder).  Boards are stored canonical (see
+// CanonicalBoard()) in a minimal perfect hash: a board hashes to a bucket,
+// the bucket's displacement picks its slot, and the key in the slot tells
+// whether the board is in the book at all.  The file is mapped read-only
+// and used in place, so opening a book costs nothing until it is probed.
+//
+// NOTE: the spawn rule of AddNew() is not symmetric, so a move is the one
+// searched for the canonical orientation, carried back to the board.
+//
+class OpeningBook
+{
+  public:
+    enum { FORMAT = 1, KEYS_PER_BUCKET = 4 };
+
+    OpeningBook()
+        : file_(), count_(0), buckets_(0),
+          disp_(NULL), keys_(NULL), moves_(NULL) { }
+    ~OpeningBook()
+    {
+        Close();
+    }
+
+    bool Open(const char* path)
+    {
+        Close();
+
+        if (!file_.Open(path, 0, false) || (file_.Size() < sizeof(Header))) {
+            file_.Close();
+            return false;
+        } else { }
+
+        const char* base = (const char*)file_.Data();
+        const Header& h = *(const Header*)base;
+        size_t keys_at = 0;
+        size_t moves_at = 0;
+
+        if ((memcmp(h.magic, MAGIC, sizeof(h.magic)) != 0) ||
+            (h.format != FORMAT) || (h.engine != EvalCache::ENGINE) ||
+            (h.count == 0) || (h.buckets == 0) ||
+            (Layout(h.count, h.buckets, keys_at, moves_at) > file_.Size())) {
+            file_.Close();
+            return false;
+        } else { }
+
+        count_ = h.count;
+        buckets_ = h.buckets;
+        disp_ = (const int32_t*)(base + sizeof(Header));
+        keys_ = (const PackedBoard*)(base + keys_at);
+        moves_ = (const uint8_t*)(base + moves_at);
+        return true;
+    }
+
+    void Close()
+    {
+        count_ = 0;
+        buckets_ = 0;
+        disp_ = NULL;
+        keys_ = NULL;
+        moves_ = NULL;
+        file_.Close();
+    }
+
+    // best stripe type for board, UUS if the board is not in the book
+    int Lookup(PackedBoard board) const
+    {
+        if (count_ == 0) {
+            return UUS;
+        } else { }
+
+        int sym = 0;
+        PackedBoard key = CanonicalBoard(board, sym);
+        size_t slot = Slot(key, disp_, count_, buckets_);
+
+        if (keys_[slot] != key) {
+            return UUS;
+        } else { }
+
+        return TransformMove(moves_[slot], sym, true);
+    }
+
+    size_t Size() const
+    {
+        return count_;
+    }
+
+    // Writes a book of count distinct canonical boards and their moves,
+    // searched to depth.  Displacements are found for the largest buckets
+    // first while the table is still empty; single-key buckets then take
+    // the free slots directly.
+    static bool Write(const char* path, const PackedBoard* keys,
+                      const uint8_t* moves, size_t count, int depth)
+    {
+        if ((count == 0) || (count > 0x7fffffffu)) {
+            return false;
+        } else { }
+
+        size_t buckets = count / KEYS_PER_BUCKET + 1;
+        std::vector<uint32_t> start(buckets + 1, 0);
+        std::vector<uint32_t> member(count);
+        std::vector<uint32_t> order(buckets);
+
+        for (size_t i = 0; i < count; ++i) {
+            ++start[HashBoard(keys[i]) % buckets + 1];
+        }
+
+        for (size_t b = 0; b < buckets; ++b) {
+            start[b + 1] += start[b];
+            order[b] = (uint32_t)b;
+        }
+
+        std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+
+        for (size_t i = 0; i < count; ++i) {
+            member[fill[HashBoard(keys[i]) % buckets]++] = (uint32_t)i;
+        }
+
+        std::stable_sort(order.begin(), order.end(),
+                         [&start](uint32_t a, uint32_t b) {
+                             return (start[a + 1] - start[a]) >
+                                    (start[b + 1] - start[b]);
+                         });
+
+        std::vector<int32_t> disp(buckets, 0);
+        std::vector<uint32_t> slot(count);
+        std::vector<uint8_t> taken(count, 0);
+        size_t free_slot = 0;
+
+        for (size_t k = 0; k < buckets; ++k) {
+            uint32_t b = order[k];
+            uint32_t n = start[b + 1] - start[b];
+            const uint32_t* m = &member[start[b]];
+
+            if (n == 0) {
+                break;
+            } else if (n == 1) {
+                while (taken[free_slot]) {
+                    ++free_slot;
+                }
+
+                taken[free_slot] = 1;
+                slot[m[0]] = (uint32_t)free_slot;
+                disp[b] = -(int32_t)free_slot - 1;
+                continue;
+            } else { }
+
+            for (int32_t d = 1; disp[b] == 0; ++d) {
+                uint32_t j = 0;
+
+                for (; j < n; ++j) {
+                    slot[m[j]] = (uint32_t)(HashBoard(keys[m[j]], d) % count);
+
+                    if (taken[slot[m[j]]]) {
+                        break;
+                    } else {
+                        taken[slot[m[j]]] = 1;
+                    }
+                }
+
+                if (j == n) {
+                    disp[b] = d;
+                } else if (d == 0x7fffffff) {
+                    return false;  // duplicate keys
+                } else {
+                    while (j--) {
+                        taken[slot[m[j]]] = 0;
+                    }
+                }
+            }
+        }
+
+        size_t keys_at = 0;
+        size_t moves_at = 0;
+        std::vector<char> image(Layout(count, buckets, keys_at, moves_at), 0);
+        Header& h = *(Header*)&image[0];
+
+        memcpy(h.magic, MAGIC, sizeof(h.magic));
+        h.format = FORMAT;
+        h.engine = EvalCache::ENGINE;
+        h.count = (uint32_t)count;
+        h.buckets = (uint32_t)buckets;
+        h.depth = (uint32_t)depth;
+        memcpy(&image[sizeof(Header)], &disp[0], buckets * sizeof(int32_t));
+
+        for (size_t i = 0; i < count; ++i) {
+            memcpy(&image[keys_at + slot[i] * sizeof(PackedBoard)], &keys[i],
+                   sizeof(PackedBoard));
+            image[moves_at + slot[i]] = (char)moves[i];
+        }
+
+        return WriteFileAtomic(path, &image[0], image.size());
+    }
+
+  private:
+    struct Header {
+        char magic[8];
+        uint32_t format;
+        uint32_t engine;    // EvalCache::ENGINE the moves were searched with
+        uint32_t count;
+        uint32_t buckets;
+        uint32_t depth;     // search depth of the moves
+        uint32_t reserved;
+    };
+
+    static const char MAGIC[8];
+
+    // header, displacements, keys (8-byte aligned) and moves
+    static size_t Layout(size_t count, size_t buckets,
+                         size_t& keys_at, size_t& moves_at)
+    {
+        keys_at = (sizeof(Header) + buckets * sizeof(int32_t) + 7) & ~(size_t)7;
+        moves_at = keys_at + count * sizeof(PackedBoard);
+        return moves_at + count;
+    }
+
+    static size_t Slot(PackedBoard key, const int32_t* disp,
+                       size_t count, size_t buckets)
+    {
+        int32_t d = disp[HashBoard(key) % buckets];
+        return (d < 0) ? (size_t)(-(d + 1))
+                       : (size_t)(HashBoard(key, (uint64_t)d) % count);
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(OpeningBook);
+
+  private:
+    MappedFile file_;
+    size_t count_;
+    size_t buckets_;
+    const int32_t* disp_;
+    const PackedBoard* keys_;
+    const uint8_t* moves_;
+};
+
+const char OpeningBook::MAGIC[8] = { 'X', '8', '0', '0', 'W', 'O', 'B', '\0' };
+
+//
+// Walks the game tree from every board Start2048() can deal.  Each
+// canonical position reached within plies moves is searched to depth, and
+// the spawns after its best move are the positions of the next ply.
+//
+class BookBuilder
+{
+  public:
+    enum { DEFAULT_PLIES = 8, DEFAULT_DEPTH = 5, TABLE_MB = 256 };
+
+    BookBuilder(int plies, int depth, TranspositionTable* cache = NULL)
+        : plies_(plies < 1 ? 1 : plies), depth_(depth < 1 ? 1 : depth),
+          cache_(cache) { }
+    ~BookBuilder() { }
+
+    bool Build(const char* path, FILE* log)
+    {
+        const MoveKernel& kernel = MoveKernel::Instance();
+        TranspositionTable tt(TABLE_MB);
+        ExpectiMax search(tt, depth_);
+        BoardSet seen;
+        std::vector<PackedBoard> frontier;
+        std::vector<PackedBoard> next;
+        std::vector<PackedBoard> keys;
+        std::vector<uint8_t> moves;
+        int64_t start = Clock().Ticks_ms();
+
+        search.SetCache(cache_);
+
+        auto queue = [&seen](std::vector<PackedBoard>& to, PackedBoard board) {
+            PackedBoard key = CanonicalBoard(board);
+
+            if (seen.Insert(key)) {
+                to.push_back(key);
+            } else { }
+        };
+
+        ForEachSpawn(0, [&](PackedBoard first, float) {
+            ForEachSpawn(first, [&](PackedBoard second, float) {
+                queue(frontier, second);
+            });
+        });
+
+        for (int ply = 0; (ply < plies_) && !frontier.empty(); ++ply) {
+            for (size_t i = 0; i < frontier.size(); ++i) {
+                int type = search.BestMove(frontier[i]);
+
+                if (type == UUS) {
+                    continue;
+                } else { }
+
+                keys.push_back(frontier[i]);
+                moves.push_back((uint8_t)type);
+
+                // spawns are not symmetric, so every orientation of the
+                // position is played on to reach what a game can reach
+                for (int sym = 0; (sym < 8) && (ply + 1 < plies_); ++sym) {
+                    int unused = 0;
+                    PackedBoard moved =
+                        kernel.Move(TransformBoard(frontier[i], sym),
+                                    TransformMove(type, sym), unused);
+
+                    ForEachSpawn(moved, [&](PackedBoard spawned, float) {
+                        queue(next, spawned);
+                    });
+                }
+            }
+
+            fprintf(log, "ply %d: %u positions, %u in book, %u ms\n", ply + 1,
+                    (unsigned int)frontier.size(), (unsigned int)keys.size(),
+                    (unsigned int)(Clock().Ticks_ms() - start));
+            frontier.swap(next);
+            next.clear();
+        }
+
+        tt.PrintStats(log, search.Stats());
+
+        if (cache_) {
+            tt.PrintStats(log, search.CacheStats(), "cache");
+        } else { }
+
+        return OpeningBook::Write(path, keys.empty() ? NULL : &keys[0],
+                                  moves.empty() ? NULL : &moves[0],
+                                  keys.size(), depth_);
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(BookBuilder);
+
+  private:
+    int plies_;
+    int depth_;
+    TranspositionTable* cache_;
+};
+// end of opening book }}}
+
+// small board tablebase {{{
+//
+// Runs f(begin, end) over count items split into contiguous chunks, one
+// chunk per thread.
+//
+template<typename T>
+void ParallelFor(size_t count, int threads, T f)
+{
+    if (threads < 1) {
+        threads = (int)Max(1u, std::thread::hardware_concurrency());
+    } else { }
+
+    size_t chunk = (count + threads - 1) / threads;
+    std::vector<std::thread> worker;
+
+    for (size_t begin = chunk; begin < count; begin += chunk) {
+        worker.push_back(std::thread(f, begin, Min(begin + chunk, count)));
+    }
+
+    f((size_t)0, Min(chunk, count));
+
+    for (size_t i = 0; i < worker.size(); ++i) {
+        worker[i].join();
+    }
+}
+
+//
+// 3x3 boards packed like PackedBoard, nibble (r * SIDE + c).  A move is
+// made by the 4x4 MoveKernel on the board placed in the corner it moves
+// towards, where the spare row and column stay empty.
+//
+struct SmallBoard {
+    enum { SIDE = 3, CELLS = SIDE * SIDE };
+
+    static PackedBoard Move(PackedBoard board, int type)
+    {
+        int unused = 0;
+        int corner = ((type == ROW_R2L_STRIPE) || (type == COL_D2U_STRIPE));
+        PackedBoard moved = MoveKernel::Instance().Move(Embed(board, corner),
+                                                        type, unused);
+        return Extract(moved, corner);
+    }
+
+    // sum of tile values, which a move keeps and a spawn raises
+    static unsigned int Sum(PackedBoard board)
+    {
+        unsigned int sum = 0;
+
+        for (int i = 0; i < CELLS; ++i) {
+            unsigned int v = GetTile(board, i);
+            sum += v ? (1u << v) : 0;
+        }
+
+        return sum;
+    }
+
+    static unsigned int MaxTile(PackedBoard board)
+    {
+        unsigned int m = 0;
+
+        for (int i = 0; i < CELLS; ++i) {
+            m = Max(m, GetTile(board, i));
+        }
+
+        return m;
+    }
+
+    static PackedBoard Embed(PackedBoard board, int corner)
+    {
+        PackedBoard x = 0;
+
+        for (int r = 0; r < SIDE; ++r) {
+            for (int c = 0; c < SIDE; ++c) {
+                x |= (PackedBoard)GetTile(board, r * SIDE + c) <<
+                     (4 * ((r + corner) * N + c + corner));
+            }
+        }
+
+        return x;
+    }
+
+    static PackedBoard Extract(PackedBoard x, int corner)
+    {
+        PackedBoard board = 0;
+
+        for (int r = 0; r < SIDE; ++r) {
+            for (int c = 0; c < SIDE; ++c) {
+                board |= (PackedBoard)GetTile(x, (r + corner) * N + c + corner) <<
+                         (4 * (r * SIDE + c));
+            }
+        }
+
+        return board;
+    }
+};
+
+//
+// Exact win probabilities of 3x3 games, where reaching the cap tile wins,
+// with spawns as GetSpawnModel() gives them.  Positions (player to move)
+// are grouped into levels by tile sum / 2, keys sorted within a level, so
+// a probe is a binary search of one level.  Keys are the 36 board bits in
+// KEY_BYTES bytes.  The file is mapped read-only.
+//
+class SmallTablebase
+{
+  public:
+    enum { FORMAT = 1, KEY_BYTES = 5 };
+
+    SmallTablebase()
+        : file_(), cap_(0), levels_(0), count_(0),
+          start_(NULL), keys_(NULL), win_(NULL), moves_(NULL) { }
+    ~SmallTablebase()
+    {
+        Close();
+    }
+
+    bool Open(const char* path)
+    {
+        Close();
+
+        if (!file_.Open(path, 0, false) || (file_.Size() < sizeof(Header))) {
+            file_.Close();
+            return false;
+        } else { }
+
+        const char* base = (const char*)file_.Data();
+        const Header& h = *(const Header*)base;
+        Layout layout;
+
+        if ((memcmp(h.magic, MAGIC, sizeof(h.magic)) != 0) ||
+            (h.format != FORMAT) || (h.side != SmallBoard::SIDE) ||
+            (GetLayout(h.levels, h.count, layout) > file_.Size())) {
+            file_.Close();
+            return false;
+        } else { }
+
+        cap_ = h.cap;
+        levels_ = h.levels;
+        count_ = h.count;
+        start_ = (const uint64_t*)(base + layout.start);
+        keys_ = (const uint8_t*)(base + layout.keys);
+        win_ = (const float*)(base + layout.win);
+        moves_ = (const uint8_t*)(base + layout.moves);
+
+        if (start_[levels_] != count_) {
+            Close();
+            return false;
+        } else { }
+
+        return true;
+    }
+
+    void Close()
+    {
+        cap_ = 0;
+        levels_ = 0;
+        count_ = 0;
+        start_ = NULL;
+        keys_ = NULL;
+        win_ = NULL;
+        moves_ = NULL;
+        file_.Close();
+    }
+
+    // win probability and best stripe type (UUS when won or lost) of a
+    // 3x3 board with the player to move; false if it is not reachable
+    bool Probe(PackedBoard board, float& win, int& type) const
+    {
+        size_t level = SmallBoard::Sum(board) / 2;
+
+        if (level >= levels_) {
+            return false;
+        } else { }
+
+        size_t lo = (size_t)start_[level];
+        size_t hi = (size_t)start_[level + 1];
+
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+
+            if (GetKey(mid) < board) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        if ((lo == (size_t)start_[level + 1]) || (GetKey(lo) != board)) {
+            return false;
+        } else { }
+
+        win = win_[lo];
+        type = moves_[lo];
+        return true;
+    }
+
+    unsigned int Cap() const
+    {
+        return cap_;
+    }
+
+    size_t Size() const
+    {
+        return count_;
+    }
+
+    // Writes the positions of each level, sorted, with their win
+    // probabilities and best moves.
+    static bool Write(const char* path, unsigned int cap,
+                      const std::vector<std::vector<PackedBoard> >& keys,
+                      const std::vector<std::vector<float> >& win,
+                      const std::vector<std::vector<uint8_t> >& moves)
+    {
+        size_t count = 0;
+
+        for (size_t level = 0; level < keys.size(); ++level) {
+            count += keys[level].size();
+        }
+
+        Layout layout;
+        std::vector<char> image(GetLayout(keys.size(), count, layout), 0);
+        Header& h = *(Header*)&image[0];
+        uint64_t* start = (uint64_t*)&image[layout.start];
+        size_t at = 0;
+
+        memcpy(h.magic, MAGIC, sizeof(h.magic));
+        h.format = FORMAT;
+        h.side = SmallBoard::SIDE;
+        h.cap = cap;
+        h.levels = (uint32_t)keys.size();
+        h.count = count;
+
+        for (size_t level = 0; level < keys.size(); ++level) {
+            size_t n = keys[level].size();
+            start[level] = at;
+
+            for (size_t i = 0; i < n; ++i) {
+                for (int b = 0; b < KEY_BYTES; ++b) {
+                    image[layout.keys + (at + i) * KEY_BYTES + b] =
+                        (char)(keys[level][i] >> (8 * b));
+                }
+            }
+
+            if (n) {
+                memcpy(&image[layout.win + at * sizeof(float)],
+                       &win[level][0], n * sizeof(float));
+                memcpy(&image[layout.moves + at], &moves[level][0], n);
+            } else { }
+
+            at += n;
+        }
+
+        start[keys.size()] = at;
+        return WriteFileAtomic(path, &image[0], image.size());
+    }
+
+  private:
+    struct Header {
+        char magic[8];
+        uint32_t format;
+        uint32_t side;
+        uint32_t cap;       // exponent of the winning tile
+        uint32_t levels;
+        uint64_t count;
+    };
+
+    struct Layout {
+        size_t start;
+        size_t keys;
+        size_t win;
+        size_t moves;
+    };
+
+    static const char MAGIC[8];
+
+    // header, level starts, keys, win probabilities and moves
+    static size_t GetLayout(size_t levels, size_t count, Layout& layout)
+    {
+        layout.start = sizeof(Header);
+        layout.keys = layout.start + (levels + 1) * sizeof(uint64_t);
+        layout.win = layout.keys + count * KEY_BYTES;
+        layout.moves = layout.win + count * sizeof(float);
+        return layout.moves + count;
+    }
+
+    PackedBoard GetKey(size_t i) const
+    {
+        PackedBoard key = 0;
+
+        for (int b = KEY_BYTES; b-- > 0; (void)0) {
+            key = (key << 8) | keys_[i * KEY_BYTES + b];
+        }
+
+        return key;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(SmallTablebase);
+
+  private:
+    MappedFile file_;
+    unsigned int cap_;
+    size_t levels_;
+    size_t count_;
+    const uint64_t* start_;
+    const uint8_t* keys_;
+    const float* win_;
+    const uint8_t* moves_;
+};
+
+const char SmallTablebase::MAGIC[8] = { 'X', '8', '0', '0', 'W', 'T', 'B', '\0' };
+
+//
+// Solves 3x3 games to the cap tile.  Every move keeps the tile sum and
+// every spawn raises it, so the positions are enumerated forwards level by
+// level, and solved backwards with each level depending only on higher
+// ones.  The positions of a level are split across threads both ways.
+//
+class TablebaseBuilder
+{
+  public:
+    enum { DEFAULT_CAP = 6, MIN_CAP = 5, MAX_CAP = 9 };
+
+    TablebaseBuilder(unsigned int cap, int threads = 0)
+        : cap_(Min<unsigned int>(Max<unsigned int>(cap, MIN_CAP), MAX_CAP)),
+          threads_(threads) { }
+    ~TablebaseBuilder() { }
+
+    bool Build(const char* path, FILE* log)
+    {
+        int64_t start = Clock().Ticks_ms();
+        size_t count = Enumerate();
+
+        fprintf(log, "%u levels, %u positions, %u ms\n",
+                (unsigned int)keys_.size(), (unsigned int)count,
+                (unsigned int)(Clock().Ticks_ms() - start));
+        Solve();
+        fprintf(log, "solved, %u ms\n",
+                (unsigned int)(Clock().Ticks_ms() - start));
+
+        if (!SmallTablebase::Write(path, cap_, keys_, win_, moves_)) {
+            return false;
+        } else { }
+
+        // the opening value read back from the file
+        SmallTablebase table;
+        double win = 0.0;
+        bool ok = table.Open(path);
+
+        ForEachSpawn(0, [&](PackedBoard first, float p) {
+            ForEachSpawn(first, [&](PackedBoard second, float q) {
+                float w = 0.0f;
+                int type = UUS;
+                ok = ok && table.Probe(second, w, type);
+                win += (double)p * q * w;
+            }, SmallBoard::SIDE);
+        }, SmallBoard::SIDE);
+
+        if (ok) {
+            fprintf(log, "tile %u is reached with probability %.6f\n",
+                    1u << cap_, win);
+        } else { }
+
+        return ok;
+    }
+
+  private:
+    typedef std::vector<PackedBoard> Level;
+
+    bool Won(PackedBoard board) const
+    {
+        return SmallBoard::MaxTile(board) >= cap_;
+    }
+
+    void Add(std::vector<Level>& to, PackedBoard board) const
+    {
+        size_t level = SmallBoard::Sum(board) / 2;
+
+        if (level >= to.size()) {
+            to.resize(level + 1);
+        } else { }
+
+        to[level].push_back(board);
+    }
+
+    size_t Enumerate()
+    {
+        size_t count = 0;
+
+        keys_.clear();
+        ForEachSpawn(0, [&](PackedBoard first, float) {
+            ForEachSpawn(first, [&](PackedBoard second, float) {
+                Add(keys_, second);
+            }, SmallBoard::SIDE);
+        }, SmallBoard::SIDE);
+
+        for (size_t level = 0; level < keys_.size(); ++level) {
+            Level& keys = keys_[level];
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+            count += keys.size();
+
+            // successors of each chunk are collected apart, then merged
+            std::vector<std::vector<Level> > found;
+            std::mutex lock;
+
+            ParallelFor(keys.size(), threads_, [&](size_t begin, size_t end) {
+                std::vector<Level> next;
+
+                for (size_t i = begin; i < end; ++i) {
+                    if (Won(keys[i])) {
+                        continue;
+                    } else { }
+
+                    for (int type = ROW_L2R_STRIPE; type <= COL_D2U_STRIPE; ++type) {
+                        PackedBoard moved = SmallBoard::Move(keys[i], type);
+
+                        if (moved != keys[i]) {
+                            ForEachSpawn(moved, [&](PackedBoard spawned, float) {
+                                Add(next, spawned);
+                            }, SmallBoard::SIDE);
+                        } else { }
+                    }
+                }
+
+                for (size_t j = 0; j < next.size(); ++j) {
+                    std::sort(next[j].begin(), next[j].end());
+                    next[j].erase(std::unique(next[j].begin(), next[j].end()),
+                                  next[j].end());
+                }
+
+                std::lock_guard<std::mutex> guard(lock);
+                found.push_back(std::vector<Level>());
+                found.back().swap(next);
+            });
+
+            for (size_t k = 0; k < found.size(); ++k) {
+                for (size_t j = level + 1; j < found[k].size(); ++j) {
+                    if (j >= keys_.size()) {
+                        keys_.resize(j + 1);
+                    } else { }
+
+                    keys_[j].insert(keys_[j].end(), found[k][j].begin(),
+                                    found[k][j].end());
+                }
+            }
+        }
+
+        return count;
+    }
+
+    float Value(PackedBoard board) const
+    {
+        const Level& keys = keys_[SmallBoard::Sum(board) / 2];
+        size_t at = std::lower_bound(keys.begin(), keys.end(), board) -
+                    keys.begin();
+        return win_[SmallBoard::Sum(board) / 2][at];
+    }
+
+    void Solve()
+    {
+        win_.assign(keys_.size(), std::vector<float>());
+        moves_.assign(keys_.size(), std::vector<uint8_t>());
+
+        for (size_t level = keys_.size(); level-- > 0; (void)0) {
+            const Level& keys = keys_[level];
+            std::vector<float>& win = win_[level];
+            std::vector<uint8_t>& moves = moves_[level];
+
+            win.assign(keys.size(), 0.0f);
+            moves.assign(keys.size(), (uint8_t)UUS);
+
+            ParallelFor(keys.size(), threads_, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    if (Won(keys[i])) {
+                        win[i] = 1.0f;
+                        continue;
+                    } else { }
+
+                    // doubles, so that sums of small terms stay exact enough
+                    for (int type = ROW_L2R_STRIPE; type <= COL_D2U_STRIPE; ++type) {
+                        PackedBoard moved = SmallBoard::Move(keys[i], type);
+                        double value = 0.0;
+
+                        if (moved == keys[i]) {
+                            continue;
+                        } else { }
+
+                        ForEachSpawn(moved, [&](PackedBoard spawned, float p) {
+                            value += (double)p * Value(spawned);
+                        }, SmallBoard::SIDE);
+
+                        if ((moves[i] == UUS) || (value > win[i])) {
+                            win[i] = (float)value;
+                            moves[i] = (uint8_t)type;
+                        } else { }
+                    }
+                }
+            });
+        }
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(TablebaseBuilder);
+
+  private:
+    unsigned int cap_;
+    int threads_;
+    std::vector<Level> keys_;
+    std::vector<std::vector<float> > win_;
+    std::vector<std::vector<uint8_t> > moves_;
+};
+// end of small board tablebase }}}
+
+// perft {{{
+//
+// Counts the (move, spawn) sequences from a board to each depth, as a fixed
+// check of move generation and a measure of its speed.  Moves are made by
+// the MoveKernel tables or, with stripe, by Stripe::Nudge() itself; both
+// must give the same counts.
+//
+// Without dedup the tree is walked depth first, its subtrees below
+// SPLIT_DEPTH spread over threads.  With dedup it is expanded a depth at a
+// time, positions reached by several sequences merged in hash maps that
+// keep the number of sequences, so unique states are counted as well.
+//
+class Perft
+{
+  public:
+    enum { MAX_DEPTH = 16, SPLIT_DEPTH = 2, SHARDS = 64 };
+
+    Perft(bool stripe, bool dedup, int threads = 0)
+        : stripe_(stripe), dedup_(dedup),
+          threads_(threads > 0 ? threads
+                   : (int)Max(1u, std::thread::hardware_concurrency())),
+          kernel_(MoveKernel::Instance()) { }
+    ~Perft() { }
+
+    void Run(PackedBoard root, int depth, FILE* log)
+    {
+        uint64_t nodes[MAX_DEPTH + 1] = { };
+        uint64_t unique[MAX_DEPTH + 1] = { };
+        depth = Min(Max(depth, 0), (int)MAX_DEPTH);
+
+        fprintf(log, "perft %s, %d threads%s\n",
+                stripe_ ? "Stripe::Nudge" : "MoveKernel", threads_,
+                dedup_ ? ", merging transpositions" : "");
+        int64_t start = Clock().Ticks_ms();
+
+        if (dedup_) {
+            RunLevels(root, depth, nodes, unique, log);
+        } else {
+            RunTree(root, depth, nodes);
+        }
+
+        int64_t ms = Clock().Ticks_ms() - start;
+        uint64_t total = 0;
+        uint64_t states = 0;
+
+        for (int d = 0; d <= depth; ++d) {
+            total += nodes[d];
+            states += unique[d];
+
+            if (dedup_) {
+                fprintf(log, "depth %2d: %20llu nodes %12llu unique\n", d,
+                        (unsigned long long)nodes[d],
+                        (unsigned long long)unique[d]);
+            } else {
+                fprintf(log, "depth %2d: %20llu nodes\n", d,
+                        (unsigned long long)nodes[d]);
+            }
+        }
+
+        if (dedup_) {
+            // nodes are sums of merged paths, so only states make a rate
+            fprintf(log, "%llu nodes as %llu unique states in %u ms,"
+                    " %llu states/s\n", (unsigned long long)total,
+                    (unsigned long long)states, (unsigned int)ms,
+                    (unsigned long long)(ms > 0 ? states * 1000 / (uint64_t)ms : 0));
+        } else {
+            fprintf(log, "%llu nodes in %u ms, %llu nodes/s\n",
+                    (unsigned long long)total, (unsigned int)ms,
+                    (unsigned long long)(ms > 0 ? total * 1000 / (uint64_t)ms : 0));
+        }
+    }
+
+  private:
+    struct Entry {
+        PackedBoard board;
+        uint64_t paths;     // sequences reaching board
+    };
+
+    //
+    // Open-addressed map of boards to sequence counts.  Boards after a
+    // spawn are never empty, so 0 marks a free slot.
+    //
+    class Counter
+    {
+      public:
+        Counter() : keys_(1024, 0), paths_(1024, 0), count_(0) { }
+
+        void Add(PackedBoard board, uint64_t paths)
+        {
+            if (2 * (count_ + 1) > keys_.size()) {
+                Grow();
+            } else { }
+
+            size_t i = Find(board);
+            count_ += keys_[i] ? 0 : 1;
+            keys_[i] = board;
+            paths_[i] += paths;
+        }
+
+        void Export(std::vector<Entry>& to) const
+        {
+            for (size_t i = 0; i < keys_.size(); ++i) {
+                if (keys_[i]) {
+                    Entry e = { keys_[i], paths_[i] };
+                    to.push_back(e);
+                } else { }
+            }
+        }
+
+      private:
+        size_t Find(PackedBoard board) const
+        {
+            size_t mask = keys_.size() - 1;
+            size_t i = (size_t)HashBoard(board, 1) & mask;
+
+            while (keys_[i] && (keys_[i] != board)) {
+                i = (i + 1) & mask;
+            }
+
+            return i;
+        }
+
+        void Grow()
+        {
+            std::vector<PackedBoard> keys(2 * keys_.size(), 0);
+            std::vector<uint64_t> paths(2 * keys_.size(), 0);
+            keys.swap(keys_);
+            paths.swap(paths_);
+
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (keys[i]) {
+                    size_t j = Find(keys[i]);
+                    keys_[j] = keys[i];
+                    paths_[j] = paths[i];
+                } else { }
+            }
+        }
+
+      private:
+        std::vector<PackedBoard> keys_;
+        std::vector<uint64_t> paths_;
+        size_t count_;
+    };
+
+    struct NullScorer {
+        void operator()(int) { }
+    };
+
+    PackedBoard Move(PackedBoard board, int type) const
+    {
+        if (stripe_) {
+            Board4x4 b;
+            NullScorer scorer;
+            UnpackBoard(board, b);
+
+            for (int i = 0; i < N; ++i) {
+                Stripe s(type, i, b.ac);
+                s.Nudge(scorer);
+            }
+
+            return PackBoard(b);
+        } else {
+            int unused = 0;
+            return kernel_.Move(board, type, unused);
+        }
+    }
+
+    // calls f(child) for the children of board, each move followed by each
+    // spawn
+    template<typename T>
+    void ForEachChild(PackedBoard board, T f) const
+    {
+        for (int type = ROW_L2R_STRIPE; type <= COL_D2U_STRIPE; ++type) {
+            PackedBoard moved = Move(board, type);
+
+            if (moved != board) {
+                ForEachSpawn(moved, [&f](PackedBoard spawned, float) {
+                    f(spawned);
+                });
+            } else { }
+        }
+    }
+
+    void Walk(PackedBoard board, int depth, int left, uint64_t* nodes) const
+    {
+        ++nodes[depth];
+
+        if (left > 0) {
+            ForEachChild(board, [&](PackedBoard child) {
+                Walk(child, depth + 1, left - 1, nodes);
+            });
+        } else { }
+    }
+
+    void RunTree(PackedBoard root, int depth, uint64_t* nodes) const
+    {
+        std::vector<PackedBoard> split(1, root);
+        int top = 0;
+
+        // the first depths are expanded here, then their subtrees in parallel
+        for (; (top < Min(depth, (int)SPLIT_DEPTH)) && !split.empty(); ++top) {
+            std::vector<PackedBoard> next;
+            nodes[top] += split.size();
+
+            for (size_t i = 0; i < split.size(); ++i) {
+                ForEachChild(split[i], [&next](PackedBoard child) {
+                    next.push_back(child);
+                });
+            }
+
+            split.swap(next);
+        }
+
+        std::mutex lock;
+
+        ParallelFor(split.size(), threads_, [&](size_t begin, size_t end) {
+            uint64_t local[MAX_DEPTH + 1] = { };
+
+            for (size_t i = begin; i < end; ++i) {
+                Walk(split[i], top, depth - top, local);
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+
+            for (int d = top; d <= depth; ++d) {
+                nodes[d] += local[d];
+            }
+        });
+    }
+
+    void RunLevels(PackedBoard root, int depth, uint64_t* nodes,
+                   uint64_t* unique, FILE* log) const
+    {
+        Entry first = { root, 1 };
+        std::vector<Entry> level(1, first);
+        int64_t start = Clock().Ticks_ms();
+
+        nodes[0] = 1;
+        unique[0] = 1;
+
+        for (int d = 1; d <= depth; ++d) {
+            // children are merged per chunk, then per shard of the hash
+            size_t chunks = (size_t)threads_ * 4;
+            std::vector<std::vector<Entry> > shard(chunks * SHARDS);
+
+            ParallelFor(chunks, threads_, [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; ++c) {
+                    Counter counter;
+                    std::vector<Entry> found;
+
+                    for (size_t i = c; i < level.size(); i += chunks) {
+                        uint64_t paths = level[i].paths;
+
+                        ForEachChild(level[i].board, [&](PackedBoard child) {
+                            counter.Add(child, paths);
+                        });
+                    }
+
+                    counter.Export(found);
+
+                    for (size_t i = 0; i < found.size(); ++i) {
+                        size_t k = (size_t)HashBoard(found[i].board) % SHARDS;
+                        shard[c * SHARDS + k].push_back(found[i]);
+                    }
+                }
+            });
+
+            std::vector<std::vector<Entry> > merged(SHARDS);
+
+            ParallelFor(SHARDS, threads_, [&](size_t begin, size_t end) {
+                for (size_t k = begin; k < end; ++k) {
+                    Counter counter;
+
+                    for (size_t c = 0; c < chunks; ++c) {
+                        const std::vector<Entry>& part = shard[c * SHARDS + k];
+
+                        for (size_t i = 0; i < part.size(); ++i) {
+                            counter.Add(part[i].board, part[i].paths);
+                        }
+                    }
+
+                    counter.Export(merged[k]);
+                }
+            });
+
+            level.clear();
+
+            for (size_t k = 0; k < SHARDS; ++k) {
+                level.insert(level.end(), merged[k].begin(), merged[k].end());
+            }
+
+            for (size_t i = 0; i < level.size(); ++i) {
+                nodes[d] += level[i].paths;
+            }
+
+            unique[d] = level.size();
+            fprintf(log, "depth %2d done, %u ms\n", d,
+                    (unsigned int)(Clock().Ticks_ms() - start));
+        }
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Perft);
+
+  private:
+    bool stripe_;
+    bool dedup_;
+    int threads_;
+    const MoveKernel& kernel_;
+};
+// end of perft }}}
+
+// packed game {{{
+//
+// A game on a packed board for programs playing without the console, as
+// GameServer sessions and BotRing games.  A request is a move (the stripe
+// type, 1 left, 2 up, 3 right, 4 down), undo, restart or state.  Each
+// request is answered by a GameReply of what changed: the new tile, the
+// points of the move and the packed board after it, in host byte order.
+//
+enum {
+    REQ_UNDO = COL_D2U_STRIPE + 1,
+    REQ_RESTART,
+    REQ_STATE,
+};
+
+enum {
+    REPLY_MOVED,  // the board changed
+    REPLY_SAME,   // nothing moved, or nothing to undo
+    REPLY_OVER,   // moved, and no move is left
+    REPLY_BAD,    // unknown request
+};
+
+struct GameReply {
+    uint8_t request;   // echoed
+    uint8_t status;    // REPLY_MOVED etc.
+    uint8_t cell;      // nibble index of the new tile, 0xff if none
+    uint8_t tile;      // exponent of the new tile
+    uint32_t points;   // won by the move
+    uint32_t score;
+    uint32_t time_ms;  // since the game started
+    PackedBoard board;
+};
+
+static_assert((sizeof(GameReply) == 24), "GameReply: 24 bytes on the wire");
+
+// plain data, so that tables of games can live in mapped memory
+struct PackedGame {
+    PackedBoard board;
+    PackedBoard undo;
+    uint32_t score;
+    uint32_t undo_score;
+    uint32_t rng;       // xorshift32 state, 0 for no game
+    uint32_t start_ms;  // of the game, on the caller's clock
+
+    void Start(uint64_t seed, uint32_t now_ms)
+    {
+        GameReply unused;
+        rng = (uint32_t)HashBoard(seed) | 1u;
+        Restart(now_ms, unused);
+    }
+
+    void Answer(const MoveKernel& kernel, int request, uint32_t now_ms,
+                GameReply& r)
+    {
+        r.request = (uint8_t)request;
+        r.status = REPLY_SAME;
+        r.cell = 0xff;
+        r.tile = 0;
+        r.points = 0;
+
+        if ((request >= ROW_L2R_STRIPE) && (request <= COL_D2U_STRIPE)) {
+            int points = 0;
+            PackedBoard moved = kernel.Move(board, request, points);
+
+            if (moved != board) {
+                undo = board;
+                undo_score = score;
+                board = Spawn(moved, r);
+                score += (uint32_t)points;
+                r.points = (uint32_t)points;
+                r.status = kernel.LegalMoves(board) ? REPLY_MOVED : REPLY_OVER;
+            } else { }
+        } else if (request == REQ_UNDO) {
+            if (undo != board) {
+                board = undo;  // one level, as the game has
+                score = undo_score;
+                r.status = REPLY_MOVED;
+            } else { }
+        } else if (request == REQ_RESTART) {
+            Restart(now_ms, r);
+            r.status = REPLY_MOVED;
+        } else if (request == REQ_STATE) {
+        } else {
+            r.status = REPLY_BAD;
+        }
+
+        r.score = score;
+        r.time_ms = now_ms - start_ms;
+        r.board = board;
+    }
+
+    static uint32_t Next(uint32_t& x)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return x;
+    }
+
+    // the new tile where and as Puzzle2048::AddNew() would put it
+    PackedBoard Spawn(PackedBoard before, GameReply& r)
+    {
+        SpawnModel sm;
+        GetSpawnModel(before, sm);
+
+        if (sm.count) {
+        } else {
+            return before;
+        }
+
+        uint32_t x = Next(rng);
+        int cell = sm.cell[(x >> 8) % (uint32_t)sm.count];
+        int rnd = (int)(x & 0xffu);
+        int t = 0;
+
+        while ((t < 3) && (rnd >= sm.range[t])) {
+            rnd -= sm.range[t];
+            ++t;
+        }
+
+        r.cell = (uint8_t)cell;
+        r.tile = (uint8_t)(t + 1);
+        return before | ((PackedBoard)(t + 1) << (4 * cell));
+    }
+
+    void Restart(uint32_t now_ms, GameReply& r)
+    {
+        board = Spawn(Spawn(0, r), r);
+        undo = board;
+        score = undo_score = 0;
+        start_ms = now_ms;
+    }
+};
+// end of packed game }}}
+
+// game server {{{
+//
+// Many independent games in one process, one per connection to a Unix
+// socket, all served by a single epoll loop.  A request is one byte, and
+// the answer the GameReply of the PackedGame of the connection.
+//
+#if defined(__linux__)
+class GameServer
+{
+  public:
+    enum {
+        QUEUE = 8,       // requests read at once, replies kept for slow clients
+        EVENTS = 256,    // per epoll_wait()
+        BENCH_MS = 3000,
+    };
+
+    GameServer()
+        : listen_fd_(-1), epoll_fd_(-1), signal_fd_(-1), sessions_(NULL),
+          capacity_(0), open_(0), peak_(0), paused_(false), served_(0),
+          requests_(0), seed_(0), start_ms_(0), now_ms_(0), base_kb_(0),
+          peak_kb_(0), path_(), mask_(), old_mask_(), kernel_(MoveKernel::Instance())
+    { }
+    ~GameServer()
+    {
+        Close(true);
+    }
+
+    // binds the socket, and blocks the signals that stop Run() so that they
+    // are read from a signalfd
+    bool Listen(const char* path)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+
+        if (strlen(path) < sizeof(addr.sun_path)) {
+            memcpy(addr.sun_path, path, strlen(path) + 1);
+            memcpy(path_, path, strlen(path) + 1);
+        } else {
+            return false;
+        }
+
+        struct stat st;
+
+        if ((lstat(path, &st) == 0) && S_ISSOCK(st.st_mode)) {
+            unlink(path);  // left by a server that did not exit
+        } else { }
+
+        // sessions are indexed by descriptor, pages are touched as they open
+        capacity_ = RaiseFileLimit();
+        void* p = mmap(NULL, capacity_ * sizeof(Session), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if (p != MAP_FAILED) {
+            sessions_ = (Session*)p;
+        } else {
+            return false;
+        }
+
+        sigemptyset(&mask_);
+        sigaddset(&mask_, SIGINT);
+        sigaddset(&mask_, SIGTERM);
+        sigaddset(&mask_, SIGHUP);
+        sigaddset(&mask_, SIGCHLD);
+        pthread_sigmask(SIG_BLOCK, &mask_, &old_mask_);
+
+        signal_fd_ = signalfd(-1, &mask_, SFD_NONBLOCK | SFD_CLOEXEC);
+        listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+
+        if ((signal_fd_ >= 0) && (listen_fd_ >= 0) && (epoll_fd_ >= 0) &&
+            (bind(listen_fd_, (struct sockaddr*)&addr, sizeof(addr)) == 0) &&
+            (listen(listen_fd_, SOMAXCONN) == 0) &&
+            Watch(listen_fd_, EPOLLIN, EPOLL_CTL_ADD) &&
+            Watch(signal_fd_, EPOLLIN, EPOLL_CTL_ADD)) {
+        } else {
+            Close(false);
+            return false;
+        }
+
+        seed_ = (uint64_t)Clock().Ticks_ns();
+        start_ms_ = Clock().Ticks_ms();
+        base_kb_ = peak_kb_ = ResidentKiB();
+        return true;
+    }
+
+    // serves until SIGINT, SIGTERM, SIGHUP or SIGCHLD
+    void Run(FILE* log)
+    {
+        struct epoll_event events[EVENTS];
+        bool stop = false;
+
+        fprintf(log, "serving on %s, up to %u sessions\n", path_,
+                (unsigned int)capacity_);
+        fflush(log);
+
+        while (!stop) {
+            int n = epoll_wait(epoll_fd_, events, EVENTS, -1);
+
+            if (n < 0) {
+                stop = (errno != EINTR);
+                continue;
+            } else { }
+
+            now_ms_ = (uint32_t)(Clock().Ticks_ms() - start_ms_);
+
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+
+                if (fd == listen_fd_) {
+                    Accept();
+                } else if (fd == signal_fd_) {
+                    stop = true;
+                } else if (events[i].events & EPOLLOUT) {
+                    Flush(fd);
+                } else {
+                    Serve(fd);
+                }
+            }
+        }
+
+        // both resident sizes from statm: ru_maxrss may have peaked before
+        long grown = peak_kb_ - base_kb_;
+
+        fprintf(log, "%llu sessions served, %u at once at most, %llu requests\n",
+                (unsigned long long)served_, peak_,
+                (unsigned long long)requests_);
+        fprintf(log, "process peak resident %ld KiB\n", ResidentPeakKiB());
+        fprintf(log, "session state %u bytes, resident +%ld KiB with %u sessions"
+                " open", (unsigned int)sizeof(Session), grown, peak_);
+
+        if (peak_) {
+            fprintf(log, ", %ld bytes per session\n",
+                    grown * 1024 / (long)peak_);
+        } else {
+            fprintf(log, "\n");
+        }
+    }
+
+    // serves sessions games played by a child process for BENCH_MS, each with
+    // one request in flight, like players waiting for every answer
+    static int Bench(int sessions, FILE* log)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/2048-bench-%d.sock", (int)getpid());
+        GameServer server;
+
+        if (server.Listen(path)) {
+        } else {
+            fprintf(stderr, "cannot listen on '%s'\n", path);
+            return 0;
+        }
+
+        fflush(log);
+        pid_t pid = fork();
+
+        if (pid == 0) {
+            server.Close(false);
+            int ret = Drive(path, sessions, log);
+            fflush(log);
+            _exit(ret ? 0 : 1);
+        } else if (pid < 0) {
+            return 0;
+        } else { }
+
+        server.Run(log);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+    }
+
+  private:
+    // the replies first, so that they are aligned
+    struct Session {
+        GameReply reply[QUEUE];
+        PackedGame game;    // no game while the descriptor is not a session
+        uint16_t pending;   // reply bytes to write
+        uint16_t sent;      // of which written
+        uint8_t waiting;    // for EPOLLOUT
+    };
+
+    // one session per descriptor: as many as the hard limit allows
+    static size_t RaiseFileLimit()
+    {
+        struct rlimit rl;
+
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+            rl.rlim_cur = (rl.rlim_max < (1u << 20)) ? rl.rlim_max : (1u << 20);
+            setrlimit(RLIMIT_NOFILE, &rl);
+            getrlimit(RLIMIT_NOFILE, &rl);
+            return (size_t)rl.rlim_cur;
+        } else {
+            return 1024;
+        }
+    }
+
+    static long ResidentKiB()
+    {
+        long size = 0;
+        long resident = 0;
+        FILE* f = fopen("/proc/self/statm", "r");
+
+        if (f) {
+            if (fscanf(f, "%ld %ld", &size, &resident) != 2) {
+                resident = 0;
+            } else { }
+
+            fclose(f);
+        } else { }
+
+        return resident * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+
+    static long ResidentPeakKiB()
+    {
+        struct rusage ru;
+        return (getrusage(RUSAGE_SELF, &ru) == 0) ? ru.ru_maxrss : 0;
+    }
+
+    bool Watch(int fd, uint32_t events, int op)
+    {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        return epoll_ctl(epoll_fd_, op, fd, &ev) == 0;
+    }
+
+    void Close(bool unlink_path)
+    {
+        const int fds[3] = { listen_fd_, epoll_fd_, signal_fd_ };
+
+        for (int i = 0; i < 3; ++i) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            } else { }
+        }
+
+        if (sessions_) {
+            for (size_t fd = 0; fd < capacity_; ++fd) {
+                if (sessions_[fd].game.rng && unlink_path) {
+                    close((int)fd);
+                } else { }
+            }
+
+            munmap(sessions_, capacity_ * sizeof(Session));
+            pthread_sigmask(SIG_SETMASK, &old_mask_, NULL);
+        } else { }
+
+        if (unlink_path && (listen_fd_ >= 0)) {
+            unlink(path_);
+        } else { }
+
+        listen_fd_ = epoll_fd_ = signal_fd_ = -1;
+        sessions_ = NULL;
+    }
+
+    void Accept()
+    {
+        unsigned int peak = peak_;
+
+        for (;;) {
+            int fd = accept4(listen_fd_, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            if (fd < 0) {
+                if ((errno == EMFILE) || (errno == ENFILE)) {
+                    // full: accepted again when a session closes
+                    paused_ = Watch(listen_fd_, 0, EPOLL_CTL_MOD);
+                } else { }
+
+                if (peak_ > peak) {
+                    peak_kb_ = ResidentKiB();  // once per call, not per session
+                } else { }
+
+                return;
+            } else if (((size_t)fd >= capacity_) ||
+                       !Watch(fd, EPOLLIN, EPOLL_CTL_ADD)) {
+                close(fd);
+                continue;
+            } else { }
+
+            Session& s = sessions_[fd];
+            memset(&s, 0, sizeof(s));
+            s.game.Start(++served_ + seed_, now_ms_);
+            ++open_;
+            peak_ = (open_ > peak_) ? open_ : peak_;
+        }
+    }
+
+    void Drop(int fd)
+    {
+        sessions_[fd].game.rng = 0;
+        close(fd);  // also leaves the epoll set
+        --open_;
+
+        if (paused_) {
+            paused_ = !Watch(listen_fd_, EPOLLIN, EPOLL_CTL_MOD);
+        } else { }
+    }
+
+    // reads at most QUEUE requests, more are left to the socket until the
+    // replies are written
+    void Serve(int fd)
+    {
+        Session& s = sessions_[fd];
+        uint8_t request[QUEUE];
+        ssize_t n = read(fd, request, sizeof(request));
+
+        if (n > 0) {
+            for (ssize_t i = 0; i < n; ++i) {
+                s.game.Answer(kernel_, request[i], now_ms_, s.reply[i]);
+            }
+
+            s.pending = (uint16_t)(n * sizeof(GameReply));
+            s.sent = 0;
+            requests_ += (uint64_t)n;
+            Flush(fd);
+        } else if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+        } else {
+            Drop(fd);
+        }
+    }
+
+    void Flush(int fd)
+    {
+        Session& s = sessions_[fd];
+        ssize_t n = send(fd, (const char*)s.reply + s.sent,
+                         (size_t)(s.pending - s.sent), MSG_NOSIGNAL);
+
+        if (n >= 0) {
+            s.sent = (uint16_t)(s.sent + n);
+        } else if ((errno == EAGAIN) || (errno == EINTR)) {
+        } else {
+            Drop(fd);
+            return;
+        }
+
+        if (s.sent < s.pending) {
+            if (s.waiting) {
+            } else {
+                s.waiting = Watch(fd, EPOLLOUT, EPOLL_CTL_MOD) ? 1 : 0;
+            }
+        } else {
+            s.pending = s.sent = 0;
+
+            if (s.waiting) {
+                s.waiting = Watch(fd, EPOLLIN, EPOLL_CTL_MOD) ? 0 : 1;
+            } else { }
+        }
+    }
+
+    // the client side of Bench(): random moves, a restart when a game ends
+    static bool Drive(const char* path, int sessions, FILE* log)
+    {
+        RaiseFileLimit();
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path, strlen(path) + 1);
+
+        int ep = epoll_create1(EPOLL_CLOEXEC);
+        std::vector<int> fds((size_t)sessions, -1);
+        std::vector<GameReply> replies((size_t)sessions);
+        std::vector<uint8_t> got((size_t)sessions, 0);
+        bool ok = (ep >= 0);
+
+        for (int i = 0; ok && (i < sessions); ++i) {
+            struct epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.u32 = (uint32_t)i;
+            fds[i] = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            ok = (fds[i] >= 0) &&
+                 (connect(fds[i], (struct sockaddr*)&addr, sizeof(addr)) == 0) &&
+                 (fcntl(fds[i], F_SETFL, O_NONBLOCK) == 0) &&
+                 (epoll_ctl(ep, EPOLL_CTL_ADD, fds[i], &ev) == 0);
+
+            if (ok) {
+            } else {
+                fprintf(stderr, "cannot connect session %d: %s\n", i,
+                        strerror(errno));
+            }
+        }
+
+        uint32_t x = 2463534242u;
+        uint64_t requests = 0;
+        uint64_t moves = 0;
+        uint64_t games = 0;
+        int64_t start = Clock().Ticks_ms();
+        int64_t now = start;
+
+        for (int i = 0; ok && (i < sessions); ++i) {
+            uint8_t move = (uint8_t)(ROW_L2R_STRIPE + PackedGame::Next(x) % 4);
+            ok = (write(fds[i], &move, 1) == 1);
+        }
+
+        while (ok && (now - start < BENCH_MS)) {
+            struct epoll_event events[EVENTS];
+            int n = epoll_wait(ep, events, EVENTS, 100);
+
+            for (int k = 0; k < n; ++k) {
+                uint32_t i = events[k].data.u32;
+                ssize_t m = read(fds[i], (char*)&replies[i] + got[i],
+                                 sizeof(GameReply) - got[i]);
+
+                if (m > 0) {
+                    got[i] = (uint8_t)(got[i] + m);
+                } else if ((m < 0) && (errno == EAGAIN)) {
+                    continue;
+                } else {
+                    ok = false;
+                    break;
+                }
+
+                if (got[i] < sizeof(GameReply)) {
+                    continue;
+                } else { }
+
+                got[i] = 0;
+                ++requests;
+                moves += (replies[i].request <= COL_D2U_STRIPE) ? 1u : 0u;
+                uint8_t next;
+
+                if (replies[i].status == REPLY_OVER) {
+                    next = REQ_RESTART;
+                    ++games;
+                } else {
+                    next = (uint8_t)(ROW_L2R_STRIPE + PackedGame::Next(x) % 4);
+                }
+
+                ok = (write(fds[i], &next, 1) == 1);
+            }
+
+            now = Clock().Ticks_ms();
+        }
+
+        int64_t ms = (now > start) ? (now - start) : 1;
+        fprintf(log, "%d sessions, %llu requests in %d ms: %.0f moves/s,"
+                " %llu games played to the end\n", sessions,
+                (unsigned long long)requests, (int)ms,
+                (double)moves * 1000.0 / (double)ms,
+                (unsigned long long)games);
+
+        for (int i = 0; i < sessions; ++i) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            } else { }
+        }
+
+        if (ep >= 0) {
+            close(ep);
+        } else { }
+
+        return ok;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(GameServer);
+
+  private:
+    int listen_fd_;
+    int epoll_fd_;
+    int signal_fd_;
+    Session* sessions_;
+    size_t capacity_;
+    unsigned int open_;
+    unsigned int peak_;
+    bool paused_;
+    uint64_t served_;
+    uint64_t requests_;
+    uint64_t seed_;
+    int64_t start_ms_;
+    uint32_t now_ms_;
+    long base_kb_;  // resident when listening
+    long peak_kb_;  // resident when peak_ sessions were last reached
+    char path_[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    sigset_t mask_;
+    sigset_t old_mask_;
+    const MoveKernel& kernel_;
+};
+#endif  // __linux__
+// end of game server }}}
+
+// bot ring {{{
+//
+// Bots play through a file that the engine and the bot both map: the bot
+// writes requests into one ring and reads replies from another, and neither
+// side makes a system call while the other keeps up.  A request is a
+// uint32_t, the PackedGame request in the low byte and the game (0 to
+// GAMES - 1) above it.  Replies come in the order of requests, reply k in
+// the slot of request k, so a bot keeps at most RING requests unanswered.
+//
+// A side finding nothing new spins a little, then (Linux) sets its sleeping
+// flag and sleeps on a futex; the other side wakes it only when it finds the
+// flag set after publishing.  With spin, it yields instead of sleeping.
+//
+#if !defined(_WIN32)
+struct BotShared {
+    char magic[8];  // "2048BOT1"
+    uint32_t ring;
+    uint32_t games;
+    std::atomic<uint32_t> closed;  // by the bot
+    alignas(64) std::atomic<uint32_t> requests;  // written by the bot
+    std::atomic<uint32_t> engine_sleeping;
+    alignas(64) std::atomic<uint32_t> replies;   // written by the engine
+    std::atomic<uint32_t> bot_sleeping;
+    alignas(64) uint32_t request[4096];
+    GameReply reply[4096];
+};
+
+class BotRing
+{
+  public:
+    enum {
+        RING = 4096,
+        GAMES = 4096,
+        SPINS = 256,
+        BENCH_GAMES = 256,
+    };
+
+    BotRing()
+        : file_(), shared_(NULL), games_(), spin_(false), sent_(0),
+          received_(0), known_(0), sleeps_(0), wakes_(0),
+          kernel_(MoveKernel::Instance())
+    { }
+    ~BotRing() { }
+
+    // for the engine: creates the file, with every game started
+    bool Create(const char* path, bool spin)
+    {
+        if (file_.Open(path, sizeof(BotShared))) {
+        } else {
+            return false;
+        }
+
+        shared_ = (BotShared*)file_.Data();
+        memset((void*)shared_, 0, sizeof(BotShared));
+        memcpy(shared_->magic, "2048BOT1", 8);
+        shared_->ring = RING;
+        shared_->games = GAMES;
+        spin_ = spin;
+
+        uint64_t seed = (uint64_t)Clock().Ticks_ns();
+        games_.resize(GAMES);
+
+        for (size_t g = 0; g < games_.size(); ++g) {
+            games_[g].Start(seed + g, 0);
+        }
+
+        return true;
+    }
+
+    // for a bot: maps a file made by Create()
+    bool Attach(const char* path, bool spin)
+    {
+        if (file_.Open(path, 0) && (file_.Size() >= sizeof(BotShared))) {
+            shared_ = (BotShared*)file_.Data();
+        } else {
+            return false;
+        }
+
+        spin_ = spin;
+        sent_ = received_ = known_ = shared_->requests.load();
+        return (memcmp(shared_->magic, "2048BOT1", 8) == 0) &&
+               (shared_->ring == RING) && (shared_->games == GAMES);
+    }
+
+    // for the engine: answers until the bot closes the ring or the program
+    // is interrupted, and gives the number of requests answered
+    uint64_t Serve()
+    {
+        const uint32_t mask = RING - 1;
+        uint32_t tail = shared_->requests.load(std::memory_order_acquire);
+        uint64_t answered = 0;
+        int64_t start = Clock().Ticks_ms();
+
+        shared_->replies.store(tail);
+
+        while (!shared_->closed.load(std::memory_order_acquire) &&
+               !con.Interrupted()) {
+            uint32_t head = Await(shared_->requests, tail,
+                                  shared_->engine_sleeping);
+            uint32_t now = (uint32_t)(Clock().Ticks_ms() - start);
+
+            for (answered += head - tail; tail != head; ++tail) {
+                uint32_t q = shared_->request[tail & mask];
+                GameReply& r = shared_->reply[tail & mask];
+
+                if ((q >> 8) < GAMES) {
+                    games_[q >> 8].Answer(kernel_, (int)(q & 0xffu), now, r);
+                } else {
+                    memset(&r, 0, sizeof(r));
+                    r.request = (uint8_t)q;
+                    r.status = REPLY_BAD;
+                }
+            }
+
+            Publish(shared_->replies, tail, shared_->bot_sleeping);
+        }
+
+        return answered;
+    }
+
+    // for a bot: queues a request, false while RING are unanswered
+    bool Send(uint32_t game, int request)
+    {
+        if (sent_ - received_ < RING) {
+            shared_->request[sent_ & (RING - 1)] = (game << 8) | (uint32_t)request;
+            ++sent_;
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    // for a bot: hands the queued requests to the engine
+    void Flush()
+    {
+        Publish(shared_->requests, sent_, shared_->engine_sleeping);
+    }
+
+    // for a bot: the next reply, false if there is none and wait is not set
+    bool Receive(GameReply& r, bool wait)
+    {
+        while (received_ == known_) {
+            known_ = shared_->replies.load(std::memory_order_acquire);
+
+            if (received_ != known_) {
+            } else if (!wait || (received_ == sent_)) {
+                return false;
+            } else {
+                Flush();
+                known_ = Await(shared_->replies, known_, shared_->bot_sleeping);
+            }
+        }
+
+        r = shared_->reply[received_++ & (RING - 1)];
+        return true;
+    }
+
+    void Close()
+    {
+        shared_->closed.store(1);
+        Publish(shared_->requests, sent_, shared_->engine_sleeping);
+    }
+
+    // a bot in a child process plays moves random moves, first waiting for
+    // every reply with one game, then with a ring kept full over BENCH_GAMES
+    static int Bench(int moves, bool spin, FILE* log)
+    {
+        char path[64];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/2048-bot-%d",
+                 (stat("/dev/shm", &st) == 0) ? "/dev/shm" : "/tmp",
+                 (int)getpid());
+        BotRing engine;
+
+        if (engine.Create(path, spin)) {
+        } else {
+            fprintf(stderr, "cannot create bot ring '%s'\n", path);
+            return 0;
+        }
+
+        fflush(log);
+        pid_t pid = fork();
+
+        if (pid == 0) {
+            BotRing bot;
+            int ret = bot.Attach(path, spin) ? bot.Drive(moves, log) : 0;
+            fflush(log);
+            _exit(ret ? 0 : 1);
+        } else if (pid < 0) {
+            unlink(path);
+            return 0;
+        } else { }
+
+        uint64_t answered = engine.Serve();
+        int status = 0;
+        waitpid(pid, &status, 0);
+        unlink(path);
+        fprintf(log, "engine: %llu requests, %llu sleeps, %llu wakes\n",
+                (unsigned long long)answered,
+                (unsigned long long)engine.sleeps_,
+                (unsigned long long)engine.wakes_);
+        return WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+    }
+
+  private:
+    static void CpuRelax()
+    {
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+        _mm_pause();
+#elif (defined(__GNUC__) || defined(__clang__)) && \
+      (defined(__i386__) || defined(__x86_64__))
+        __builtin_ia32_pause();
+#endif
+    }
+
+    // value of word once it is not seen, or seen after a while
+    uint32_t Await(std::atomic<uint32_t>& word, uint32_t seen,
+                   std::atomic<uint32_t>& sleeping)
+    {
+        for (int i = 0; i < SPINS; ++i) {
+            uint32_t v = word.load(std::memory_order_acquire);
+
+            if (v != seen) {
+                return v;
+            } else { }
+
+            CpuRelax();
+        }
+
+#if defined(__linux__)
+        if (spin_) {
+        } else {
+            sleeping.store(1);
+
+            if (word.load() == seen) {
+                struct timespec ts = { 0, 100 * 1000000 };
+                syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAIT, seen, &ts,
+                        NULL, 0);
+                ++sleeps_;
+            } else { }
+
+            sleeping.store(0, std::memory_order_relaxed);
+            return word.load(std::memory_order_acquire);
+        }
+#else
+        (void)sleeping;
+#endif
+        std::this_thread::yield();
+        return word.load(std::memory_order_acquire);
+    }
+
+    void Publish(std::atomic<uint32_t>& word, uint32_t value,
+                 std::atomic<uint32_t>& sleeping)
+    {
+        word.store(value);
+
+#if defined(__linux__)
+        if (sleeping.load()) {
+            syscall(SYS_futex, (uint32_t*)&word, FUTEX_WAKE, 1, NULL, NULL, 0);
+            ++wakes_;
+        } else { }
+#else
+        (void)sleeping;
+#endif
+    }
+
+    // the bot of Bench(), restarting games that are over
+    bool Drive(int moves, FILE* log)
+    {
+        std::vector<uint8_t> next(BENCH_GAMES, ROW_L2R_STRIPE);
+        uint32_t x = 2463534242u;
+        GameReply r;
+        int64_t start = Clock().Ticks_ms();
+
+        for (int i = 0; i < moves; ++i) {
+            Send(0, next[0]);
+            Flush();
+
+            if (Receive(r, true)) {
+            } else {
+                return false;
+            }
+
+            next[0] = (r.status == REPLY_OVER) ? (uint8_t)REQ_RESTART :
+                      (uint8_t)(ROW_L2R_STRIPE + PackedGame::Next(x) % 4);
+        }
+
+        fprintf(log, "one game, every reply awaited: ");
+        Report(moves, start, log);
+        start = Clock().Ticks_ms();
+        int queued = 0;
+
+        for (int done = 0; done < moves; (void)0) {
+            while ((queued < moves) &&
+                   Send((uint32_t)(queued % BENCH_GAMES), next[queued % BENCH_GAMES])) {
+                ++queued;
+            }
+
+            Flush();
+
+            for (bool wait = true; Receive(r, wait); wait = false) {
+                int g = done++ % BENCH_GAMES;
+                next[g] = (r.status == REPLY_OVER) ? (uint8_t)REQ_RESTART :
+                          (uint8_t)(ROW_L2R_STRIPE + PackedGame::Next(x) % 4);
+            }
+        }
+
+        fprintf(log, "%d games, ring kept full: ", (int)BENCH_GAMES);
+        Report(moves, start, log);
+        fprintf(log, "bot: %llu sleeps, %llu wakes\n",
+                (unsigned long long)sleeps_, (unsigned long long)wakes_);
+        Close();
+        return true;
+    }
+
+    static void Report(int moves, int64_t start, FILE* log)
+    {
+        int64_t ms = Clock().Ticks_ms() - start;
+        ms = (ms > 0) ? ms : 1;
+        fprintf(log, "%d moves in %d ms, %.0f moves/s\n", moves,
+                (int)ms, (double)moves * 1000.0 / (double)ms);
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(BotRing);
+
+  private:
+    MappedFile file_;
+    BotShared* shared_;
+    std::vector<PackedGame> games_;  // of the engine
+    bool spin_;
+    uint32_t sent_;      // requests queued by the bot
+    uint32_t received_;  // replies read by the bot
+    uint32_t known_;     // replies published, as last seen by the bot
+    uint64_t sleeps_;
+    uint64_t wakes_;
+    const MoveKernel& kernel_;
+};
+
+static_assert((sizeof(((BotShared*)0)->request) / sizeof(uint32_t) ==
+               BotRing::RING), "BotShared: ring size");
+#endif  // !_WIN32
+// end of bot ring }}}
+
+// c api {{{
+//
+// The engine for other programs, see lib2048.h.  A g2048_game is a
+// PackedGame without its timer.
+//
+#if defined(LIB2048_)
+static_assert(((int)G2048_LEFT == ROW_L2R_STRIPE) &&
+              ((int)G2048_UP == COL_U2D_STRIPE) &&
+              ((int)G2048_RIGHT == ROW_R2L_STRIPE) &&
+              ((int)G2048_DOWN == COL_D2U_STRIPE),
+              "lib2048: directions are stripe types");
+
+struct g2048_game {
+    PackedGame game;
+};
+
+extern "C" {
+
+int g2048_version(void)
+{
+    return G2048_VERSION;
+}
+
+g2048_game* g2048_create(uint64_t seed)
+{
+    g2048_game* game = new (std::nothrow) g2048_game;
+
+    if (game) {
+        game->game.Start(seed, 0);
+    } else { }
+
+    return game;
+}
+
+void g2048_destroy(g2048_game* game)
+{
+    delete game;
+}
+
+void g2048_seed(g2048_game* game, uint64_t seed)
+{
+    game->game.rng = (uint32_t)HashBoard(seed) | 1u;
+}
+
+void g2048_restart(g2048_game* game)
+{
+    GameReply unused;
+    game->game.Restart(0, unused);
+}
+
+int g2048_step(g2048_game* game, int direction, g2048_result* result)
+{
+    const MoveKernel& kernel = MoveKernel::Instance();
+    GameReply r;
+
+    if ((direction >= G2048_LEFT) && (direction <= G2048_DOWN)) {
+        game->game.Answer(kernel, direction, 0, r);
+    } else {
+        return -1;
+    }
+
+    int moved = (r.status != REPLY_SAME) ? 1 : 0;
+
+    if (result) {
+        result->moved = (uint8_t)moved;
+        result->done = (r.status == REPLY_OVER) ||
+                       (!moved && !kernel.LegalMoves(r.board));
+        result->spawn_cell = r.cell;
+        result->spawn_tile = r.tile;
+        result->score_delta = r.points;
+    } else { }
+
+    return moved;
+}
+
+size_t g2048_step_batch(g2048_game* const* games, const int* directions,
+                        g2048_result* results, size_t count)
+{
+    size_t moved = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        int m = g2048_step(games[i], directions[i], results ? &results[i] : NULL);
+        moved += (m > 0) ? 1u : 0u;
+    }
+
+    return moved;
+}
+
+unsigned int g2048_legal_moves(const g2048_game* game)
+{
+    return MoveKernel::Instance().LegalMoves(game->game.board);
+}
+
+uint64_t g2048_export(const g2048_game* game, uint32_t* score)
+{
+    if (score) {
+        *score = game->game.score;
+    } else { }
+
+    return game->game.board;
+}
+
+void g2048_import(g2048_game* game, uint64_t board, uint32_t score)
+{
+    game->game.board = game->game.undo = board;
+    game->game.score = game->game.undo_score = score;
+}
+
+}  // extern "C"
+#endif  // LIB2048_
+// end of c api }}}
+
+// move policies {{{
+//
+// A shared object with the plugin functions of lib2048.h.  Functions it
+// does not define are done without: choose_move_batch() by a call of
+// choose_move() per board, the others by nothing.
+//
+class StrategyPlugin
+{
+  public:
+    typedef void* (*OpenFn)(uint64_t seed);
+    typedef void (*CloseFn)(void* ctx);
+    typedef void (*SeedFn)(void* ctx, uint64_t seed);
+    typedef int (*ChooseFn)(uint64_t board, void* ctx);
+    typedef void (*BatchFn)(const uint64_t* boards, int* moves, size_t count,
+                            void* ctx);
+
+    StrategyPlugin()
+        : library_(NULL), ctx_(NULL), open_(NULL), close_(NULL), seed_(NULL),
+          choose_(NULL), batch_(NULL)
+    { }
+    ~StrategyPlugin()
+    {
+        Close();
+    }
+
+    bool Open(const char* path, uint64_t seed)
+    {
+        Close();
+#if defined(_WIN32)
+        library_ = (void*)LoadLibraryA(path);
+#else
+        library_ = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+#endif
+
+        if (library_) {
+        } else {
+            return false;
+        }
+
+        open_ = (OpenFn)Symbol("plugin_open");
+        close_ = (CloseFn)Symbol("plugin_close");
+        seed_ = (SeedFn)Symbol("plugin_seed");
+        choose_ = (ChooseFn)Symbol("choose_move");
+        batch_ = (BatchFn)Symbol("choose_move_batch");
+        ctx_ = open_ ? open_(seed) : NULL;
+
+        if (choose_ && (ctx_ || !open_)) {
+            return true;
+        } else {
+            Close();
+            return false;
+        }
+    }
+
+    void Close()
+    {
+        if (ctx_ && close_) {
+            close_(ctx_);
+        } else { }
+
+        if (library_) {
+#if defined(_WIN32)
+            FreeLibrary((HMODULE)library_);
+#else
+            dlclose(library_);
+#endif
+        } else { }
+
+        library_ = ctx_ = NULL;
+        open_ = NULL;  // they pointed into the library
+        close_ = NULL;
+        seed_ = NULL;
+        choose_ = NULL;
+        batch_ = NULL;
+    }
+
+    void Seed(uint64_t seed)
+    {
+        if (seed_) {
+            seed_(ctx_, seed);
+        } else { }
+    }
+
+    int Choose(PackedBoard board)
+    {
+        return choose_(board, ctx_);
+    }
+
+    // one call for all boards, if the plugin takes them so
+    void Choose(const PackedBoard* boards, int* moves, size_t count)
+    {
+        if (batch_) {
+            batch_(boards, moves, count, ctx_);
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                moves[i] = choose_(boards[i], ctx_);
+            }
+        }
+    }
+
+  private:
+    void* Symbol(const char* name)
+    {
+#if defined(_WIN32)
+        return (void*)GetProcAddress((HMODULE)library_, name);
+#else
+        return dlsym(library_, name);
+#endif
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(StrategyPlugin);
+
+  private:
+    void* library_;
+    void* ctx_;
+    OpenFn open_;
+    CloseFn close_;
+    SeedFn seed_;
+    ChooseFn choose_;
+    BatchFn batch_;
+};
+
+//
+// Ways of choosing a move for a packed board, named on the command line:
+// "heuristic" takes the move whose board evaluates best right after it,
+// "expectimax:D" searches D plies deep with a table of its own,
+// "rollouts:N" plays N games of random moves after each move and takes the
+// best mean score, and "plugin:PATH" asks the StrategyPlugin at PATH.  A
+// policy is used by one thread at a time.
+//
+class MovePolicy
+{
+  public:
+    enum { HEURISTIC, EXPECTIMAX, ROLLOUTS, PLUGIN };
+    enum { DEFAULT_ROLLOUTS = 100, MAX_ROLLOUTS = 100000, TT_MB = 16 };
+
+    MovePolicy()
+        : kind_(HEURISTIC), param_(0), rng_(1), tt_(NULL), search_(NULL),
+          plugin_(), kernel_(MoveKernel::Instance())
+    { }
+    ~MovePolicy()
+    {
+        delete search_;
+        delete tt_;
+    }
+
+    // false if name is none of the policies
+    static bool Parse(const char* name, int& kind, int& param)
+    {
+        const char* colon = strchr(name, ':');
+        size_t len = colon ? (size_t)(colon - name) : strlen(name);
+        param = colon ? atoi(colon + 1) : 0;
+
+        if ((len == 9) && (strncmp(name, "heuristic", len) == 0) && !colon) {
+            kind = HEURISTIC;
+            return true;
+        } else if ((len == 10) && (strncmp(name, "expectimax", len) == 0)) {
+            kind = EXPECTIMAX;
+            param = colon ? param : (int)ExpectiMax::DEFAULT_DEPTH;
+            return (param >= 1) && (param <= 9);
+        } else if ((len == 8) && (strncmp(name, "rollouts", len) == 0)) {
+            kind = ROLLOUTS;
+            param = colon ? param : (int)DEFAULT_ROLLOUTS;
+            return (param >= 1) && (param <= MAX_ROLLOUTS);
+        } else if ((len == 6) && (strncmp(name, "plugin", len) == 0)) {
+            kind = PLUGIN;
+            param = 0;
+            return colon && colon[1];
+        } else {
+            return false;
+        }
+    }
+
+    bool Set(const char* name, uint64_t seed)
+    {
+        if (Parse(name, kind_, param_)) {
+        } else {
+            return false;
+        }
+
+        plugin_.Close();
+        Seed(seed);
+        delete search_;
+        delete tt_;
+        search_ = NULL;
+        tt_ = NULL;
+
+        if (kind_ == EXPECTIMAX) {
+            tt_ = new TranspositionTable(TT_MB);
+            search_ = new ExpectiMax(*tt_, param_, 1);
+        } else if (kind_ == PLUGIN) {
+            if (plugin_.Open(strchr(name, ':') + 1, seed)) {
+            } else {
+                fprintf(stderr, "cannot load plugin '%s'\n", strchr(name, ':') + 1);
+                return false;
+            }
+        } else { }
+
+        return true;
+    }
+
+    // random numbers of rollouts or of a plugin from seed, e.g. to replay
+    // a game
+    void Seed(uint64_t seed)
+    {
+        rng_ = (uint32_t)HashBoard(seed) | 1u;
+        plugin_.Seed(seed);
+    }
+
+    // random state of rollouts, to go on with a game where it was left
+    uint32_t Rng() const
+    {
+        return rng_;
+    }
+
+    void SetRng(uint32_t rng)
+    {
+        rng_ = rng;
+    }
+
+    // stripe type of the chosen move, UUS if there is no move; value is the
+    // evaluation, the expected evaluation or the mean score of the move
+    int Choose(PackedBoard board, float& value)
+    {
+        int best = UUS;
+        value = 0.0f;
+
+        if (kind_ == EXPECTIMAX) {
+            return search_->BestMove(board, &value);
+        } else if (kind_ == PLUGIN) {
+            return Legal(board, plugin_.Choose(board));
+        } else { }
+
+        for (int type = ROW_L2R_STRIPE; type <= COL_D2U_STRIPE; ++type) {
+            int points = 0;
+            PackedBoard moved = kernel_.Move(board, type, points);
+            float v;
+
+            if (moved == board) {
+                continue;
+            } else if (kind_ == HEURISTIC) {
+                v = kernel_.Evaluate(moved);
+            } else {
+                v = Rollouts(board, type);
+            }
+
+            if ((best == UUS) || (v > value)) {
+                best = type;
+                value = v;
+            } else { }
+        }
+
+        return best;
+    }
+
+    // Choose() of each board, with the boards of a plugin passed in one call
+    void Choose(const PackedBoard* boards, int* moves, float* values,
+                size_t count)
+    {
+        if (kind_ == PLUGIN) {
+            plugin_.Choose(boards, moves, count);
+
+            for (size_t i = 0; i < count; ++i) {
+                moves[i] = Legal(boards[i], moves[i]);
+                values[i] = 0.0f;
+            }
+        } else {
+            for (size_t i = 0; i < count; ++i) {
+                moves[i] = Choose(boards[i], values[i]);
+            }
+        }
+    }
+
+  private:
+    // a plugin's move if it moves the board, else UUS so games end
+    int Legal(PackedBoard board, int type) const
+    {
+        bool legal = (type >= ROW_L2R_STRIPE) && (type <= COL_D2U_STRIPE) &&
+                     ((kernel_.LegalMoves(board) >> (type - 1)) & 1u);
+        return legal ? type : (int)UUS;
+    }
+
+    // mean final score of param_ games of random legal moves after type
+    float Rollouts(PackedBoard board, int type)
+    {
+        double total = 0.0;
+
+        for (int n = 0; n < param_; ++n) {
+            PackedGame game = { board, board, 0, 0, rng_, 0 };
+            GameReply r;
+            game.Answer(kernel_, type, 0, r);
+
+            while (r.status != REPLY_OVER) {
+                unsigned int mask = kernel_.LegalMoves(game.board);
+                int legal[COL_D2U_STRIPE];
+                int count = 0;
+
+                for (int t = ROW_L2R_STRIPE; t <= COL_D2U_STRIPE; ++t) {
+                    if (mask & (1u << (t - 1))) {
+                        legal[count++] = t;
+                    } else { }
+                }
+
+                game.Answer(kernel_, legal[PackedGame::Next(game.rng) % count],
+                            0, r);
+            }
+
+            rng_ = game.rng;
+            total += game.score;
+        }
+
+        return (float)(total / param_);
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(MovePolicy);
+
+  private:
+    int kind_;
+    int param_;
+    uint32_t rng_;
+    TranspositionTable* tt_;
+    ExpectiMax* search_;
+    StrategyPlugin plugin_;
+    const MoveKernel& kernel_;
+};
+
+inline const char* MoveName(int type)
+{
+    switch (type) {
+    case ROW_L2R_STRIPE: return "left";
+    case COL_U2D_STRIPE: return "up";
+    case ROW_R2L_STRIPE: return "right";
+    case COL_D2U_STRIPE: return "down";
+    default: break;
+    }
+
+    return "none";
+}
+// end of move policies }}}
+
+// move oracle {{{
+//
+// Best moves of boards read from standard input, a line each: 16 hex digit
+// exponents as for --board, a packed board as 0x and hex digits, or 16 tile
+// values.  A line is answered by the move and its value, or "error".
+//
+// Lines are taken as they come: the reading thread cuts what it has into
+// chunks of up to CHUNK lines and queues them, workers started once, with a
+// policy each, answer a chunk at a time (in one call for plugins), and a
+// writing thread prints the chunks in order, flushing whenever the next
+// one is not done.  A slow stream is answered line by line without waiting
+// for threads to start, and reading goes on while chunks are answered.
+//
+class MoveOracle
+{
+  public:
+    enum {
+        BUFFER = 1 << 16,
+        LINE = 256,
+        CHUNK = 256,      // lines answered at once by a worker
+        IN_FLIGHT = 256,  // chunks read but not yet written
+    };
+
+    MoveOracle()
+        : policies_(), threads_(1), mutex_(), work_(), done_(), space_(),
+          pending_(), order_(), reading_(false) { }
+    ~MoveOracle()
+    {
+        for (size_t i = 0; i < policies_.size(); ++i) {
+            delete policies_[i];
+        }
+    }
+
+    bool Set(const char* policy)
+    {
+        threads_ = (int)Max(1u, std::thread::hardware_concurrency());
+
+        for (int i = 0; i < threads_; ++i) {
+            policies_.push_back(new MovePolicy);
+
+            if (policies_.back()->Set(policy, (uint64_t)i + 1)) {
+            } else {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // answers until the end of input
+    bool Run(int in, FILE* out)
+    {
+        std::vector<std::thread> workers;
+        reading_ = true;
+
+        for (int t = 0; t < threads_; ++t) {
+            workers.push_back(std::thread(&MoveOracle::Work, this, t));
+        }
+
+        std::thread writer(&MoveOracle::Write, this, out);
+        Read(in);
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            reading_ = false;
+        }
+        work_.notify_all();
+        done_.notify_all();
+
+        for (size_t i = 0; i < workers.size(); ++i) {
+            workers[i].join();
+        }
+
+        writer.join();
+        return !ferror(out);
+    }
+
+  private:
+    struct Chunk {
+        Chunk() : boards(), parsed(), moves(), values(), done(false) { }
+
+        std::vector<PackedBoard> boards;
+        std::vector<uint8_t> parsed;
+        std::vector<int> moves;
+        std::vector<float> values;
+        bool done;
+    };
+
+    // queues the lines of in as they come
+    void Read(int in)
+    {
+        std::vector<char> buffer(BUFFER);
+        Chunk* chunk = new Chunk;
+        size_t used = 0;
+        bool more = true;
+
+        while (more) {
+#if defined(_WIN32)
+            int n = _read(in, &buffer[used], (unsigned int)(BUFFER - used));
+#else
+            ssize_t n = read(in, &buffer[used], BUFFER - used);
+
+            if ((n < 0) && (errno == EINTR)) {
+                continue;
+            } else { }
+#endif
+            more = (n > 0);
+            used += more ? (size_t)n : 0;
+
+            // complete lines, and at the end a last line without newline
+            size_t begin = 0;
+
+            for (size_t i = 0; i < used; ++i) {
+                if ((buffer[i] == '\n') || (!more && (i + 1 == used))) {
+                    size_t end = (buffer[i] == '\n') ? i : i + 1;
+                    PackedBoard board = 0;
+                    chunk->parsed.push_back(ParseLine(&buffer[begin], end - begin,
+                                                      board));
+                    chunk->boards.push_back(board);
+                    begin = i + 1;
+                } else { }
+
+                if (chunk->boards.size() == CHUNK) {
+                    Submit(chunk);
+                    chunk = new Chunk;
+                } else { }
+            }
+
+            if ((begin == 0) && (used == BUFFER)) {
+                begin = used;  // a line too long for the buffer
+                chunk->parsed.push_back(0);
+                chunk->boards.push_back(0);
+            } else { }
+
+            memmove(&buffer[0], &buffer[begin], used - begin);
+            used -= begin;
+
+            if (chunk->boards.empty()) {
+            } else {
+                Submit(chunk);
+                chunk = new Chunk;
+            }
+        }
+
+        delete chunk;
+    }
+
+    // hands chunk to the workers, waiting while IN_FLIGHT are unwritten
+    void Submit(Chunk* chunk)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        space_.wait(lock, [this] { return order_.size() < IN_FLIGHT; });
+        pending_.push_back(chunk);
+        order_.push_back(chunk);
+        lock.unlock();
+        work_.notify_one();
+    }
+
+    // answers chunks with the policy of thread t until reading is over
+    void Work(int t)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        for (;;) {
+            work_.wait(lock, [this] { return !pending_.empty() || !reading_; });
+
+            if (pending_.empty()) {
+                return;
+            } else { }
+
+            Chunk& c = *pending_.front();
+            pending_.pop_front();
+            lock.unlock();
+
+            c.moves.resize(c.boards.size());
+            c.values.resize(c.boards.size());
+            policies_[(size_t)t]->Choose(&c.boards[0], &c.moves[0], &c.values[0],
+                                         c.boards.size());
+
+            for (size_t i = 0; i < c.boards.size(); ++i) {
+                c.moves[i] = c.parsed[i] ? c.moves[i] : -1;
+            }
+
+            lock.lock();
+            c.done = true;
+            done_.notify_all();
+        }
+    }
+
+    // prints the chunks in order, flushing before waiting for one
+    void Write(FILE* out)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        for (;;) {
+            if (order_.empty() && !reading_) {
+                break;
+            } else if (order_.empty() || !order_.front()->done) {
+                lock.unlock();
+                fflush(out);
+                lock.lock();
+                done_.wait(lock, [this] {
+                    return (!order_.empty() && order_.front()->done) ||
+                           (order_.empty() && !reading_);
+                });
+                continue;
+            } else { }
+
+            Chunk* c = order_.front();
+            order_.pop_front();
+            lock.unlock();
+            space_.notify_one();
+
+            for (size_t i = 0; i < c->boards.size(); ++i) {
+                if (c->moves[i] < 0) {
+                    fprintf(out, "error\n");
+                } else {
+                    fprintf(out, "%s %.2f\n", MoveName(c->moves[i]), c->values[i]);
+                }
+            }
+
+            delete c;
+            lock.lock();
+        }
+
+        lock.unlock();
+        fflush(out);
+    }
+
+    static uint8_t ParseLine(const char* text, size_t len, PackedBoard& board)
+    {
+        char line[LINE];
+
+        while ((len > 0) && ((text[len - 1] == '\r') || (text[len - 1] == ' '))) {
+            --len;
+        }
+
+        while ((len > 0) && (*text == ' ')) {
+            ++text;
+            --len;
+        }
+
+        if (len < sizeof(line)) {
+            memcpy(line, text, len);
+            line[len] = '\0';
+        } else {
+            return 0;
+        }
+
+        if ((line[0] == '0') && ((line[1] == 'x') || (line[1] == 'X'))) {
+            char* end = NULL;
+            board = (PackedBoard)strtoull(line + 2, &end, 16);
+            return (end != line + 2) && (*end == '\0') && (len <= 18);
+        } else if (ParseBoard(line, board)) {
+            return 1;
+        } else { }
+
+        // tile values separated by spaces, tabs or commas
+        const char* p = line;
+        board = 0;
+
+        for (int i = 0; i < N * N; ++i) {
+            char* end = NULL;
+            unsigned long v = strtoul(p, &end, 10);
+            unsigned int e = 0;
+
+            if (end == p) {
+                return 0;
+            } else { }
+
+            while ((e < 15) && ((1ul << e) < v)) {
+                ++e;
+            }
+
+            if ((v == 0) || ((v > 1) && ((1ul << e) == v))) {
+                board |= (PackedBoard)e << (4 * i);
+            } else {
+                return 0;
+            }
+
+            p = end;
+
+            while ((*p == ' ') || (*p == '\t') || (*p == ',')) {
+                ++p;
+            }
+        }
+
+        return *p == '\0';
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(MoveOracle);
+
+  private:
+    std::vector<MovePolicy*> policies_;
+    int threads_;
+    std::mutex mutex_;  // guards the rest
+    std::condition_variable work_;   // a chunk is pending, or reading is over
+    std::condition_variable done_;   // a chunk is done, or reading is over
+    std::condition_variable space_;  // a chunk is written
+    std::deque<Chunk*> pending_;  // not yet taken by a worker
+    std::deque<Chunk*> order_;    // not yet written, in input order
+    bool reading_;
+};
+// end of move oracle }}}
+
+// tournament {{{
+//
+// Runs tasks 0 to count - 1 on threads that each start with a block of them
+// and, once theirs are done, take from the ends of the other blocks, so long
+// tasks on one thread hold up nobody.  f(task, thread) must be safe to
+// call from several threads.
+//
+class WorkStealer
+{
+  public:
+    template<typename T>
+    static void Run(size_t count, int threads, T f)
+    {
+        threads = (threads < 1) ? 1 : threads;
+        std::vector<Queue> queue((size_t)threads);
+        std::vector<std::thread> worker;
+
+        for (size_t i = 0; i < count; ++i) {
+            queue[i * (size_t)threads / count].tasks.push_back(i);
+        }
+
+        auto work = [&](int self) {
+            size_t task;
+
+            while (Take(queue, self, task)) {
+                f(task, self);
+            }
+        };
+
+        for (int t = 1; t < threads; ++t) {
+            worker.push_back(std::thread(work, t));
+        }
+
+        work(0);
+
+        for (size_t i = 0; i < worker.size(); ++i) {
+            worker[i].join();
+        }
+    }
+
+  private:
+    struct Queue {
+        Queue() : mutex(), tasks() { }
+
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    // the next task of its own queue, or the last of another's
+    static bool Take(std::vector<Queue>& queue, int self, size_t& task)
+    {
+        int n = (int)queue.size();
+
+        for (int i = 0; i < n; ++i) {
+            Queue& q = queue[(size_t)((self + i) % n)];
+            std::lock_guard<std::mutex> guard(q.mutex);
+
+            if (q.tasks.empty()) {
+            } else if (i == 0) {
+                task = q.tasks.front();
+                q.tasks.pop_front();
+                return true;
+            } else {
+                task = q.tasks.back();
+                q.tasks.pop_back();
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+//
+// Policies play the same games: game s of every policy starts from seed s,
+// so both get the same tiles for as long as their boards agree.  Each game
+// is appended to the results file as it ends; a run with the file of an
+// earlier run plays only the games not in it.
+//
+class Tournament
+{
+  public:
+    enum { MAX_POLICIES = 16, WIN_TILE = 11, TILE_BINS = 6 };
+
+    Tournament() : names_(), games_(), seeds_(0), threads_(1), file_(NULL),
+                   mutex_() { }
+    ~Tournament()
+    {
+        if (file_) {
+            fclose(file_);
+        } else { }
+    }
+
+    // policies separated by commas, false if one is not a policy
+    static bool ParseList(const char* list, std::vector<std::string>& names)
+    {
+        int kind, param;
+        names.clear();
+
+        for (const char* p = list; *p; (void)0) {
+            const char* comma = strchr(p, ',');
+            std::string name(p, comma ? (size_t)(comma - p) : strlen(p));
+
+            if (MovePolicy::Parse(name.c_str(), kind, param) &&
+                (names.size() < MAX_POLICIES)) {
+                names.push_back(name);
+            } else {
+                return false;
+            }
+
+            p = comma ? comma + 1 : p + strlen(p);
+        }
+
+        return !names.empty();
+    }
+
+    bool Run(const char* list, int seeds, const char* path, FILE* log)
+    {
+        if (ParseList(list, names_) && (seeds > 0)) {
+        } else {
+            return false;
+        }
+
+        seeds_ = seeds;
+        threads_ = (int)Max(1u, std::thread::hardware_concurrency());
+        games_.assign(names_.size() * (size_t)seeds, Game());
+
+        if (path && !Resume(path, log)) {
+            fprintf(stderr, "cannot open results file '%s'\n", path);
+            return false;
+        } else { }
+
+        std::vector<size_t> todo;
+
+        for (size_t i = 0; i < games_.size(); ++i) {
+            if (games_[i].done) {
+            } else {
+                todo.push_back(i);
+            }
+        }
+
+        fprintf(log, "%u policies, %d seeds, %u games to play on %d threads\n",
+                (unsigned int)names_.size(), seeds, (unsigned int)todo.size(),
+                threads_);
+        fflush(log);
+
+        // a policy of each kind for each thread
+        std::vector<MovePolicy*> policy(names_.size() * (size_t)threads_);
+
+        bool ready = true;
+
+        for (size_t i = 0; i < policy.size(); ++i) {
+            policy[i] = new MovePolicy;
+            ready = policy[i]->Set(names_[i % names_.size()].c_str(), 0) && ready;
+        }
+
+        if (ready) {
+        } else {
+            for (size_t i = 0; i < policy.size(); ++i) {
+                delete policy[i];
+            }
+
+            return false;
+        }
+
+        // game i is seed i / P of policy i % P: all policies move along
+        WorkStealer::Run(todo.size(), threads_, [&](size_t task, int thread) {
+            size_t i = todo[task];
+            size_t p = i % names_.size();
+            Play(*policy[(size_t)thread * names_.size() + p],
+                 (uint32_t)(i / names_.size() + 1), games_[i]);
+            Record(p, games_[i]);
+        });
+
+        for (size_t i = 0; i < policy.size(); ++i) {
+            delete policy[i];
+        }
+
+        Report(log);
+        return true;
+    }
+
+  private:
+    struct Game {
+        bool done;
+        uint32_t seed;
+        uint32_t score;
+        uint32_t moves;
+        uint32_t max_tile;  // exponent
+        uint64_t us;        // time played
+    };
+
+    static void Play(MovePolicy& policy, uint32_t seed, Game& g)
+    {
+        const MoveKernel& kernel = MoveKernel::Instance();
+        PackedGame game;
+        GameReply r = { };
+        int64_t start = Clock().Ticks_us();
+
+        game.Start(seed, 0);
+        policy.Seed(seed);
+        g.moves = 0;
+
+        for (float value; r.status != REPLY_OVER; ++g.moves) {
+            int type = policy.Choose(game.board, value);
+
+            if (type == UUS) {
+                break;
+            } else { }
+
+            game.Answer(kernel, type, 0, r);
+        }
+
+        g.done = true;
+        g.seed = seed;
+        g.score = game.score;
+        g.max_tile = 0;
+
+        for (int i = 0; i < N * N; ++i) {
+            g.max_tile = Max(g.max_tile, GetTile(game.board, i));
+        }
+
+        g.us = (uint64_t)(Clock().Ticks_us() - start);
+    }
+
+    void Record(size_t p, const Game& g)
+    {
+        if (file_) {
+            std::lock_guard<std::mutex> guard(mutex_);
+            fprintf(file_, "%s %u %u %u %u %llu\n", names_[p].c_str(), g.seed,
+                    g.score, 1u << g.max_tile, g.moves, (unsigned long long)g.us);
+            fflush(file_);
+        } else { }
+    }
+
+    // games of the policies and seeds of this run found in the file, which
+    // is then cut after its last complete line and opened for appending
+    bool Resume(const char* path, FILE* log)
+    {
+        FILE* f = fopen(path, "rb");
+        bool existed = (f != NULL);
+        unsigned int found = 0;
+        long complete = 0;  // bytes up to the last newline
+        long size = 0;
+
+        if (existed) {
+            char line[256];
+
+            while (fgets(line, sizeof(line), f)) {
+                char name[128];
+                Game g = { true, 0, 0, 0, 0, 0 };
+                unsigned int tile = 0;
+                unsigned long long us = 0;
+                size_t len = strlen(line);
+                bool newline = (len > 0) && (line[len - 1] == '\n');
+                size = ftell(f);
+                complete = newline ? size : complete;
+
+                if (newline &&
+                    (sscanf(line, "%127s %u %u %u %u %llu", name, &g.seed,
+                            &g.score, &tile, &g.moves, &us) == 6) &&
+                    (g.seed >= 1) && (g.seed <= (uint32_t)seeds_)) {
+                } else {
+                    continue;
+                }
+
+                for (size_t p = 0; p < names_.size(); ++p) {
+                    Game& to = games_[(g.seed - 1) * names_.size() + p];
+
+                    if ((names_[p] == name) && !to.done) {
+                        while ((g.max_tile < 15) && ((1u << g.max_tile) < tile)) {
+                            ++g.max_tile;
+                        }
+
+                        g.us = us;
+                        to = g;
+                        ++found;
+                    } else { }
+                }
+            }
+
+            fclose(f);
+            fprintf(log, "%u games read from '%s'\n", found, path);
+        } else { }
+
+        if ((complete < size) && !TruncateFile(path, (uint64_t)complete)) {
+            return false;  // a line cut short by an earlier run stays
+        } else { }
+
+        file_ = fopen(path, "a");
+
+        if (file_ && !existed) {
+            fprintf(file_, "# policy seed score max_tile moves us\n");
+        } else { }
+
+        return file_ != NULL;
+    }
+
+    static double Percentile(const std::vector<double>& sorted, double p)
+    {
+        size_t rank = (size_t)ceil(p / 100.0 * (double)sorted.size());
+        return sorted[(rank > 0) ? rank - 1 : 0];
+    }
+
+    void Report(FILE* log)
+    {
+        static const char* const bins[TILE_BINS] = {
+            "<=256", "512", "1024", "2048", "4096", ">=8192"
+        };
+        size_t policies = names_.size();
+
+        fprintf(log, "\n%-16s %6s %8s %8s %8s %8s %8s %6s %9s %8s\n",
+                "policy", "games", "mean", "median", "p10", "p90", "p99",
+                "2048%", "moves/s", "games/s");
+
+        for (size_t p = 0; p < policies; ++p) {
+            std::vector<double> score;
+            uint64_t moves = 0;
+            uint64_t us = 0;
+            int wins = 0;
+            double total = 0.0;
+
+            for (int s = 0; s < seeds_; ++s) {
+                const Game& g = games_[(size_t)s * policies + p];
+
+                if (g.done) {
+                    score.push_back(g.score);
+                    total += g.score;
+                    moves += g.moves;
+                    us += g.us;
+                    wins += (g.max_tile >= WIN_TILE) ? 1 : 0;
+                } else { }
+            }
+
+            if (score.empty()) {
+                continue;
+            } else { }
+
+            // a thread's rates, so policies compare however many threads ran
+            double seconds = (us > 0) ? (double)us / 1e6 : 1e-6;
+            std::sort(score.begin(), score.end());
+            fprintf(log, "%-16s %6u %8.0f %8.0f %8.0f %8.0f %8.0f %6.1f %9.0f %8.1f\n",
+                    names_[p].c_str(), (unsigned int)score.size(),
+                    total / (double)score.size(), Percentile(score, 50),
+                    Percentile(score, 10), Percentile(score, 90),
+                    Percentile(score, 99), 100.0 * wins / (double)score.size(),
+                    (double)moves / seconds, (double)score.size() / seconds);
+        }
+
+        fprintf(log, "\n%-16s", "max tile %");
+
+        for (int b = 0; b < TILE_BINS; ++b) {
+            fprintf(log, " %7s", bins[b]);
+        }
+
+        fprintf(log, "\n");
+
+        for (size_t p = 0; p < policies; ++p) {
+            int count[TILE_BINS] = { };
+            int games = 0;
+
+            for (int s = 0; s < seeds_; ++s) {
+                const Game& g = games_[(size_t)s * policies + p];
+
+                if (g.done) {
+                    int b = (int)g.max_tile - 8;
+                    ++count[(b < 0) ? 0 : (b >= TILE_BINS) ? TILE_BINS - 1 : b];
+                    ++games;
+                } else { }
+            }
+
+            fprintf(log, "%-16s", names_[p].c_str());
+
+            for (int b = 0; b < TILE_BINS; ++b) {
+                fprintf(log, " %7.1f", games ? 100.0 * count[b] / games : 0.0);
+            }
+
+            fprintf(log, "\n");
+        }
+
+        if (policies > 1) {
+            fprintf(log, "\npaired score differences, same seeds"
+                    " (p: two-sided, normal approximation)\n");
+        } else { }
+
+        for (size_t a = 0; a < policies; ++a) {
+            for (size_t b = a + 1; b < policies; ++b) {
+                PrintPair(a, b, log);
+            }
+        }
+    }
+
+    void PrintPair(size_t a, size_t b, FILE* log)
+    {
+        size_t policies = names_.size();
+        double sum = 0.0;
+        double squares = 0.0;
+        int n = 0;
+        int better = 0;
+
+        for (int s = 0; s < seeds_; ++s) {
+            const Game& ga = games_[(size_t)s * policies + a];
+            const Game& gb = games_[(size_t)s * policies + b];
+
+            if (ga.done && gb.done) {
+                double d = (double)ga.score - (double)gb.score;
+                sum += d;
+                squares += d * d;
+                better += (d > 0) ? 1 : 0;
+                ++n;
+            } else { }
+        }
+
+        double mean = n ? sum / n : 0.0;
+        double var = (n > 1) ? (squares - sum * mean) / (n - 1) : 0.0;
+        double se = (var > 0.0) ? sqrt(var / n) : 0.0;
+        double t = (se > 0.0) ? mean / se : 0.0;
+        double p = (se > 0.0) ? erfc(fabs(t) / sqrt(2.0)) : 1.0;
+
+        fprintf(log, "%s - %s: %+.1f over %d seeds, t %.2f, p %.4f,"
+                " first better in %d\n", names_[a].c_str(), names_[b].c_str(),
+                mean, n, t, p, better);
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Tournament);
+
+  private:
+    std::vector<std::string> names_;
+    std::vector<Game> games_;  // seed-major
+    int seeds_;
+    int threads_;
+    FILE* file_;
+    std::mutex mutex_;
+};
+// end of tournament }}}
+
+// score statistics {{{
+//
+// Count, mean and variance of a stream of values (Welford), merged with
+// those of another stream as by Chan et al.
+//
+struct RunningMoments {
+    uint64_t n;
+    double mean;
+    double m2;  // sum of squared differences from the mean
+    double min;
+    double max;
+
+    void Add(double x)
+    {
+        double delta = x - mean;
+        ++n;
+        mean += delta / (double)n;
+        m2 += delta * (x - mean);
+        min = (n == 1) ? x : Min(min, x);
+        max = (n == 1) ? x : Max(max, x);
+    }
+
+    void Merge(const RunningMoments& other)
+    {
+        if (other.n == 0) {
+            return;
+        } else if (n == 0) {
+            *this = other;
+            return;
+        } else { }
+
+        double total = (double)(n + other.n);
+        double delta = other.mean - mean;
+        mean += delta * (double)other.n / total;
+        m2 += other.m2 + delta * delta * (double)n * (double)other.n / total;
+        min = Min(min, other.min);
+        max = Max(max, other.max);
+        n += other.n;
+    }
+
+    double Deviation() const
+    {
+        return (n > 1) ? sqrt(m2 / (double)(n - 1)) : 0.0;
+    }
+};
+
+//
+// Quantiles of a stream of values within 1% of the true ones, as a
+// DDSketch: a value v >= 1 counts in bucket ceil(log(v) / log(g)), where
+// g = (1 + a) / (1 - a) for a = 1%, and is given back as the middle of its
+// bucket, 2 g^i / (g + 1); smaller values count as 0.  The buckets
+// reach past 10^17, so the size stays the same however many values come,
+// and sketches merge by adding counts.
+//
+struct QuantileSketch {
+    enum { BUCKETS = 2048 };
+    static double Gamma() { return 1.01 / 0.99; }
+
+    uint64_t zeros;
+    uint64_t count[BUCKETS];
+
+    void Add(double v)
+    {
+        static const double log_gamma = log(Gamma());
+
+        if (v < 1.0) {
+            ++zeros;
+        } else {
+            double i = ceil(log(v) / log_gamma);
+            ++count[(i < BUCKETS - 1) ? (int)i : BUCKETS - 1];
+        }
+    }
+
+    void Merge(const QuantileSketch& other)
+    {
+        zeros += other.zeros;
+
+        for (int i = 0; i < BUCKETS; ++i) {
+            count[i] += other.count[i];
+        }
+    }
+
+    // q from 0 to 1
+    double Quantile(double q) const
+    {
+        uint64_t total = zeros;
+
+        for (int i = 0; i < BUCKETS; ++i) {
+            total += count[i];
+        }
+
+        uint64_t rank = (uint64_t)(q * (double)(total ? total - 1 : 0));
+        uint64_t seen = zeros;
+
+        for (int i = 0; (seen <= rank) && (i < BUCKETS); ++i) {
+            seen += count[i];
+
+            if (seen > rank) {
+                return 2.0 * pow(Gamma(), i) / (Gamma() + 1.0);
+            } else { }
+        }
+
+        return 0.0;
+    }
+};
+
+//
+// Moments and quantiles of finished games, the same size for any number of
+// games.  All zeros is empty.
+//
+struct GameStats {
+    enum { SCORE, MOVES, MAX_TILE, MICROSECONDS, METRICS };
+
+    RunningMoments moments[METRICS];
+    QuantileSketch sketch[METRICS];
+
+    void Reset()
+    {
+        memset((void*)this, 0, sizeof(*this));
+    }
+
+    void Add(uint32_t score, uint32_t moves, uint32_t max_tile, uint64_t us)
+    {
+        const double value[METRICS] = {
+            (double)score, (double)moves, (double)max_tile, (double)us
+        };
+
+        for (int m = 0; m < METRICS; ++m) {
+            moments[m].Add(value[m]);
+            sketch[m].Add(value[m]);
+        }
+    }
+
+    void Merge(const GameStats& other)
+    {
+        for (int m = 0; m < METRICS; ++m) {
+            moments[m].Merge(other.moments[m]);
+            sketch[m].Merge(other.sketch[m]);
+        }
+    }
+
+    uint64_t Games() const
+    {
+        return moments[SCORE].n;
+    }
+
+    static const char* Name(int m)
+    {
+        static const char* const name[METRICS] = {
+            "score", "moves", "max_tile", "us"
+        };
+
+        return name[m];
+    }
+
+    // the quantile, max tiles rounded to the tile they are within 1% of
+    double Quantile(int m, double q) const
+    {
+        double v = sketch[m].Quantile(q);
+        return ((m == MAX_TILE) && (v > 0.0)) ? exp2(floor(log2(v) + 0.5)) : v;
+    }
+
+    void Print(FILE* out) const
+    {
+        fprintf(out, "%-8s %12s %10s %10s %10s %10s %10s %10s %10s\n", "",
+                "mean", "sd", "min", "p50", "p90", "p99", "p99.9", "max");
+
+        for (int m = 0; m < METRICS; ++m) {
+            fprintf(out, "%-8s %12.1f %10.1f %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+                    Name(m), moments[m].mean, moments[m].Deviation(),
+                    moments[m].min, Quantile(m, 0.5), Quantile(m, 0.9),
+                    Quantile(m, 0.99), Quantile(m, 0.999), moments[m].max);
+        }
+    }
+
+    // as JSON through a temporary file, so readers never find half of it
+    bool Save(const char* path, int64_t elapsed_ms) const
+    {
+        char text[4096];
+        int n = snprintf(text, sizeof(text), "{\n  \"elapsed_ms\": %lld,\n"
+                         "  \"games\": %llu", (long long)elapsed_ms,
+                         (unsigned long long)Games());
+
+        for (int m = 0; m < METRICS; ++m) {
+            n += snprintf(text + n, sizeof(text) - (size_t)n,
+                          ",\n  \"%s\": { \"mean\": %.3f, \"sd\": %.3f, "
+                          "\"min\": %.0f, \"p50\": %.0f, \"p90\": %.0f, "
+                          "\"p99\": %.0f, \"p999\": %.0f, \"max\": %.0f }",
+                          Name(m), moments[m].mean, moments[m].Deviation(),
+                          moments[m].min, Quantile(m, 0.5), Quantile(m, 0.9),
+                          Quantile(m, 0.99), Quantile(m, 0.999), moments[m].max);
+        }
+
+        n += snprintf(text + n, sizeof(text) - (size_t)n, "\n}\n");
+        return WriteFileAtomic(path, text, (size_t)n);
+    }
+};
+// end of score statistics }}}
+
+// self-play {{{
+//
+// Plays games of a policy, game k from seed k + 1 on thread k % threads,
+// until games are played or the program is interrupted.  Each thread keeps
+// GameStats of its games and copies them out every PUBLISH_MS; the main
+// thread merges the copies every interval, prints them and saves them to a
+// file if there is one.  Memory does not grow with the number of games.
+//
+// The copies also hold the game in play, so the main thread can write them
+// to a checkpoint file while the threads play on, and a run resumed from
+// the file goes on from them: a thread copies its state when it finds the
+// lock free and never waits for a write.
+//
+class SelfPlay
+{
+  public:
+    enum { PUBLISH_MS = 100, POLL_MS = 50, NAME = 128 };
+
+    SelfPlay()
+        : workers_(), games_(0), stop_(false), total_(NULL), policy_(),
+          elapsed_ms_(0), checkpoint_(NULL), checkpoint_ms_(0), resume_(false)
+    { }
+    ~SelfPlay()
+    {
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            delete workers_[i];
+        }
+
+        delete total_;
+    }
+
+    // writes the state to path every interval_ms and when the run ends, and
+    // with resume first goes on from the state in path
+    void SetCheckpoint(const char* path, int interval_ms, bool resume)
+    {
+        checkpoint_ = path;
+        checkpoint_ms_ = interval_ms;
+        resume_ = resume;
+    }
+
+    // games 0 plays until interrupted
+    bool Run(const char* policy, uint64_t games, int interval_ms,
+             const char* path, FILE* log)
+    {
+        int threads = (int)Max(1u, std::thread::hardware_concurrency());
+        games_ = games;
+        total_ = new GameStats;
+
+        if (strlen(policy) < NAME) {
+            strcpy(policy_, policy);
+        } else {
+            return false;
+        }
+
+        if (resume_ && !Resume(threads, log)) {
+            return false;
+        } else if (resume_) {
+        } else {
+            for (int t = 0; t < threads; ++t) {
+                workers_.push_back(new Worker((uint64_t)t));
+            }
+        }
+
+        for (int t = 0; t < threads; ++t) {
+            if (workers_[(size_t)t]->policy.Set(policy, (uint64_t)t + 1)) {
+            } else {
+                return false;
+            }
+        }
+
+        fprintf(log, "%s on %d threads, statistics every %d ms\n", policy,
+                threads, interval_ms);
+        fflush(log);
+
+        std::vector<std::thread> thread;
+        int64_t start = Clock().Ticks_ms() - elapsed_ms_;
+        int64_t reported = Clock().Ticks_ms();
+        int64_t saved = reported;
+        bool ok = true;
+
+        for (int t = 0; t < threads; ++t) {
+            thread.push_back(std::thread(&SelfPlay::Work, this, t));
+        }
+
+        while (!Done()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MS));
+            int64_t now = Clock().Ticks_ms();
+
+            if (con.Interrupted()) {
+                stop_.store(true);
+            } else if (now - reported >= interval_ms) {
+                reported = now;
+                ok = Report(now - start, path, log) && ok;
+            } else if (checkpoint_ && (checkpoint_ms_ > 0) &&
+                       (now - saved >= checkpoint_ms_)) {
+                saved = now;
+                ok = Checkpoint(now - start) && ok;
+            } else { }
+        }
+
+        for (size_t t = 0; t < thread.size(); ++t) {
+            thread[t].join();
+        }
+
+        ok = Report(Clock().Ticks_ms() - start, path, log) && ok;
+        return (!checkpoint_ || Checkpoint(Clock().Ticks_ms() - start)) && ok;
+    }
+
+  private:
+    // what a thread needs to go on where it was: its finished games and the
+    // one in play
+    struct Snapshot {
+        GameStats stats;
+        PackedGame game;
+        uint64_t next;     // game in play, or to play
+        uint64_t us;       // time taken by the game in play
+        uint32_t moves;    // of the game in play
+        uint32_t rng;      // of the policy
+        uint32_t playing;  // the game is in play
+        uint32_t unused;
+    };
+
+    // starts the checkpoint file, followed by a Snapshot per thread
+    struct Header {
+        char magic[8];  // "2048SP01"
+        uint32_t threads;
+        uint32_t snapshot;  // sizeof(Snapshot)
+        int64_t elapsed_ms;
+        char policy[NAME];
+    };
+
+    struct Worker {
+        explicit Worker(uint64_t first)
+            : policy(), state(), mutex(), published(), done(false)
+        {
+            memset((void*)&state, 0, sizeof(state));
+            state.next = first;
+            published = state;
+        }
+
+        MovePolicy policy;
+        Snapshot state;
+        std::mutex mutex;
+        Snapshot published;  // state as of the last Publish()
+        std::atomic<bool> done;
+
+      private:
+        DISALLOW_COPY_AND_ASSIGN(Worker);
+    };
+
+    void Work(int t)
+    {
+        const MoveKernel& kernel = MoveKernel::Instance();
+        Worker& w = *workers_[(size_t)t];
+        Snapshot& s = w.state;
+        int64_t published = Clock().Ticks_ms();
+        int64_t start = Clock().Ticks_us() - (int64_t)s.us;
+
+        if (s.playing) {
+            w.policy.Seed(s.next + 1);
+            w.policy.SetRng(s.rng);
+        } else { }
+
+        while (!stop_.load(std::memory_order_relaxed)) {
+            if (s.playing) {
+            } else if (games_ && (s.next >= games_)) {
+                break;
+            } else {
+                s.game.Start(s.next + 1, 0);
+                w.policy.Seed(s.next + 1);
+                s.moves = 0;
+                s.playing = 1;
+                start = Clock().Ticks_us();
+            }
+
+            float value;
+            int type = w.policy.Choose(s.game.board, value);
+            GameReply r;
+
+            if (type == UUS) {
+                r.status = REPLY_OVER;
+            } else {
+                s.game.Answer(kernel, type, 0, r);
+                ++s.moves;
+            }
+
+            if (r.status == REPLY_OVER) {
+                uint32_t max_tile = 0;
+
+                for (int i = 0; i < N * N; ++i) {
+                    max_tile = Max(max_tile, GetTile(s.game.board, i));
+                }
+
+                s.stats.Add(s.game.score, s.moves, 1u << max_tile,
+                            (uint64_t)(Clock().Ticks_us() - start));
+                s.next += workers_.size();
+                s.playing = 0;
+            } else { }
+
+            if (((s.moves & 63) == 0) &&
+                (Clock().Ticks_ms() - published >= PUBLISH_MS)) {
+                s.us = (uint64_t)(Clock().Ticks_us() - start);
+                s.rng = w.policy.Rng();
+                published = Publish(w, false) ? Clock().Ticks_ms() : published;
+            } else { }
+        }
+
+        s.us = (uint64_t)(Clock().Ticks_us() - start);
+        s.rng = w.policy.Rng();
+        Publish(w, true);
+        w.done.store(true);
+    }
+
+    // false if the main thread holds the lock and wait is not set
+    static bool Publish(Worker& w, bool wait)
+    {
+        std::unique_lock<std::mutex> lock(w.mutex, std::defer_lock);
+
+        if (wait) {
+            lock.lock();
+        } else if (lock.try_lock()) {
+        } else {
+            return false;
+        }
+
+        w.published = w.state;
+        return true;
+    }
+
+    bool Done()
+    {
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            if (workers_[i]->done.load()) {
+            } else {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool Report(int64_t elapsed_ms, const char* path, FILE* log)
+    {
+        total_->Reset();
+
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            std::lock_guard<std::mutex> guard(workers_[i]->mutex);
+            total_->Merge(workers_[i]->published.stats);
+        }
+
+        double seconds = (elapsed_ms > 0) ? (double)elapsed_ms / 1000.0 : 0.001;
+        fprintf(log, "\n%llu games in %.1f s, %.1f games/s\n",
+                (unsigned long long)total_->Games(), seconds,
+                (double)total_->Games() / seconds);
+        total_->Print(log);
+        fflush(log);
+
+        if (path && !total_->Save(path, elapsed_ms)) {
+            fprintf(stderr, "cannot write statistics file '%s'\n", path);
+            return false;
+        } else {
+            return true;
+        }
+    }
+
+    // the published states, copied a thread at a time and then written
+    bool Checkpoint(int64_t elapsed_ms)
+    {
+        std::vector<char> image(sizeof(Header) +
+                                workers_.size() * sizeof(Snapshot));
+        Header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "2048SP01", 8);
+        header.threads = (uint32_t)workers_.size();
+        header.snapshot = (uint32_t)sizeof(Snapshot);
+        header.elapsed_ms = elapsed_ms;
+        strcpy(header.policy, policy_);
+        memcpy(&image[0], &header, sizeof(header));
+
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            std::lock_guard<std::mutex> guard(workers_[i]->mutex);
+            memcpy(&image[sizeof(Header) + i * sizeof(Snapshot)],
+                   (const void*)&workers_[i]->published, sizeof(Snapshot));
+        }
+
+        if (WriteFileAtomic(checkpoint_, &image[0], image.size())) {
+            return true;
+        } else {
+            fprintf(stderr, "cannot write checkpoint '%s'\n", checkpoint_);
+            return false;
+        }
+    }
+
+    // the workers of the checkpoint, as many as it has threads
+    bool Resume(int& threads, FILE* log)
+    {
+        FILE* f = fopen(checkpoint_, "rb");
+        Header header;
+
+        if (f && (fread(&header, sizeof(header), 1, f) == 1) &&
+            (memcmp(header.magic, "2048SP01", 8) == 0) &&
+            (header.snapshot == sizeof(Snapshot)) && (header.threads > 0) &&
+            (header.threads <= 1024) &&
+            (strncmp(header.policy, policy_, NAME) == 0)) {
+        } else {
+            fprintf(stderr, "cannot resume from '%s' with %s\n", checkpoint_,
+                    policy_);
+
+            if (f) {
+                fclose(f);
+            } else { }
+
+            return false;
+        }
+
+        uint64_t games = 0;
+
+        for (uint32_t t = 0; t < header.threads; ++t) {
+            workers_.push_back(new Worker(t));
+            Worker& w = *workers_.back();
+
+            if (fread((void*)&w.state, sizeof(Snapshot), 1, f) == 1) {
+                w.published = w.state;
+                games += w.state.stats.Games();
+            } else {
+                fclose(f);
+                fprintf(stderr, "checkpoint '%s' is cut short\n", checkpoint_);
+                return false;
+            }
+        }
+
+        fclose(f);
+        threads = (int)header.threads;
+        elapsed_ms_ = header.elapsed_ms;
+        fprintf(log, "%llu games and %u in play resumed from '%s'\n",
+                (unsigned long long)games, (unsigned int)CountPlaying(),
+                checkpoint_);
+        return true;
+    }
+
+    size_t CountPlaying() const
+    {
+        size_t playing = 0;
+
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            playing += workers_[i]->state.playing ? 1 : 0;
+        }
+
+        return playing;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(SelfPlay);
+
+  private:
+    std::vector<Worker*> workers_;
+    uint64_t games_;
+    std::atomic<bool> stop_;
+    GameStats* total_;  // merged by Report()
+    char policy_[NAME];
+    int64_t elapsed_ms_;  // by earlier runs
+    const char* checkpoint_;
+    int checkpoint_ms_;
+    bool resume_;
+};
+// end of self-play }}}
+
+enum {
+    GAME_ERROR = -1,
+    GAME_NOOP = 0,
+    GAME_ABORT,
+    GAME_STOP,
+    GAME_LOST,
+    GAME_WON,
+    GAME_PERSIST,
+    GAME_RESTART,
+    GAME_TIMER,
+    GAME_UNDO,
+    GAME_HINT,
+    GAME_AUTOPLAY,
+
+    MOVE_LEFT = 0x10,
+    MOVE_UP,
+    MOVE_RIGHT,
+    MOVE_DOWN,
+    MOVE_MOUSE_WHEEL_FW = 0x20,
+    MOVE_MOUSE_WHEEL_BW,
+    MOVE_MOUSE_WHEEL_FW_SHIFT,
+    MOVE_MOUSE_WHEEL_BW_SHIFT,
+
+    BOARD_REFRESH = 0x40,
+    BOARD_TRANSPOSE,
+    BOARD_ROTATE_CW,
+    BOARD_ROTATE_CCW,
+    BOARD_SWAP_VERTICAL,
+    BOARD_SWAP_HORIZONTAL,
+};
+
+class Mapper
+{
+  public:
+    Mapper(int y_top = 0) : r(-1), c(-1), top(y_top) { }
+    ~Mapper() { }
+
+    int FindCell(int x, int y)
+    {
+        enum {
+            W = 9,
+            H = 4,
+            NO_X1 = Grid::MESG_X + 22,
+            NO_X2 = Grid::MESG_X + 23,
+            YES_X1 = Grid::MESG_X + 14,
+            YES_X2 = Grid::MESG_X + 18,
+        };
+
+        if (y == Grid::MESG_Y + 4 + top) {
+            if ((x >= YES_X1) && (x <= YES_X2)) {
+                // DPRINT("mouse yes");
+                return GAME_PERSIST;
+            } else if ((x >= NO_X1) && (x <= NO_X2)) {
+                // DPRINT("mouse no");
+                return GAME_STOP;
+            } else {
+                return 0;
+            }
+        } else { }
+
+        x -= Grid::GRID_X;
+        y -= Grid::GRID_Y + top;
+
+        if ((x <= 0) || (y <= 0) || (x >= N * W) || (y >= N * H)) {
+            r = c = -1;
+            return 0;
+        } else { }
+
+        switch (x % W) {
+        case 0:
+        case 1:
+        case W - 1:
+            return 0;
+        default:
+            c = x / W;
+        }
+
+        switch (y % H) {
+        case 0:
+            return 0;
+        default:
+            r = y / H;
+        }
+
+        // DPRINT("mouse cell: %3d %3d", c, r);
+
+        return (0x10000 + r * 0x100 + c);
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Mapper);
+
+  private:
+    int r;
+    int c;
+    int top;
+    // previous position (xc,xr) is needed for tracing mouse path
+    // int xr;
+    // int xc;
+};
+
+// latency histograms {{{
+//
+// Times from an input to the stages of its answer, in microseconds, kept in
+// log-linear buckets: exact below 8, then 8 buckets for each power of two,
+// so a percentile is off by at most 1/8 of its value.
+//
+class Histogram
+{
+  public:
+    enum { SUB = 8, BUCKETS = SUB * 62 };
+
+    Histogram() : count_(0), sum_(0), max_(0)
+    {
+        memset(bucket_, 0, sizeof(bucket_));
+    }
+    ~Histogram() { }
+
+    void Add(uint64_t v)
+    {
+        ++bucket_[Index(v)];
+        ++count_;
+        sum_ += v;
+        max_ = Max(max_, v);
+    }
+
+    uint64_t Count() const
+    {
+        return count_;
+    }
+
+    uint64_t Maximum() const
+    {
+        return max_;
+    }
+
+    // the value below which are p of the samples, at the top of its bucket
+    uint64_t Percentile(double p) const
+    {
+        uint64_t rank = (uint64_t)ceil(p * (double)count_);
+        uint64_t n = 0;
+
+        for (unsigned int i = 0; i < BUCKETS; ++i) {
+            n += bucket_[i];
+
+            if (n && (n >= rank)) {
+                return Min(Top(i), max_);
+            } else { }
+        }
+
+        return max_;
+    }
+
+    // the nonempty buckets, one "top count" line each
+    void Dump(FILE* out) const
+    {
+        for (unsigned int i = 0; i < BUCKETS; ++i) {
+            if (bucket_[i]) {
+                fprintf(out, "%llu %llu\n", (unsigned long long)Top(i),
+                        (unsigned long long)bucket_[i]);
+            } else { }
+        }
+    }
+
+  private:
+    static unsigned int Index(uint64_t v)
+    {
+        if (v < SUB) {
+            return (unsigned int)v;
+        } else {
+            unsigned int e = 3;
+
+            while ((v >> (e + 1)) != 0) {
+                ++e;
+            }
+
+            return SUB * (e - 2) + (unsigned int)((v >> (e - 3)) & (SUB - 1));
+        }
+    }
+
+    static uint64_t Top(unsigned int i)
+    {
+        if (i < SUB) {
+            return i;
+        } else {
+            unsigned int e = i / SUB + 2;
+            uint64_t low = (uint64_t)(SUB + i % SUB) << (e - 3);
+            return low + ((uint64_t)1 << (e - 3)) - 1;
+        }
+    }
+
+  private:
+    uint64_t bucket_[BUCKETS];
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t max_;
+};
+
+// Latencies of moves made by keys or the mouse: from the input to the end
+// of the move, to the new tile, and to the frame that shows them written
+// out.  The game thread adds the first two, the render thread the last.
+class LatencyStats
+{
+  public:
+    enum { MOVE_STAGE, SPAWN_STAGE, FRAME_STAGE, STAGES };
+
+    LatencyStats() { }
+    ~LatencyStats() { }
+
+    void Add(int stage, int64_t since_us)
+    {
+        if (since_us) {
+            int64_t us = Clock().Ticks_us() - since_us;
+            stage_[stage].Add((uint64_t)Max((int64_t)0, us));
+        } else { }
+    }
+
+    void Print(FILE* out) const
+    {
+        if (stage_[MOVE_STAGE].Count()) {
+        } else {
+            return;
+        }
+
+        fprintf(out, "%-10s %8s %8s %8s %8s %8s\n", "latency us", "count",
+                "p50", "p95", "p99", "max");
+
+        for (int i = 0; i < STAGES; ++i) {
+            const Histogram& h = stage_[i];
+            fprintf(out, "%-10s %8llu %8llu %8llu %8llu %8llu\n", Name(i),
+                    (unsigned long long)h.Count(),
+                    (unsigned long long)h.Percentile(0.50),
+                    (unsigned long long)h.Percentile(0.95),
+                    (unsigned long long)h.Percentile(0.99),
+                    (unsigned long long)h.Maximum());
+        }
+    }
+
+    // the summary, then the buckets of each stage
+    bool Dump(const char* path) const
+    {
+        FILE* out = fopen(path, "w");
+
+        if (out) {
+        } else {
+            return false;
+        }
+
+        Print(out);
+
+        for (int i = 0; i < STAGES; ++i) {
+            fprintf(out, "\n[%s]\n", Name(i));
+            stage_[i].Dump(out);
+        }
+
+        return (fclose(out) == 0);
+    }
+
+  private:
+    static const char* Name(int stage)
+    {
+        static const char* const name[STAGES] = { "move", "spawn", "frame" };
+        return name[stage];
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(LatencyStats);
+
+  private:
+    Histogram stage_[STAGES];
+};
+// end of latency histograms }}}
+
+// tile animation {{{
+//
+// Slides the tiles of a move from where they were to where the move put
+// them.  The paths come from the boards before and after Stripe::Nudge():
+// along a stripe the tiles keep their order, and each merged tile (0x80) is
+// where two of them went.  Frames are composed on the empty board in a back
+// buffer and drawn with one WriteCells().
+//
+// Frames are due at a capped rate, but each is drawn for the time it is
+// drawn at, so a slow console skips frames instead of slowing the slide,
+// and a board that changes before a slide ends cuts it short.  Tick() is
+// called by the render thread when Wait() is up.
+//
+class Animator
+{
+  public:
+    enum { MAX_MS = 1000, MAX_FPS = 120, DEFAULT_FPS = 60 };
+
+    explicit Animator(Grid& g)
+        : duration_ms_(0), frame_ms_(1000 / DEFAULT_FPS), frames_(0), next_(0),
+          paths_(0), spawn_r_(0), spawn_c_(0), spawn_(false), busy_(false),
+          start_(0), slides_(0), drawn_(0), dropped_(0), render_us_(0),
+          max_render_us_(0), grid_(g)
+    {
+        memset(after_, 0, sizeof(after_));
+        memset(path_, 0, sizeof(path_));
+        memset(back_, 0, sizeof(back_));
+    }
+    ~Animator() { }
+
+    // slides of ms milliseconds, at up to fps frames a second; 0 ms for none
+    void Setup(unsigned int ms, unsigned int fps)
+    {
+        duration_ms_ = Min(ms, (unsigned int)MAX_MS);
+        frame_ms_ = 1000 / Max(1u, Min(fps, (unsigned int)MAX_FPS));
+    }
+
+    bool Enabled()
+    {
+        return duration_ms_ > 0;
+    }
+
+    bool Busy()
+    {
+        return busy_;
+    }
+
+    void Start(const uint8_t (&before)[N][N], const uint8_t (&after)[N][N], int type)
+    {
+        Cancel();  // the new slide starts where the last one ends
+        memcpy(after_, after, sizeof(after_));
+        Trace(before, type);
+        spawn_ = false;
+        frames_ = Max(1u, (duration_ms_ + frame_ms_ - 1) / frame_ms_);
+        next_ = 0;
+        start_ = Clock().Ticks_ms();
+        busy_ = true;
+        ++slides_;
+    }
+
+    // the tile added after the move, highlighted in the last frame
+    void Spawn(unsigned int r, unsigned int c, uint8_t value)
+    {
+        spawn_r_ = r;
+        spawn_c_ = c;
+        spawn_ = true;
+        after_[r][c] = value;
+    }
+
+    // draws the frame that is due, if it is not drawn yet
+    void Tick()
+    {
+        if (busy_) {
+        } else {
+            return;
+        }
+
+        int64_t elapsed = Clock().Ticks_ms() - start_;
+        unsigned int due = (unsigned int)(elapsed / frame_ms_);
+
+        if (due >= frames_) {
+            Finish();
+        } else if (due >= next_) {
+            dropped_ += due - next_;
+            Draw((unsigned int)(elapsed * 1000 / duration_ms_));
+            next_ = due + 1;
+        } else { }
+    }
+
+    // milliseconds until the next frame is due
+    unsigned int Wait()
+    {
+        int64_t due = start_ + (int64_t)Min(next_, frames_) * frame_ms_;
+        int64_t now = Clock().Ticks_ms();
+        return (due > now) ? (unsigned int)(due - now) : 0;
+    }
+
+    // draws the last frame, the ones not drawn yet are dropped
+    void Finish()
+    {
+        if (busy_) {
+            dropped_ += frames_ - next_;
+            Draw(1000);
+            busy_ = false;
+        } else { }
+    }
+
+    // stops without drawing, as the board is drawn over
+    void Cancel()
+    {
+        if (busy_) {
+            dropped_ += frames_ + 1 - next_;
+            busy_ = false;
+        } else { }
+    }
+
+    void PrintStats(FILE* out)
+    {
+        if (drawn_) {
+            fprintf(out, "animation: %u slides, %u frames, %u dropped,"
+                    " %.1f us/frame, max %u us\n", slides_, drawn_, dropped_,
+                    (double)render_us_ / drawn_, max_render_us_);
+        } else { }
+    }
+
+  private:
+    struct Path {
+        uint8_t r0, c0;  // from
+        uint8_t r1, c1;  // to
+        uint8_t value;  // as it was before the move
+    };
+
+    // cell of the stripe i at j, counted from where the tiles are moved to
+    static void Locate(int type, int i, int j, int& r, int& c)
+    {
+        switch (type) {
+        case ROW_L2R_STRIPE: r = i; c = j; break;
+        case ROW_R2L_STRIPE: r = i; c = N - 1 - j; break;
+        case COL_U2D_STRIPE: r = j; c = i; break;
+        case COL_D2U_STRIPE: r = N - 1 - j; c = i; break;
+        default: r = i; c = j; break;
+        }
+    }
+
+    void Trace(const uint8_t (&before)[N][N], int type)
+    {
+        paths_ = 0;
+
+        for (int i = 0; i < N; ++i) {
+            int from[N];
+            int n = 0;
+            int r, c;
+
+            for (int j = 0; j < N; ++j) {
+                Locate(type, i, j, r, c);
+
+                if (before[r][c] & 0x7fu) {
+                    from[n++] = j;
+                } else { }
+            }
+
+            for (int j = 0, k = 0; (j < N) && (k < n); ++j) {
+                Locate(type, i, j, r, c);
+
+                for (int t = (after_[r][c] & 0x80u) ? 2 : 1; t && (k < n); --t, ++k) {
+                    Path& path = path_[paths_++];
+                    Locate(type, i, from[k], path.r0, path.c0);
+                    path.r1 = (uint8_t)r;
+                    path.c1 = (uint8_t)c;
+                    path.value = before[path.r0][path.c0] & 0x7fu;
+                }
+            }
+        }
+    }
+
+    static void Locate(int type, int i, int j, uint8_t& r, uint8_t& c)
+    {
+        int row, col;
+        Locate(type, i, j, row, col);
+        r = (uint8_t)row;
+        c = (uint8_t)col;
+    }
+
+    void Put(unsigned int n, int state, unsigned int x, unsigned int y)
+    {
+        const Grid::TileImage& tile = grid_.Tile(n, state);
+
+        for (unsigned int i = 0; i < Grid::TILE_H; ++i) {
+            memcpy(&back_[y + i][x], tile.cells[i], sizeof(tile.cells[i]));
+        }
+    }
+
+    // composes and draws the board at permille of the slide
+    void Draw(unsigned int permille)
+    {
+        int64_t t = Clock().Ticks_us();
+        memcpy(back_, grid_.Background(), sizeof(back_));
+
+        if (permille < 1000) {
+            int p = (int)(1000 - (1000 - permille) * (1000 - permille) / 1000);  // eases out
+
+            // tiles in place first, the moving ones may pass over them
+            for (int moving = 0; moving < 2; ++moving) {
+                for (unsigned int i = 0; i < paths_; ++i) {
+                    const Path& path = path_[i];
+                    int dr = path.r1 - path.r0;
+                    int dc = path.c1 - path.c0;
+
+                    if ((dr || dc) == (moving != 0)) {
+                        Put(path.value, Grid::TILE_PLAIN,
+                            (unsigned int)(1 + 9 * path.c0 + 9 * dc * p / 1000),
+                            (unsigned int)(4 * path.r0 + 4 * dr * p / 1000));
+                    } else { }
+                }
+            }
+        } else {
+            for (unsigned int r = 0; r < N; ++r) {
+                for (unsigned int c = 0; c < N; ++c) {
+                    unsigned int n = after_[r][c];
+
+                    if (spawn_ && (r == spawn_r_) && (c == spawn_c_)) {
+                        Put(n, Grid::TILE_HIGHLIGHT, 1 + 9 * c, 4 * r);
+                    } else if (n) {
+                        Put(n, (n & 0x80u) ? Grid::TILE_UNDERLINE : Grid::TILE_PLAIN,
+                            1 + 9 * c, 4 * r);
+                    } else { }
+                }
+            }
+        }
+
+        grid_.ShowBoard(&back_[0][0]);
+        con.Flush();
+
+        unsigned int us = (unsigned int)(Clock().Ticks_us() - t);
+        render_us_ += us;
+        max_render_us_ = Max(max_render_us_, us);
+        ++drawn_;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Animator);
+
+  private:
+    unsigned int duration_ms_;
+    unsigned int frame_ms_;
+    unsigned int frames_;  // due before the last frame
+    unsigned int next_;  // first of them not yet drawn or dropped
+    unsigned int paths_;
+    unsigned int spawn_r_;
+    unsigned int spawn_c_;
+    bool spawn_;
+    bool busy_;
+    int64_t start_;
+    unsigned int slides_;
+    unsigned int drawn_;
+    unsigned int dropped_;
+    uint64_t render_us_;
+    unsigned int max_render_us_;
+    uint8_t after_[N][N];
+    Path path_[N * N];
+    ConsoleCell back_[Grid::BOARD_H][Grid::BOARD_W];
+    Grid& grid_;
+};
+// end of tile animation }}}
+
+// render thread {{{
+//
+// All that the game shows is kept in one Snapshot: the board with merged
+// tiles flagged, the highlighted cells, score, time, message and hint.  The
+// game changes its copy with the Show*() calls and Publish()es it, and the
+// render thread draws what differs between the newest published snapshot
+// and the one it drew before.  A slow console so delays the drawing only,
+// and snapshots published meanwhile are skipped over.
+//
+// Snapshots pass through a single-producer/single-consumer ring.  Neither
+// side waits for the other: with the ring full, Publish() keeps its
+// snapshot for the next call, and the render thread takes the newest entry
+// and frees the older ones with it.  The mutex only guards the sleep of
+// the render thread against a lost wake-up; it is never held while drawing.
+//
+// Before Start() and after Stop(), Publish() draws on the calling thread.
+//
+class Renderer
+{
+  public:
+    enum { RING_SIZE = 8 };
+    enum { NO_MESSAGE, WON_MESSAGE, LOST_MESSAGE };
+
+    struct Snapshot {
+        Board4x4 board;  // merged tiles flagged 0x80
+        Board4x4 before;  // the board the slide of the move starts from
+        uint16_t highlight;  // bit 4 * r + c of each highlighted cell
+        uint8_t slide;  // stripe type of the move, UUS if none
+        uint8_t message;
+        uint8_t hint;  // stripe type of the hinted move, UUS if none
+        bool show_ms;
+        uint32_t rank;   // of the score, shown with the message
+        uint32_t games;  // ranked among, 0 for no rank
+        Duration time;
+        int score;
+        uint32_t moves;  // a slide starts when this changes
+        uint32_t redraws;  // the whole screen is drawn when this changes
+        int64_t input_us;  // when the input drawn for came, 0 if not timed
+    };
+
+    Renderer(Grid& g, LatencyStats& latency)
+        : next_(), shown_(), dirty_(false), valid_(false), running_(false),
+          stop_(false), ring_(), head_(0), tail_(0), slid_(0), published_(0),
+          drawn_(0), skipped_(0), deferred_(0), grid_(g), latency_(latency),
+          animator_(g), mutex_(), wake_(), thread_() { }
+    ~Renderer()
+    {
+        Stop();
+    }
+
+    void SetAnimation(unsigned int ms, unsigned int fps)
+    {
+        animator_.Setup(ms, fps);
+    }
+
+    void Start()
+    {
+        if (running_) {
+        } else {
+            stop_ = false;
+            running_ = true;
+            con.SetRenderThread(true);
+            thread_ = std::thread(&Renderer::Run, this);
+        }
+    }
+
+    // draws what is left and joins the render thread
+    void Stop()
+    {
+        if (running_) {
+            Publish();
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                stop_ = true;
+            }
+            wake_.notify_one();
+            thread_.join();
+            con.SetRenderThread(false);
+            running_ = false;
+            Publish();  // if the ring was full
+            animator_.Finish();
+            con.Flush();
+        } else { }
+    }
+
+    // the last move is not drawn yet, or still slides
+    bool Sliding()
+    {
+        return running_ ? (slid_.load() != next_.moves) : animator_.Busy();
+    }
+
+    void DrawGrid()
+    {
+        ++next_.redraws;
+        dirty_ = true;
+    }
+
+    void ShowMatrix(const Board4x4& board)
+    {
+        next_.board = board;
+        next_.highlight = 0;
+        dirty_ = true;
+    }
+
+    // the board after a move, slid to from the board before it
+    void Slide(const Board4x4& before, const Board4x4& after, int type)
+    {
+        next_.before = before;
+        next_.board = after;
+        next_.highlight = 0;
+        next_.slide = (uint8_t)type;
+        ++next_.moves;
+        dirty_ = true;
+    }
+
+    void ShowCell(unsigned int n, unsigned int r, unsigned int c, bool highlight = true)
+    {
+        uint16_t bit = (uint16_t)(1u << (4 * r + c));
+        next_.board.ac[r][c] = (uint8_t)n;
+        next_.highlight = (uint16_t)(highlight ? (next_.highlight | bit)
+                                               : (next_.highlight & ~bit));
+        dirty_ = true;
+    }
+
+    void ShowScore(const int score)
+    {
+        next_.score = score;
+        dirty_ = true;
+    }
+
+    void ShowTime(Duration dur, bool show_ms = false)
+    {
+        next_.time = dur;
+        next_.show_ms = show_ms;
+        dirty_ = true;
+    }
+
+    void ShowMessage(bool won, unsigned int rank = 0, unsigned int games = 0)
+    {
+        next_.message = won ? WON_MESSAGE : LOST_MESSAGE;
+        next_.rank = rank;
+        next_.games = games;
+        dirty_ = true;
+    }
+
+    void ClearMessage()
+    {
+        next_.message = NO_MESSAGE;
+        dirty_ = true;
+    }
+
+    void ShowHint(int type)
+    {
+        next_.hint = (uint8_t)type;
+        dirty_ = true;
+    }
+
+    // the time of the input that the changes answer, see LatencyStats
+    void SetInputTime(int64_t us)
+    {
+        next_.input_us = us;
+        dirty_ = true;
+    }
+
+    // hands the changes since the last call over to be drawn
+    void Publish()
+    {
+        if (dirty_) {
+        } else {
+            return;
+        }
+
+        if (running_) {
+        } else {
+            Draw(next_);
+            ++published_;
+            dirty_ = false;
+            return;
+        }
+
+        uint32_t head = head_.load(std::memory_order_relaxed);
+
+        bool queued = (head - tail_.load(std::memory_order_acquire) < RING_SIZE);
+        tracer.Record(TR_PUBLISH, (int32_t)next_.moves, queued);
+
+        if (queued) {
+            ring_[head % RING_SIZE] = next_;
+            head_.store(head + 1, std::memory_order_release);
+            ++published_;
+            dirty_ = false;
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+            }
+            wake_.notify_one();
+        } else {
+            ++deferred_;  // the render thread is behind, this one waits
+        }
+    }
+
+    void PrintStats(FILE* out)
+    {
+        fprintf(out, "render: %u snapshots, %u drawn, %u skipped, %u deferred\n",
+                published_, drawn_, skipped_, deferred_);
+        animator_.PrintStats(out);
+    }
+
+  private:
+    bool Take(Snapshot& snap)
+    {
+        uint32_t head = head_.load(std::memory_order_acquire);
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+
+        if (head == tail) {
+            return false;
+        } else {
+            snap = ring_[(head - 1) % RING_SIZE];  // the newest one
+            tail_.store(head, std::memory_order_release);
+            skipped_ += head - tail - 1;
+            return true;
+        }
+    }
+
+    void Run()
+    {
+        Snapshot snap;
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        for (;;) {
+            if (stop_ || (head_.load() != tail_.load())) {
+            } else if (animator_.Busy()) {
+                wake_.wait_for(lock, std::chrono::milliseconds(animator_.Wait()));
+            } else {
+                wake_.wait(lock);
+            }
+
+            bool taken = Take(snap);
+
+            if (stop_ && !taken) {
+                break;
+            } else { }
+
+            lock.unlock();
+            con.BeginFrame();
+
+            if (taken) {
+                Draw(snap);
+            } else { }
+
+            {
+                AllocPhase phase(ALLOC_FRAME);
+                CounterTimer timer(CTR_DRAW_NS);
+                animator_.Tick();
+            }
+
+            if (animator_.Busy()) {
+            } else {
+                slid_ = shown_.moves;
+            }
+
+            lock.lock();
+        }
+    }
+
+    // draws the parts of snap that differ from what is shown
+    void Draw(const Snapshot& snap)
+    {
+        AllocPhase phase(ALLOC_FRAME);
+        CounterTimer timer(CTR_DRAW_NS);
+        bool all = !valid_ || (snap.redraws != shown_.redraws);
+        TraceScope scope(TR_DRAW, (int32_t)snap.moves, all);
+
+        if (all) {
+            grid_.DrawGrid();
+        } else { }
+
+        if (all || (snap.message != shown_.message) || (snap.rank != shown_.rank) ||
+            (snap.games != shown_.games)) {
+            if (snap.message == NO_MESSAGE) {
+                grid_.ClearMessage();
+            } else {
+                grid_.ShowMessage(snap.message == WON_MESSAGE, snap.rank, snap.games);
+            }
+        } else { }
+
+        if (all || (snap.hint != shown_.hint)) {
+            grid_.ShowHint(snap.hint);
+        } else { }
+
+        if (all || (snap.score != shown_.score)) {
+            grid_.ShowScore(snap.score);
+        } else { }
+
+        if (all || (snap.show_ms != shown_.show_ms) ||
+            memcmp(&snap.time, &shown_.time, sizeof(snap.time))) {
+            grid_.ShowTime(snap.time, snap.show_ms);
+        } else { }
+
+        if (all || (snap.highlight != shown_.highlight) ||
+            memcmp(&snap.board, &shown_.board, sizeof(snap.board))) {
+            if (!all && (snap.slide != UUS) && (snap.moves != shown_.moves) &&
+                animator_.Enabled()) {
+                animator_.Start(snap.before.ac, snap.board.ac, snap.slide);
+
+                for (unsigned int i = 0; i < N * N; ++i) {
+                    if (snap.highlight & (1u << i)) {
+                        animator_.Spawn(i / N, i % N, snap.board.ac[i / N][i % N]);
+                    } else { }
+                }
+
+                animator_.Tick();
+            } else {
+                animator_.Cancel();
+                Board4x4 board = snap.board;
+                Matrix matrix(board.ac);
+                grid_.ShowMatrix(matrix, snap.highlight);
+            }
+        } else { }
+
+        con.Flush();
+
+        if (snap.input_us != shown_.input_us) {
+            latency_.Add(LatencyStats::FRAME_STAGE, snap.input_us);
+        } else { }
+
+        shown_ = snap;
+        valid_ = true;
+        ++drawn_;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Renderer);
+
+  private:
+    Snapshot next_;  // of the game thread
+    Snapshot shown_;  // of the drawing thread
+    bool dirty_;
+    bool valid_;
+    bool running_;
+    bool stop_;
+    Snapshot ring_[RING_SIZE];
+    std::atomic<uint32_t> head_;  // published
+    std::atomic<uint32_t> tail_;  // taken
+    std::atomic<uint32_t> slid_;  // moves drawn to the end
+    unsigned int published_;
+    unsigned int drawn_;
+    unsigned int skipped_;
+    unsigned int deferred_;
+    Grid& grid_;
+    LatencyStats& latency_;
+    Animator animator_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::thread thread_;
+};
+// end of render thread }}}
+
+// game snapshot {{{
+//
+// Path of a file named name in the home directory, NULL if there is none.
+//
+inline const char* HomePath(char* path, size_t size, const char* name)
+{
+#if defined(_WIN32)
+    const char* home = getenv("APPDATA");
+    const char* slash = "\\";
+#else
+    const char* home = getenv("HOME");
+    const char* slash = "/.";
+#endif
+
+    if (home && ((size_t)snprintf(path, size, "%s%s%s", home, slash, name) < size)) {
+        return path;
+    } else {
+        return NULL;
+    }
+}
+
+//
+// The interactive game as it was left: board, undo board and their scores,
+// time played, the tile generator and what the game history records,
+// checked by FNV-1a on reading.
+//
+struct GameSnapshot {
+    char magic[8];  // "2048SAV2"
+    uint8_t board[N][N];
+    uint8_t undo[N][N];
+    int32_t score;
+    int32_t undo_score;
+    int64_t played_ns;
+    uint32_t rng;
+    uint32_t state;     // 0 playing, 0x20 won
+    uint32_t seed;      // of the tile generator when the game started
+    uint32_t moves;
+    uint32_t autoplayed;
+    uint32_t checksum;  // of the bytes before
+
+    uint32_t Checksum() const
+    {
+        const uint8_t* p = (const uint8_t*)this;
+        uint32_t h = 2166136261u;
+
+        for (size_t i = 0; i < offsetof(GameSnapshot, checksum); ++i) {
+            h = (h ^ p[i]) * 16777619u;
+        }
+
+        return h;
+    }
+
+    bool Read(const char* path)
+    {
+        FILE* f = fopen(path, "rb");
+        bool ok = f && (fread(this, sizeof(*this), 1, f) == 1) &&
+                  (memcmp(magic, "2048SAV2", 8) == 0) &&
+                  (checksum == Checksum());
+
+        if (f) {
+            fclose(f);
+        } else { }
+
+        for (int i = 0; ok && (i < N * N); ++i) {
+            ok = (board[i / N][i % N] < 32) && (undo[i / N][i % N] < 32);
+        }
+
+        return ok;
+    }
+
+    // in the home directory, NULL if there is none
+    static const char* DefaultPath()
+    {
+        static char path[1024];
+        return HomePath(path, sizeof(path), "2048-save");
+    }
+};
+
+//
+// Writes the snapshots posted by the input loop from a thread of its own:
+// the latest one every INTERVAL_MS, if it is new, and at Stop().  Post()
+// takes the lock only to copy, which the thread never holds while writing.
+//
+class SnapshotWriter
+{
+  public:
+    enum { INTERVAL_MS = 5000 };
+
+    SnapshotWriter()
+        : path_(NULL), snapshot_(), posted_(0), written_(0), discard_(false),
+          stop_(false), mutex_(), wake_(), thread_() { }
+    ~SnapshotWriter()
+    {
+        Stop();
+    }
+
+    void Start(const char* path)
+    {
+        path_ = path;
+        posted_ = written_ = 0;
+        discard_ = false;
+        stop_ = false;
+
+        if (path_) {
+            thread_ = std::thread(&SnapshotWriter::Run, this);
+        } else { }
+    }
+
+    void Post(const GameSnapshot& snapshot)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        snapshot_ = snapshot;
+        ++posted_;
+        discard_ = false;
+    }
+
+    // the game is over, nothing is left to resume: the file is removed
+    void Discard()
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        discard_ = true;
+    }
+
+    // writes the last snapshot, false if that fails
+    bool Stop()
+    {
+        if (thread_.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(mutex_);
+                stop_ = true;
+            }
+            wake_.notify_one();
+            thread_.join();
+        } else {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        if (discard_) {
+            remove(path_);
+            return true;
+        } else {
+            return Write(lock);
+        }
+    }
+
+  private:
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        while (!wake_.wait_for(lock, std::chrono::milliseconds(INTERVAL_MS),
+                               [this] { return stop_; })) {
+            if (discard_) {
+            } else {
+                Write(lock);
+            }
+        }
+    }
+
+    // the latest snapshot if not yet written, with the lock let go meanwhile
+    bool Write(std::unique_lock<std::mutex>& lock)
+    {
+        if (posted_ == written_) {
+            return true;
+        } else { }
+
+        GameSnapshot snapshot = snapshot_;
+        uint64_t posted = posted_;
+        lock.unlock();
+        bool ok = WriteFileAtomic(path_, &snapshot, sizeof(snapshot));
+        lock.lock();
+        written_ = ok ? posted : written_;
+        return ok;
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(SnapshotWriter);
+
+  private:
+    const char* path_;
+    GameSnapshot snapshot_;
+    uint64_t posted_;
+    uint64_t written_;
+    bool discard_;
+    bool stop_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::thread thread_;
+};
+// end of game snapshot }}}
+
+// game history {{{
+//
+// A finished game, sealed by a checksum so that one cut short by a crash
+// is found.
+//
+struct GameRecord {
+    uint32_t seed;      // of the tile generator when the game started
+    uint32_t score;
+    uint32_t moves;
+    uint32_t duration_ms;
+    uint8_t max_tile;   // exponent
+    char policy[11];    // "human", or the policy of autoplay cut short
+    uint32_t checksum;  // FNV-1a of the bytes before
+
+    uint32_t Checksum() const
+    {
+        const uint8_t* p = (const uint8_t*)this;
+        uint32_t h = 2166136261u;
+
+        for (size_t i = 0; i < offsetof(GameRecord, checksum); ++i) {
+            h = (h ^ p[i]) * 16777619u;
+        }
+
+        return h;
+    }
+};
+
+static_assert(sizeof(GameRecord) == 32, "GameRecord: 32 bytes");
+
+//
+// Finished games appended to a log, and an index next to it (path.idx):
+// the keys score << 32 | record of the first records of the log, sorted
+// and memory-mapped, so ranks, quantiles and the best games are binary
+// searches.  Keys of the records after the index are kept sorted in memory
+// and merged into a new index once there are TAIL of them.  Append()
+// returns once its record is on the disk, and a record cut short by a
+// crash is cut off by the next Open().
+//
+class GameHistory
+{
+  public:
+    enum { TAIL = 4096 };
+
+    GameHistory() : path_(), index_(), tail_(), records_(0), indexed_(0) { }
+    ~GameHistory() { }
+
+    // in the home directory, NULL if there is none
+    static const char* DefaultPath()
+    {
+        static char path[1024];
+        return HomePath(path, sizeof(path), "2048-history");
+    }
+
+    bool Open(const char* path)
+    {
+        path_ = path;
+        index_.Close();
+        tail_.clear();
+        records_ = indexed_ = 0;
+
+        FILE* f = fopen(path, "rb");
+        long size = 0;
+
+        if (f) {
+            fseek(f, 0, SEEK_END);
+            size = ftell(f);
+        } else {
+            return true;  // no games yet
+        }
+
+        records_ = (uint64_t)size / sizeof(GameRecord);
+        GameRecord last;
+
+        if ((records_ > 0) &&
+            (fseek(f, (long)((records_ - 1) * sizeof(GameRecord)), SEEK_SET) == 0) &&
+            (fread(&last, sizeof(last), 1, f) == 1) &&
+            (last.checksum != last.Checksum())) {
+            --records_;
+        } else { }
+
+        fclose(f);
+
+        if ((uint64_t)size == records_ * sizeof(GameRecord)) {
+        } else if (TruncateFile(path, records_ * sizeof(GameRecord))) {
+        } else {
+            return false;
+        }
+
+        if (index_.Open(IndexPath().c_str(), 0, false) &&
+            (index_.Size() >= sizeof(IndexHeader))) {
+            const IndexHeader& header = *(const IndexHeader*)index_.Data();
+
+            if ((memcmp(header.magic, "2048IDX1", 8) == 0) &&
+                (header.records <= records_) &&
+                (index_.Size() >= sizeof(IndexHeader) + header.records * 8)) {
+                indexed_ = header.records;
+            } else {
+                index_.Close();
+            }
+        } else {
+            index_.Close();
+        }
+
+        return LoadTail() && ((tail_.size() < TAIL) || Reindex());
+    }
+
+    bool Append(GameRecord& record)
+    {
+        FILE* f = fopen(path_.c_str(), "ab");
+        record.checksum = record.Checksum();
+
+        if (f) {
+        } else {
+            return false;
+        }
+
+        bool ok = (fwrite(&record, sizeof(record), 1, f) == 1) &&
+                  (fflush(f) == 0);
+#if defined(_WIN32)
+        ok = ok && (_commit(_fileno(f)) == 0);
+#else
+        ok = ok && (fsync(fileno(f)) == 0);
+#endif
+        ok = (fclose(f) == 0) && ok;
+
+        if (ok) {
+            uint64_t key = Key(record.score, records_++);
+            tail_.insert(std::upper_bound(tail_.begin(), tail_.end(), key), key);
+        } else { }
+
+        return ok && ((tail_.size() < TAIL) || Reindex());
+    }
+
+    uint64_t Games() const
+    {
+        return indexed_ + tail_.size();
+    }
+
+    // 1 for the best score
+    uint64_t Rank(uint32_t score)
+    {
+        return 1 + CountAbove(score);
+    }
+
+    // the score below which q (0 to 1) of the games scored
+    uint32_t Quantile(double q)
+    {
+        uint64_t games = Games();
+        uint64_t k = (uint64_t)(q * (double)(games ? games - 1 : 0));
+        uint32_t low = 0;
+        uint32_t high = 0xffffffffu;
+
+        // the least score with more than k games at most as good
+        while (low < high) {
+            uint32_t mid = low + (high - low) / 2;
+
+            if (games - CountAbove(mid) > k) {
+                high = mid;
+            } else {
+                low = mid + 1;
+            }
+        }
+
+        return low;
+    }
+
+    // the n best games, best first
+    bool Best(size_t n, std::vector<GameRecord>& best)
+    {
+        const uint64_t* keys = Keys();
+        size_t i = (size_t)indexed_;
+        size_t j = tail_.size();
+        FILE* f = fopen(path_.c_str(), "rb");
+        best.clear();
+
+        while (f && (best.size() < n) && (i + j > 0)) {
+            bool tail = (i == 0) || ((j > 0) && (tail_[j - 1] > keys[i - 1]));
+            uint64_t key = tail ? tail_[--j] : keys[--i];
+            GameRecord r;
+
+            if ((fseek(f, (long)((key & 0xffffffffu) * sizeof(r)), SEEK_SET) == 0) &&
+                (fread(&r, sizeof(r), 1, f) == 1)) {
+                best.push_back(r);
+            } else {
+                break;
+            }
+        }
+
+        if (f) {
+            fclose(f);
+        } else { }
+
+        return best.size() == Min((uint64_t)n, Games());
+    }
+
+    // the n best games and quantiles of the scores, with the time taken
+    bool Print(size_t n, FILE* log)
+    {
+        static const double q[] = { 0.1, 0.5, 0.9, 0.99, 0.999 };
+        std::vector<GameRecord> best;
+        int64_t start = Clock().Ticks_ns();
+        bool ok = Best(n, best);
+        int64_t best_ns = Clock().Ticks_ns() - start;
+
+        fprintf(log, "%llu games in '%s'\n", (unsigned long long)Games(),
+                path_.c_str());
+        fprintf(log, "%6s %8s %6s %6s %9s  %-11s %s\n", "rank", "score", "tile",
+                "moves", "time", "policy", "seed");
+
+        for (size_t i = 0; i < best.size(); ++i) {
+            const GameRecord& r = best[i];
+            fprintf(log, "%6u %8u %6u %6u %8.1fs  %-11.11s %u\n",
+                    (unsigned int)i + 1, r.score, 1u << r.max_tile, r.moves,
+                    r.duration_ms / 1000.0, r.policy, r.seed);
+        }
+
+        uint32_t score[sizeof(q) / sizeof(q[0])];
+        start = Clock().Ticks_ns();
+
+        for (size_t i = 0; i < sizeof(q) / sizeof(q[0]); ++i) {
+            score[i] = Quantile(q[i]);
+        }
+
+        int64_t quantile_ns = Clock().Ticks_ns() - start;
+        start = Clock().Ticks_ns();
+        uint64_t rank = Rank(score[1]);
+        int64_t rank_ns = Clock().Ticks_ns() - start;
+
+        fprintf(log, "\nscore percentiles:");
+
+        for (size_t i = 0; i < sizeof(q) / sizeof(q[0]); ++i) {
+            fprintf(log, " p%g %u", q[i] * 100, score[i]);
+        }
+
+        fprintf(log, "\nmedian score ranks #%llu\n"
+                "best %u in %.1f us, a quantile in %.1f us, a rank in %.1f us\n",
+                (unsigned long long)rank, (unsigned int)best.size(),
+                best_ns / 1000.0,
+                quantile_ns / 1000.0 / (double)(sizeof(q) / sizeof(q[0])),
+                rank_ns / 1000.0);
+        return ok;
+    }
+
+  private:
+    struct IndexHeader {
+        char magic[8];  // "2048IDX1"
+        uint64_t records;
+    };
+
+    static uint64_t Key(uint32_t score, uint64_t record)
+    {
+        return ((uint64_t)score << 32) | (record & 0xffffffffu);
+    }
+
+    std::string IndexPath() const
+    {
+        return path_ + ".idx";
+    }
+
+    const uint64_t* Keys()
+    {
+        return index_.Data() ? (const uint64_t*)((const char*)index_.Data() +
+                                                 sizeof(IndexHeader)) : NULL;
+    }
+
+    uint64_t CountAbove(uint32_t score)
+    {
+        uint64_t last = Key(score, 0xffffffffu);
+        const uint64_t* keys = Keys();
+        uint64_t n = tail_.end() - std::upper_bound(tail_.begin(), tail_.end(), last);
+
+        if (keys) {
+            n += (uint64_t)(keys + indexed_ - std::upper_bound(keys, keys + indexed_, last));
+        } else { }
+
+        return n;
+    }
+
+    // keys of the records after the index
+    bool LoadTail()
+    {
+        FILE* f = fopen(path_.c_str(), "rb");
+        bool ok = f && (fseek(f, (long)(indexed_ * sizeof(GameRecord)), SEEK_SET) == 0);
+        GameRecord r;
+
+        for (uint64_t i = indexed_; ok && (i < records_); ++i) {
+            ok = (fread(&r, sizeof(r), 1, f) == 1);
+            tail_.push_back(Key(r.score, i));
+        }
+
+        if (f) {
+            fclose(f);
+        } else { }
+
+        std::sort(tail_.begin(), tail_.end());
+        return ok;
+    }
+
+    // a new index of all records, written through a temporary file
+    bool Reindex()
+    {
+        std::vector<uint64_t> keys((size_t)Games() + 2);
+        const uint64_t* old = Keys();
+        IndexHeader* header = (IndexHeader*)&keys[0];
+
+        memset(header, 0, sizeof(*header));
+        memcpy(header->magic, "2048IDX1", 8);
+        header->records = records_;
+        std::merge(old, old ? old + indexed_ : old, tail_.begin(), tail_.end(),
+                   keys.begin() + 2);
+        index_.Close();
+
+        if (WriteFileAtomic(IndexPath().c_str(), &keys[0],
+                            keys.size() * sizeof(uint64_t)) &&
+            index_.Open(IndexPath().c_str(), 0, false)) {
+            indexed_ = records_;
+            tail_.clear();
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(GameHistory);
+
+  private:
+    std::string path_;
+    MappedFile index_;
+    std::vector<uint64_t> tail_;  // sorted
+    uint64_t records_;   // in the log
+    uint64_t indexed_;   // by the index
+};
+// end of game history }}}
+
+class TimeKeeper
+{
+  public:
+    explicit TimeKeeper(Renderer& r) : show_ms_(false), hash_(-1), timer_(), renderer_(r) { }
+    ~TimeKeeper() { }
+
+    void operator()()
+    {
+        Update();
+    }
+
+    void Update()
+    {
+        const Duration dur = timer_;
+
+        if (show_ms_) {
+            if (dur.ms + 1000 == hash_) {
+                return;
+            } else {
+                hash_ = dur.ms + 1000;
+            }
+        } else  {
+            if (dur.sec == hash_) {
+                return;
+            } else {
+                hash_ = dur.sec;
+            }
+        }
+
+        renderer_.ShowTime(timer_, show_ms_);
+    }
+
+    void Update(bool show_ms)
+    {
+        show_ms_ = show_ms;
+        Update();
+    }
+
+    void Start(int64_t played_ns = 0)
+    {
+        show_ms_ = false;
+        hash_ = -1;
+        timer_.Start(played_ns);
+    }
+
+    int64_t Played_ns()
+    {
+        return timer_.Elapsed_ns();
+    }
+
+    void Stop()
+    {
+        show_ms_ = true;
+        timer_.Stop();
+    }
+
+    void Continue()
+    {
+        show_ms_ = false;
+        hash_ = -1;
+        timer_.Continue();
+        Update();
+    }
+
+    void Pause()
+    {
+        show_ms_ = true;
+        timer_.Pause();
+        Update(true);
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(TimeKeeper);
+
+  private:
+    bool show_ms_;
+    int hash_;
+    Timer timer_;
+    Renderer& renderer_;
+};
+
+
+class Puzzle2048
+{
+  public:
+    Puzzle2048()
+        : old_score_(0), hint_(false), autoplay_(false), depth_(0),
+          score_(), grid_(), latency_(), renderer_(grid_, latency_),
+          time_keeper_(renderer_),
+#if defined(_MSC_VER) && (_MSC_VER < 1800)
+          // not supported ?
+#else
+          undo_{ }, board_{ },
+#endif
+          matrix(board_.ac), tt_(NULL), tt_stats_(), cache_(), cache_stats_(),
+          book_(), book_hits_(0), policy_(NULL), policy_name_(NULL),
+          latency_log_(NULL), save_path_(GameSnapshot::DefaultPath()),
+          snapshots_(), history_path_(GameHistory::DefaultPath()), history_(),
+          history_failed_(false), seed_(0), moves_(0), autoplayed_(false),
+          recorded_(false)
+    {
+#if defined(_MSC_VER) && (_MSC_VER < 1800)
+        memset(&undo_, 0, sizeof(undo_));
+        memset(&board_, 0, sizeof(undo_));
+#endif
+        matrix.Reset(0);
+    }
+    ~Puzzle2048()
+    {
+        delete policy_;
+        delete tt_;
+    }
+
+    // hint searches share the evaluation cache file at path
+    bool OpenCache(const char* path)
+    {
+        return cache_.Open(path);
+    }
+
+    // hints and autoplay take moves from the book at path when it has them
+    bool OpenBook(const char* path)
+    {
+        return book_.Open(path);
+    }
+
+    // hints and autoplay take moves from the MovePolicy name instead of the
+    // book and the search
+    bool SetPolicy(const char* name)
+    {
+        delete policy_;
+        policy_ = new MovePolicy;
+
+        if (policy_->Set(name, (uint64_t)Clock().Ticks_ns())) {
+            policy_name_ = name;
+            return true;
+        } else {
+            delete policy_;
+            policy_ = NULL;
+            return false;
+        }
+    }
+
+    // depth of hint searches, 0 for ExpectiMax::DEFAULT_DEPTH
+    void SetSearchDepth(int depth)
+    {
+        depth_ = depth;
+    }
+
+    // moves slide tiles for ms milliseconds at up to fps frames a second
+    void SetAnimation(unsigned int ms, unsigned int fps)
+    {
+        renderer_.SetAnimation(ms, fps);
+    }
+
+    // the input latency histograms are written to path when a game ends
+    void SetLatencyLog(const char* path)
+    {
+        latency_log_ = path;
+    }
+
+    // Play() saves the game to path and starts from the game saved there
+    void SetSavePath(const char* path)
+    {
+        save_path_ = path;
+    }
+
+    // Play() records lost games in the history at path and ranks scores
+    // among them
+    void SetHistoryPath(const char* path)
+    {
+        history_path_ = path;
+    }
+
+    // builds an opening book at path, searching each position to depth
+    int MakeBook(const char* path, int depth)
+    {
+        BookBuilder builder(BookBuilder::DEFAULT_PLIES,
+                            depth ? depth : (int)BookBuilder::DEFAULT_DEPTH,
+                            cache_.Table());
+
+        if (builder.Build(path, stderr)) {
+            fprintf(stderr, "book written to '%s'\n", path);
+            return 1;
+        } else {
+            fprintf(stderr, "cannot write book '%s'\n", path);
+            return 0;
+        }
+    }
+
+    int Play(int s, int d)
+    {
+        unsigned int m = 1;
+        int k = GAME_NOOP;
+        int state = 0;
+        int type;
+        unsigned int rand_row = 0;
+        unsigned int rand_col = 0;
+        bool highlight = false;
+        Board4x4 before;
+
+        // while the game is idle the timer is updated
+        class Ticker
+        {
+          public:
+            Ticker(TimeKeeper& time_keeper, Renderer& renderer) :
+                time_keeper_(time_keeper), renderer_(renderer) { }
+
+            void operator()()
+            {
+                time_keeper_();
+                renderer_.Publish();
+            }
+
+          private:
+            DISALLOW_COPY_AND_ASSIGN(Ticker);
+
+          private:
+            TimeKeeper& time_keeper_;
+            Renderer& renderer_;
+        };
+        Ticker ticker(time_keeper_, renderer_);
+
+        if (history_path_ && !history_.Open(history_path_)) {
+            fprintf(stderr, "cannot open game history '%s'\n", history_path_);
+            history_path_ = NULL;
+        } else { }
+
+        short y_top = InitConsole(s, d);
+        InputReader ir(y_top);
+        int64_t played_ns = 0;
+        renderer_.Start();
+
+        if (Restore(state, played_ns)) {
+        } else {
+            Start2048();
+        }
+
+        for (; k == GAME_NOOP; k = ir.GetInput()) {
+            // no-op
+        }
+
+        time_keeper_.Start(played_ns);
+        snapshots_.Start(save_path_);
+
+        if (state) {
+            time_keeper_.Pause();  // won
+        } else { }
+
+        // what an input changed is drawn by the render thread
+        for (; k != GAME_ABORT;
+             renderer_.Publish(), PostSnapshot(state), k = ir.GetInput(ticker)) {
+            if (k == GAME_AUTOPLAY) {
+                autoplay_ = !autoplay_ && !state;
+                autoplayed_ = autoplayed_ || autoplay_;
+                ir.SetTimerEvents(autoplay_);
+                continue;
+            } else if (k == GAME_TIMER) {
+                autoplay_ = autoplay_ && !state;  // stops at won/lost
+                ir.SetTimerEvents(autoplay_);
+                k = (autoplay_ && !renderer_.Sliding()) ? AutoMove() : GAME_NOOP;
+            } else { }
+
+            switch (k) {
+            case GAME_ERROR:  // TODO: report error and exit or try recover?
+            case GAME_NOOP:
+                continue;
+            case GAME_ABORT:
+                time_keeper_.Update(true);
+                break;
+            case GAME_UNDO:
+                highlight = false;
+                Undo();
+
+                if (state) {
+                    renderer_.ClearMessage();
+                    state = 0;
+                } else { }
+
+                time_keeper_.Continue();
+                renderer_.ShowScore(score_);
+                renderer_.ShowMatrix(board_);
+                continue;
+            default:
+                if (k >= 0x10000) {  // cheating ...
+                    int r = (k / 0x100) & 0xff;
+                    int c = k & 0xff;
+                    uint8_t cur = 0;
+
+                    if ((r - 1) >= 0) {
+                        cur = Max<uint8_t>(cur, matrix(r - 1, c));
+                    } else { }
+
+                    if ((r + 1) < N) {
+                        cur = Max<uint8_t>(cur, matrix(r + 1, c));
+                    } else { }
+
+                    if ((c - 1) >= 0) {
+                        cur = Max<uint8_t>(cur, matrix(r, c - 1));
+                    } else { }
+
+                    if ((c + 1) < N) {
+                        cur = Max<uint8_t>(cur, matrix(r, c + 1));
+                    } else { }
+
+                    if (cur && cur > matrix(r, c)) {
+                        matrix.SetAt(r, c, cur);
+                    } else { }
+
+                    renderer_.ShowMatrix(board_);
+                } else { }
+                break;
+            }
+
+            if (state) {
+                if (k == GAME_STOP) {
+                    time_keeper_.Pause();
+                    break;
+                } else {
+                    if (((state & 0x20) && ((state & 0x0f) > 0)) ||
+                        ((state & 0x10) && ((state & 0x0f) > 1))) {
+                        k = GAME_PERSIST;
+                    } else { }
+                }
+
+                switch (k) {
+                case GAME_PERSIST:
+                    renderer_.ClearMessage();
+
+                    if ((state & 0xf0) == 0x10) {
+                        Start2048();
+                    } else {
+                        time_keeper_.Continue();
+
+                        if (AddNew(rand_row, rand_col)) {
+                            renderer_.ShowCell(matrix(rand_row, rand_col), rand_row, rand_col, true);
+                        } else { }
+                    }
+
+                    state = 0;
+                    break;
+                case GAME_STOP:
+                    break;  // see above
+                case MOVE_LEFT:
+                case MOVE_RIGHT:
+                case MOVE_UP:
+                case MOVE_DOWN:
+                    ++state;
+                    continue;
+                default:
+                    continue;
+                }
+            } else {
+                if (m) {
+                    Save();
+                } else { }
+
+                m = 0;
+                time_keeper_.Update(false);
+
+                switch (k) {
+                case GAME_RESTART:
+                    Start2048();
+                    renderer_.ShowMatrix(board_);
+                    continue;
+                case BOARD_REFRESH:
+                    renderer_.DrawGrid();
+                    renderer_.ShowMatrix(board_);
+                    renderer_.ShowScore(score_);
+                    time_keeper_.Update();
+                    continue;
+                case BOARD_TRANSPOSE:
+                    matrix.Transpose();
+                    renderer_.ShowMatrix(board_);
+                    continue;
+                case GAME_HINT:
+                    ShowHint();
+                    continue;
+                case BOARD_ROTATE_CW:
+                    matrix.RotateCW();
+                    renderer_.ShowMatrix(board_);
+                    continue;
+                case BOARD_ROTATE_CCW:
+                    matrix.RotateCCW();
+                    renderer_.ShowMatrix(board_);
+                    continue;
+                case BOARD_SWAP_VERTICAL:
+                    matrix.SwapV();
+                    renderer_.ShowMatrix(board_);
+                    continue;
+                case BOARD_SWAP_HORIZONTAL:
+                    matrix.SwapH();
+                    renderer_.ShowMatrix(board_);
+                    continue;
+#ifdef TEST_
+                case GAME_WON:
+                    state = 0x20;
+                    time_keeper_.Pause();
+                    renderer_.ShowMessage(true);  // won
+                    continue;
+                case GAME_LOST:
+                    state = 0x10;
+                    time_keeper_.Pause();
+                    renderer_.ShowMessage(false);  // lost
+                    continue;
+#endif
+                default:
+                    break;
+                }
+
+                switch (k) {
+                case MOVE_LEFT:
+                case MOVE_MOUSE_WHEEL_FW:
+                    type = ROW_L2R_STRIPE;
+                    break;
+                case MOVE_RIGHT:
+                case MOVE_MOUSE_WHEEL_FW_SHIFT:
+                    type = ROW_R2L_STRIPE;
+                    break;
+                case MOVE_UP:
+                case MOVE_MOUSE_WHEEL_BW_SHIFT:
+                    type = COL_U2D_STRIPE;
+                    break;
+                case MOVE_DOWN:
+                case MOVE_MOUSE_WHEEL_BW:
+                    type = COL_D2U_STRIPE;
+                    break;
+                default:
+                    type = UUS;
+                    break;
+                }
+
+                if (type != UUS) {
+                    before = board_;
+                    m = Nudge(type);
+
+                    if (m > 0) {
+                        latency_.Add(LatencyStats::MOVE_STAGE, ir.InputTime());
+                        ++moves_;
+                    } else { }
+                } else { }
+
+                if (m >= 2048) {
+                    state = 0x20;
+                    time_keeper_.Pause();
+                    renderer_.ShowScore(score_);
+                    ShowEnd(true);
+                    renderer_.ShowMatrix(board_);
+                    ResetHighlight();
+                    continue;
+                } else { }
+
+                if (m > 0) {
+                    if (hint_) {
+                        renderer_.ShowHint(UUS);
+                        hint_ = false;
+                    } else { }
+
+                    renderer_.ShowScore(score_);
+                    renderer_.Slide(before, board_, type);
+                    m = AddNew(rand_row, rand_col);
+                    highlight = (m > 0);
+
+                    if (highlight) {
+                        renderer_.ShowCell(matrix(rand_row, rand_col), rand_row, rand_col, true);
+                    } else { }
+
+                    latency_.Add(LatencyStats::SPAWN_STAGE, ir.InputTime());
+                    renderer_.SetInputTime(ir.InputTime());
+                } else {
+                    if (highlight) {
+                        renderer_.ShowCell(matrix(rand_row, rand_col), rand_row, rand_col, false);  // reset
+                        highlight = false;
+                    } else { }
+                }
+
+                if (IsSolvable()) {
+                } else {
+                    m = 0;
+                    state = 0x10;
+                    time_keeper_.Pause();
+                    ShowEnd(false);
+                }
+            }
+        }
+
+        PostSnapshot(state);
+        renderer_.Stop();
+        ResetConsole(s);
+
+        if (snapshots_.Stop()) {
+        } else {
+            fprintf(stderr, "cannot save the game to '%s'\n", save_path_);
+        }
+
+        if (history_failed_) {
+            fprintf(stderr, "cannot record games in '%s'\n", history_path_);
+        } else { }
+
+        con.PrintStats(stderr);
+        renderer_.PrintStats(stderr);
+        latency_.Print(stderr);
+
+        if (latency_log_ && !latency_.Dump(latency_log_)) {
+            fprintf(stderr, "cannot write latency log '%s'\n", latency_log_);
+        } else { }
+
+        if (tt_) {
+            tt_->PrintStats(stderr, tt_stats_);
+        } else { }
+
+        if (cache_.Table()) {
+            cache_.Table()->PrintStats(stderr, cache_stats_, "cache");
+        } else { }
+
+        if (book_.Size()) {
+            fprintf(stderr, "book: %u positions, %u hits\n",
+                    (unsigned int)book_.Size(), book_hits_);
+        } else { }
+
+        return 1;
+    }
+
+    int SchemeTest(int s, int d)
+    {
+        int unused;
+        COLORREF ct[16];
+        InitConsole(s, d);
+        con.GetPalette(ct);
+
+        con.Write("\n Press ESC key to exit\n\n");
+
+        char buf[16] = { };
+
+        for (unsigned int i = 0; i < 16; ++i) {
+            con.Write(" ");
+
+            for (unsigned int j = 0; j < 16; ++j) {
+                unsigned int color = ((i * 16) + j) & 0xffu;
+                unused = snprintf(buf, sizeof(buf) - 1, " %2x ", color);
+                (void)unused;  // TODO: assert?
+                con.Write(color, buf);
+            }
+
+            unused = snprintf(buf, sizeof(buf) - 1, " - %06lx\n", ct[i]);
+            (void)unused;  // TODO: assert?
+            con.Write(0x07u, buf);
+        }
+
+        int k;
+        InputReader ir;
+
+        while ((k = ir.GetInput()) != GAME_ABORT) {
+            Sleep(0);
+        }
+
+        con.Write("\n");
+        ResetConsole(s);
+        return 0;
+    }
+
+    int GridTest(int g, int s, int d)
+    {
+        InitConsole(s, d);
+
+        switch (g) {
+        case 1:
+            Preset(-1);
+            board_.ac[0][0] = 0;
+            board_.ac[0][1] = 1;
+            break;
+        case 2:
+            Preset(N * N - N - 1);
+            break;
+        case 3:
+            Preset(N * N + 1);
+            break;
+        default:
+            matrix.Reset(0);
+            break;
+        }
+
+        grid_.DrawGrid();
+        grid_.ShowMatrix(matrix);
+
+        if (g == 1) {
+            grid_.ShowCell(matrix(0, 1), 0, 1);
+        } else { }
+
+        con.MoveTo(48, 10);
+        con.SetColor(0x70u);
+        con.Write(" Press ESC to exit ");
+
+        int k;
+        InputReader ir;
+
+        while ((k = ir.GetInput()) != GAME_ABORT) {
+            if (k == 'W') {
+                grid_.ShowMessage(true);  // won
+                continue;
+            } else if (k == 'E') {
+                grid_.ShowMessage(false);  // lost
+                continue;
+            } else {
+                grid_.ClearMessage();
+            }
+
+            Sleep(0);
+        }
+
+        ResetConsole(s);
+        return 0;
+    }
+    // plays moves chosen by searches, drawn by the render thread, and fails
+    // if a move, a spawn, a frame or a search allocates once warmed up
+    int AllocTest(int moves, int d, FILE* out)
+    {
+#if defined(ALLOC_TRACKING_)
+        enum { WARM_UP = 16 };
+        InitConsole(0, d);
+        renderer_.Start();
+        Start2048();
+
+        for (int i = 0; i < WARM_UP + moves; renderer_.Publish(), ++i) {
+            if (i == WARM_UP) {
+                alloc_tracker.Reset();
+                alloc_tracker.Start();
+            } else { }
+
+            int type = SuggestMove();
+            Board4x4 before = board_;
+            unsigned int m = (type == UUS) ? 0 : Nudge(type);
+
+            if ((m == 0) || (m >= 2048)) {
+                Start2048();
+                continue;
+            } else { }
+
+            unsigned int r, c;
+            renderer_.ShowScore(score_);
+            renderer_.Slide(before, board_, type);
+
+            if (AddNew(r, c)) {
+                renderer_.ShowCell(matrix(r, c), r, c, true);
+            } else { }
+        }
+
+        alloc_tracker.Stop();
+        renderer_.Stop();
+        ResetConsole(0);
+        alloc_tracker.Print(out);
+
+        uint64_t hot = alloc_tracker.Count(ALLOC_MOVE) + alloc_tracker.Count(ALLOC_SPAWN) +
+                       alloc_tracker.Count(ALLOC_FRAME) + alloc_tracker.Count(ALLOC_SEARCH);
+
+        if (hot) {
+            fprintf(out, "%llu allocations in moves, spawns, frames or searches\n",
+                    (unsigned long long)hot);
+        } else {
+            fprintf(out, "%d moves without allocations\n", moves);
+        }
+
+        return hot ? 0 : 1;
+#else
+        (void)moves;
+        (void)d;
+        fprintf(out, "%s\n", "allocations are not tracked in this build");
+        return 0;
+#endif  // ALLOC_TRACKING_
+    }
+
+
+#if defined(RECORDING_CONSOLE_)
+    // draws a game of random moves on the recording console and reports the
+    // drawing calls and bytes of each kind of screen update
+    int RenderBench(int moves, int d, FILE* out)
+    {
+        enum { START, MOVE, TIME, MESSAGE, REDRAW, PHASES };
+        static const char* const name[PHASES] = {
+            "start", "move", "time", "message", "redraw"
+        };
+
+        RenderStats total[PHASES];
+        RenderStats worst[PHASES];
+        unsigned int count[PHASES] = { };
+        memset(total, 0, sizeof(total));
+        memset(worst, 0, sizeof(worst));
+
+        class Sample
+        {
+          public:
+            Sample(RenderStats& total, RenderStats& worst, unsigned int& count) :
+                total_(total), worst_(worst), count_(count)
+            {
+                con.ResetStats();
+            }
+            ~Sample()
+            {
+                const RenderStats& s = con.GetStats();
+                total_.move_to += s.move_to;
+                total_.set_color += s.set_color;
+                total_.write += s.write;
+                total_.copy_region += s.copy_region;
+                total_.write_cells += s.write_cells;
+                total_.bytes += s.bytes;
+                worst_.move_to = std::max(worst_.move_to, s.move_to);
+                worst_.set_color = std::max(worst_.set_color, s.set_color);
+                worst_.write = std::max(worst_.write, s.write);
+                worst_.copy_region = std::max(worst_.copy_region, s.copy_region);
+                worst_.write_cells = std::max(worst_.write_cells, s.write_cells);
+                worst_.bytes = std::max(worst_.bytes, s.bytes);
+                ++count_;
+            }
+
+          private:
+            DISALLOW_COPY_AND_ASSIGN(Sample);
+
+          private:
+            RenderStats& total_;
+            RenderStats& worst_;
+            unsigned int& count_;
+        };
+
+        InitConsole(0, d);
+
+        {
+            Sample sample(total[START], worst[START], count[START]);
+            Start2048();
+        }
+
+        // the same board every run, so that frame hashes can be compared
+        unsigned int r, c;
+        rng.Seed(0);
+        matrix.Reset(0);
+        AddNew(r, c);
+        AddNew(r, c);
+        score_.Reset(0);
+        grid_.ShowMatrix(matrix);
+        grid_.ShowScore(score_);
+
+        for (int i = 0; i < moves; ++i) {
+            static const int types[4] = {
+                ROW_L2R_STRIPE, COL_U2D_STRIPE, ROW_R2L_STRIPE, COL_D2U_STRIPE
+            };
+            unsigned int m = 0;
+            unsigned int first = rng(4);
+
+            for (unsigned int j = 0; (j < 4) && (m == 0); ++j) {
+                m = Nudge(types[(first + j) & 3]);
+            }
+
+            if (m == 0) {
+                break;  // lost
+            } else { }
+
+            Sample sample(total[MOVE], worst[MOVE], count[MOVE]);
+            grid_.ShowScore(score_);
+            grid_.ShowMatrix(matrix);
+
+            if (AddNew(r, c)) {
+                grid_.ShowCell(matrix(r, c), r, c, true);
+            } else { }
+        }
+
+        for (int i = 0; i < 60; ++i) {
+            Duration dur = { 0, 0, (int8_t)(i / 60), (int8_t)(i % 60), 0 };
+            Sample sample(total[TIME], worst[TIME], count[TIME]);
+            grid_.ShowTime(dur);
+        }
+
+        for (int i = 0; i < 2; ++i) {
+            Sample sample(total[MESSAGE], worst[MESSAGE], count[MESSAGE]);
+            grid_.ShowMessage(i == 0);
+            grid_.ClearMessage();
+        }
+
+        {
+            Sample sample(total[REDRAW], worst[REDRAW], count[REDRAW]);
+            grid_.DrawGrid();
+            grid_.ShowMatrix(matrix);
+            grid_.ShowScore(score_);
+        }
+
+        ResetConsole(0);
+
+        fprintf(out, "%-8s %6s %8s %8s %8s %8s %8s %8s %8s\n", "update", "count",
+                "moves", "colors", "writes", "copies", "blits", "bytes", "max");
+
+        for (int i = 0; i < PHASES; ++i) {
+            unsigned int n = count[i] ? count[i] : 1;
+            fprintf(out, "%-8s %6u %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f %8llu\n",
+                    name[i], count[i],
+                    (double)total[i].move_to / n, (double)total[i].set_color / n,
+                    (double)total[i].write / n, (double)total[i].copy_region / n,
+                    (double)total[i].write_cells / n, (double)total[i].bytes / n, (unsigned long long)worst[i].bytes);
+        }
+
+        fprintf(out, "frame hash %016llx\n", (unsigned long long)con.FrameHash());
+        return 1;
+    }
+#endif  // RECORDING_CONSOLE_
+
+  private:
+    class Scorer
+    {
+      public:
+        Scorer() : value_(0) { }
+        ~Scorer() { }
+
+        void operator()(int a)
+        {
+            value_ += a;
+        }
+
+        // int operator=(int n)
+        // {
+        //     value_ = n;
+        //     return value_;
+        // }
+
+        operator int() const
+        {
+            return value_;
+        }
+
+        void Reset(int n)
+        {
+            value_ = n;
         }
 
       private:
         DISALLOW_COPY_AND_ASSIGN(Scorer);
 
-      private:
-        int value_;
-    };
+      private:
+        int value_;
+    };
+
+    class InputReader
+    {
+      public:
+        InputReader(short top = 0)
+            : k_(0), xk_(0), t_(0), xt_(0), input_us_(0), timer_events_(false),
+              mapper_(top)
+#if defined(_MSC_VER) && (_MSC_VER < 1900)
+        // not supported ?
+#else
+              , inrec_{0, {{0, 0, 0, 0, {0}, 0}}}
+#endif
+        {
+#if defined(_MSC_VER) && (_MSC_VER < 1900)
+            memset(&inrec_, 0, sizeof(inrec_));
+#endif
+        }
+        ~InputReader() { }
+
+        // with timer events on, an idle input wait returns GAME_TIMER
+        void SetTimerEvents(bool on)
+        {
+            timer_events_ = on;
+        }
+
+        // Clock::Ticks_us() when the last input was read, 0 for GAME_TIMER
+        int64_t InputTime()
+        {
+            return input_us_;
+        }
+
+        int GetInput()
+        {
+            class Dummy
+            {
+              public:
+                void operator()()
+                {
+                    // no-op
+                }
+            };
+            Dummy dummy;
+            return GetInput(dummy);
+        }
+
+        template<typename T>
+        int GetInput(T& time_keeper)
+        {
+            k_ = GAME_NOOP;
+            int n = 0;
+            int value = 0;
+            bool done = false;
+
+            do {
+                if (con.ReadInput(inrec_)) {
+                    switch (inrec_.EventType) {
+                    case 0:  // NOTE: 0 is set by Console.ReadInput(). can be error
+                        time_keeper();
+                        tracer.Record(TR_IDLE, timer_events_);
+
+                        if (timer_events_) {
+                            input_us_ = 0;
+                            return GAME_TIMER;
+                        } else { }
+                        continue;
+                    case KEY_EVENT:
+                        input_us_ = Clock().Ticks_us();
+                        value = GetKeyInput(inrec_.Event.KeyEvent, n);
+                        tracer.Record(TR_KEY, inrec_.Event.KeyEvent.wVirtualKeyCode,
+                                      inrec_.Event.KeyEvent.bKeyDown, value);
+
+                        if (value) {
+                            return value;
+                        } else { }
+                        continue;
+                    case MOUSE_EVENT:
+                        input_us_ = Clock().Ticks_us();
+                        value = GetMouseInput(inrec_.Event.MouseEvent);
+                        tracer.Record(TR_MOUSE, inrec_.Event.MouseEvent.dwMousePosition.X,
+                                      inrec_.Event.MouseEvent.dwMousePosition.Y, value);
+
+                        if (value) {
+                            return value;
+                        } else { }
+                        continue;
+                    case WINDOW_BUFFER_SIZE_EVENT:
+                    case MENU_EVENT:
+                    case FOCUS_EVENT:
+                        continue;
+                    default:
+                        DPRINT("unknown input.EventType: %u", inrec_.EventType);
+                        continue;
+                    }
+                } else {
+                    return GAME_ABORT;
+                }
+                continue;
+            } while (!done);
+
+            return GAME_NOOP;
+        }
+
+      private:
+        int GetKeyInput(KEY_EVENT_RECORD& ker, int& n)
+        {
+            k_ = ker.wVirtualKeyCode;
+
+            if (ker.bKeyDown == FALSE) {
+                switch (k_) {
+                case VK_F5: return BOARD_REFRESH;
+                case 'Y': case VK_RETURN: return GAME_PERSIST;
+                case 'Q': case VK_ESCAPE: return GAME_ABORT;
+                case 'N': return GAME_STOP;
+                case 'Z': return GAME_UNDO;
+                case 'S': return GAME_HINT;
+                case 'A': return GAME_AUTOPLAY;
+                case 'I': return GAME_RESTART;
+                case 'T': return BOARD_TRANSPOSE;
+                case 'R': return BOARD_ROTATE_CW;
+                case 'V': return BOARD_SWAP_VERTICAL;
+                case 'H': return BOARD_SWAP_HORIZONTAL;
+#ifdef TEST_
+                case 'W': return (++n == 3) ? GAME_WON : GAME_NOOP;
+                case 'E': return (++n == 3) ? GAME_LOST : GAME_NOOP;
+#endif
+                default: break;
+                }
+            } else { }
+
+            n = (xk_ != k_) ? 0 : n;
+
+            t_ = Clock().Ticks_ms();
+
+            if (k_ == xk_) {
+                if ((t_ - xt_) < 300u) {
+                    return GAME_NOOP;
+                } else { }
+            } else { }
+
+            xt_ = t_;
+            xk_ = k_;
+
+            switch (k_) {
+            case VK_LEFT: return MOVE_LEFT;
+            case VK_RIGHT: return MOVE_RIGHT;
+            case VK_UP: return MOVE_UP;
+            case VK_DOWN: return MOVE_DOWN;
+            case 'R':
+                if (ker.dwControlKeyState & SHIFT_PRESSED) {
+                    return BOARD_ROTATE_CCW;
+                } else { }
+                break;
+            default: break;
+            }
+
+            return GAME_NOOP;
+        }
+
+        int GetMouseInput(MOUSE_EVENT_RECORD& mer)
+        {
+            if (mer.dwEventFlags & MOUSE_WHEELED) {
+                if (mer.dwControlKeyState & SHIFT_PRESSED) {
+                    if ((int)mer.dwButtonState > 0) {
+                        return MOVE_MOUSE_WHEEL_FW_SHIFT;
+                    } else {
+                        return MOVE_MOUSE_WHEEL_BW_SHIFT;
+                    }
+                } else {
+                    if ((int)mer.dwButtonState > 0) {
+                        return MOVE_MOUSE_WHEEL_FW;
+                    } else {
+                        return MOVE_MOUSE_WHEEL_BW;
+                    }
+                }
+            } else {
+                if (mer.dwButtonState == FROM_LEFT_1ST_BUTTON_PRESSED) {
+                    COORD& pos = mer.dwMousePosition;
+                    int ret = mapper_.FindCell(pos.X, pos.Y);
+
+                    if (ret < 0x10000) {
+                        return ret;
+                    } else {
+                        DWORD& key = mer.dwControlKeyState;
+
+                        if (key & LEFT_ALT_PRESSED) {
+                            return ret;  // cheating :)
+                        } else { }
+                    }
+#if 0
+                } else if (mer.dwControlKeyState & SHIFT_PRESSED) {
+#endif
+                } else { }
+            }
+
+            return GAME_NOOP;
+        }
+
+      private:
+        DISALLOW_COPY_AND_ASSIGN(InputReader);
+
+      private:
+        int k_;
+        int xk_;
+        int64_t t_;
+        int64_t xt_;
+        int64_t input_us_;
+        bool timer_events_;
+        Mapper mapper_;
+        INPUT_RECORD inrec_;
+    };
+
+    short InitConsole(int a, int d)
+    {
+        con.Acquire();
+        grid_.SetGridMode(d);
+        int board_height = grid_.GetMinHeight();
+        con.Resize(board_height + 1);
+
+        short y_top;
+
+        if (a & 0x4) {
+            con.SaveBuffer();
+            y_top = con.ResetCursorPosition(0);
+        } else {
+            con.Clear();
+            y_top = con.ResetCursorPosition(-1);
+        }
+
+        con.SavePalette();
+
+        if (a != '?') {
+            grid_.SetColorScheme(a & 0x3);
+        } else { }
+
+        con.FlushInput();
+        con.MoveTo(0, 0);
+
+        return y_top;
+    }
+
+    void ResetConsole(int a)
+    {
+        if (con.CanReset()) {
+            if (a != '?') {
+                con.ResetPalette();
+
+                if (a & 0x4) {
+                    con.RestoreBuffer();
+                } else {
+                    con.MoveTo(0, (4 * N + 3));
+                }
+            } else { }
+
+            con.Release();
+        } else { }
+    }
+
+    void Start2048(int n = 0)
+    {
+        renderer_.ClearMessage();
+        rng.Seed(rng(256) + (((unsigned int)Clock().Ticks_ms()) & 0xffff));
+        seed_ = rng.State();
+        moves_ = 0;
+        autoplayed_ = false;
+        recorded_ = false;
+
+        if (n) {
+            Preset(n);
+            board_.ac[0][0] = (uint8_t)(n + 1);
+            score_.Reset(0);
+        } else {
+            matrix.Reset(0);
+            unsigned int r, c;
+            AddNew(r, c);
+            AddNew(r, c);
+            score_.Reset(0);
+        }
+
+        renderer_.DrawGrid();
+        renderer_.ShowMatrix(board_);
+        renderer_.ShowScore(score_);
+        time_keeper_.Start();
+        time_keeper_.Update();
+        renderer_.Publish();
+        Save();
+    }
+
+    // the game saved by an earlier Play(), false if there is none
+    bool Restore(int& state, int64_t& played_ns)
+    {
+        GameSnapshot snapshot;
+
+        if (save_path_ && snapshot.Read(save_path_)) {
+        } else {
+            return false;
+        }
+
+        memcpy(board_.ac, snapshot.board, sizeof(board_.ac));
+        memcpy(undo_.ac, snapshot.undo, sizeof(undo_.ac));
+        score_.Reset(snapshot.score);
+        old_score_ = snapshot.undo_score;
+        rng.Seed(snapshot.rng);
+        state = (snapshot.state == 0x20) ? 0x20 : 0;
+        played_ns = snapshot.played_ns;
+        seed_ = snapshot.seed;
+        moves_ = snapshot.moves;
+        autoplayed_ = (snapshot.autoplayed != 0);
+        recorded_ = false;
+
+        renderer_.DrawGrid();
+        renderer_.ShowMatrix(board_);
+        renderer_.ShowScore(score_);
+
+        if (state) {
+            ShowEnd(true);
+        } else { }
+
+        renderer_.Publish();
+        return true;
+    }
+
+    // hands the game to the snapshot thread, or lets it go once lost
+    void PostSnapshot(int state)
+    {
+        if (save_path_) {
+        } else {
+            return;
+        }
+
+        if ((state & 0xf0) == 0x10) {
+            snapshots_.Discard();
+            return;
+        } else { }
+
+        GameSnapshot snapshot;
+        memset(&snapshot, 0, sizeof(snapshot));
+        memcpy(snapshot.magic, "2048SAV2", 8);
+
+        for (int i = 0; i < N * N; ++i) {
+            snapshot.board[i / N][i % N] = board_.ac[i / N][i % N] & 0x7f;
+            snapshot.undo[i / N][i % N] = undo_.ac[i / N][i % N] & 0x7f;
+        }
+
+        snapshot.score = score_;
+        snapshot.undo_score = old_score_;
+        snapshot.played_ns = time_keeper_.Played_ns();
+        snapshot.rng = rng.State();
+        snapshot.state = (uint32_t)(state & 0xf0);
+        snapshot.seed = seed_;
+        snapshot.moves = moves_;
+        snapshot.autoplayed = autoplayed_ ? 1 : 0;
+        snapshot.checksum = snapshot.Checksum();
+        snapshots_.Post(snapshot);
+    }
+
+    // the won or lost message with the rank of the score; a lost game is
+    // recorded first, once, and a won one is ranked as if it ended now
+    void ShowEnd(bool won)
+    {
+        if (history_path_) {
+        } else {
+            renderer_.ShowMessage(won);
+            return;
+        }
+
+        if (won || recorded_) {
+        } else {
+            GameRecord record;
+            const char* policy = autoplayed_ ? (policy_ ? policy_name_ : "search")
+                                             : "human";
+            memset(&record, 0, sizeof(record));
+            record.seed = seed_;
+            record.score = (uint32_t)(int)score_;
+            record.moves = moves_;
+            record.duration_ms = (uint32_t)(time_keeper_.Played_ns() / 1000000);
+            memcpy(record.policy, policy,
+                   Min(strlen(policy), sizeof(record.policy)));
+
+            for (int i = 0; i < N * N; ++i) {
+                record.max_tile = Max<uint8_t>(record.max_tile,
+                                               board_.ac[i / N][i % N] & 0x7f);
+            }
+
+            recorded_ = history_.Append(record);
+            history_failed_ = history_failed_ || !recorded_;
+        }
+
+        if (won || recorded_) {
+            uint64_t games = history_.Games() + (won ? 1 : 0);
+            renderer_.ShowMessage(won,
+                                  (unsigned int)history_.Rank((uint32_t)(int)score_),
+                                  (unsigned int)games);
+        } else {
+            renderer_.ShowMessage(won);  // not recorded
+        }
+    }
+
+    // stripe type of the book move for the board, or of a searched move
+    // when the board is not in the book
+    int SuggestMove()
+    {
+        enum { HINT_TT_MB = 16 };
+        PackedBoard board = PackBoard(board_);
+        float value;
+
+        if (policy_) {
+            return policy_->Choose(board, value);
+        } else { }
+
+        int type = book_.Lookup(board);
+
+        if (type != UUS) {
+            ++book_hits_;
+            return type;
+        } else if (tt_) {
+        } else {
+            tt_ = new TranspositionTable(HINT_TT_MB);
+        }
+
+        ExpectiMax search(*tt_, depth_ ? depth_ : (int)ExpectiMax::DEFAULT_DEPTH);
+        search.SetCache(cache_.Table());
+        type = search.BestMove(board);
+        tt_stats_.Add(search.Stats());
+        cache_stats_.Add(search.CacheStats());
+        return type;
+    }
+
+    void ShowHint()
+    {
+        renderer_.ShowHint(SuggestMove());
+        hint_ = true;
+    }
+
+    int AutoMove()
+    {
+        switch (SuggestMove()) {
+        case ROW_L2R_STRIPE: return MOVE_LEFT;
+        case ROW_R2L_STRIPE: return MOVE_RIGHT;
+        case COL_U2D_STRIPE: return MOVE_UP;
+        case COL_D2U_STRIPE: return MOVE_DOWN;
+        default: break;
+        }
+
+        return GAME_NOOP;
+    }
+
+    unsigned int Nudge(int type)
+    {
+        AllocPhase phase(ALLOC_MOVE);
+        CounterTimer timer(CTR_MOVE_NS);
+        unsigned int m = 0;
+
+        for (int i = 0; i < N; ++i) {
+            Stripe s(type, i, board_.ac);
+            m += s.Nudge(score_);
+        }
+
+        if (m) {
+            unsigned int merges = 0;
+
+            for (int i = 0; i < N * N; ++i) {
+                merges += (board_.ac[i / N][i % N] >> 7);
+            }
+
+            counters.Add(CTR_MOVES);
+            counters.Add(CTR_MERGES, merges);
+        } else {
+            counters.Add(CTR_NOOP_MOVES);
+        }
+
+        tracer.Record(TR_MOVE, type, (int32_t)m, score_);
+
+        return m;
+    }
+
+    void Save()
+    {
+        old_score_ = score_;
+
+        for (int i = 0; i < N64; ++i) {
+            undo_.al[i] = board_.al[i];
+        }
+    }
+
+#if defined(_MSC_VER) && (_MSC_VER < 1800)
+#define HIGHLIGHT_FILTER 0x7f7f7f7f7f7f7f7fu
+#else
+#define HIGHLIGHT_FILTER 0x7f7f7f7f7f7f7f7fllu
+#endif
+    void Undo()
+    {
+        counters.Add(CTR_UNDOS);
+        tracer.Record(TR_UNDO);
+        score_.Reset(old_score_);
+
+        for (int i = 0; i < N64; ++i) {
+            board_.al[i] = undo_.al[i] & HIGHLIGHT_FILTER;
+        }
+    }
+
+    void ResetHighlight()
+    {
+        for (int i = 0; i < N64; ++i) {
+            board_.al[i] &= HIGHLIGHT_FILTER;
+        }
+    }
+#undef HIGHLIGHT_FILTER
+
+    unsigned int CountZeros(int& min, int& max)
+    {
+        max = 0;
+        min = 16;
+        unsigned int n = 0;
+
+        ResetHighlight();
+
+        for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < N; ++c) {
+                if (board_.ac[r][c] == 0) {
+                    ++n;
+                } else if (board_.ac[r][c] < min) {
+                    min = board_.ac[r][c];
+                } else if (board_.ac[r][c] > max) {
+                    max = board_.ac[r][c];
+                } else { }
+            }
+        }
+
+        return n;
+    }
+
+    unsigned int AddNew(unsigned int& row, unsigned int& col)
+    {
+        AllocPhase phase(ALLOC_SPAWN);
+        int min, max;
+        unsigned int nz = CountZeros(min, max);
+
+        if (nz > N + N) {
+            nz -= N;
+        } else { }
+
+        if (nz > 0) {
+            unsigned int pos = rng(nz);
+            uint8_t v = GetNewValue(min, max);
+            unsigned int n = 0;
+
+            for (unsigned int r = N; r--; (void)0) {
+                for (unsigned int c = N; c--; (void)0) {
+                    if (board_.ac[r][c] == 0) {
+                        if (n == pos) {
+                            board_.ac[r][c] = v;  // TODO
+                            row = r;
+                            col = c;
+                            tracer.Record(TR_SPAWN, (int32_t)r, (int32_t)c, v);
+                        } else { }
+
+                        ++n;
+                    } else { }
+                }
+            }
+
+            counters.Add(CTR_SPAWNS);
+        } else { }
+
+        return nz;
+    }
+
+    uint8_t GetNewValue(int min, int max)
+    {
+        int range[4];  // ranges for 2, 4, 8 and 16 respectively
+        GetSpawnRanges(min, max, range);
+
+        int rnd = (unsigned short)rng(256);
+        int r = 2;
+
+        if (range[0] > rnd) {
+            r = 1;  // 2
+        } else if ((range[0] + range[1]) > rnd) {
+            r = 2;  // 4
+        } else if ((range[0] + range[1] + range[2]) > rnd) {
+            r = 3;  // 8
+        } else {
+            r = 4;  // 16
+        }
+
+        return (uint8_t)r;
+    }
+
+    int IsSolvable()
+    {
+        for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < N - 1; ++c) {
+                if (board_.ac[r][c] == board_.ac[r][c + 1]) {
+                    return 1;
+                } else { }
+            }
+        }
+
+        for (int c = 0; c < N; ++c) {
+            for (int r = 0; r < N - 1; ++r) {
+                if (board_.ac[r][c] == board_.ac[r + 1][c]) {
+                    return 1;
+                } else { }
+            }
+        }
+
+        for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < N; ++c) {
+                if (board_.ac[r][c] == 0) {
+                    return 1;
+                } else { }
+            }
+        }
+
+        return 0;
+    }
+
+    void Preset(int i)
+    {
+        for (int r = 0; r < N; ++r) {
+            for (int c = 0; c < N; ++c, ++i) {
+                if (r & 1) {
+                    board_.ac[r][N - 1 - c] = (uint8_t)(i > 0 ? i : 0);
+                } else {
+                    board_.ac[r][c] = (uint8_t)(i > 0 ? i : 0);
+                }
+            }
+        }
+    }
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Puzzle2048);
 
-    class InputReader
+  private:
+    int old_score_;
+    bool hint_;
+    bool autoplay_;
+    int depth_;
+    Scorer score_;
+    Grid grid_;
+    LatencyStats latency_;
+    Renderer renderer_;
+    TimeKeeper time_keeper_;
+    Board4x4 undo_;
+    Board4x4 board_;
+    Matrix matrix;
+    TranspositionTable* tt_;
+    TTStats tt_stats_;
+    EvalCache cache_;
+    TTStats cache_stats_;
+    OpeningBook book_;
+    unsigned int book_hits_;
+    MovePolicy* policy_;
+    const char* policy_name_;
+    const char* latency_log_;
+    const char* save_path_;
+    SnapshotWriter snapshots_;
+    const char* history_path_;
+    GameHistory history_;
+    bool history_failed_;
+    uint32_t seed_;       // of the tile generator when the game started
+    uint32_t moves_;
+    bool autoplayed_;     // autoplay made some of the moves
+    bool recorded_;       // the game is in the history
+};
+
+// application option/help/version helpers {{{
+class AppInfo
+{
+  public:
+    AppInfo() { }
+    ~AppInfo() { }
+
+    void ShowVersion()
     {
-      public:
-        InputReader(short top = 0)
-            : k_(0), xk_(0), t_(0), xt_(0), mapper_(top)
-#if defined(_MSC_VER) && (_MSC_VER < 1900)
-        // not supported ?
+        const char* ret;
+
+        ShowTitle(true);
+        char str[128];
+        fprintf(stdout, " Compilation:\n  compiler: %s\n", GetCompilerVersion(str));
+
+        if ((ret = GetCompilerArgs()) != 0) {
+            fprintf(stdout, "  command: %s\n", ret);
+        } else { }
+    }
+
+    void ShowTitle(bool show_date = false)
+    {
+        fprintf(stdout, "%s version %s", GetDescription(), GetVersion());
+
+        if (show_date) {
+            char str[128];
+            const char* ret;
+
+            if ((ret = GetBuildDate(str)) != 0) {
+                fprintf(stdout, " (%s)\n", ret);
+            } else { }
+        } else {
+            fprintf(stdout, " \n");
+        }
+    }
+
+    const char* GetDescription()
+    {
+#if defined(APP_DESCRIPTION)
+        return APP_DESCRIPTION;
 #else
-              , inrec_{0, {{0, 0, 0, 0, {0}, 0}}}
+        return 0;
 #endif
-        {
-#if defined(_MSC_VER) && (_MSC_VER < 1900)
-            memset(&inrec_, 0, sizeof(inrec_));
+    }
+
+    const char* GetVersion()
+    {
+#if defined(APP_VERSION)
+        return APP_VERSION;
+#else
+        return 0;
 #endif
+    }
+
+    template <size_t N>
+    const char* GetBuildDate(char (&str)[N])
+    {
+        memset(str, 0, N);
+
+        // Mmm dd yyyy - format of __DATE__
+        // 012 45 7890
+
+        str[0] = __DATE__[7];
+        str[1] = __DATE__[8];
+        str[2] = __DATE__[9];
+        str[3] = __DATE__[10];
+        str[4] = '-';
+        str[5] = '0';
+        str[6] = '?';
+        str[7] = '-';
+
+        switch (__DATE__[0]) {
+        case 'O': case 'N': case 'D':
+            str[5] = '1'; break;
+        default: break;
         }
-        ~InputReader() { }
 
-        int GetInput()
-        {
-            class Dummy
-            {
-              public:
-                void operator()()
-                {
-                    // no-op
-                }
-            };
-            Dummy dummy;
-            return GetInput(dummy);
+        switch (__DATE__[2]) {
+        case 'b': str[6] = '2'; break;  // Feb
+        case 'c': str[6] = '2'; break;  // Dec
+        case 'g': str[6] = '8'; break;  // Aug
+        case 'l': str[6] = '7'; break;  // Jul
+        case 'n': str[6] = __DATE__[1] == 'a' ? '1' : '6'; break;  // Jan | Jun
+        case 'p': str[6] = '9'; break;  // Sep
+        case 'r': str[6] = __DATE__[1] == 'a' ? '3' : '4'; break;  // Mar | Apr
+        case 't': str[6] = '0'; break;  // Oct
+        case 'v': str[6] = '1'; break;  // Nov
+        case 'y': str[6] = '5'; break;  // May
+        default:  str[6] = '?'; break;  // NOTE: error
         }
 
-        template<typename T>
-        int GetInput(T& time_keeper)
-        {
-            k_ = GAME_NOOP;
-            int n = 0;
-            int value = 0;
-            bool done = false;
+        str[7] = '-';
+        str[8] = (__DATE__[4] == ' ' ? '0' : __DATE__[4]);
+        str[9] = __DATE__[5];
+        str[10] = ' ';
+        str[11] = __TIME__[0];
+        str[12] = __TIME__[1];
+        str[13] = ':';
+        str[14] = __TIME__[3];
+        str[15] = __TIME__[4];
+        str[16] = ':';
+        str[17] = __TIME__[6];
+        str[18] = __TIME__[7];
+        str[19] = '\0';
+#if defined(GCC_ONLY_)
+        static_assert((__DATE__[0] != '?'), "error in __DATE__ macro");
+#endif
+        static_assert((N > 19), "specify a larger string, at least 19 chars needed");
 
-            do {
-                if (con.ReadInput(inrec_)) {
-                    switch (inrec_.EventType) {
-                    case 0:  // NOTE: 0 is set by Console.ReadInput(). can be error
-                        time_keeper();
-                        continue;
-                    case KEY_EVENT:
-                        value = GetKeyInput(inrec_.Event.KeyEvent, n);
+        return str;
+    }
 
-                        if (value) {
-                            return value;
-                        } else { }
-                        continue;
-                    case MOUSE_EVENT:
-                        value = GetMouseInput(inrec_.Event.MouseEvent);
+    template <size_t N>
+    const char* GetCompilerVersion(char (&str)[N])
+    {
+        // TODO: __GNUC__ et al. seems incorrect with LLVM/Clang
+        memset(str, 0, N);
 
-                        if (value) {
-                            return value;
-                        } else { }
-                        continue;
-                    case WINDOW_BUFFER_SIZE_EVENT:
-                    case MENU_EVENT:
-                    case FOCUS_EVENT:
-                        continue;
-                    default:
-                        DPRINT("unknown input.EventType: %u", inrec_.EventType);
-                        continue;
-                    }
-                } else {
-                    return GAME_ABORT;
-                }
-                continue;
-            } while (!done);
+        errno_t error;
 
-            return GAME_NOOP;
-        }
+#define BREAK_IF_ERROR($cmd, $err) \
+        do { \
+            $err = $cmd; \
+            if ($err != 0) { \
+                break; \
+            } else { \
+            } \
+        } while (FALSE_CONDITION)
+
+        do {
+#if defined(__clang__)
+            BREAK_IF_ERROR(strcat_s(str, "Clang/LLVM "), error);
+            BREAK_IF_ERROR(strcat_s(str, STR2(__clang_major__)), error);
+            BREAK_IF_ERROR(strcat_s(str, STR2(__clang_minor__)), error);
+            BREAK_IF_ERROR(strcat_s(str, STR1(__clang_patchlevel__)), error);
+
+#if defined(__GNUC__) || defined(_MSC_FULL_VER)
+            BREAK_IF_ERROR(strcat_s(str, " ["), error);
+#endif
+#endif  // __clang__
+#if defined(__GNUC__)
+            BREAK_IF_ERROR(strcat_s(str, "GCC/C++ "), error);
+#if defined(CC_STUB_GC_VER)
+            BREAK_IF_ERROR(strcat_s(str, STR1(CC_STUB_GC_VER)), error);
+#else
+            BREAK_IF_ERROR(strcat_s(str, STR2(__GNUC__)), error);
+            BREAK_IF_ERROR(strcat_s(str, STR2(__GNUC_MINOR__)), error);
+            BREAK_IF_ERROR(strcat_s(str, STR1(__GNUC_PATCHLEVEL__)), error);
+#endif  // CC_STUB_GC_VER
+#if defined(__MINGW32__)
+#if defined(__MINGW64_VERSION_MAJOR)
+            BREAK_IF_ERROR(strcat_s(str, " [MinGW-w64 "), error);
+            BREAK_IF_ERROR(strcat_s(str, STR2(__MINGW64_VERSION_MAJOR)), error);
+            BREAK_IF_ERROR(strcat_s(str, STR1(__MINGW64_VERSION_MINOR)), error);
+#else
+            // NOTE: __MINGW32__ may not be needed
+            BREAK_IF_ERROR(strcat_s(str, " [MinGW "), error);
+            BREAK_IF_ERROR(strcat_s(str, STR2(__MINGW32_MAJOR_VERSION)), error);
+            BREAK_IF_ERROR(strcat_s(str, STR1(__MINGW32_MINOR_VERSION)), error);
+#endif  // __MINGW64__
+            BREAK_IF_ERROR(strcat_s(str, "]"), error);
+#endif  // __MINGW32__
+#endif  // __GNUC__
+#if defined(_MSC_FULL_VER)
+            BREAK_IF_ERROR(strcat_s(str, "MSVC++ "), error);
+#if defined(CC_STUB_VC_VER)
+            BREAK_IF_ERROR(strcat_s(str, STR1(CC_STUB_VC_VER)), error);
+#else
+            // VVRRPPPPP since VS 2005
+            BREAK_IF_ERROR(strncat_s(str, STR1(_MSC_FULL_VER) + 0, 2), error);
+            BREAK_IF_ERROR(strcat_s(str, "."), error);
+            BREAK_IF_ERROR(strncat_s(str, STR1(_MSC_FULL_VER) + 2, 2), error);
+            BREAK_IF_ERROR(strcat_s(str, "."), error);
+            BREAK_IF_ERROR(strcat_s(str, STR1(_MSC_FULL_VER) + 4), error);
+#if defined(_MSC_BUILD)
+            BREAK_IF_ERROR(strcat_s(str, "."), error);
+            BREAK_IF_ERROR(strcat_s(str, STR1(_MSC_BUILD)), error);
+#endif
+#endif  // CC_STUB_VC_VER
+#endif  // _MSC_FULL_VER
+
+#if defined(__clang__)
+#if defined(__GNUC__) || defined(_MSC_FULL_VER)
+            BREAK_IF_ERROR(strcat_s(str, "]"), error);
+#endif
+#endif  // __clang__
+        } while (FALSE_CONDITION);
 
-      private:
-        int GetKeyInput(KEY_EVENT_RECORD& ker, int& n)
-        {
-            k_ = ker.wVirtualKeyCode;
+#undef BREAK_IF_ERROR
 
-            if (ker.bKeyDown == FALSE) {
-                switch (k_) {
-                case VK_F5: return BOARD_REFRESH;
-                case 'Y': case VK_RETURN: return GAME_PERSIST;
-                case 'Q': case VK_ESCAPE: return GAME_ABORT;
-                case 'N': return GAME_STOP;
-                case 'Z': return GAME_UNDO;
-                case 'I': return GAME_RESTART;
-                case 'T': return BOARD_TRANSPOSE;
-                case 'R': return BOARD_ROTATE_CW;
-                case 'V': return BOARD_SWAP_VERTICAL;
-                case 'H': return BOARD_SWAP_HORIZONTAL;
-#ifdef TEST_
-                case 'W': return (++n == 3) ? GAME_WON : GAME_NOOP;
-                case 'E': return (++n == 3) ? GAME_LOST : GAME_NOOP;
+#if defined(__MINGW32__) && !defined(__MINGW64_VERSION_MAJOR)
+        // since strcat() is used with MinGW,
+        // error points to str and cannot be used for error checking.
+        if (error) {
+            error = NULL;
+        } else { }
 #endif
-                default: break;
-                }
-            } else { }
 
-            n = (xk_ != k_) ? 0 : n;
+        if (error) {
+            return 0;
+        } else { }
 
-            t_ = Clock().Ticks_ms();
+        return str;
+    }
 
-            if (k_ == xk_) {
-                if ((t_ - xt_) < 300u) {
-                    return GAME_NOOP;
-                } else { }
-            } else { }
+    const char* GetCompilerArgs()
+    {
+#if defined(CC_STUB_CONFIG)
+        return STR1(CC_STUB_CONFIG);
+#else
+        return 0;
+#endif
+    }
 
-            xt_ = t_;
-            xk_ = k_;
+  private:
+    DISALLOW_COPY_AND_ASSIGN(AppInfo);
+};
 
-            switch (k_) {
-            case VK_LEFT: return MOVE_LEFT;
-            case VK_RIGHT: return MOVE_RIGHT;
-            case VK_UP: return MOVE_UP;
-            case VK_DOWN: return MOVE_DOWN;
-            case 'R':
-                if (ker.dwControlKeyState & SHIFT_PRESSED) {
-                    return BOARD_ROTATE_CCW;
-                } else { }
-                break;
-            default: break;
-            }
+struct arg_definition {
+    int need_value;
+    char short_option;
+    const char* long_option;
+    const char* default_value;
+    const char* help;
+    const char* value;
+    int count;
+};
 
-            return GAME_NOOP;
-        }
+template <size_t N>
+class ArgParser
+{
+  private:
+    enum { LENGTH = N };
+  public:
+    explicit ArgParser(arg_definition(&arg_def)[N])
+        : help_(0), version_(0), arg_def_(arg_def) { }
+    ~ArgParser() { }
 
-        int GetMouseInput(MOUSE_EVENT_RECORD& mer)
-        {
-            if (mer.dwEventFlags & MOUSE_WHEELED) {
-                if (mer.dwControlKeyState & SHIFT_PRESSED) {
-                    if ((int)mer.dwButtonState > 0) {
-                        return MOVE_MOUSE_WHEEL_FW_SHIFT;
+    int parse(int argc, char* argv[])
+    {
+        int error = 0;
+        int token = 0;
+        bool end_of_opt = false;
+
+        for (int i = 1; i < argc; i++) {
+            int ret = 0;
+
+            if (argv[i][0] == '-') {
+                if (argv[i][1] == '-') {
+                    if (argv[i][2] == '\0') {
+                        end_of_opt = !end_of_opt;
+                        continue;
                     } else {
-                        return MOVE_MOUSE_WHEEL_BW_SHIFT;
+                        if (end_of_opt) {
+                            ret = get_argument(argv[i]);
+                        } else {
+                            ret = get_long_arg(argv[i]);
+                        }
                     }
-                } else {
-                    if ((int)mer.dwButtonState > 0) {
-                        return MOVE_MOUSE_WHEEL_FW;
+                } else if (argv[i][1] != '\0') {
+                    if (end_of_opt) {
+                        ret = get_argument(argv[i]);
                     } else {
-                        return MOVE_MOUSE_WHEEL_BW;
+                        ret = get_short_arg(argv, i, argc);
                     }
+                } else {
+                    ret = -1;
                 }
             } else {
-                if (mer.dwButtonState == FROM_LEFT_1ST_BUTTON_PRESSED) {
-                    COORD& pos = mer.dwMousePosition;
-                    int ret = mapper_.FindCell(pos.X, pos.Y);
-
-                    if (ret < 0x10000) {
-                        return ret;
-                    } else {
-                        DWORD& key = mer.dwControlKeyState;
-
-                        if (key & LEFT_ALT_PRESSED) {
-                            return ret;  // cheating :)
-                        } else { }
-                    }
-#if 0
-                } else if (mer.dwControlKeyState & SHIFT_PRESSED) {
-#endif
-                } else { }
+                ret = get_argument(argv[i]);
             }
 
-            return GAME_NOOP;
-        }
-
-      private:
-        DISALLOW_COPY_AND_ASSIGN(InputReader);
-
-      private:
-        int k_;
-        int xk_;
-        int64_t t_;
-        int64_t xt_;
-        Mapper mapper_;
-        INPUT_RECORD inrec_;
-    };
-
-    short InitConsole(int a, int d)
-    {
-        con.Acquire();
-        grid_.SetGridMode(d);
-        int board_height = grid_.GetMinHeight();
-        con.Resize(board_height + 1);
-
-        short y_top;
+            if (ret < 0) {
+                if (check_known_opt(argv[i])) {
+                    return 1;
+                } else { }
 
-        if (a & 0x4) {
-            con.SaveBuffer();
-            y_top = con.ResetCursorPosition(0);
-        } else {
-            con.Clear();
-            y_top = con.ResetCursorPosition(-1);
+                ++error;
+            } else {
+                token += ret + 1;
+                i += ret;
+            }
         }
 
-        con.SavePalette();
-
-        if (a != '?') {
-            grid_.SetColorScheme(a & 0x3);
+        if (token == 0 && argc > 1) {
+            error++;
         } else { }
 
-        con.FlushInput();
-        con.MoveTo(0, 0);
+        // EPRINT("tok %d, argc %d, err %d, ret %d\n", token, argc, error,
+        //        (error == 0 ? 1 : 0));
 
-        return y_top;
+        return error == 0 ? 1 : 0;
     }
 
-    void ResetConsole(int a)
+    void show_help(const char* name, const char* header, const char* footer)
     {
-        if (con.CanReset()) {
-            if (a != '?') {
-                con.ResetPalette();
-
-                if (a & 0x4) {
-                    con.RestoreBuffer();
-                } else {
-                    con.MoveTo(0, (4 * N + 3));
-                }
-            } else { }
-
-            con.Release();
+        if (header && *header) {
+            fprintf(stdout, "%s", header);
         } else { }
-    }
 
-    void Start2048(int n = 0)
-    {
-        grid_.ClearMessage();
-        con.MoveTo(0, 0);
-        rng.Seed(rng(256) + (((unsigned int)Clock().Ticks_ms()) & 0xffff));
+        fprintf(stdout, "Usage: %s [options]\n", name);
+        fprintf(stdout, " Options:\n");
 
-        if (n) {
-            Preset(n);
-            board_.ac[0][0] = (uint8_t)(n + 1);
-            score_.Reset(0);
-        } else {
-            matrix.Reset(0);
-            unsigned int r, c;
-            AddNew(r, c);
-            AddNew(r, c);
-            score_.Reset(0);
+        for (int i = 0; i < LENGTH; ++i) {
+            show_option_help(i);
         }
 
-        grid_.DrawGrid();
-        grid_.ShowMatrix(matrix);
-        grid_.ShowScore(score_);
-        time_keeper_.Start();
-        time_keeper_.Update();
-        Save();
+        if (footer && *footer) {
+            fprintf(stdout, "%s", footer);
+        } else { }
     }
 
-    unsigned int Nudge(int type)
+    int show_option_help(int id)
     {
-        unsigned int m = 0;
+        if ((id < 0) || (id >= LENGTH)) {  // TODO: assert
+            return 0;
+        } else { }
 
-        for (int i = 0; i < N; ++i) {
-            Stripe s(type, i, board_.ac);
-            m += s.Nudge(score_);
-        }
+#define PRINT_OPT($opt, $fmt, $sep, $hasopt) \
+        if (arg_def_[id].need_value) { \
+            if (arg_def_[id].$opt) { \
+                fprintf(stdout, $fmt $sep "VALUE", arg_def_[id].$opt); \
+                $hasopt = 1; \
+            } else { } \
+        } else { \
+            if (arg_def_[id].$opt) { \
+                fprintf(stdout, $fmt, arg_def_[id].$opt); \
+                $hasopt = 1; \
+            } else { } \
+        } (void)0
 
-        return m;
-    }
+        int has_opt = 0;
 
-    void Save()
-    {
-        old_score_ = score_;
+        PRINT_OPT(short_option, "  -%c", " ", has_opt);
+        PRINT_OPT(long_option, "  --%s", "=", has_opt);
 
-        for (int i = 0; i < N64; ++i) {
-            undo_.al[i] = board_.al[i];
-        }
+        if (has_opt) {
+            fprintf(stdout, "  %s %s%s%c\n",
+                    (arg_def_[id].help ? arg_def_[id].help : ""),
+                    (arg_def_[id].default_value ? "(default: " : ""),
+                    (arg_def_[id].default_value ? arg_def_[id].default_value : ""),
+                    (arg_def_[id].default_value ? ')' : ' '));
+        } else { }
+
+#undef PRINT_OPT
+        return 1;
     }
 
-#if defined(_MSC_VER) && (_MSC_VER < 1800)
-#define HIGHLIGHT_FILTER 0x7f7f7f7f7f7f7f7fu
-#else
-#define HIGHLIGHT_FILTER 0x7f7f7f7f7f7f7f7fllu
-#endif
-    void Undo()
+    int has_help_opt()
     {
-        score_.Reset(old_score_);
-
-        for (int i = 0; i < N64; ++i) {
-            board_.al[i] = undo_.al[i] & HIGHLIGHT_FILTER;
-        }
+        return help_;
     }
 
-    void ResetHighlight()
+    int has_version_opt()
     {
-        for (int i = 0; i < N64; ++i) {
-            board_.al[i] &= HIGHLIGHT_FILTER;
-        }
+        return version_;
     }
-#undef HIGHLIGHT_FILTER
 
-    unsigned int CountZeros(int& min, int& max)
+  private:
+    int get_short_arg(char* argv[], int pos, int argc)
     {
-        max = 0;
-        min = 16;
-        unsigned int n = 0;
+        if (!(argv && (pos > 0) && (pos < argc))) {  // TODO: assert
+            return -1;
+        } else { }
 
-        ResetHighlight();
+        int error = 0;
+        int consumed = 0;
+        const char* arg = argv[pos];
 
-        for (int r = 0; r < N; ++r) {
-            for (int c = 0; c < N; ++c) {
-                if (board_.ac[r][c] == 0) {
-                    ++n;
-                } else if (board_.ac[r][c] < min) {
-                    min = board_.ac[r][c];
-                } else if (board_.ac[r][c] > max) {
-                    max = board_.ac[r][c];
+        for (char opt = *++arg; opt; opt = *++arg) {
+            // EPRINT("get_short_arg: %c\n", opt);
+            int found = 0;
+
+            for (int i = 0; i < LENGTH; i++) {
+                if (arg_def_[i].short_option == opt) {
+                    arg_def_[i].count += 1;
+
+                    if (arg_def_[i].need_value) {
+                        if ((++pos) < argc) {
+                            arg_def_[i].value = argv[pos];
+                            ++consumed;
+                        } else {
+                            // EPRINT("get_short_arg ret -1: %c\n", opt);
+                            return -1;
+                        }
+                    } else { }
+
+                    ++found;
                 } else { }
             }
+
+            // EPRINT("get_short_arg: %c %s found , con %d err %d ret %d\n",
+            //        opt, (found?"":"not"), consumed, error,
+            //        (error == 0 ? consumed : -1));
+            if (found == 0) {
+                ++error;
+            } else { }
         }
 
-        return n;
+        return error == 0 ? consumed : -1;
     }
 
-    unsigned int AddNew(unsigned int& row, unsigned int& col)
+    int get_long_arg(const char* arg)
     {
-        int min, max;
-        unsigned int nz = CountZeros(min, max);
-
-        if (nz > N + N) {
-            nz -= N;
+        if (!arg) {  // TODO: assert
+            return -1;
         } else { }
 
-        if (nz > 0) {
-            unsigned int pos = rng(nz);
-            uint8_t v = GetNewValue(min, max);
-            unsigned int n = 0;
+        bool negate = false;
 
-            for (unsigned int r = N; r--; (void)0) {
-                for (unsigned int c = N; c--; (void)0) {
-                    if (board_.ac[r][c] == 0) {
-                        if (n == pos) {
-                            board_.ac[r][c] = v;  // TODO
-                            row = r;
-                            col = c;
-                        } else { }
+        if ((arg[2] == 'n') && (arg[3] == 'o')) {
+            negate = true;
 
-                        ++n;
-                    } else { }
-                }
-            }
+            if (arg[4] == '-') {
+                arg += 1;
+            } else { }
 
-            grid_.ShowCell(matrix(row, col), row, col, true);
+            arg += 2;
         } else { }
 
-        return nz;
-    }
+        if (*arg == '\0') {
+            return -1;
+        } else { }
 
-    uint8_t GetNewValue(int min, int max)
-    {
-        // max  1 2 3  4      5  6   7    8   9   10    11
-        //             |             |        |    |     |
-        //      2 4 8 16     32 64 128  256 512 1024  2048
+        for (int i = 0; i < LENGTH; i++) {
+            size_t pos = opt_equal(arg_def_[i].long_option, arg);
 
-        int r2, r4, r8;  // ranges for 2, 4 and 8 respectively
+            if (pos) {
+                arg += pos;
 
-#define SET($r2, $r4, $r8, $x) \
-        r2 = $r2; \
-        r4 = $r4; \
-        r8 = $r8; \
-        static_assert(($r2+$r4+$r8+$x) == 256, \
-                      "GetNewValue: total of ranges should be 256") \
+                if (arg_def_[i].need_value) {
+                    if (*arg) {
+                        arg_def_[i].value = arg;
+                    } else {
+                        return -1;
+                    }
+                } else {
+                    if (*arg) {
+                        arg_def_[i].value = arg;  // TODO: ignoring error, why?
+                    } else { }
+                }
 
-#define SET2($r2, $r4, $r8, $r22, $r24, $r28) \
-        if (min != 1) { \
-            r2 = $r2; \
-            r4 = $r4; \
-            r8 = $r8; \
-        } else { \
-            r2 = $r22; \
-            r4 = $r24; \
-            r8 = $r28; \
-        } \
-        static_assert(($r2+$r4+$r8) == 256, \
-                      "GetNewValue: total of ranges should be 256"); \
-        static_assert(($r22+$r24+$r28) == 256, \
-                      "GetNewValue: total of ranges should be 256") \
+                if (negate) {
+                    if (arg_def_[i].count > 0) {
+                        arg_def_[i].count = -arg_def_[i].count;
+                    } else { }
 
-        switch (max) {
-        case 0: case 1: case 2: case 3: case 4:
-            SET(160, 96, 0, 0);
-            break;
-        case 5: case 6: case 7:
-            SET(64, 160, 32, 0);
-            break;
-        case 8: case 9:
-            SET2(0, 208, 48, 120, 120, 16);
-            break;
-        case 10:
-            SET(0, 160, 96, 0);
-            break;
-        default:
-            SET(0, 96, 152, 8);
-            break;
-        }
-#undef SET
-#undef SET2
+                    arg_def_[i].count -= 1;
+                } else {
+                    if (arg_def_[i].count < 0) {
+                        arg_def_[i].count = -arg_def_[i].count;
+                    } else { }
 
-        int rnd = (unsigned short)rng(256);
-        int r = 2;
+                    arg_def_[i].count += 1;
+                }
 
-        if (r2 > rnd) {
-            r = 1;  // 2
-        } else if ((r2 + r4) > rnd) {
-            r = 2;  // 4
-        } else if ((r2 + r4 + r8) > rnd) {
-            r = 3;  // 8
-        } else {
-            r = 4;  // 16
+                return 0;
+            } else { }
         }
 
-        return (uint8_t)r;
+        return -1;
     }
 
-    int IsSolvable()
+    int get_argument(const char* arg)
     {
-        for (int r = 0; r < N; ++r) {
-            for (int c = 0; c < N - 1; ++c) {
-                if (board_.ac[r][c] == board_.ac[r][c + 1]) {
-                    return 1;
-                } else { }
-            }
-        }
+        if (!arg) {  // TODO: assert
+            return -1;
+        } else { }
 
-        for (int c = 0; c < N; ++c) {
-            for (int r = 0; r < N - 1; ++r) {
-                if (board_.ac[r][c] == board_.ac[r + 1][c]) {
-                    return 1;
-                } else { }
-            }
+        int found = 0;
+
+        for (int i = 0; i < LENGTH; i++) {
+            if ((!arg_def_[i].value) &&
+                (!arg_def_[i].short_option) &&
+                (!arg_def_[i].long_option)) {
+                ++found;
+                arg_def_[i].value = arg;
+                break;
+            } else { }
         }
 
-        for (int r = 0; r < N; ++r) {
-            for (int c = 0; c < N; ++c) {
-                if (board_.ac[r][c] == 0) {
+        return found ? 0 : -1;
+    }
+
+    int check_known_opt(const char* arg)
+    {
+        if (!arg) {  // TODO: assert
+            return -1;
+        } else { }
+
+        char c0 = arg[0];
+
+        if (c0 == '?') {
+            help_ = 1;
+            return 1;
+        } else if (c0 == '-') {
+            char c1 = arg[1];
+
+            if (c1 == '?') {
+                help_ = 1;
+                return 1;
+            } else if (c1 == '-') {
+                char c2 = arg[2];
+
+                if (c2 == '?') {
+                    help_ = 1;
+                    return 1;
+                } else if ((c2 == 'h') &&
+                           (arg[3] == 'e') &&
+                           (arg[4] == 'l') &&
+                           (arg[5] == 'p') &&
+                           (arg[6] == '\0')) {
+                    help_ = 1;
+                    return 1;
+                } else if ((c2 == 'v') &&
+                           (arg[3] == 'e') &&
+                           (arg[4] == 'r') &&
+                           (arg[5] == 's') &&
+                           (arg[6] == 'i') &&
+                           (arg[7] == 'o') &&
+                           (arg[8] == 'n') &&
+                           (arg[9] == '\0')) {
+                    version_ = 1;
                     return 1;
                 } else { }
-            }
-        }
+            } else { }
+        } else { }
 
         return 0;
     }
 
-    void Preset(int i)
+    size_t opt_equal(const char* option, const char* arg)
     {
-        for (int r = 0; r < N; ++r) {
-            for (int c = 0; c < N; ++c, ++i) {
-                if (r & 1) {
-                    board_.ac[r][N - 1 - c] = (uint8_t)(i > 0 ? i : 0);
-                } else {
-                    board_.ac[r][c] = (uint8_t)(i > 0 ? i : 0);
-                }
-            }
-        }
+        if (!(option && arg && arg[2])) {  // TODO: assert
+            return 0;
+        } else { }
+
+        size_t len = strlen(option);  // NOTE: length can be cached
+
+        if (len > 0) {
+            if (strncmp(option, (arg + 2), len) == 0) {
+                if (arg[len + 2] == '=') {
+                    return len + 3;
+                } else if (arg[len + 2] == '\0') {
+                    return len + 2;
+                } else { }
+            } else { }
+        } else { }
+
+        return 0;
     }
 
   private:
-    DISALLOW_COPY_AND_ASSIGN(Puzzle2048);
+    DISALLOW_COPY_AND_ASSIGN(ArgParser);
 
   private:
-    int old_score_;
-    Scorer score_;
-    Grid grid_;
-    TimeKeeper time_keeper_;
-    Board4x4 undo_;
-    Board4x4 board_;
-    Matrix matrix;
+    int help_;
+    int version_;
+    struct arg_definition(&arg_def_)[N];
 };
 
-// application option/help/version helpers {{{
-class AppInfo
+/* get-options */
+#define UNWRAP(x) x
+// macro args:    id, need, short, long, default, help, type (of option.id)
+// arg types:     --, int,  char,  char*, char*,  char*, --
+#define OPT_CLRS (color_id, 1, 'c', "color", "0", "color scheme: 0, 1, 2 or 3", int)
+#define OPT_GRID (grid_type, 1, 'g', "grid", "unicode", "draw with ascii|unicode characters", int)
+#define OPT_WIPE (wipe_con, 0, 'w', "wipe", NULL, "wipes the display when exiting(default: do not wipe)", int)
+#define OPT_TEST (test_mode, 0, '\0', "test", NULL, "with '--color' shows color scheme and exit", int)
+#define OPT_TILE (tile_set, 1, '\0', "tile-set", "1", "previews grid/tiles, choices 1, 2 or 3", int)
+#define OPT_CACHE (cache_file, 1, '\0', "cache", NULL, "memory-mapped evaluation cache file shared by searches", const char*)
+#define OPT_BOOK (book_file, 1, '\0', "book", NULL, "opening book file consulted by hints and autoplay", const char*)
+#define OPT_MKBK (make_book, 1, '\0', "make-book", NULL, "builds an opening book file and exit", const char*)
+#define OPT_DPTH (search_depth, 1, '\0', "depth", NULL, "search depth of hints or book moves, 1 to 9", int)
+#define OPT_MKTB (make_tablebase, 1, '\0', "make-tablebase", NULL, "solves 3x3 games into a tablebase file and exit", const char*)
+#define OPT_TCAP (tile_cap, 1, '\0', "tile-cap", "64", "winning tile of the 3x3 tablebase, 32 to 512", int)
+#define OPT_PRFT (perft_depth, 1, '\0', "perft", NULL, "counts move/spawn sequences to depth 1 to 16 and exit", int)
+#define OPT_BORD (start_board, 1, '\0', "board", "0000000000000011", "perft board, 16 hex exponents in row order", const char*)
+#define OPT_PHSH (perft_hash, 0, '\0', "perft-hash", NULL, "perft merges transpositions and counts unique states", int)
+#define OPT_PSTR (perft_stripe, 0, '\0', "perft-stripe", NULL, "perft moves with Stripe::Nudge instead of tables", int)
+#define OPT_RBEN (render_bench, 1, '\0', "render-bench", NULL, "draws N random moves on a recording console and exit", int)
+#define OPT_ANIM (animate, 1, '\0', "animate", NULL, "slides moved tiles for N ms, 1 to 1000", int)
+#define OPT_FPS  (frame_rate, 1, '\0', "fps", "60", "frame rate cap of slides, 1 to 120", int)
+#define OPT_LTCY (latency_log, 1, '\0', "latency-log", NULL, "writes input latency histograms to the file", const char*)
+#define OPT_CNTR (counter_log, 1, '\0', "counters", NULL, "writes work counters as JSON to the file on exit", const char*)
+#define OPT_CINT (counter_interval, 1, '\0', "counter-interval", NULL, "also rewrites the --counters file every N ms", int)
+#define OPT_TRCE (trace_file, 1, '\0', "trace", NULL, "records an event trace, written to the file on exit", const char*)
+#define OPT_DTRC (decode_trace, 1, '\0', "decode-trace", NULL, "prints a trace file and exit", const char*)
+#define OPT_TFMT (trace_format, 1, '\0', "trace-format", "text", "decoded trace as text|chrome (JSON)", int)
+#define OPT_ALRP (alloc_report, 0, '\0', "alloc-report", NULL, "counts allocations per phase, printed on exit", int)
+#define OPT_ALTS (alloc_test, 1, '\0', "alloc-test", NULL, "plays N searched moves, fails if any allocates, and exit", int)
+#define OPT_SERV (serve_path, 1, '\0', "serve", NULL, "hosts games on a Unix socket until interrupted (Linux)", const char*)
+#define OPT_SBEN (serve_bench, 1, '\0', "serve-bench", NULL, "plays N sessions against a server for 3 s and exit", int)
+#define OPT_BOT  (bot_file, 1, '\0', "bot", NULL, "plays for a bot through a shared-memory ring file until interrupted", const char*)
+#define OPT_BSPN (bot_spin, 0, '\0', "bot-spin", NULL, "bot ring sides spin and yield instead of sleeping", int)
+#define OPT_BBEN (bot_bench, 1, '\0', "bot-bench", NULL, "plays N moves for a bot through the ring, twice, and exit", int)
+#define OPT_ORCL (oracle, 1, '\0', "oracle", NULL, "best moves of boards read from stdin by a policy, and exit", const char*)
+#define OPT_TRNY (tournament, 1, '\0', "tournament", NULL, "plays policies, separated by commas, on the same seeds and exit", const char*)
+#define OPT_SEED (seeds, 1, '\0', "seeds", "100", "games per policy of a tournament", int)
+#define OPT_RSLT (results_file, 1, '\0', "results", NULL, "tournament games appended to the file, read back to resume", const char*)
+#define OPT_PLCY (policy, 1, '\0', "policy", NULL, "policy of hints and autoplay instead of book and search", const char*)
+#define OPT_SELF (self_play, 1, '\0', "self-play", NULL, "plays games of a policy with running statistics until interrupted", const char*)
+#define OPT_GAMS (games, 1, '\0', "games", "0", "games of self-play, 0 for no end", int)
+#define OPT_STAT (stats_file, 1, '\0', "stats", NULL, "self-play statistics rewritten to the file as JSON", const char*)
+#define OPT_SINT (stats_interval, 1, '\0', "stats-interval", "10000", "ms between self-play statistics, at least 100", int)
+#define OPT_CKPT (checkpoint, 1, '\0', "checkpoint", NULL, "self-play state written to the file, to resume from", const char*)
+#define OPT_CINV (checkpoint_interval, 1, '\0', "checkpoint-interval", "60000", "ms between self-play checkpoints, 0 for only at the end", int)
+#define OPT_RSUM (resume, 0, '\0', "resume", NULL, "self-play goes on from the checkpoint file", int)
+#define OPT_SAVE (save_file, 1, '\0', "save", NULL, "the game is saved to and resumed from the file (default: ~/.2048-save)", const char*)
+#define OPT_HIST (history_file, 1, '\0', "history", NULL, "lost games are recorded in and ranked against the file (default: ~/.2048-history)", const char*)
+#define OPT_TOP  (top, 1, '\0', "top", NULL, "prints the N best games and score percentiles of the history and exit", int)
+#define OPT_HELP (more_arg, 0, '\0', NULL, NULL, NULL, int)
+
+#define OPTS \
+    OPT_CLRS,OPT_GRID,OPT_WIPE,OPT_TEST,OPT_TILE,OPT_CACHE,OPT_BOOK,OPT_MKBK, \
+    OPT_DPTH,OPT_MKTB,OPT_TCAP,OPT_PRFT,OPT_BORD,OPT_PHSH,OPT_PSTR,OPT_RBEN, \
+    OPT_ANIM,OPT_FPS,OPT_LTCY,OPT_CNTR,OPT_CINT, \
+    OPT_TRCE,OPT_DTRC,OPT_TFMT,OPT_ALRP,OPT_ALTS,OPT_SERV,OPT_SBEN, \
+    OPT_BOT,OPT_BSPN,OPT_BBEN,OPT_ORCL,OPT_TRNY,OPT_SEED,OPT_RSLT,OPT_PLCY, \
+    OPT_SELF,OPT_GAMS,OPT_STAT,OPT_SINT,OPT_CKPT,OPT_CINV,OPT_RSUM,OPT_SAVE, \
+    OPT_HIST,OPT_TOP,OPT_HELP
+
+// macros GET_FUNC and CODE_GEN based on FOR_EACH macros from link below:
+// http://stackoverflow.com/questions/1872220/
+
+#define F1(F,A) F(A)
+#define F2(F,A,...) F(A)UNWRAP(F1(F,__VA_ARGS__))
+#define F3(F,A,...) F(A)UNWRAP(F2(F,__VA_ARGS__))
+#define F4(F,A,...) F(A)UNWRAP(F3(F,__VA_ARGS__))
+#define F5(F,A,...) F(A)UNWRAP(F4(F,__VA_ARGS__))
+#define F6(F,A,...) F(A)UNWRAP(F5(F,__VA_ARGS__))
+#define F7(F,A,...) F(A)UNWRAP(F6(F,__VA_ARGS__))
+#define F8(F,A,...) F(A)UNWRAP(F7(F,__VA_ARGS__))
+#define F9(F,A,...) F(A)UNWRAP(F8(F,__VA_ARGS__))
+#define F10(F,A,...) F(A)UNWRAP(F9(F,__VA_ARGS__))
+#define F11(F,A,...) F(A)UNWRAP(F10(F,__VA_ARGS__))
+#define F12(F,A,...) F(A)UNWRAP(F11(F,__VA_ARGS__))
+#define F13(F,A,...) F(A)UNWRAP(F12(F,__VA_ARGS__))
+#define F14(F,A,...) F(A)UNWRAP(F13(F,__VA_ARGS__))
+#define F15(F,A,...) F(A)UNWRAP(F14(F,__VA_ARGS__))
+#define F16(F,A,...) F(A)UNWRAP(F15(F,__VA_ARGS__))
+#define F17(F,A,...) F(A)UNWRAP(F16(F,__VA_ARGS__))
+#define F18(F,A,...) F(A)UNWRAP(F17(F,__VA_ARGS__))
+#define F19(F,A,...) F(A)UNWRAP(F18(F,__VA_ARGS__))
+#define F20(F,A,...) F(A)UNWRAP(F19(F,__VA_ARGS__))
+#define F21(F,A,...) F(A)UNWRAP(F20(F,__VA_ARGS__))
+#define F22(F,A,...) F(A)UNWRAP(F21(F,__VA_ARGS__))
+#define F23(F,A,...) F(A)UNWRAP(F22(F,__VA_ARGS__))
+#define F24(F,A,...) F(A)UNWRAP(F23(F,__VA_ARGS__))
+#define F25(F,A,...) F(A)UNWRAP(F24(F,__VA_ARGS__))
+#define F26(F,A,...) F(A)UNWRAP(F25(F,__VA_ARGS__))
+#define F27(F,A,...) F(A)UNWRAP(F26(F,__VA_ARGS__))
+#define F28(F,A,...) F(A)UNWRAP(F27(F,__VA_ARGS__))
+#define F29(F,A,...) F(A)UNWRAP(F28(F,__VA_ARGS__))
+#define F30(F,A,...) F(A)UNWRAP(F29(F,__VA_ARGS__))
+#define F31(F,A,...) F(A)UNWRAP(F30(F,__VA_ARGS__))
+#define F32(F,A,...) F(A)UNWRAP(F31(F,__VA_ARGS__))
+#define F33(F,A,...) F(A)UNWRAP(F32(F,__VA_ARGS__))
+#define F34(F,A,...) F(A)UNWRAP(F33(F,__VA_ARGS__))
+#define F35(F,A,...) F(A)UNWRAP(F34(F,__VA_ARGS__))
+#define F36(F,A,...) F(A)UNWRAP(F35(F,__VA_ARGS__))
+#define F37(F,A,...) F(A)UNWRAP(F36(F,__VA_ARGS__))
+#define F38(F,A,...) F(A)UNWRAP(F37(F,__VA_ARGS__))
+#define F39(F,A,...) F(A)UNWRAP(F38(F,__VA_ARGS__))
+#define F40(F,A,...) F(A)UNWRAP(F39(F,__VA_ARGS__))
+#define F41(F,A,...) F(A)UNWRAP(F40(F,__VA_ARGS__))
+#define F42(F,A,...) F(A)UNWRAP(F41(F,__VA_ARGS__))
+#define F43(F,A,...) F(A)UNWRAP(F42(F,__VA_ARGS__))
+#define F44(F,A,...) F(A)UNWRAP(F43(F,__VA_ARGS__))
+#define F45(F,A,...) F(A)UNWRAP(F44(F,__VA_ARGS__))
+#define F46(F,A,...) F(A)UNWRAP(F45(F,__VA_ARGS__))
+#define F47(F,A,...) F(A)UNWRAP(F46(F,__VA_ARGS__))
+#define F48(F,A,...) F(A)UNWRAP(F47(F,__VA_ARGS__))
+
+#define GET_FUNC(A1,A2,A3,A4,A5,A6,A7,A8,A9,A10,A11,A12,A13,A14,A15,A16, \
+                 A17,A18,A19,A20,A21,A22,A23,A24,A25,A26,A27,A28,A29,A30, \
+                 A31,A32,A33,A34,A35,A36,A37,A38,A39,A40,A41,A42,A43,A44, \
+                 A45,A46,A47,A48,FUNC,...) FUNC
+#define CODE_GEN(GEN_FUNC,...) \
+    UNWRAP(GET_FUNC(__VA_ARGS__,F48,F47,F46,F45,F44,F43,F42,F41,F40,F39, \
+                    F38,F37,F36,F35,F34,F33,F32,F31,F30,F29,F28,F27,F26,F25, \
+                    F24,F23,F22,F21,F20,F19,F18,F17,F16,F15,F14,F13,F12,F11, \
+                    F10,F9,F8,F7,F6,F5,F4,F3,F2,F1) \
+           (GEN_FUNC,__VA_ARGS__))
+
+#define GET_ID(a,b,c,d,e,f,g) g a;
+#define CALL_GET_ID(x) GET_ID x
+struct option {
+    CODE_GEN(CALL_GET_ID, OPTS)
+};
+#undef GET_ID
+#undef CALL_GET_ID
+
+#define GET_ENUM_ID(a,...) k_##a,
+#define CALL_GET_ENUM_ID(x) GET_ENUM_ID x
+enum {
+    CODE_GEN(CALL_GET_ENUM_ID, OPTS)
+};
+#undef GET_ENUM_ID
+#undef CALL_GET_ENUM_ID
+
+template <size_t N>
+class ArgResolver
 {
+  private:
+    enum { LENGTH = N };
   public:
-    AppInfo() { }
-    ~AppInfo() { }
+    ArgResolver(option& opt, arg_definition(&arg_def)[N])
+        : help_(0), error_(0), version_(0), opt_(opt), arg_def_(arg_def) { }
+    ~ArgResolver() { }
 
-    void ShowVersion()
+    int Resolve()
     {
-        const char* ret;
+#define RESOLVE_OPT(a,...) \
+        Resolve_##a();
 
-        ShowTitle(true);
-        char str[128];
-        fprintf(stdout, " Compilation:\n  compiler: %s\n", GetCompilerVersion(str));
+#define CALL_RESOLVE_OPT(x) RESOLVE_OPT x
 
-        if ((ret = GetCompilerArgs()) != 0) {
-            fprintf(stdout, "  command: %s\n", ret);
+        CODE_GEN(CALL_RESOLVE_OPT, OPTS)
+
+#undef RESOLVE_OPT
+#undef CALL_RESOLVE_OPT
+
+        if (error_ > 0) {
+            return -error_;
+        } else if (help_ || version_) {
+            return 0;
         } else { }
+
+        return 1;
     }
 
-    void ShowTitle(bool show_date = false)
+    int Resolve_color_id()
     {
-        fprintf(stdout, "%s version %s", GetDescription(), GetVersion());
+        // EPRINT("%s\n", "color");
+        int id = k_color_id;
 
-        if (show_date) {
-            char str[128];
-            const char* ret;
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[1] == '\0') {
+                switch (arg_def_[id].value[0]) {
+                case '0': opt_.color_id = 0; break;
+                case '1': opt_.color_id = 1; break;
+                case '2': opt_.color_id = 2; break;
+                case '3': opt_.color_id = 3; break;
+                default: ++error_; break;
+                }
+            } else {
+                ++error_;
+            }
+        } else { }
 
-            if ((ret = GetBuildDate(str)) != 0) {
-                fprintf(stdout, " (%s)\n", ret);
-            } else { }
-        } else {
-            fprintf(stdout, " \n");
-        }
+        return error_ ? 0 : 1;
     }
 
-    const char* GetDescription()
+    int Resolve_grid_type()
     {
-#if defined(APP_DESCRIPTION)
-        return APP_DESCRIPTION;
-#else
-        return 0;
-#endif
-    }
+        // EPRINT("%s\n", "grid");
+        int id = k_grid_type;
 
-    const char* GetVersion()
-    {
-#if defined(APP_VERSION)
-        return APP_VERSION;
-#else
-        return 0;
-#endif
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (strcmp(arg_def_[id].value, "ascii") == 0) {
+                opt_.grid_type = 0;
+            } else if (strcmp(arg_def_[id].value, "unicode") == 0) {
+                opt_.grid_type = 1;
+            } else {
+                ++error_;
+            }
+        } else { }
+
+        return error_ ? 0 : 1;
     }
 
-    template <size_t N>
-    const char* GetBuildDate(char (&str)[N])
+    int Resolve_wipe_con()
     {
-        memset(str, 0, N);
+        // EPRINT("%s\n", "wipe");
+        int id = k_wipe_con;
 
-        // Mmm dd yyyy - format of __DATE__
-        // 012 45 7890
+        if (arg_def_[id].count > 0) {
+            opt_.wipe_con = 1;
+        } else {
+            opt_.wipe_con = 0;
+        }
 
-        str[0] = __DATE__[7];
-        str[1] = __DATE__[8];
-        str[2] = __DATE__[9];
-        str[3] = __DATE__[10];
-        str[4] = '-';
-        str[5] = '0';
-        str[6] = '?';
-        str[7] = '-';
+        return 1;
+    }
 
-        switch (__DATE__[0]) {
-        case 'O': case 'N': case 'D':
-            str[5] = '1'; break;
-        default: break;
-        }
+    int Resolve_test_mode()
+    {
+        // EPRINT("%s\n", "test");
+        int id = k_test_mode;
 
-        switch (__DATE__[2]) {
-        case 'b': str[6] = '2'; break;  // Feb
-        case 'c': str[6] = '2'; break;  // Dec
-        case 'g': str[6] = '8'; break;  // Aug
-        case 'l': str[6] = '7'; break;  // Jul
-        case 'n': str[6] = __DATE__[1] == 'a' ? '1' : '6'; break;  // Jan | Jun
-        case 'p': str[6] = '9'; break;  // Sep
-        case 'r': str[6] = __DATE__[1] == 'a' ? '3' : '4'; break;  // Mar | Apr
-        case 't': str[6] = '0'; break;  // Oct
-        case 'v': str[6] = '1'; break;  // Nov
-        case 'y': str[6] = '5'; break;  // May
-        default:  str[6] = '?'; break;  // NOTE: error
+        if (arg_def_[id].count > 0) {
+            opt_.test_mode = 1;
+        } else {
+            opt_.test_mode = 0;
         }
 
-        str[7] = '-';
-        str[8] = (__DATE__[4] == ' ' ? '0' : __DATE__[4]);
-        str[9] = __DATE__[5];
-        str[10] = ' ';
-        str[11] = __TIME__[0];
-        str[12] = __TIME__[1];
-        str[13] = ':';
-        str[14] = __TIME__[3];
-        str[15] = __TIME__[4];
-        str[16] = ':';
-        str[17] = __TIME__[6];
-        str[18] = __TIME__[7];
-        str[19] = '\0';
-#if defined(GCC_ONLY_)
-        static_assert((__DATE__[0] != '?'), "error in __DATE__ macro");
-#endif
-        static_assert((N > 19), "specify a larger string, at least 19 chars needed");
+        return 1;
+    }
+
+    int Resolve_tile_set()
+    {
+        int id = k_tile_set;
+
+        // EPRINT("%s %s\n", "tile", arg_def_[id].value);
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[1] == '\0') {
+                switch (arg_def_[id].value[0]) {
+                case '1': opt_.tile_set = 1; break;
+                case '2': opt_.tile_set = 2; break;
+                case '3': opt_.tile_set = 3; break;
+                default: ++error_; break;
+                }
+            } else {
+                ++error_;
+            }
+        } else { }
 
-        return str;
+        return error_ ? 0 : 1;
     }
 
-    template <size_t N>
-    const char* GetCompilerVersion(char (&str)[N])
+    int Resolve_cache_file()
     {
-        // TODO: __GNUC__ et al. seems incorrect with LLVM/Clang
-        memset(str, 0, N);
+        int id = k_cache_file;
 
-        errno_t error;
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.cache_file = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
+        } else { }
 
-#define BREAK_IF_ERROR($cmd, $err) \
-        do { \
-            $err = $cmd; \
-            if ($err != 0) { \
-                break; \
-            } else { \
-            } \
-        } while (FALSE_CONDITION)
+        return error_ ? 0 : 1;
+    }
 
-        do {
-#if defined(__clang__)
-            BREAK_IF_ERROR(strcat_s(str, "Clang/LLVM "), error);
-            BREAK_IF_ERROR(strcat_s(str, STR2(__clang_major__)), error);
-            BREAK_IF_ERROR(strcat_s(str, STR2(__clang_minor__)), error);
-            BREAK_IF_ERROR(strcat_s(str, STR1(__clang_patchlevel__)), error);
+    int Resolve_book_file()
+    {
+        int id = k_book_file;
 
-#if defined(__GNUC__) || defined(_MSC_FULL_VER)
-            BREAK_IF_ERROR(strcat_s(str, " ["), error);
-#endif
-#endif  // __clang__
-#if defined(__GNUC__)
-            BREAK_IF_ERROR(strcat_s(str, "GCC/C++ "), error);
-#if defined(CC_STUB_GC_VER)
-            BREAK_IF_ERROR(strcat_s(str, STR1(CC_STUB_GC_VER)), error);
-#else
-            BREAK_IF_ERROR(strcat_s(str, STR2(__GNUC__)), error);
-            BREAK_IF_ERROR(strcat_s(str, STR2(__GNUC_MINOR__)), error);
-            BREAK_IF_ERROR(strcat_s(str, STR1(__GNUC_PATCHLEVEL__)), error);
-#endif  // CC_STUB_GC_VER
-#if defined(__MINGW32__)
-#if defined(__MINGW64_VERSION_MAJOR)
-            BREAK_IF_ERROR(strcat_s(str, " [MinGW-w64 "), error);
-            BREAK_IF_ERROR(strcat_s(str, STR2(__MINGW64_VERSION_MAJOR)), error);
-            BREAK_IF_ERROR(strcat_s(str, STR1(__MINGW64_VERSION_MINOR)), error);
-#else
-            // NOTE: __MINGW32__ may not be needed
-            BREAK_IF_ERROR(strcat_s(str, " [MinGW "), error);
-            BREAK_IF_ERROR(strcat_s(str, STR2(__MINGW32_MAJOR_VERSION)), error);
-            BREAK_IF_ERROR(strcat_s(str, STR1(__MINGW32_MINOR_VERSION)), error);
-#endif  // __MINGW64__
-            BREAK_IF_ERROR(strcat_s(str, "]"), error);
-#endif  // __MINGW32__
-#endif  // __GNUC__
-#if defined(_MSC_FULL_VER)
-            BREAK_IF_ERROR(strcat_s(str, "MSVC++ "), error);
-#if defined(CC_STUB_VC_VER)
-            BREAK_IF_ERROR(strcat_s(str, STR1(CC_STUB_VC_VER)), error);
-#else
-            // VVRRPPPPP since VS 2005
-            BREAK_IF_ERROR(strncat_s(str, STR1(_MSC_FULL_VER) + 0, 2), error);
-            BREAK_IF_ERROR(strcat_s(str, "."), error);
-            BREAK_IF_ERROR(strncat_s(str, STR1(_MSC_FULL_VER) + 2, 2), error);
-            BREAK_IF_ERROR(strcat_s(str, "."), error);
-            BREAK_IF_ERROR(strcat_s(str, STR1(_MSC_FULL_VER) + 4), error);
-#if defined(_MSC_BUILD)
-            BREAK_IF_ERROR(strcat_s(str, "."), error);
-            BREAK_IF_ERROR(strcat_s(str, STR1(_MSC_BUILD)), error);
-#endif
-#endif  // CC_STUB_VC_VER
-#endif  // _MSC_FULL_VER
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.book_file = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
+        } else { }
 
-#if defined(__clang__)
-#if defined(__GNUC__) || defined(_MSC_FULL_VER)
-            BREAK_IF_ERROR(strcat_s(str, "]"), error);
-#endif
-#endif  // __clang__
-        } while (FALSE_CONDITION);
+        return error_ ? 0 : 1;
+    }
 
-#undef BREAK_IF_ERROR
+    int Resolve_make_book()
+    {
+        int id = k_make_book;
 
-#if defined(__MINGW32__) && !defined(__MINGW64_VERSION_MAJOR)
-        // since strcat() is used with MinGW,
-        // error points to str and cannot be used for error checking.
-        if (error) {
-            error = NULL;
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.make_book = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
         } else { }
-#endif
 
-        if (error) {
-            return 0;
+        return error_ ? 0 : 1;
+    }
+
+    int Resolve_search_depth()
+    {
+        int id = k_search_depth;
+
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if ((arg_def_[id].value[0] >= '1') &&
+                (arg_def_[id].value[0] <= '9') &&
+                (arg_def_[id].value[1] == '\0')) {
+                opt_.search_depth = arg_def_[id].value[0] - '0';
+            } else {
+                ++error_;
+            }
         } else { }
 
-        return str;
+        return error_ ? 0 : 1;
     }
 
-    const char* GetCompilerArgs()
+    int Resolve_make_tablebase()
     {
-#if defined(CC_STUB_CONFIG)
-        return STR1(CC_STUB_CONFIG);
-#else
-        return 0;
-#endif
+        int id = k_make_tablebase;
+
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.make_tablebase = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
+        } else { }
+
+        return error_ ? 0 : 1;
     }
 
-  private:
-    DISALLOW_COPY_AND_ASSIGN(AppInfo);
-};
+    int Resolve_tile_cap()
+    {
+        int id = k_tile_cap;
 
-struct arg_definition {
-    int need_value;
-    char short_option;
-    const char* long_option;
-    const char* default_value;
-    const char* help;
-    const char* value;
-    int count;
-};
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int cap = atoi(arg_def_[id].value);
+
+            switch (cap) {
+            case 32: opt_.tile_cap = 5; break;
+            case 64: opt_.tile_cap = 6; break;
+            case 128: opt_.tile_cap = 7; break;
+            case 256: opt_.tile_cap = 8; break;
+            case 512: opt_.tile_cap = 9; break;
+            default: ++error_; break;
+            }
+        } else { }
 
-template <size_t N>
-class ArgParser
-{
-  private:
-    enum { LENGTH = N };
-  public:
-    explicit ArgParser(arg_definition(&arg_def)[N])
-        : help_(0), version_(0), arg_def_(arg_def) { }
-    ~ArgParser() { }
+        return error_ ? 0 : 1;
+    }
 
-    int parse(int argc, char* argv[])
+    int Resolve_perft_depth()
     {
-        int error = 0;
-        int token = 0;
-        bool end_of_opt = false;
+        int id = k_perft_depth;
 
-        for (int i = 1; i < argc; i++) {
-            int ret = 0;
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int depth = atoi(arg_def_[id].value);
 
-            if (argv[i][0] == '-') {
-                if (argv[i][1] == '-') {
-                    if (argv[i][2] == '\0') {
-                        end_of_opt = !end_of_opt;
-                        continue;
-                    } else {
-                        if (end_of_opt) {
-                            ret = get_argument(argv[i]);
-                        } else {
-                            ret = get_long_arg(argv[i]);
-                        }
-                    }
-                } else if (argv[i][1] != '\0') {
-                    if (end_of_opt) {
-                        ret = get_argument(argv[i]);
-                    } else {
-                        ret = get_short_arg(argv, i, argc);
-                    }
-                } else {
-                    ret = -1;
-                }
+            if ((depth >= 1) && (depth <= Perft::MAX_DEPTH)) {
+                opt_.perft_depth = depth;
             } else {
-                ret = get_argument(argv[i]);
+                ++error_;
             }
+        } else { }
 
-            if (ret < 0) {
-                if (check_known_opt(argv[i])) {
-                    return 1;
-                } else { }
+        return error_ ? 0 : 1;
+    }
 
-                ++error;
+    int Resolve_start_board()
+    {
+        int id = k_start_board;
+        PackedBoard unused;
+
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (ParseBoard(arg_def_[id].value, unused)) {
+                opt_.start_board = arg_def_[id].value;
             } else {
-                token += ret + 1;
-                i += ret;
+                ++error_;
             }
+        } else { }
+
+        return error_ ? 0 : 1;
+    }
+
+    int Resolve_perft_hash()
+    {
+        int id = k_perft_hash;
+
+        if (arg_def_[id].count > 0) {
+            opt_.perft_hash = 1;
+        } else {
+            opt_.perft_hash = 0;
         }
 
-        if (token == 0 && argc > 1) {
-            error++;
+        return 1;
+    }
+
+    int Resolve_perft_stripe()
+    {
+        int id = k_perft_stripe;
+
+        if (arg_def_[id].count > 0) {
+            opt_.perft_stripe = 1;
+        } else {
+            opt_.perft_stripe = 0;
+        }
+
+        return 1;
+    }
+
+    int Resolve_render_bench()
+    {
+        int id = k_render_bench;
+
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int moves = atoi(arg_def_[id].value);
+
+            if (moves >= 1) {
+                opt_.render_bench = moves;
+            } else {
+                ++error_;
+            }
         } else { }
 
-        // EPRINT("tok %d, argc %d, err %d, ret %d\n", token, argc, error,
-        //        (error == 0 ? 1 : 0));
+        return error_ ? 0 : 1;
+    }
 
-        return error == 0 ? 1 : 0;
+    int Resolve_animate()
+    {
+        int id = k_animate;
+
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int ms = atoi(arg_def_[id].value);
+
+            if ((ms >= 1) && (ms <= Animator::MAX_MS)) {
+                opt_.animate = ms;
+            } else {
+                ++error_;
+            }
+        } else { }
+
+        return error_ ? 0 : 1;
     }
 
-    void show_help(const char* name, const char* header, const char* footer)
+    int Resolve_frame_rate()
     {
-        if (header && *header) {
-            fprintf(stdout, "%s", header);
+        int id = k_frame_rate;
+
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int fps = atoi(arg_def_[id].value);
+
+            if ((fps >= 1) && (fps <= Animator::MAX_FPS)) {
+                opt_.frame_rate = fps;
+            } else {
+                ++error_;
+            }
         } else { }
 
-        fprintf(stdout, "Usage: %s [options]\n", name);
-        fprintf(stdout, " Options:\n");
+        return error_ ? 0 : 1;
+    }
 
-        for (int i = 0; i < LENGTH; ++i) {
-            show_option_help(i);
-        }
+    int Resolve_latency_log()
+    {
+        int id = k_latency_log;
 
-        if (footer && *footer) {
-            fprintf(stdout, "%s", footer);
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.latency_log = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
         } else { }
+
+        return error_ ? 0 : 1;
     }
 
-    int show_option_help(int id)
+    int Resolve_counter_log()
     {
-        if ((id < 0) || (id >= LENGTH)) {  // TODO: assert
-            return 0;
+        int id = k_counter_log;
+
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.counter_log = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
         } else { }
 
-#define PRINT_OPT($opt, $fmt, $sep, $hasopt) \
-        if (arg_def_[id].need_value) { \
-            if (arg_def_[id].$opt) { \
-                fprintf(stdout, $fmt $sep "VALUE", arg_def_[id].$opt); \
-                $hasopt = 1; \
-            } else { } \
-        } else { \
-            if (arg_def_[id].$opt) { \
-                fprintf(stdout, $fmt, arg_def_[id].$opt); \
-                $hasopt = 1; \
-            } else { } \
-        } (void)0
+        return error_ ? 0 : 1;
+    }
 
-        int has_opt = 0;
+    int Resolve_counter_interval()
+    {
+        int id = k_counter_interval;
 
-        PRINT_OPT(short_option, "  -%c", " ", has_opt);
-        PRINT_OPT(long_option, "  --%s", "=", has_opt);
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int ms = atoi(arg_def_[id].value);
 
-        if (has_opt) {
-            fprintf(stdout, "  %s %s%s%c\n",
-                    (arg_def_[id].help ? arg_def_[id].help : ""),
-                    (arg_def_[id].default_value ? "(default: " : ""),
-                    (arg_def_[id].default_value ? arg_def_[id].default_value : ""),
-                    (arg_def_[id].default_value ? ')' : ' '));
+            if ((ms >= 10) && opt_.counter_log) {
+                opt_.counter_interval = ms;
+            } else {
+                ++error_;  // no counters file to rewrite
+            }
         } else { }
 
-#undef PRINT_OPT
-        return 1;
+        return error_ ? 0 : 1;
     }
 
-    int has_help_opt()
+    int Resolve_trace_file()
     {
-        return help_;
-    }
+        int id = k_trace_file;
 
-    int has_version_opt()
-    {
-        return version_;
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.trace_file = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
+        } else { }
+
+        return error_ ? 0 : 1;
     }
 
-  private:
-    int get_short_arg(char* argv[], int pos, int argc)
+    int Resolve_decode_trace()
     {
-        if (!(argv && (pos > 0) && (pos < argc))) {  // TODO: assert
-            return -1;
+        int id = k_decode_trace;
+
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.decode_trace = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
         } else { }
 
-        int error = 0;
-        int consumed = 0;
-        const char* arg = argv[pos];
+        return error_ ? 0 : 1;
+    }
 
-        for (char opt = *++arg; opt; opt = *++arg) {
-            // EPRINT("get_short_arg: %c\n", opt);
-            int found = 0;
+    int Resolve_trace_format()
+    {
+        int id = k_trace_format;
 
-            for (int i = 0; i < LENGTH; i++) {
-                if (arg_def_[i].short_option == opt) {
-                    arg_def_[i].count += 1;
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (strcmp(arg_def_[id].value, "text") == 0) {
+                opt_.trace_format = 0;
+            } else if (strcmp(arg_def_[id].value, "chrome") == 0) {
+                opt_.trace_format = 1;
+            } else {
+                ++error_;
+            }
+        } else { }
 
-                    if (arg_def_[i].need_value) {
-                        if ((++pos) < argc) {
-                            arg_def_[i].value = argv[pos];
-                            ++consumed;
-                        } else {
-                            // EPRINT("get_short_arg ret -1: %c\n", opt);
-                            return -1;
-                        }
-                    } else { }
+        return error_ ? 0 : 1;
+    }
 
-                    ++found;
-                } else { }
-            }
+    int Resolve_alloc_report()
+    {
+        int id = k_alloc_report;
 
-            // EPRINT("get_short_arg: %c %s found , con %d err %d ret %d\n",
-            //        opt, (found?"":"not"), consumed, error,
-            //        (error == 0 ? consumed : -1));
-            if (found == 0) {
-                ++error;
-            } else { }
+        if (arg_def_[id].count > 0) {
+            opt_.alloc_report = 1;
+        } else {
+            opt_.alloc_report = 0;
         }
 
-        return error == 0 ? consumed : -1;
+        return 1;
     }
 
-    int get_long_arg(const char* arg)
+    int Resolve_alloc_test()
     {
-        if (!arg) {  // TODO: assert
-            return -1;
-        } else { }
+        int id = k_alloc_test;
 
-        bool negate = false;
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int moves = atoi(arg_def_[id].value);
 
-        if ((arg[2] == 'n') && (arg[3] == 'o')) {
-            negate = true;
+            if (moves >= 1) {
+                opt_.alloc_test = moves;
+            } else {
+                ++error_;
+            }
+        } else { }
 
-            if (arg[4] == '-') {
-                arg += 1;
-            } else { }
+        return error_ ? 0 : 1;
+    }
 
-            arg += 2;
-        } else { }
+    int Resolve_serve_path()
+    {
+        int id = k_serve_path;
 
-        if (*arg == '\0') {
-            return -1;
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.serve_path = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
         } else { }
 
-        for (int i = 0; i < LENGTH; i++) {
-            size_t pos = opt_equal(arg_def_[i].long_option, arg);
+        return error_ ? 0 : 1;
+    }
 
-            if (pos) {
-                arg += pos;
+    int Resolve_serve_bench()
+    {
+        int id = k_serve_bench;
 
-                if (arg_def_[i].need_value) {
-                    if (*arg) {
-                        arg_def_[i].value = arg;
-                    } else {
-                        return -1;
-                    }
-                } else {
-                    if (*arg) {
-                        arg_def_[i].value = arg;  // TODO: ignoring error, why?
-                    } else { }
-                }
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int sessions = atoi(arg_def_[id].value);
 
-                if (negate) {
-                    if (arg_def_[i].count > 0) {
-                        arg_def_[i].count = -arg_def_[i].count;
-                    } else { }
+            if (sessions >= 1) {
+                opt_.serve_bench = sessions;
+            } else {
+                ++error_;
+            }
+        } else { }
 
-                    arg_def_[i].count -= 1;
-                } else {
-                    if (arg_def_[i].count < 0) {
-                        arg_def_[i].count = -arg_def_[i].count;
-                    } else { }
+        return error_ ? 0 : 1;
+    }
 
-                    arg_def_[i].count += 1;
-                }
+    int Resolve_bot_file()
+    {
+        int id = k_bot_file;
 
-                return 0;
-            } else { }
-        }
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.bot_file = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
+        } else { }
 
-        return -1;
+        return error_ ? 0 : 1;
     }
 
-    int get_argument(const char* arg)
+    int Resolve_bot_spin()
     {
-        if (!arg) {  // TODO: assert
-            return -1;
-        } else { }
-
-        int found = 0;
+        int id = k_bot_spin;
 
-        for (int i = 0; i < LENGTH; i++) {
-            if ((!arg_def_[i].value) &&
-                (!arg_def_[i].short_option) &&
-                (!arg_def_[i].long_option)) {
-                ++found;
-                arg_def_[i].value = arg;
-                break;
-            } else { }
+        if (arg_def_[id].count > 0) {
+            opt_.bot_spin = 1;
+        } else {
+            opt_.bot_spin = 0;
         }
 
-        return found ? 0 : -1;
+        return 1;
     }
 
-    int check_known_opt(const char* arg)
+    int Resolve_bot_bench()
     {
-        if (!arg) {  // TODO: assert
-            return -1;
-        } else { }
+        int id = k_bot_bench;
 
-        char c0 = arg[0];
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int moves = atoi(arg_def_[id].value);
 
-        if (c0 == '?') {
-            help_ = 1;
-            return 1;
-        } else if (c0 == '-') {
-            char c1 = arg[1];
+            if (moves >= 1) {
+                opt_.bot_bench = moves;
+            } else {
+                ++error_;
+            }
+        } else { }
 
-            if (c1 == '?') {
-                help_ = 1;
-                return 1;
-            } else if (c1 == '-') {
-                char c2 = arg[2];
+        return error_ ? 0 : 1;
+    }
 
-                if (c2 == '?') {
-                    help_ = 1;
-                    return 1;
-                } else if ((c2 == 'h') &&
-                           (arg[3] == 'e') &&
-                           (arg[4] == 'l') &&
-                           (arg[5] == 'p') &&
-                           (arg[6] == '\0')) {
-                    help_ = 1;
-                    return 1;
-                } else if ((c2 == 'v') &&
-                           (arg[3] == 'e') &&
-                           (arg[4] == 'r') &&
-                           (arg[5] == 's') &&
-                           (arg[6] == 'i') &&
-                           (arg[7] == 'o') &&
-                           (arg[8] == 'n') &&
-                           (arg[9] == '\0')) {
-                    version_ = 1;
-                    return 1;
-                } else { }
-            } else { }
+    int Resolve_oracle()
+    {
+        int id = k_oracle;
+        int kind, param;
+
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (MovePolicy::Parse(arg_def_[id].value, kind, param)) {
+                opt_.oracle = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
         } else { }
 
-        return 0;
+        return error_ ? 0 : 1;
     }
 
-    size_t opt_equal(const char* option, const char* arg)
+    int Resolve_tournament()
     {
-        if (!(option && arg && arg[2])) {  // TODO: assert
-            return 0;
+        int id = k_tournament;
+        std::vector<std::string> names;
+
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (Tournament::ParseList(arg_def_[id].value, names)) {
+                opt_.tournament = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
         } else { }
 
-        size_t len = strlen(option);  // NOTE: length can be cached
+        return error_ ? 0 : 1;
+    }
 
-        if (len > 0) {
-            if (strncmp(option, (arg + 2), len) == 0) {
-                if (arg[len + 2] == '=') {
-                    return len + 3;
-                } else if (arg[len + 2] == '\0') {
-                    return len + 2;
-                } else { }
-            } else { }
+    int Resolve_seeds()
+    {
+        int id = k_seeds;
+
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int seeds = atoi(arg_def_[id].value);
+
+            if (seeds >= 1) {
+                opt_.seeds = seeds;
+            } else {
+                ++error_;
+            }
         } else { }
 
-        return 0;
+        return error_ ? 0 : 1;
     }
 
-  private:
-    DISALLOW_COPY_AND_ASSIGN(ArgParser);
+    int Resolve_results_file()
+    {
+        int id = k_results_file;
 
-  private:
-    int help_;
-    int version_;
-    struct arg_definition(&arg_def_)[N];
-};
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.results_file = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
+        } else { }
 
-/* get-options */
-#define UNWRAP(x) x
-// macro args:    id, need, short, long, default, help, value, count
-// arg types:     --, int,  char,  char*, char*,  char*, char*, int
-#define OPT_CLRS (color_id, 1, 'c', "color", "0", "color scheme: 0, 1, 2 or 3")
-#define OPT_GRID (grid_type, 1, 'g', "grid", "unicode", "draw with ascii|unicode characters")
-#define OPT_WIPE (wipe_con, 0, 'w', "wipe", NULL, "wipes the display when exiting(default: do not wipe)")
-#define OPT_TEST (test_mode, 0, '\0', "test", NULL, "with '--color' shows color scheme and exit")
-#define OPT_TILE (tile_set, 1, '\0', "tile-set", "1", "previews grid/tiles, choices 1, 2 or 3")
-#define OPT_HELP (more_arg, 0, '\0', NULL, NULL, NULL)
+        return error_ ? 0 : 1;
+    }
 
-#define OPTS \
-    OPT_CLRS,OPT_GRID,OPT_WIPE,OPT_TEST,OPT_TILE,OPT_HELP
+    int Resolve_policy()
+    {
+        int id = k_policy;
+        int kind, param;
 
-// macros GET_FUNC and CODE_GEN based on FOR_EACH macros from link below:
-// http://stackoverflow.com/questions/1872220/
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (MovePolicy::Parse(arg_def_[id].value, kind, param)) {
+                opt_.policy = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
+        } else { }
 
-#define F1(F,A) F(A)
-#define F2(F,A,...) F(A)UNWRAP(F1(F,__VA_ARGS__))
-#define F3(F,A,...) F(A)UNWRAP(F2(F,__VA_ARGS__))
-#define F4(F,A,...) F(A)UNWRAP(F3(F,__VA_ARGS__))
-#define F5(F,A,...) F(A)UNWRAP(F4(F,__VA_ARGS__))
-#define F6(F,A,...) F(A)UNWRAP(F5(F,__VA_ARGS__))
+        return error_ ? 0 : 1;
+    }
 
-#define GET_FUNC(A1,A2,A3,A4,A5,A6,FUNC,...) FUNC
-#define CODE_GEN(GEN_FUNC,...) \
-    UNWRAP(GET_FUNC(__VA_ARGS__,F6,F5,F4,F3,F2,F1)(GEN_FUNC,__VA_ARGS__))
+    int Resolve_self_play()
+    {
+        int id = k_self_play;
+        int kind, param;
 
-#define GET_ID(a,...) int a;
-#define CALL_GET_ID(x) GET_ID x
-struct option {
-    CODE_GEN(CALL_GET_ID, OPTS)
-};
-#undef GET_ID
-#undef CALL_GET_ID
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (MovePolicy::Parse(arg_def_[id].value, kind, param)) {
+                opt_.self_play = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
+        } else { }
 
-#define GET_ENUM_ID(a,...) k_##a,
-#define CALL_GET_ENUM_ID(x) GET_ENUM_ID x
-enum {
-    CODE_GEN(CALL_GET_ENUM_ID, OPTS)
-};
-#undef GET_ENUM_ID
-#undef CALL_GET_ENUM_ID
+        return error_ ? 0 : 1;
+    }
 
-template <size_t N>
-class ArgResolver
-{
-  private:
-    enum { LENGTH = N };
-  public:
-    ArgResolver(option& opt, arg_definition(&arg_def)[N])
-        : help_(0), error_(0), version_(0), opt_(opt), arg_def_(arg_def) { }
-    ~ArgResolver() { }
+    int Resolve_games()
+    {
+        int id = k_games;
 
-    int Resolve()
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int games = atoi(arg_def_[id].value);
+
+            if (games >= 0) {
+                opt_.games = games;
+            } else {
+                ++error_;
+            }
+        } else { }
+
+        return error_ ? 0 : 1;
+    }
+
+    int Resolve_stats_file()
     {
-#define RESOLVE_OPT(a,...) \
-        Resolve_##a();
+        int id = k_stats_file;
 
-#define CALL_RESOLVE_OPT(x) RESOLVE_OPT x
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.stats_file = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
+        } else { }
 
-        CODE_GEN(CALL_RESOLVE_OPT, OPTS)
+        return error_ ? 0 : 1;
+    }
 
-#undef RESOLVE_OPT
-#undef CALL_RESOLVE_OPT
+    int Resolve_stats_interval()
+    {
+        int id = k_stats_interval;
 
-        if (error_ > 0) {
-            return -error_;
-        } else if (help_ || version_) {
-            return 0;
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int ms = atoi(arg_def_[id].value);
+
+            if (ms >= 100) {
+                opt_.stats_interval = ms;
+            } else {
+                ++error_;
+            }
         } else { }
 
-        return 1;
+        return error_ ? 0 : 1;
     }
 
-    int Resolve_color_id()
+    int Resolve_checkpoint()
     {
-        // EPRINT("%s\n", "color");
-        int id = k_color_id;
+        int id = k_checkpoint;
 
         if (arg_def_[id].count && arg_def_[id].value) {
-            if (arg_def_[id].value[1] == '\0') {
-                switch (arg_def_[id].value[0]) {
-                case '0': opt_.color_id = 0; break;
-                case '1': opt_.color_id = 1; break;
-                case '2': opt_.color_id = 2; break;
-                case '3': opt_.color_id = 3; break;
-                default: ++error_; break;
-                }
+            if (arg_def_[id].value[0]) {
+                opt_.checkpoint = arg_def_[id].value;
             } else {
                 ++error_;
             }
@@ -3870,16 +14979,15 @@ class ArgResolver
         return error_ ? 0 : 1;
     }
 
-    int Resolve_grid_type()
+    int Resolve_checkpoint_interval()
     {
-        // EPRINT("%s\n", "grid");
-        int id = k_grid_type;
+        int id = k_checkpoint_interval;
 
         if (arg_def_[id].count && arg_def_[id].value) {
-            if (strcmp(arg_def_[id].value, "ascii") == 0) {
-                opt_.grid_type = 0;
-            } else if (strcmp(arg_def_[id].value, "unicode") == 0) {
-                opt_.grid_type = 1;
+            int ms = atoi(arg_def_[id].value);
+
+            if (ms >= 0) {
+                opt_.checkpoint_interval = ms;
             } else {
                 ++error_;
             }
@@ -3888,47 +14996,60 @@ class ArgResolver
         return error_ ? 0 : 1;
     }
 
-    int Resolve_wipe_con()
+    int Resolve_resume()
     {
-        // EPRINT("%s\n", "wipe");
-        int id = k_wipe_con;
+        int id = k_resume;
 
-        if (arg_def_[id].count > 0) {
-            opt_.wipe_con = 1;
-        } else {
-            opt_.wipe_con = 0;
-        }
+        if (arg_def_[id].count) {
+            if (opt_.checkpoint) {
+                opt_.resume = 1;
+            } else {
+                ++error_;  // nothing to resume from
+            }
+        } else { }
 
-        return 1;
+        return error_ ? 0 : 1;
     }
 
-    int Resolve_test_mode()
+    int Resolve_save_file()
     {
-        // EPRINT("%s\n", "test");
-        int id = k_test_mode;
+        int id = k_save_file;
 
-        if (arg_def_[id].count > 0) {
-            opt_.test_mode = 1;
-        } else {
-            opt_.test_mode = 0;
-        }
+        if (arg_def_[id].count && arg_def_[id].value) {
+            if (arg_def_[id].value[0]) {
+                opt_.save_file = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
+        } else { }
 
-        return 1;
+        return error_ ? 0 : 1;
     }
 
-    int Resolve_tile_set()
+    int Resolve_history_file()
     {
-        int id = k_tile_set;
+        int id = k_history_file;
 
-        // EPRINT("%s %s\n", "tile", arg_def_[id].value);
         if (arg_def_[id].count && arg_def_[id].value) {
-            if (arg_def_[id].value[1] == '\0') {
-                switch (arg_def_[id].value[0]) {
-                case '1': opt_.tile_set = 1; break;
-                case '2': opt_.tile_set = 2; break;
-                case '3': opt_.tile_set = 3; break;
-                default: ++error_; break;
-                }
+            if (arg_def_[id].value[0]) {
+                opt_.history_file = arg_def_[id].value;
+            } else {
+                ++error_;
+            }
+        } else { }
+
+        return error_ ? 0 : 1;
+    }
+
+    int Resolve_top()
+    {
+        int id = k_top;
+
+        if (arg_def_[id].count && arg_def_[id].value) {
+            int n = atoi(arg_def_[id].value);
+
+            if (n >= 1) {
+                opt_.top = n;
             } else {
                 ++error_;
             }
@@ -4015,7 +15136,7 @@ void dump_arg_def(struct arg_definition* arg_def)
 
 int get_option(int argc, char* argv[], struct option& opt)
 {
-#define GET_DEF(a,b,c,d,e,f) { b, c, d, e, f, 0, 0 },
+#define GET_DEF(a,b,c,d,e,f,g) { b, c, d, e, f, 0, 0 },
 #define CALL_GET_DEF(x) GET_DEF x
     int error = 0;
     struct arg_definition arg_def[] = {
@@ -4066,11 +15187,20 @@ int get_option(int argc, char* argv[], struct option& opt)
     return error ? 0 : 1;
 }
 
+void dump_opt_value(const char* name, int value)
+{
+    fprintf(stderr, "%-10s : %d\n", name, value);
+}
+
+void dump_opt_value(const char* name, const char* value)
+{
+    fprintf(stderr, "%-10s : %s\n", name, value ? value : "(null)");
+}
+
 void dump_opt(struct option& opt)
 {
 #define PRINT_OPT(a,...) \
-    fprintf(stderr, "%-10s : %d\n", \
-            (#a), opt.a);
+    dump_opt_value((#a), opt.a);
 
 #define CALL_PRINT_OPT(x) PRINT_OPT x
 
@@ -4088,15 +15218,82 @@ void dump_opt(struct option& opt)
 #undef F4
 #undef F5
 #undef F6
+#undef F7
+#undef F8
+#undef F9
+#undef F10
+#undef F11
+#undef F12
+#undef F13
+#undef F14
+#undef F15
+#undef F16
+#undef F17
+#undef F18
+#undef F19
+#undef F20
+#undef F21
+#undef F22
+#undef F23
+#undef F24
+#undef F25
+#undef F26
+#undef F27
+#undef F28
+#undef F29
+#undef F30
+#undef F31
+#undef F32
 #undef FUNC
 #undef GEN_FUNC
 #undef GET_FUNC
 #undef OPTS
+#undef OPT_ALRP
+#undef OPT_ALTS
+#undef OPT_ANIM
+#undef OPT_BBEN
+#undef OPT_BOOK
+#undef OPT_BORD
+#undef OPT_BOT
+#undef OPT_BSPN
+#undef OPT_CACHE
+#undef OPT_CINT
+#undef OPT_CINV
+#undef OPT_CKPT
 #undef OPT_CLRS
+#undef OPT_CNTR
+#undef OPT_DPTH
+#undef OPT_DTRC
+#undef OPT_FPS
+#undef OPT_GAMS
 #undef OPT_GRID
 #undef OPT_HELP
+#undef OPT_HIST
+#undef OPT_LTCY
+#undef OPT_MKBK
+#undef OPT_MKTB
+#undef OPT_ORCL
+#undef OPT_PHSH
+#undef OPT_PLCY
+#undef OPT_PRFT
+#undef OPT_PSTR
+#undef OPT_RBEN
+#undef OPT_RSLT
+#undef OPT_RSUM
+#undef OPT_SAVE
+#undef OPT_SBEN
+#undef OPT_SEED
+#undef OPT_SELF
+#undef OPT_SERV
+#undef OPT_SINT
+#undef OPT_STAT
+#undef OPT_TCAP
 #undef OPT_TEST
+#undef OPT_TFMT
 #undef OPT_TILE
+#undef OPT_TOP
+#undef OPT_TRCE
+#undef OPT_TRNY
 #undef OPT_WIPE
 #undef UNWRAP
 
@@ -4114,7 +15311,14 @@ int play1(int argc, char* argv[])
     rng.Seed((unsigned int)Clock().Ticks_ms() & 0xffff);
     Puzzle2048 p2048;
 
-    option opt = { 0, 1, 0, 0, 0, 0 };
+    option opt = option();  // 0 and NULL but for these
+    opt.grid_type = 1;
+    opt.tile_cap = TablebaseBuilder::DEFAULT_CAP;
+    opt.start_board = "0000000000000011";
+    opt.frame_rate = Animator::DEFAULT_FPS;
+    opt.seeds = 100;
+    opt.stats_interval = 10000;
+    opt.checkpoint_interval = 60000;
 
     if (argc > 1) {
         ret = get_option(argc, argv, opt);
@@ -4126,7 +15330,135 @@ int play1(int argc, char* argv[])
                 opt.color_id |= 0x4;
             } else { }
 
-            if (opt.test_mode) {
+            if (opt.cache_file && !p2048.OpenCache(opt.cache_file)) {
+                fprintf(stderr, "cannot open cache file '%s'\n", opt.cache_file);
+            } else { }
+
+            if (opt.book_file && !p2048.OpenBook(opt.book_file)) {
+                fprintf(stderr, "cannot open book file '%s'\n", opt.book_file);
+            } else { }
+
+            if (opt.policy && !p2048.SetPolicy(opt.policy)) {
+                fprintf(stderr, "cannot set policy '%s'\n", opt.policy);
+            } else { }
+
+            p2048.SetSearchDepth(opt.search_depth);
+            p2048.SetAnimation(opt.animate, opt.frame_rate);
+            p2048.SetLatencyLog(opt.latency_log);
+
+            if (opt.save_file) {
+                p2048.SetSavePath(opt.save_file);
+            } else { }
+
+            if (opt.history_file) {
+                p2048.SetHistoryPath(opt.history_file);
+            } else { }
+
+            counters.StartDump(opt.counter_log, opt.counter_interval);
+
+            if (opt.trace_file) {
+                tracer.Start();
+            } else { }
+
+            if (opt.alloc_report) {
+                alloc_tracker.Start();
+            } else { }
+
+            if (opt.decode_trace) {
+                ret = DecodeTrace(opt.decode_trace, opt.trace_format == 1, stdout) ? 1 : 0;
+
+                if (ret) {
+                } else {
+                    fprintf(stderr, "cannot read trace file '%s'\n", opt.decode_trace);
+                }
+            } else if (opt.serve_path || opt.serve_bench) {
+#if defined(__linux__)
+                if (opt.serve_bench) {
+                    ret = GameServer::Bench(opt.serve_bench, stdout);
+                } else {
+                    GameServer server;
+
+                    if (server.Listen(opt.serve_path)) {
+                        server.Run(stdout);
+                        ret = 1;
+                    } else {
+                        fprintf(stderr, "cannot listen on '%s'\n", opt.serve_path);
+                        ret = 0;
+                    }
+                }
+#else
+                fprintf(stderr, "%s\n", "--serve needs Linux (epoll)");
+                ret = 0;
+#endif
+            } else if (opt.self_play) {
+                SelfPlay self_play;
+                self_play.SetCheckpoint(opt.checkpoint, opt.checkpoint_interval,
+                                        opt.resume != 0);
+                ret = self_play.Run(opt.self_play, (uint64_t)opt.games,
+                                    opt.stats_interval, opt.stats_file,
+                                    stdout) ? 1 : 0;
+            } else if (opt.tournament) {
+                Tournament tournament;
+                ret = tournament.Run(opt.tournament, opt.seeds,
+                                     opt.results_file, stdout) ? 1 : 0;
+            } else if (opt.oracle) {
+                MoveOracle oracle;
+                ret = (oracle.Set(opt.oracle) &&
+                       oracle.Run(0, stdout)) ? 1 : 0;  // 0: stdin
+            } else if (opt.top) {
+                const char* path = opt.history_file ? opt.history_file
+                                                    : GameHistory::DefaultPath();
+                GameHistory history;
+
+                if (path && history.Open(path)) {
+                    ret = history.Print((size_t)opt.top, stdout) ? 1 : 0;
+                } else {
+                    fprintf(stderr, "cannot open game history '%s'\n",
+                            path ? path : "");
+                    ret = 0;
+                }
+            } else if (opt.bot_file || opt.bot_bench) {
+#if !defined(_WIN32)
+                if (opt.bot_bench) {
+                    ret = BotRing::Bench(opt.bot_bench, opt.bot_spin != 0, stdout);
+                } else {
+                    BotRing ring;
+
+                    if (ring.Create(opt.bot_file, opt.bot_spin != 0)) {
+                        fprintf(stdout, "%llu bot requests answered\n",
+                                (unsigned long long)ring.Serve());
+                        ret = 1;
+                    } else {
+                        fprintf(stderr, "cannot create bot ring '%s'\n", opt.bot_file);
+                        ret = 0;
+                    }
+                }
+#else
+                fprintf(stderr, "%s\n", "--bot is not supported on Windows yet");
+                ret = 0;
+#endif
+            } else if (opt.alloc_test) {
+                ret = p2048.AllocTest(opt.alloc_test, opt.grid_type, stdout);
+            } else if (opt.make_book) {
+                ret = p2048.MakeBook(opt.make_book, opt.search_depth);
+            } else if (opt.perft_depth) {
+                PackedBoard board = 0;
+                ParseBoard(opt.start_board, board);
+                Perft perft(opt.perft_stripe != 0, opt.perft_hash != 0);
+                perft.Run(board, opt.perft_depth, stdout);
+                ret = 1;
+            } else if (opt.render_bench) {
+#if defined(RECORDING_CONSOLE_)
+                ret = p2048.RenderBench(opt.render_bench, opt.grid_type, stdout);
+#else
+                fprintf(stderr, "%s\n", "--render-bench needs a build with"
+                        " -DRECORDING_CONSOLE_");
+                ret = 0;
+#endif
+            } else if (opt.make_tablebase) {
+                TablebaseBuilder builder(opt.tile_cap);
+                ret = builder.Build(opt.make_tablebase, stderr) ? 1 : 0;
+            } else if (opt.test_mode) {
                 con.SetTitle(_TEXT("Puzzle 2048: color scheme test"));
                 ret = p2048.SchemeTest(opt.color_id, opt.grid_type);
             } else if (opt.tile_set) {
@@ -4142,6 +15474,21 @@ int play1(int argc, char* argv[])
         ret = p2048.Play(0, 1);
     }
 
+    if (counters.StopDump()) {
+    } else {
+        fprintf(stderr, "cannot write counters file '%s'\n", opt.counter_log);
+    }
+
+    if (!opt.trace_file || tracer.Save(opt.trace_file)) {
+    } else {
+        fprintf(stderr, "cannot write trace file '%s'\n", opt.trace_file);
+    }
+
+    if (opt.alloc_report) {
+        alloc_tracker.Stop();
+        alloc_tracker.Print(stderr);
+    } else { }
+
     if (opt.wipe_con) {
     } else if (ret) {
         fprintf(stderr, "%s\n", "Good day, bye");
@@ -4150,8 +15497,10 @@ int play1(int argc, char* argv[])
     return ret;
 }
 
+#if !defined(LIB2048_)
 int main(int argc, char* argv[])
 {
+#if defined(_WIN32)
     SetErrorMode(SEM_NOGPFAULTERRORBOX);
     SetUnhandledExceptionFilter(UnhandledExceptionFilterFunc);
 #if defined(__MINGW32__) && !defined(__MINGW64_VERSION_MAJOR)
@@ -4168,6 +15517,19 @@ int main(int argc, char* argv[])
     } else {
         fprintf(stderr, "\nERROR: Could not set control handler");
     }
+#else
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = SignalHandler;  // no SA_RESTART, poll() has to return
+    sigemptyset(&sa.sa_mask);
+    const int signals[] = { SIGINT, SIGTERM, SIGHUP, SIGWINCH };
+
+    for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i) {
+        if (sigaction(signals[i], &sa, NULL) != 0) {
+            fprintf(stderr, "\nERROR: Could not set signal handler");
+        } else { }
+    }
+#endif  // _WIN32
 
     int ret = 0;
 
@@ -4187,6 +15549,7 @@ int main(int argc, char* argv[])
 
     return ret;
 }
+#endif  // !LIB2048_
 
 #if defined(MSC_ONLY_)
 #if defined(NO_WALL_FILTER)
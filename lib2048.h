@@ -0,0 +1,106 @@
+/*
+ * lib2048.h: C API of the 2048 engine, for programs playing without the
+ * console.  The library is 2048.cpp built with LIB2048_ defined:
+ *
+ *   g++ -std=c++11 -O2 -fPIC -shared -fvisibility=hidden -DLIB2048_ \
+ *       -pthread 2048.cpp -o lib2048.so
+ *
+ * Boards are packed: 16 tile exponents of 4 bits each (0 empty, 1 for 2, 2
+ * for 4 and so on), row by row from the top left cell in the lowest bits.
+ * New tiles appear where and as the console game puts them.  A game is used
+ * by one thread at a time; different games need no locking.
+ */
+#ifndef LIB2048_H_
+#define LIB2048_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define G2048_API __declspec(dllexport)
+#elif defined(__GNUC__) || defined(__clang__)
+#define G2048_API __attribute__((visibility("default")))
+#else
+#define G2048_API
+#endif
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define G2048_VERSION 1
+
+enum {
+    G2048_LEFT = 1,
+    G2048_UP = 2,
+    G2048_RIGHT = 3,
+    G2048_DOWN = 4
+};
+
+typedef struct g2048_game g2048_game;
+
+typedef struct g2048_result {
+    uint8_t moved;         /* the board changed */
+    uint8_t done;          /* no move is left */
+    uint8_t spawn_cell;    /* cell of the new tile, 0 to 15, 0xff if none */
+    uint8_t spawn_tile;    /* exponent of the new tile */
+    uint32_t score_delta;  /* points of the move */
+} g2048_result;
+
+/* G2048_VERSION of the library */
+G2048_API int g2048_version(void);
+
+/* a new game with two tiles, NULL if out of memory */
+G2048_API g2048_game* g2048_create(uint64_t seed);
+G2048_API void g2048_destroy(g2048_game* game);
+
+/* reseeds the tiles to come, the board is kept */
+G2048_API void g2048_seed(g2048_game* game, uint64_t seed);
+
+/* a new board with two tiles and no score */
+G2048_API void g2048_restart(g2048_game* game);
+
+/* moves towards G2048_LEFT etc., gives 1 if the board changed, 0 if not and
+   -1 for no direction; result may be NULL */
+G2048_API int g2048_step(g2048_game* game, int direction, g2048_result* result);
+
+/* g2048_step() of games[i] towards directions[i] into results[i] (results
+   may be NULL), gives the number of boards changed */
+G2048_API size_t g2048_step_batch(g2048_game* const* games,
+                                  const int* directions,
+                                  g2048_result* results, size_t count);
+
+/* bit (direction - 1) is set for each direction changing the board */
+G2048_API unsigned int g2048_legal_moves(const g2048_game* game);
+
+/* the packed board, and the score if score is not NULL */
+G2048_API uint64_t g2048_export(const g2048_game* game, uint32_t* score);
+
+/* replaces board and score */
+G2048_API void g2048_import(g2048_game* game, uint64_t board, uint32_t score);
+
+/*
+ * Strategy plugins: a shared object loaded by 2048 with --oracle, --policy
+ * or --tournament as plugin:PATH.  It defines choose_move() and may define
+ * the others; a context made by plugin_open() is used by one thread at a
+ * time.  Moves are G2048_LEFT etc., 0 for none.
+ */
+
+/* a context for choose_move(), the tiles of rollouts and such from seed */
+G2048_API void* plugin_open(uint64_t seed);
+G2048_API void plugin_close(void* ctx);
+
+/* a new seed, e.g. before each game of a tournament */
+G2048_API void plugin_seed(void* ctx, uint64_t seed);
+
+G2048_API int choose_move(uint64_t board, void* ctx);
+
+/* choose_move() of boards[i] into moves[i] */
+G2048_API void choose_move_batch(const uint64_t* boards, int* moves,
+                                 size_t count, void* ctx);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* LIB2048_H_ */